@@ -0,0 +1,50 @@
+"""Per-call latency of foo operators from Python.
+
+Compares calling the foo operators through torch.ops.foo, which boxes every
+argument into an IValue and looks up the operator on each call, with the
+generated fast-path bindings in torch_foo.ops, which parse their arguments
+statically and call the dispatcher unboxed. The tensors are tiny so the
+numbers are dominated by call overhead rather than by the kernels.
+
+    python benchmarks/bench_call_latency.py [--device foo|cpu]
+"""
+import argparse
+
+import torch
+import torch.utils.benchmark as benchmark
+import torch_foo
+
+OPS = {
+    "mymuladd": "{ns}.mymuladd(a, b, 2.0)",
+    "mymul": "{ns}.mymul(a, b)",
+    "myadd_out": "{ns}.myadd_out(a, b, out)",
+}
+
+
+def measure(stmt, env):
+    timer = benchmark.Timer(stmt=stmt, globals=env)
+    return timer.blocked_autorange(min_run_time=0.5).median
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--device", default="foo")
+    parser.add_argument("--numel", type=int, default=16)
+    args = parser.parse_args()
+
+    a = torch.randn(args.numel, device=args.device)
+    b = torch.randn(args.numel, device=args.device)
+    out = torch.empty(args.numel, device=args.device)
+    env = {"torch": torch, "torch_foo": torch_foo, "a": a, "b": b, "out": out}
+
+    print(f"{'op':<10} {'torch.ops (us)':>15} {'torch_foo.ops (us)':>19} {'speedup':>8}")
+    for name, stmt in OPS.items():
+        boxed = measure(stmt.format(ns="torch.ops.foo"), env)
+        fast = measure(stmt.format(ns="torch_foo.ops"), env)
+        print(f"{name:<10} {boxed * 1e6:>15.2f} {fast * 1e6:>19.2f} {boxed / fast:>7.2f}x")
+    if args.device == "foo":
+        torch.foo.synchronize()
+
+
+if __name__ == "__main__":
+    main()
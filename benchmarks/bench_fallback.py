@@ -0,0 +1,47 @@
+"""Per-op cost of the CPU fallback in "copy" and "alias" mode.
+
+Runs ops that have no foo kernel on foo tensors of increasing size and reports
+the time per call for the copying fallback (at::native::cpu_fallback) and for
+the zero-copy alias fallback, next to the same op on plain CPU tensors.
+
+    python benchmarks/bench_fallback.py
+"""
+import torch
+import torch.utils.benchmark as benchmark
+import torch_foo  # noqa: F401  registers the foo backend
+
+SIZES = [1 << 10, 1 << 16, 1 << 20, 1 << 24]
+OPS = {
+    "cumsum": "torch.cumsum(x, 0)",
+    "cumsum_": "x.cumsum_(0)",
+    "flip": "torch.flip(x, (0,))",
+}
+
+
+def measure(stmt, env):
+    timer = benchmark.Timer(stmt=stmt, globals=env)
+    return timer.blocked_autorange(min_run_time=0.5).median
+
+
+def main():
+    print(f"{'op':<8} {'numel':>10} {'cpu (us)':>10} {'copy (us)':>10} {'alias (us)':>11} {'speedup':>8}")
+    for name, stmt in OPS.items():
+        for numel in SIZES:
+            x_cpu = torch.randn(numel)
+            y_cpu = torch.randn(numel)
+            x, y = x_cpu.to("foo"), y_cpu.to("foo")
+            cpu_time = measure(stmt, {"torch": torch, "x": x_cpu, "y": y_cpu})
+            times = {}
+            torch.foo.reset_fallback_stats()
+            for mode in ("copy", "alias"):
+                torch.foo.set_fallback_mode(mode)
+                times[mode] = measure(stmt, {"torch": torch, "x": x, "y": y})
+            torch.foo.set_fallback_mode("copy")
+            # Ops that gained a foo kernel no longer measure the fallback.
+            assert torch.foo.fallback_stats(), f"{name} no longer falls back to the CPU"
+            print(f"{name:<8} {numel:>10} {cpu_time * 1e6:>10.1f} {times['copy'] * 1e6:>10.1f} "
+                  f"{times['alias'] * 1e6:>11.1f} {times['copy'] / times['alias']:>7.2f}x")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,62 @@
+"""Throughput of the foo::mymuladd / mymul / myadd_out kernels.
+
+Reports the effective memory bandwidth (bytes read + bytes written per second)
+for contiguous and strided (transposed) inputs across dtypes. For
+multi-million-element tensors the kernels should be memory-bandwidth bound,
+so the numbers can be compared against a plain `torch.add` on the same data.
+
+    python benchmarks/bench_kernels.py [--threads N]
+"""
+import argparse
+
+import torch
+import torch.utils.benchmark as benchmark
+import torch_foo  # noqa: F401  registers torch.ops.foo
+
+SIZES = [1 << 20, 1 << 22, 1 << 24]
+DTYPES = [torch.float32, torch.float64, torch.bfloat16, torch.float16]
+
+
+def make_inputs(numel, dtype, strided):
+    side = int(numel ** 0.5)
+    a = torch.randn(side, side, dtype=dtype)
+    b = torch.randn(side, side, dtype=dtype)
+    if strided:
+        a, b = a.t(), b.t()
+    return a, b
+
+
+def run(label, stmt, env, nbytes):
+    timer = benchmark.Timer(stmt=stmt, globals=env, label=label)
+    m = timer.blocked_autorange(min_run_time=0.5)
+    return m.median, nbytes / m.median / 1e9
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--threads", type=int, default=torch.get_num_threads())
+    args = parser.parse_args()
+    torch.set_num_threads(args.threads)
+
+    print(f"threads={torch.get_num_threads()}")
+    print(f"{'op':<10} {'dtype':<15} {'numel':>10} {'layout':<10} {'time (us)':>10} {'GB/s':>8} {'ref GB/s':>9}")
+    for dtype in DTYPES:
+        for numel in SIZES:
+            for strided in (False, True):
+                a, b = make_inputs(numel, dtype, strided)
+                out = torch.empty_like(a)
+                n = a.numel() * a.element_size()
+                env = {"torch": torch, "a": a, "b": b, "out": out}
+                layout = "strided" if strided else "contig"
+                _, ref_bw = run("ref", "torch.add(a, b, out=out)", env, 3 * n)
+                for op, stmt in (
+                    ("mymuladd", "torch.ops.foo.mymuladd(a, b, 1.0)"),
+                    ("mymul", "torch.ops.foo.mymul(a, b)"),
+                    ("myadd_out", "torch.ops.foo.myadd_out(a, b, out)"),
+                ):
+                    t, bw = run(op, stmt, env, 3 * n)
+                    print(f"{op:<10} {str(dtype):<15} {a.numel():>10} {layout:<10} {t * 1e6:>10.1f} {bw:>8.2f} {ref_bw:>9.2f}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,75 @@
+"""Compares two benchmark result files and flags regressions.
+
+Understands the JSON written by the C++ suite
+(foo_benchmarks --benchmark_out=run.json --benchmark_out_format=json) and by
+the pytest suite (pytest benchmarks/test_benchmarks.py --benchmark-json=run.json).
+Benchmarks are matched by name and compared on their median time. Exits with
+status 1 when any benchmark got slower than the threshold, so it can gate CI.
+
+    python benchmarks/compare.py baseline.json candidate.json [--threshold 0.05]
+"""
+import argparse
+import json
+import sys
+from typing import Dict
+
+TIME_UNITS = {"ns": 1e-9, "us": 1e-6, "ms": 1e-3, "s": 1.0}
+
+
+def load(path: str) -> Dict[str, float]:
+    """Returns the median time in seconds of every benchmark in a result file."""
+    with open(path) as f:
+        data = json.load(f)
+    results = {}
+    if "machine_info" in data:
+        # pytest-benchmark: stats are already in seconds
+        for bench in data["benchmarks"]:
+            results[bench["fullname"]] = bench["stats"]["median"]
+        return results
+    # Google Benchmark: prefer the median aggregate when run with repetitions
+    medians = {}
+    for bench in data["benchmarks"]:
+        seconds = bench["real_time"] * TIME_UNITS[bench.get("time_unit", "ns")]
+        if bench.get("run_type") == "aggregate":
+            if bench.get("aggregate_name") == "median":
+                medians[bench["run_name"]] = seconds
+        else:
+            results.setdefault(bench.get("run_name", bench["name"]), seconds)
+    results.update(medians)
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("baseline")
+    parser.add_argument("candidate")
+    parser.add_argument("--threshold", type=float, default=0.05,
+                        help="relative slowdown that counts as a regression (default: 0.05)")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    candidate = load(args.candidate)
+    names = [name for name in baseline if name in candidate]
+    if not names:
+        sys.exit("no benchmarks in common")
+
+    width = max(len(name) for name in names)
+    print(f"{'benchmark':<{width}} {'baseline (us)':>14} {'candidate (us)':>15} {'change':>8}")
+    regressions = 0
+    for name in names:
+        change = candidate[name] / baseline[name] - 1
+        flag = ""
+        if change > args.threshold:
+            regressions += 1
+            flag = "  REGRESSION"
+        print(f"{name:<{width}} {baseline[name] * 1e6:>14.2f} {candidate[name] * 1e6:>15.2f} {change:>+8.1%}{flag}")
+
+    for name in sorted(set(baseline) ^ set(candidate)):
+        print(f"only in {'baseline' if name in baseline else 'candidate'}: {name}")
+    if regressions:
+        print(f"{regressions} of {len(names)} benchmarks regressed by more than {args.threshold:.0%}")
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
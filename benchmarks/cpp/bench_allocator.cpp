@@ -0,0 +1,45 @@
+// Latency of at::empty on foo devices, served from the caching allocator or,
+// after emptying the cache, from the system.
+
+#include "bench_common.h"
+#include "foo_core/allocator.h"
+
+namespace foo_bench {
+namespace {
+
+void BM_empty_cached(benchmark::State& state)
+{
+    const at::TensorOptions options = foo_options();
+    // Warm the cache with a block of this size.
+    at::empty({state.range(0)}, options);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(at::empty({state.range(0)}, options));
+    }
+}
+
+void BM_empty_uncached(benchmark::State& state)
+{
+    const at::TensorOptions options = foo_options();
+    for (auto _ : state) {
+        state.PauseTiming();
+        foo_core::empty_cache();
+        state.ResumeTiming();
+        benchmark::DoNotOptimize(at::empty({state.range(0)}, options));
+    }
+}
+
+void BM_empty_pinned_host(benchmark::State& state)
+{
+    const at::TensorOptions options = at::TensorOptions().pinned_memory(true);
+    at::empty({state.range(0)}, options);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(at::empty({state.range(0)}, options));
+    }
+}
+
+BENCHMARK(BM_empty_cached)->Apply(numel_args);
+BENCHMARK(BM_empty_uncached)->Apply(numel_args);
+BENCHMARK(BM_empty_pinned_host)->Apply(numel_args);
+
+} // namespace
+} // namespace foo_bench
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <ATen/ATen.h>
+#include <benchmark/benchmark.h>
+
+#include "foo_core/stream.h"
+
+namespace foo_bench {
+
+inline c10::Device foo_device()
+{
+    return c10::Device(c10::DeviceType::PrivateUse1, 0);
+}
+
+inline at::TensorOptions foo_options(at::ScalarType dtype = at::kFloat)
+{
+    return at::TensorOptions().device(foo_device()).dtype(dtype);
+}
+
+// Foo kernels run asynchronously on stream workers, so every timed iteration
+// waits for the work it enqueued.
+inline void sync()
+{
+    foo_core::synchronize();
+}
+
+// Element counts from one L1-sized vector up to well past the last level cache.
+inline void numel_args(benchmark::internal::Benchmark* b)
+{
+    b->RangeMultiplier(16)->Range(1 << 8, 1 << 24);
+}
+
+} // namespace foo_bench
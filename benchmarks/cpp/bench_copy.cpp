@@ -0,0 +1,58 @@
+// Bandwidth of host<->foo copies from pageable and pinned host memory, and of
+// strided copies that cannot use the flat memcpy path.
+
+#include "bench_common.h"
+
+namespace foo_bench {
+namespace {
+
+at::Tensor host_tensor(int64_t numel, bool pinned)
+{
+    return at::randn({numel}, at::TensorOptions().pinned_memory(pinned));
+}
+
+// state.range(1) selects pinned (1) or pageable (0) host memory.
+void BM_copy_host_to_foo(benchmark::State& state)
+{
+    const at::Tensor src = host_tensor(state.range(0), state.range(1));
+    at::Tensor dst = at::empty({state.range(0)}, foo_options());
+    for (auto _ : state) {
+        dst.copy_(src, /*non_blocking=*/true);
+        sync();
+    }
+    state.SetBytesProcessed(state.iterations() * src.nbytes());
+}
+
+void BM_copy_foo_to_host(benchmark::State& state)
+{
+    const at::Tensor src = at::randn({state.range(0)}, foo_options());
+    at::Tensor dst = host_tensor(state.range(0), state.range(1));
+    for (auto _ : state) {
+        dst.copy_(src, /*non_blocking=*/true);
+        sync();
+    }
+    state.SetBytesProcessed(state.iterations() * src.nbytes());
+}
+
+void BM_copy_host_to_foo_transposed(benchmark::State& state)
+{
+    const int64_t n = state.range(0);
+    const at::Tensor src = at::randn({n, n}).t();
+    at::Tensor dst = at::empty({n, n}, foo_options());
+    for (auto _ : state) {
+        dst.copy_(src);
+    }
+    state.SetBytesProcessed(state.iterations() * src.nbytes());
+}
+
+void copy_args(benchmark::internal::Benchmark* b)
+{
+    b->ArgNames({"numel", "pinned"})->ArgsProduct({benchmark::CreateRange(1 << 10, 1 << 24, 16), {0, 1}});
+}
+
+BENCHMARK(BM_copy_host_to_foo)->Apply(copy_args);
+BENCHMARK(BM_copy_foo_to_host)->Apply(copy_args);
+BENCHMARK(BM_copy_host_to_foo_transposed)->RangeMultiplier(4)->Range(64, 4096);
+
+} // namespace
+} // namespace foo_bench
@@ -0,0 +1,71 @@
+// Per-call overhead of reaching a kernel: calling it directly, through a typed
+// (unboxed) operator handle, and through the boxed calling convention that
+// torch.ops and the fallback use. Runs on tiny CPU tensors so the kernel
+// itself is negligible and no stream is involved.
+
+#include <ATen/core/dispatch/Dispatcher.h>
+#include <ATen/core/stack.h>
+
+#include "bench_common.h"
+#include "foo_core/operations.h"
+
+namespace foo_bench {
+namespace {
+
+void BM_dispatch_direct(benchmark::State& state)
+{
+    const at::Tensor a = at::randn({4});
+    const at::Tensor b = at::randn({4});
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(foo_core::mymul_cpu(a, b));
+    }
+}
+
+void BM_dispatch_unboxed(benchmark::State& state)
+{
+    const auto op = c10::Dispatcher::singleton()
+        .findSchemaOrThrow("foo::mymul", "")
+        .typed<at::Tensor(const at::Tensor&, const at::Tensor&)>();
+    const at::Tensor a = at::randn({4});
+    const at::Tensor b = at::randn({4});
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(op.call(a, b));
+    }
+}
+
+void BM_dispatch_boxed(benchmark::State& state)
+{
+    const c10::OperatorHandle op = c10::Dispatcher::singleton().findSchemaOrThrow("foo::mymul", "");
+    const at::Tensor a = at::randn({4});
+    const at::Tensor b = at::randn({4});
+    torch::jit::Stack stack;
+    for (auto _ : state) {
+        stack.clear();
+        torch::jit::push(stack, a, b);
+        op.callBoxed(&stack);
+        benchmark::DoNotOptimize(stack);
+    }
+}
+
+// The same unboxed call on foo tensors, which adds the stream launch and the
+// wait for the worker to run it.
+void BM_dispatch_foo_roundtrip(benchmark::State& state)
+{
+    const auto op = c10::Dispatcher::singleton()
+        .findSchemaOrThrow("foo::mymul", "")
+        .typed<at::Tensor(const at::Tensor&, const at::Tensor&)>();
+    const at::Tensor a = at::randn({4}, foo_options());
+    const at::Tensor b = at::randn({4}, foo_options());
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(op.call(a, b));
+        sync();
+    }
+}
+
+BENCHMARK(BM_dispatch_direct);
+BENCHMARK(BM_dispatch_unboxed);
+BENCHMARK(BM_dispatch_boxed);
+BENCHMARK(BM_dispatch_foo_roundtrip);
+
+} // namespace
+} // namespace foo_bench
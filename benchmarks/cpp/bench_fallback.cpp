@@ -0,0 +1,64 @@
+// Per-op cost of running operators without a foo kernel through the CPU
+// fallback, in copy and alias mode, next to the same op on CPU tensors.
+
+#include "bench_common.h"
+#include "foo_core/fallback.h"
+
+namespace foo_bench {
+namespace {
+
+// cumsum has no foo kernel. Ops that gain one stop measuring the fallback, so
+// the benchmarks fail rather than silently time the kernel.
+void check_fell_back(benchmark::State& state)
+{
+    if (foo_core::get_fallback_stats().empty()) {
+        state.SkipWithError("cumsum no longer falls back to the CPU");
+    }
+}
+
+void BM_fallback_cumsum_cpu(benchmark::State& state)
+{
+    const at::Tensor x = at::randn({state.range(0)});
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(at::cumsum(x, 0));
+    }
+}
+
+template <foo_core::FallbackMode mode>
+void BM_fallback_cumsum(benchmark::State& state)
+{
+    const foo_core::FallbackMode previous = foo_core::get_fallback_mode();
+    foo_core::set_fallback_mode(mode);
+    const at::Tensor x = at::randn({state.range(0)}, foo_options());
+    foo_core::reset_fallback_stats();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(at::cumsum(x, 0));
+        sync();
+    }
+    check_fell_back(state);
+    foo_core::set_fallback_mode(previous);
+}
+
+template <foo_core::FallbackMode mode>
+void BM_fallback_cumsum_(benchmark::State& state)
+{
+    const foo_core::FallbackMode previous = foo_core::get_fallback_mode();
+    foo_core::set_fallback_mode(mode);
+    at::Tensor x = at::randn({state.range(0)}, foo_options());
+    foo_core::reset_fallback_stats();
+    for (auto _ : state) {
+        x.cumsum_(0);
+        sync();
+    }
+    check_fell_back(state);
+    foo_core::set_fallback_mode(previous);
+}
+
+BENCHMARK(BM_fallback_cumsum_cpu)->Apply(numel_args);
+BENCHMARK(BM_fallback_cumsum<foo_core::FallbackMode::Copy>)->Apply(numel_args);
+BENCHMARK(BM_fallback_cumsum<foo_core::FallbackMode::Alias>)->Apply(numel_args);
+BENCHMARK(BM_fallback_cumsum_<foo_core::FallbackMode::Copy>)->Apply(numel_args);
+BENCHMARK(BM_fallback_cumsum_<foo_core::FallbackMode::Alias>)->Apply(numel_args);
+
+} // namespace
+} // namespace foo_bench
@@ -0,0 +1,67 @@
+// Throughput of the foo::mymuladd/mymul/myadd_out kernels across sizes and
+// dtypes, called through the dispatcher on foo tensors.
+
+#include <ATen/core/dispatch/Dispatcher.h>
+
+#include "bench_common.h"
+
+namespace foo_bench {
+namespace {
+
+template <at::ScalarType dtype>
+void BM_mymuladd(benchmark::State& state)
+{
+    static const auto op = c10::Dispatcher::singleton()
+        .findSchemaOrThrow("foo::mymuladd", "")
+        .typed<at::Tensor(const at::Tensor&, const at::Tensor&, double)>();
+    const at::Tensor a = at::randn({state.range(0)}, foo_options(dtype));
+    const at::Tensor b = at::randn({state.range(0)}, foo_options(dtype));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(op.call(a, b, 2.0));
+        sync();
+    }
+    state.SetBytesProcessed(state.iterations() * 3 * a.nbytes());
+}
+
+template <at::ScalarType dtype>
+void BM_mymul(benchmark::State& state)
+{
+    static const auto op = c10::Dispatcher::singleton()
+        .findSchemaOrThrow("foo::mymul", "")
+        .typed<at::Tensor(const at::Tensor&, const at::Tensor&)>();
+    const at::Tensor a = at::randn({state.range(0)}, foo_options(dtype));
+    const at::Tensor b = at::randn({state.range(0)}, foo_options(dtype));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(op.call(a, b));
+        sync();
+    }
+    state.SetBytesProcessed(state.iterations() * 3 * a.nbytes());
+}
+
+template <at::ScalarType dtype>
+void BM_myadd_out(benchmark::State& state)
+{
+    static const auto op = c10::Dispatcher::singleton()
+        .findSchemaOrThrow("foo::myadd_out", "")
+        .typed<void(const at::Tensor&, const at::Tensor&, at::Tensor&)>();
+    const at::Tensor a = at::randn({state.range(0)}, foo_options(dtype));
+    const at::Tensor b = at::randn({state.range(0)}, foo_options(dtype));
+    at::Tensor out = at::empty({state.range(0)}, foo_options(dtype));
+    for (auto _ : state) {
+        op.call(a, b, out);
+        sync();
+    }
+    state.SetBytesProcessed(state.iterations() * 3 * a.nbytes());
+}
+
+BENCHMARK(BM_mymuladd<at::kFloat>)->Apply(numel_args);
+BENCHMARK(BM_mymuladd<at::kDouble>)->Apply(numel_args);
+BENCHMARK(BM_mymuladd<at::kBFloat16>)->Apply(numel_args);
+BENCHMARK(BM_mymuladd<at::kHalf>)->Apply(numel_args);
+BENCHMARK(BM_mymul<at::kFloat>)->Apply(numel_args);
+BENCHMARK(BM_mymul<at::kBFloat16>)->Apply(numel_args);
+BENCHMARK(BM_myadd_out<at::kFloat>)->Apply(numel_args);
+BENCHMARK(BM_myadd_out<at::kBFloat16>)->Apply(numel_args);
+
+} // namespace
+} // namespace foo_bench
@@ -0,0 +1,85 @@
+"""pytest-benchmark suite for the Python-visible costs of the foo backend.
+
+Covers the same ground as the C++ foo_benchmarks target (kernels, allocation,
+host<->foo copies, call overhead and the CPU fallback) but measured from
+Python, so it also catches regressions in the bindings and the torch.ops
+layer. Save a run as JSON and compare it with another one:
+
+    pytest benchmarks/test_benchmarks.py --benchmark-json=before.json
+    pytest benchmarks/test_benchmarks.py --benchmark-json=after.json
+    python benchmarks/compare.py before.json after.json
+"""
+import pytest
+import torch
+import torch_foo
+
+pytest.importorskip("pytest_benchmark")
+
+SIZES = [1 << 10, 1 << 16, 1 << 20]
+DTYPES = [torch.float32, torch.bfloat16]
+
+
+def synced(fn):
+    """Wraps fn so each measured call waits for the foo work it enqueued."""
+    def run(*args):
+        result = fn(*args)
+        torch.foo.synchronize()
+        return result
+    return run
+
+
+@pytest.mark.parametrize("dtype", DTYPES, ids=str)
+@pytest.mark.parametrize("numel", SIZES)
+@pytest.mark.parametrize("op", ["mymuladd", "mymul", "myadd_out"])
+def test_kernel(benchmark, op, numel, dtype):
+    a = torch.randn(numel, dtype=dtype, device="foo")
+    b = torch.randn(numel, dtype=dtype, device="foo")
+    out = torch.empty(numel, dtype=dtype, device="foo")
+    args = {"mymuladd": (a, b, 2.0), "mymul": (a, b), "myadd_out": (a, b, out)}[op]
+    benchmark(synced(getattr(torch.ops.foo, op)), *args)
+
+
+@pytest.mark.parametrize("numel", SIZES)
+def test_empty(benchmark, numel):
+    torch.empty(numel, device="foo")
+    benchmark(torch.empty, numel, device="foo")
+
+
+@pytest.mark.parametrize("pinned", [False, True], ids=["pageable", "pinned"])
+@pytest.mark.parametrize("numel", SIZES)
+def test_copy_host_to_foo(benchmark, numel, pinned):
+    src = torch.randn(numel, pin_memory=pinned)
+    dst = torch.empty(numel, device="foo")
+    benchmark(synced(dst.copy_), src, True)
+
+
+@pytest.mark.parametrize("pinned", [False, True], ids=["pageable", "pinned"])
+@pytest.mark.parametrize("numel", SIZES)
+def test_copy_foo_to_host(benchmark, numel, pinned):
+    src = torch.randn(numel, device="foo")
+    dst = torch.empty(numel, pin_memory=pinned)
+    benchmark(synced(dst.copy_), src, True)
+
+
+@pytest.mark.parametrize("path", ["torch_ops", "fast_ops"])
+def test_call_overhead(benchmark, path):
+    a = torch.randn(4, device="foo")
+    b = torch.randn(4, device="foo")
+    ns = torch.ops.foo if path == "torch_ops" else torch_foo.ops
+    benchmark(ns.mymul, a, b)
+    torch.foo.synchronize()
+
+
+@pytest.mark.parametrize("mode", ["copy", "alias"])
+@pytest.mark.parametrize("numel", SIZES)
+def test_fallback(benchmark, numel, mode):
+    # cumsum has no foo kernel; check that it still measures the fallback.
+    x = torch.randn(numel, device="foo")
+    previous = torch.foo.get_fallback_mode()
+    torch.foo.set_fallback_mode(mode)
+    torch.foo.reset_fallback_stats()
+    try:
+        benchmark(synced(torch.cumsum), x, 0)
+    finally:
+        torch.foo.set_fallback_mode(previous)
+    assert torch.foo.fallback_stats()
@@ -5,14 +5,21 @@ ENV_AUTOLOAD = os.getenv("TORCH_DEVICE_BACKEND_AUTOLOAD", "1")
 os.environ["TORCH_DEVICE_BACKEND_AUTOLOAD"] = "0"
 
 import torch # Ensure torch is loaded first
-from torch_foo._C import add, multiply
+from torch_foo._C import _ops as ops
+from torch_foo._C._ops import add, multiply
 from torch_foo import foo
 
-__all__ = ['add', 'multiply']
+__all__ = ['add', 'multiply', 'ops']
 
 # expose torch_foo.foo as torch.foo
 torch._register_device_module("foo", foo)
 
+# torch.distributed backend for foo tensors, see foo._create_process_group.
+# Only built against a libtorch with c10d.
+import torch.distributed
+if torch.distributed.is_available() and foo._has_process_group():
+    torch.distributed.Backend.register_backend("foo", foo._create_process_group, devices=["foo"])
+
 # This function is an entrypoint called by PyTorch
 # when running `import torch`. There is no need to do anything.
 def _autoload():
@@ -1,11 +1,24 @@
-from typing import Optional, Union, List
+from contextlib import contextmanager
+import json
+import sys
+from typing import Any, Dict, Optional, Union, List
 import torch
+import torch.utils.dlpack
 import torch_foo._C as _C
 
 # The backend module can be logically divided into a few blocks.
 # - the Minimal API necessary to define a backend module in pytorch
 # - the random API necessary to support setting seeds
 # - the AMP api necessary to support automatic mixed precision
+# - the streams API to order and overlap work on the devices
+# - the memory API to manage the caching allocator
+# - the fallback API to control how ops without a foo kernel run
+# - the tracing API to record what the kernels do
+# - the lazy API to record and fuse elementwise ops
+# - the matmul API to cache packed weights
+# - the file API to map checkpoints into foo memory
+# - the interop API to share foo memory with other frameworks
+# - the distributed API behind the "foo" torch.distributed backend
 
 # Minimal API
 def is_available() -> bool:
@@ -18,6 +31,20 @@ def current_device() -> int:
     r"""Returns the index of the currently selected device"""
     return _C.current_device()
 
+def set_device(device: Union[int, str, torch.device]) -> None:
+    r"""Sets the current device of the calling thread"""
+    _C._set_device(_get_device_index(device))
+
+def get_device_numa_node(device: Optional[Union[int, str, torch.device]] = None) -> int:
+    r"""Returns the NUMA node whose memory and cores back the device"""
+    return _C._get_device_numa_node(_get_device_index(device))
+
+def get_cpu_capability() -> str:
+    r"""Returns the instruction set level the foo kernels run at, ``"default"``,
+        ``"avx2"`` or ``"avx512"``. The best level the host supports is picked
+        when torch_foo is loaded; ``TORCH_FOO_CPU_CAPABILITY`` pins a lower one."""
+    return _C._get_cpu_capability()
+
 # Random API
 _cached_device_count: Optional[int] = None
 def device_count() -> int:
@@ -35,20 +62,434 @@ def _is_in_bad_fork() -> bool:
     r"""True if now in bad_fork, else False"""
     raise NotImplementedError
 
+def _default_generator(device: Optional[Union[int, str, torch.device]] = None) -> torch.Generator:
+    return _C._get_default_generator(_get_device_index(device))
+
+def manual_seed(seed: int) -> None:
+    r"""Sets the seed for generating random numbers on the current device"""
+    _default_generator().manual_seed(int(seed))
+
 def manual_seed_all(seed: int) -> None:
     r"""Set the seed for generating random numbers for the devices"""
-    raise NotImplementedError
+    for index in range(device_count()):
+        _default_generator(index).manual_seed(int(seed))
+
+def seed() -> None:
+    r"""Sets the seed for generating random numbers on the current device to
+        a random number"""
+    _default_generator().seed()
+
+def seed_all() -> None:
+    r"""Sets the seed for generating random numbers on every device to the
+        same random number"""
+    manual_seed_all(_default_generator(0).seed())
+
+def initial_seed() -> int:
+    r"""Returns the current random seed of the current device"""
+    return _default_generator().initial_seed()
 
 def get_rng_state(device: Union[int, str, torch.device] = 'foo') -> torch.Tensor:
-    r"""Returns a list of ByteTensor representing the random
-        number states of all devices"""
-    raise NotImplementedError
+    r"""Returns the random number generator state of the specified device as
+        a ByteTensor. The foo generators are counter-based, so the state is
+        just the seed and the offset of the next random numbers."""
+    return _default_generator(device).get_state()
 
 def set_rng_state(new_state: torch.Tensor, device: Union[int, str, torch.device] = 'foo') -> None:
     r"""Sets the random number generator state of the specified device"""
-    raise NotImplementedError
+    _default_generator(device).set_state(new_state)
+
+def get_rng_state_all() -> List[torch.Tensor]:
+    r"""Returns a list of ByteTensor representing the random number states of
+        all devices"""
+    return [get_rng_state(index) for index in range(device_count())]
+
+def set_rng_state_all(new_states: List[torch.Tensor]) -> None:
+    r"""Sets the random number generator state of all devices"""
+    for index, state in enumerate(new_states):
+        set_rng_state(state, index)
 
 # AMP API
 def get_amp_supported_dtype() -> List[torch.dtype]:
     r"""Get the supported dtypes on your device in AMP"""
     raise NotImplementedError
+
+# Memory API
+def empty_cache() -> None:
+    r"""Releases all unoccupied cached memory currently held by the caching
+        allocator so that it can be used by other applications"""
+    _C._empty_cache()
+
+def host_empty_cache() -> None:
+    r"""Releases all unoccupied pinned host memory currently held by the
+        pinned memory allocator"""
+    _C._host_empty_cache()
+
+def memory_stats_as_nested_dict(device: Optional[Union[int, str, torch.device]] = None) -> Dict[str, Any]:
+    r"""Returns the caching allocator statistics of the device as a nested
+        dictionary, see :func:`memory_stats`"""
+    return _C._memory_stats(_get_device_index(device))
+
+def memory_stats(device: Optional[Union[int, str, torch.device]] = None) -> Dict[str, Any]:
+    r"""Returns the caching allocator statistics of the device, with the same
+        keys as :func:`torch.cuda.memory_stats`.
+
+        The ``allocation``, ``segment``, ``inactive_split``, ``allocated_bytes``,
+        ``requested_bytes``, ``reserved_bytes`` and ``inactive_split_bytes``
+        statistics each have a ``current``, ``peak``, ``allocated`` and
+        ``freed`` value for ``all`` requests and for the ``small_pool`` and
+        ``large_pool``, flattened into keys like
+        ``"allocated_bytes.all.current"``. ``inactive_split_bytes`` is the
+        free memory stranded in partly used segments, i.e. the fragmentation
+        of the cache."""
+    result = {}
+
+    def flatten(prefix: str, obj: Any) -> None:
+        if isinstance(obj, dict):
+            for key, value in obj.items():
+                flatten(f"{prefix}.{key}" if prefix else key, value)
+        else:
+            result[prefix] = obj
+
+    flatten("", memory_stats_as_nested_dict(device))
+    return dict(sorted(result.items()))
+
+def memory_allocated(device: Optional[Union[int, str, torch.device]] = None) -> int:
+    r"""Returns the bytes currently occupied by tensors on the device"""
+    return memory_stats(device)["allocated_bytes.all.current"]
+
+def max_memory_allocated(device: Optional[Union[int, str, torch.device]] = None) -> int:
+    r"""Returns the peak bytes occupied by tensors on the device since the
+        last :func:`reset_peak_memory_stats`"""
+    return memory_stats(device)["allocated_bytes.all.peak"]
+
+def memory_reserved(device: Optional[Union[int, str, torch.device]] = None) -> int:
+    r"""Returns the bytes currently held by the caching allocator on the device"""
+    return memory_stats(device)["reserved_bytes.all.current"]
+
+def max_memory_reserved(device: Optional[Union[int, str, torch.device]] = None) -> int:
+    r"""Returns the peak bytes held by the caching allocator on the device
+        since the last :func:`reset_peak_memory_stats`"""
+    return memory_stats(device)["reserved_bytes.all.peak"]
+
+def reset_peak_memory_stats(device: Optional[Union[int, str, torch.device]] = None) -> None:
+    r"""Resets the peak values tracked by the caching allocator of the device"""
+    _C._reset_peak_memory_stats(_get_device_index(device))
+
+def reset_accumulated_memory_stats(device: Optional[Union[int, str, torch.device]] = None) -> None:
+    r"""Resets the accumulated (allocated and freed) values tracked by the
+        caching allocator of the device"""
+    _C._reset_accumulated_memory_stats(_get_device_index(device))
+
+def record_memory_history(enabled: bool = True) -> None:
+    r"""Starts or stops recording the Python stack of every foo allocation.
+        The stacks show up as the ``frames`` of the blocks in
+        :func:`memory_snapshot`."""
+    _C._record_memory_history(enabled)
+
+def memory_snapshot() -> List[Dict[str, Any]]:
+    r"""Returns every segment held by the caching allocator across all
+        devices, with the same layout as the ``segments`` of
+        :func:`torch.cuda.memory_snapshot`"""
+    return _C._memory_snapshot()
+
+# Streams API
+def _get_device_index(device: Optional[Union[int, str, torch.device]] = None) -> int:
+    if device is None:
+        return current_device()
+    if isinstance(device, int):
+        return device
+    device = torch.device(device)
+    return device.index if device.index is not None else current_device()
+
+class Stream(torch.Stream):
+    r"""An in-order queue of work on a foo device. Work on different streams
+        may run concurrently with each other and with the host."""
+    def __new__(cls, device: Optional[Union[int, str, torch.device]] = None, priority: int = 0, **kwargs: Any):
+        if kwargs:
+            # (stream_id, device_index, device_type) of an existing stream
+            return super().__new__(cls, **kwargs)
+        device = torch.device("foo", _get_device_index(device))
+        return super().__new__(cls, device=device, priority=priority)
+
+class Event(torch.Event):
+    r"""A synchronization marker that can be recorded on a foo stream."""
+    def __new__(cls, enable_timing: bool = False, blocking: bool = False, interprocess: bool = False):
+        return super().__new__(cls, device="foo", enable_timing=enable_timing,
+                               blocking=blocking, interprocess=interprocess)
+
+def current_stream(device: Optional[Union[int, str, torch.device]] = None) -> Stream:
+    r"""Returns the currently selected stream for a given device"""
+    stream_id, device_index, device_type = _C._get_current_stream(_get_device_index(device))
+    return Stream(stream_id=stream_id, device_index=device_index, device_type=device_type)
+
+def default_stream(device: Optional[Union[int, str, torch.device]] = None) -> Stream:
+    r"""Returns the default stream for a given device"""
+    stream_id, device_index, device_type = _C._get_default_stream(_get_device_index(device))
+    return Stream(stream_id=stream_id, device_index=device_index, device_type=device_type)
+
+def set_stream(stream: torch.Stream) -> None:
+    r"""Sets the current stream of the stream's device"""
+    if stream is None:
+        return
+    _C._set_stream(stream.stream_id, stream.device_index, stream.device_type)
+
+@contextmanager
+def stream(stream: Optional[torch.Stream]):
+    r"""Context manager that selects a given stream, restoring the previous
+        stream of that device on exit"""
+    if stream is None:
+        yield
+        return
+    prev_stream = current_stream(stream.device_index)
+    set_stream(stream)
+    try:
+        yield
+    finally:
+        set_stream(prev_stream)
+
+def synchronize(device: Optional[Union[int, str, torch.device]] = None) -> None:
+    r"""Waits for all work on all streams of a device to complete"""
+    _C._synchronize(_get_device_index(device))
+
+# Fallback API
+def set_fallback_mode(mode: str) -> None:
+    r"""Selects how ops without a foo kernel run on the CPU. ``"copy"``, the
+        default, copies the inputs to the CPU and the results back. ``"alias"``
+        runs the CPU kernel directly on the foo memory; results it allocates
+        are not counted by the foo memory statistics."""
+    _C._set_fallback_mode(mode)
+
+def get_fallback_mode() -> str:
+    r"""Returns the current fallback mode, ``"alias"`` or ``"copy"``"""
+    return _C._get_fallback_mode()
+
+def set_fallback_raise(enabled: bool) -> None:
+    r"""Makes ops without a foo kernel raise ``NotImplementedError`` instead of
+        falling back to the CPU. Also enabled by ``TORCH_FOO_FALLBACK_RAISE=1``."""
+    _C._set_fallback_raise(enabled)
+
+def get_fallback_raise() -> bool:
+    r"""Returns whether ops without a foo kernel raise instead of falling back"""
+    return _C._get_fallback_raise()
+
+def fallback_stats() -> Dict[str, Dict[str, int]]:
+    r"""Returns, for every operator that fell back to the CPU since the last
+        reset, its number of ``calls``, ``total_time_ns`` and ``max_time_ns``
+        spent in the fallback, and the ``bytes_to_cpu`` and ``bytes_to_foo``
+        it copied between the devices (only non-zero in ``"copy"`` mode)."""
+    return _C._fallback_stats()
+
+def reset_fallback_stats() -> None:
+    r"""Resets the statistics returned by :func:`fallback_stats`"""
+    _C._reset_fallback_stats()
+
+# Tracing API
+def is_tracing_available() -> bool:
+    r"""Returns whether torch_foo was built with tracing support"""
+    return _C._is_tracing_available()
+
+def is_tracing_enabled() -> bool:
+    r"""Returns whether the foo kernels are being traced"""
+    return _C._is_tracing_enabled()
+
+def set_tracing_enabled(enabled: bool) -> None:
+    r"""Starts or stops recording the foo kernels, copies and fallbacks. Also
+        enabled by ``TORCH_FOO_TRACE=1``."""
+    _C._set_tracing_enabled(enabled)
+
+def clear_trace() -> None:
+    r"""Drops every recorded trace event"""
+    _C._clear_trace()
+
+def export_chrome_trace(path: str) -> None:
+    r"""Writes the recorded events to ``path`` in the Chrome trace format, to be
+        opened with chrome://tracing or Perfetto"""
+    with open(path, "w") as f:
+        f.write(_C._export_chrome_trace())
+
+# Lazy API
+def is_lazy_mode() -> bool:
+    r"""Returns whether elementwise float32 ops on foo tensors are recorded
+        instead of run"""
+    return _C._is_lazy_mode()
+
+def set_lazy_mode(enabled: bool) -> None:
+    r"""Turns lazy mode on or off. In lazy mode, chains of elementwise ops are
+        recorded and run as single fused kernels once their results are needed
+        (by another op, a copy such as ``.cpu()``, or :func:`sync`). Also enabled
+        by ``TORCH_FOO_LAZY=1``."""
+    _C._set_lazy_mode(enabled)
+
+@contextmanager
+def lazy(enabled: bool = True):
+    r"""Context manager that turns lazy mode on (or off) inside its scope"""
+    previous = is_lazy_mode()
+    set_lazy_mode(enabled)
+    try:
+        yield
+    finally:
+        set_lazy_mode(previous)
+
+def sync() -> None:
+    r"""Runs every pending lazy op and waits for them on every device"""
+    _C._lazy_sync()
+    for index in range(device_count()):
+        synchronize(index)
+
+def lazy_stats() -> Dict[str, int]:
+    r"""Returns the number of ops lazy mode recorded (``"recorded_ops"``) and of
+        fused kernels it ran them as (``"fused_kernels"``) since the last
+        :func:`reset_lazy_stats`"""
+    return _C._lazy_stats()
+
+def reset_lazy_stats() -> None:
+    r"""Resets the counters of :func:`lazy_stats`"""
+    _C._reset_lazy_stats()
+
+# Matmul API
+def is_weight_prepacking() -> bool:
+    r"""Returns whether float32 ``mm`` and ``addmm`` keep the packed copies of
+        their second operand"""
+    return _C._is_weight_prepacking()
+
+def set_weight_prepacking(enabled: bool) -> None:
+    r"""Turns weight prepacking on or off. When on, the packed copy of the
+        second operand of ``mm`` and ``addmm`` is kept when it is a parameter
+        (the weight of a linear layer) and reused until the tensor is written
+        to or freed, at the cost of up to one extra copy of each weight. Writes
+        that don't bump the version counter, through ``.data``,
+        :class:`HostBuffer` or DLPack, aren't seen: call
+        :func:`clear_prepacked_weights` after them. Also enabled by
+        ``TORCH_FOO_PREPACK_WEIGHTS=1``."""
+    _C._set_weight_prepacking(enabled)
+
+def prepack(weight: torch.Tensor) -> None:
+    r"""Prepacks ``weight`` and its views when they are the second operand of
+        ``mm`` and ``addmm``, whether or not weight prepacking is on or
+        ``weight`` is a parameter, until it is freed or
+        :func:`clear_prepacked_weights` is called"""
+    _C._prepack_weight(weight)
+
+def clear_prepacked_weights() -> None:
+    r"""Drops every packed weight, and forgets the weights passed to
+        :func:`prepack`"""
+    _C._clear_prepacked_weights()
+
+# File API
+def from_file(path: str, offset: int, shape: List[int], dtype: torch.dtype,
+              device: Optional[Union[int, str, torch.device]] = None) -> torch.Tensor:
+    r"""Returns a contiguous foo tensor of ``shape`` and ``dtype`` holding the
+        bytes of the file at ``path`` from ``offset`` on, without reading them.
+        The file is memory-mapped copy-on-write: pages are read from the page
+        cache when first used, and writing to the tensor never changes the
+        file. An ``offset`` that is not a multiple of the element size is read
+        into regular foo memory instead."""
+    return _C._from_file(str(path), offset, list(shape), dtype, _get_device_index(device))
+
+_SAFETENSORS_DTYPES = {
+    "F64": torch.float64, "F32": torch.float32, "F16": torch.float16, "BF16": torch.bfloat16,
+    "F8_E4M3": torch.float8_e4m3fn, "F8_E5M2": torch.float8_e5m2,
+    "I64": torch.int64, "I32": torch.int32, "I16": torch.int16, "I8": torch.int8,
+    "U64": torch.uint64, "U32": torch.uint32, "U16": torch.uint16, "U8": torch.uint8,
+    "BOOL": torch.bool,
+}
+
+def load_safetensors(path: str, device: Optional[Union[int, str, torch.device]] = None) -> Dict[str, torch.Tensor]:
+    r"""Loads the tensors of a safetensors file onto a foo device with
+        :func:`from_file`, so loading is nearly free and only the pages of the
+        tensors actually used are ever read"""
+    with open(path, "rb") as f:
+        header_size = int.from_bytes(f.read(8), "little")
+        header = json.loads(f.read(header_size))
+    data_start = 8 + header_size
+    tensors = {}
+    for name, info in header.items():
+        if name == "__metadata__":
+            continue
+        if info["dtype"] not in _SAFETENSORS_DTYPES:
+            raise ValueError(f"{path}: tensor {name!r} has unsupported dtype {info['dtype']}")
+        dtype = _SAFETENSORS_DTYPES[info["dtype"]]
+        begin, end = info["data_offsets"]
+        tensor = from_file(path, data_start + begin, info["shape"], dtype, device)
+        if tensor.numel() * tensor.element_size() != end - begin:
+            raise ValueError(f"{path}: tensor {name!r} has {end - begin} bytes, expected "
+                             f"{tensor.numel() * tensor.element_size()}")
+        tensors[name] = tensor
+    return tensors
+
+# Interop API
+_BYTE_ORDER = "<" if sys.byteorder == "little" else ">"
+_ARRAY_TYPESTRS = {
+    torch.float64: "f8", torch.float32: "f4", torch.float16: "f2",
+    torch.complex128: "c16", torch.complex64: "c8",
+    torch.int64: "i8", torch.int32: "i4", torch.int16: "i2", torch.int8: "i1",
+    torch.uint64: "u8", torch.uint32: "u4", torch.uint16: "u2", torch.uint8: "u1",
+    torch.bool: "b1",
+}
+_DL_CPU = 1
+
+class HostBuffer:
+    r"""The memory of a foo tensor, exported without a copy through DLPack
+        (``__dlpack__``) and the NumPy array interface
+        (``__array_interface__``). The work pending on the tensor is done
+        when the buffer is created, and the buffer keeps the foo storage
+        alive for as long as it or anything importing it lives.
+
+        Example::
+
+            >>> array = numpy.from_dlpack(torch.foo.HostBuffer(x))
+            >>> array = numpy.asarray(torch.foo.HostBuffer(x))
+    """
+    def __init__(self, tensor: torch.Tensor):
+        self._view = _C._host_view(tensor)
+
+    def __dlpack__(self, stream: Optional[int] = None, **kwargs: Any) -> Any:
+        if stream is not None and stream != -1:
+            raise BufferError("foo memory is exported as host memory, which takes no stream")
+        return torch.utils.dlpack.to_dlpack(self._view)
+
+    def __dlpack_device__(self):
+        return (_DL_CPU, 0)
+
+    @property
+    def __array_interface__(self) -> Dict[str, Any]:
+        view = self._view
+        if view.dtype not in _ARRAY_TYPESTRS:
+            raise TypeError(f"{view.dtype} has no array interface type; use DLPack instead")
+        typestr = _ARRAY_TYPESTRS[view.dtype]
+        itemsize = view.element_size()
+        return {
+            "version": 3,
+            "shape": tuple(view.shape),
+            "typestr": ("|" if itemsize == 1 else _BYTE_ORDER) + typestr,
+            "data": (view.data_ptr(), False),
+            "strides": tuple(stride * itemsize for stride in view.stride()),
+        }
+
+def to_dlpack(tensor: torch.Tensor) -> Any:
+    r"""Returns a DLPack capsule of host memory aliasing the foo ``tensor``,
+        see :class:`HostBuffer`"""
+    return HostBuffer(tensor).__dlpack__()
+
+def from_dlpack(ext_tensor: Any, device: Optional[Union[int, str, torch.device]] = None) -> torch.Tensor:
+    r"""Returns a foo tensor viewing the memory of a host DLPack capsule, or of
+        an object with ``__dlpack__`` such as a NumPy array, without a copy.
+        The foo tensor keeps the memory alive."""
+    cpu = torch.utils.dlpack.from_dlpack(ext_tensor)
+    if cpu.device.type != "cpu":
+        raise BufferError(f"only host memory can be viewed from foo, got memory on {cpu.device}")
+    return _C._wrap_host(cpu, _get_device_index(device))
+
+# Distributed API
+def _has_process_group() -> bool:
+    r"""Returns whether torch_foo was built with its c10d backend (FOO_WITH_C10D)."""
+    return hasattr(_C, "_create_process_group")
+
+def _create_process_group(store: Any, rank: int, world_size: int, timeout: Any) -> Any:
+    r"""Creates the c10d backend registered as ``"foo"`` with
+        :func:`torch.distributed.Backend.register_backend`. It runs allreduce,
+        allgather, reduce_scatter and broadcast of foo tensors between the
+        processes of one host through shared memory, asynchronously on a foo
+        stream. Collectives on CPU tensors, and barrier(), need a CPU backend
+        next to it, e.g. ``init_process_group("cpu:gloo,foo:foo")``."""
+    return _C._create_process_group(store, rank, world_size, timeout)
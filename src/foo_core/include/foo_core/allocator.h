@@ -0,0 +1,121 @@
+#pragma once
+
+#include <c10/core/Device.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace foo_core {
+
+// Releases every cached block held by the foo caching allocator that is not
+// currently in use back to the system, for all devices.
+void empty_cache();
+
+// Releases every cached pinned host block that is not currently in use back to
+// the system.
+void host_empty_cache();
+
+// =====================================
+// ========= Memory statistics =========
+// =====================================
+
+// The caching allocator keeps the same statistics as the CUDA caching
+// allocator, per device and split by the pool that served the request.
+
+struct Stat {
+    int64_t current = 0;   // value right now
+    int64_t peak = 0;      // highest value since the last reset_peak_stats()
+    int64_t allocated = 0; // total increase since the last reset_accumulated_stats()
+    int64_t freed = 0;     // total decrease since the last reset_accumulated_stats()
+};
+
+enum class StatType : uint8_t {
+    All,       // all requests
+    SmallPool, // requests of at most 1 MiB
+    LargePool, // everything else
+    NumTypes,
+};
+
+using StatArray = std::array<Stat, static_cast<size_t>(StatType::NumTypes)>;
+
+struct DeviceStats {
+    StatArray allocation;           // number of blocks handed out
+    StatArray segment;              // number of segments requested from the system
+    StatArray inactive_split;       // number of free blocks inside partly used segments
+    StatArray allocated_bytes;      // bytes handed out, after rounding
+    StatArray requested_bytes;      // bytes requested by callers, before rounding
+    StatArray reserved_bytes;       // bytes held in segments
+    StatArray inactive_split_bytes; // free bytes inside partly used segments (fragmentation)
+    int64_t num_alloc_retries = 0;  // segment requests that only succeeded after emptying the cache
+    int64_t num_ooms = 0;           // segment requests that failed
+};
+
+DeviceStats get_device_stats(c10::DeviceIndex device);
+void reset_peak_stats(c10::DeviceIndex device);
+void reset_accumulated_stats(c10::DeviceIndex device);
+
+// =====================================
+// ========= Memory snapshots ==========
+// =====================================
+
+struct Frame {
+    std::string filename;
+    std::string name;
+    int line;
+};
+
+// Where a block was allocated, innermost frame first.
+using AllocationContext = std::shared_ptr<const std::vector<Frame>>;
+using ContextRecorder = std::function<AllocationContext()>;
+
+// While history recording is enabled, `recorder` is called on every allocation
+// and its result is attached to the block until it is freed. Passing a null
+// recorder disables recording.
+void record_memory_history(ContextRecorder recorder);
+
+// Calls the recorder once, when created, and attaches its result to every
+// allocation the calling thread makes during the guard's lifetime instead of
+// calling the recorder again. Bindings create one before releasing the GIL, so
+// the allocations of the op they call get the Python stack of the caller,
+// which a recorder can't read without the GIL. Does nothing while history
+// recording is off.
+class AllocationContextGuard {
+public:
+    AllocationContextGuard();
+    ~AllocationContextGuard();
+    AllocationContextGuard(const AllocationContextGuard&) = delete;
+    AllocationContextGuard& operator=(const AllocationContextGuard&) = delete;
+
+private:
+    bool active_ = false;
+    std::optional<AllocationContext> previous_;
+};
+
+struct BlockInfo {
+    uintptr_t address;
+    size_t size;           // block size after rounding
+    size_t requested_size; // size the caller asked for, 0 for free blocks
+    bool allocated;
+    AllocationContext context; // null unless recorded
+};
+
+struct SegmentInfo {
+    c10::DeviceIndex device;
+    uintptr_t address;
+    size_t total_size;
+    size_t allocated_size;
+    bool is_small; // segment of the small pool
+    std::vector<BlockInfo> blocks; // in address order
+};
+
+// Returns every segment currently held by the caching allocator, on all
+// devices, with the blocks it is split into.
+std::vector<SegmentInfo> memory_snapshot();
+
+}  // namespace foo_core
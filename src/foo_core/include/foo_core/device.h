@@ -0,0 +1,28 @@
+#pragma once
+
+#include <c10/core/Device.h>
+
+#include <string>
+
+namespace foo_core {
+
+// Each foo device is backed by a NUMA node of the host: its memory is
+// allocated on that node and its streams run on that node's cores. The number
+// of devices is the number of nodes but at least two, which then share a
+// node, or TORCH_FOO_DEVICE_COUNT if set.
+c10::DeviceIndex device_count();
+
+// The current device is tracked per thread and defaults to 0.
+c10::DeviceIndex current_device();
+void set_device(c10::DeviceIndex device);
+
+// Returns the NUMA node backing `device`.
+int device_numa_node(c10::DeviceIndex device);
+
+// The foo kernels are compiled for several x86 instruction set levels and the
+// best one the host supports is picked at load time. Returns the selected
+// level, "default", "avx2" or "avx512". TORCH_FOO_CPU_CAPABILITY pins a lower
+// one.
+std::string cpu_capability();
+
+}  // namespace foo_core
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <torch/csrc/distributed/c10d/Backend.hpp>
+#include <torch/csrc/distributed/c10d/Store.hpp>
+
+#include <chrono>
+
+namespace foo_core {
+
+// The c10d backend of foo tensors, for processes on one host. The ranks share
+// a memory segment, set up through `store`, and run the collectives through
+// it with barriers in shared memory instead of sockets:
+//
+// - allreduce and reduce_scatter: every rank reduces its share of the data
+//   from the buffers of all ranks, always in rank order, so every rank gets
+//   the same bits and results don't depend on timing.
+// - allgather and broadcast: ranks copy straight out of each other's buffers.
+//
+// Collectives run on a stream of the device of their tensors, after the work
+// already enqueued on the current stream, which in turn waits for them: like
+// NCCL, they are asynchronous to the host. Every collective of a process group
+// must use the same device. Larger tensors go through the segment in chunks of
+// TORCH_FOO_SHM_SLOT_BYTES (4 MiB by default) per rank, as set for rank 0.
+//
+// Only built with FOO_WITH_C10D, against a libtorch with c10d.
+c10::intrusive_ptr<c10d::Backend> create_process_group(const c10::intrusive_ptr<c10d::Store>& store, int rank,
+    int size, std::chrono::milliseconds timeout);
+
+}  // namespace foo_core
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace foo_core {
+
+// How operators without a foo kernel are run on the CPU.
+enum class FallbackMode {
+    // Copy every foo input to a new CPU tensor, run the CPU kernel and copy
+    // the results back (at::native::cpu_fallback).
+    Copy,
+    // Run the CPU kernel on CPU views of the foo storages and wrap its outputs
+    // as foo tensors, without copying any data. Outputs the CPU kernel
+    // allocates keep their CPU memory, so they bypass the foo caching
+    // allocator and its statistics.
+    Alias,
+};
+
+// The mode defaults to Copy and can be overridden with the environment
+// variable TORCH_FOO_FALLBACK_MODE=copy|alias.
+FallbackMode get_fallback_mode();
+void set_fallback_mode(FallbackMode mode);
+
+// When set, operators without a foo kernel raise a NotImplementedError instead
+// of falling back. Defaults to TORCH_FOO_FALLBACK_RAISE=1 in the environment.
+bool get_fallback_raise();
+void set_fallback_raise(bool raise);
+
+// What the fallback cost a single operator since the last reset.
+struct FallbackOpStats {
+    std::string name;      // operator name, including the overload
+    uint64_t calls;        // number of fallback calls
+    uint64_t total_ns;     // total wall time spent in the fallback
+    uint64_t max_ns;       // longest single call
+    uint64_t bytes_to_cpu; // bytes copied from foo to CPU
+    uint64_t bytes_to_foo; // bytes copied from CPU to foo
+};
+
+// Returns the statistics of every operator that fell back since the last reset.
+std::vector<FallbackOpStats> get_fallback_stats();
+void reset_fallback_stats();
+
+}  // namespace foo_core
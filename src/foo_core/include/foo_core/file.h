@@ -0,0 +1,26 @@
+#pragma once
+
+#include <ATen/core/Tensor.h>
+#include <c10/core/Device.h>
+#include <c10/core/ScalarType.h>
+#include <c10/util/ArrayRef.h>
+
+#include <cstdint>
+#include <string>
+
+namespace foo_core {
+
+// Returns a contiguous foo tensor on `device` (-1 for the current one) with
+// the given sizes and dtype, whose elements are the bytes of the file `path`
+// from `offset` on. The storage maps the file privately instead of reading
+// it: pages are read from the page cache when first touched, and writes go to
+// private copies of the pages they touch, never to the file. Mapped storages
+// can't be resized and don't count in the caching allocator statistics, and
+// their pages are not placed on the NUMA node of the device.
+//
+// An offset that isn't a multiple of the element size can't be mapped without
+// misaligning the elements; the bytes are then read into allocator memory.
+at::Tensor from_file(const std::string& path, int64_t offset, c10::IntArrayRef sizes, c10::ScalarType dtype,
+    c10::DeviceIndex device = -1);
+
+}  // namespace foo_core
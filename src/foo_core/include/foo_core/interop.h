@@ -0,0 +1,25 @@
+#pragma once
+
+#include <ATen/core/Tensor.h>
+#include <c10/core/Device.h>
+
+namespace foo_core {
+
+// Foo memory is host memory, so other frameworks can use it in place. These
+// helpers hand foo tensors to host code and take host memory in without
+// copying; the Python side builds DLPack capsules and the NumPy array
+// interface on top of them.
+
+// Returns a CPU tensor viewing the memory of `self`, ready to be read and
+// written on the host: pending lazy ops and fills are run and the current
+// stream of its device is waited for. The view keeps the foo storage alive.
+// Work enqueued on foo afterwards is not ordered with host accesses through
+// the view.
+at::Tensor host_view(const at::Tensor& self);
+
+// Returns a foo tensor on `device` (-1 for the current one) viewing the memory
+// of the CPU tensor `cpu`, which it keeps alive. The memory isn't moved to the
+// NUMA node of the device.
+at::Tensor wrap_host(const at::Tensor& cpu, c10::DeviceIndex device = -1);
+
+}  // namespace foo_core
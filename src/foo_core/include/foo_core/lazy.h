@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+namespace foo_core {
+
+// In lazy mode, elementwise float32 ops on foo tensors are recorded instead of
+// executed. Chains of them are fused into single-pass kernels that only write
+// the results still referenced when the graph runs. The graph runs as soon as
+// anything else touches foo memory (another op, a copy, .cpu()), on
+// synchronize(), or on lazy_sync().
+//
+// Lazy mode is off by default; TORCH_FOO_LAZY=1 in the environment turns it on.
+bool is_lazy_mode();
+void set_lazy_mode(bool enabled);
+
+// Enqueues every pending lazy op on the current streams.
+void lazy_sync();
+
+// What lazy mode did since the last reset: the ops it recorded and the fused
+// kernels it ran them as.
+struct LazyStats {
+    uint64_t recorded_ops;
+    uint64_t fused_kernels;
+};
+
+LazyStats get_lazy_stats();
+void reset_lazy_stats();
+
+}  // namespace foo_core
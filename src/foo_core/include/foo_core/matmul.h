@@ -0,0 +1,34 @@
+#pragma once
+
+#include <ATen/core/Tensor.h>
+
+namespace foo_core {
+
+// float32 mm, addmm and bmm on foo tensors pack the columns of their second
+// operand into panels before multiplying. With weight prepacking on, mm and
+// addmm keep the packed copy of that operand when it is a parameter (a leaf
+// that requires grad, or a view of one), keyed on its storage, layout and
+// version counter, and reuse it until the tensor is written to or freed. This
+// saves repacking the weights of a linear layer on every call of an inference
+// loop, for up to one extra copy of each weight multiplied.
+//
+// Only writes that bump the version counter are seen. Writes through `.data`,
+// torch.foo.HostBuffer, DLPack or any other CPU alias of the memory aren't:
+// call clear_prepacked_weights() after them.
+//
+// Weight prepacking is off by default; TORCH_FOO_PREPACK_WEIGHTS=1 in the
+// environment turns it on.
+bool is_weight_prepacking();
+void set_weight_prepacking(bool enabled);
+
+// Prepacks the operands viewing the storage of `weight` whether or not
+// prepacking is on and whether or not it is a parameter, e.g. for weights
+// loaded without autograd, until the storage is freed or the packed weights
+// are cleared.
+void prepack_weight(const at::Tensor& weight);
+
+// Drops every packed weight, and the marks of prepack_weight(). Turning
+// prepacking off keeps them until then.
+void clear_prepacked_weights();
+
+}  // namespace foo_core
@@ -10,10 +10,7 @@ at::Tensor mymul_cpu(const at::Tensor& a, const at::Tensor& b);
 
 void myadd_out_cpu(const at::Tensor& a, const at::Tensor& b, at::Tensor& out);
 
-// Add two tensors element-wise
-torch::Tensor add(const torch::Tensor& a, const torch::Tensor& b);
-
-// Multiply two tensors element-wise
-torch::Tensor multiply(const torch::Tensor& a, const torch::Tensor& b);
+// Gradients of a * b with respect to a and b: (grad * b, grad * a).
+std::tuple<at::Tensor, at::Tensor> mymul_backward_cpu(const at::Tensor& grad, const at::Tensor& a, const at::Tensor& b);
 
 }  // namespace foo_core
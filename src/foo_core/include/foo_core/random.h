@@ -0,0 +1,17 @@
+#pragma once
+
+#include <ATen/core/Generator.h>
+#include <c10/core/Device.h>
+
+namespace foo_core {
+
+// Random ops on foo tensors draw from a counter-based Philox generator per
+// device, so their results only depend on the seed and on the order of the
+// ops, not on how many threads run them. Like the CUDA ones, the default
+// generators start with the seed 67280421310721 and are reseeded by
+// torch.manual_seed.
+
+// Returns the default generator of `device`, -1 meaning the current device.
+const at::Generator& default_generator(c10::DeviceIndex device = -1);
+
+}  // namespace foo_core
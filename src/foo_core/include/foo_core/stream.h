@@ -0,0 +1,38 @@
+#pragma once
+
+#include <c10/core/Device.h>
+#include <c10/core/Stream.h>
+
+#include <functional>
+
+namespace foo_core {
+
+// Every foo device owns a default stream (id 0) and a small pool of extra
+// streams. Each stream is an in-order execution queue drained by its own
+// worker thread, so work enqueued on different streams can overlap with each
+// other and with the host. A device index of -1 means the current device.
+
+// Returns the stream that kernels launched by this thread on `device` use.
+c10::Stream get_current_stream(c10::DeviceIndex device = -1);
+
+// Makes `stream` the current stream of its device for this thread.
+void set_current_stream(const c10::Stream& stream);
+
+// Returns the default stream of `device`.
+c10::Stream get_default_stream(c10::DeviceIndex device = -1);
+
+// Returns one of the pool streams of `device`, handed out round-robin.
+c10::Stream get_stream_from_pool(c10::DeviceIndex device = -1);
+
+// Enqueues `task` on `stream`. Tasks on a stream run in order. Anything the
+// task reads or writes (e.g. tensors) must be captured by value so it stays
+// alive until the task has run.
+void launch(const c10::Stream& stream, std::function<void()> task);
+
+// Enqueues `task` on the current stream of the current device.
+void launch(std::function<void()> task);
+
+// Blocks until all work enqueued on every stream of `device` has completed.
+void synchronize(c10::DeviceIndex device = -1);
+
+}  // namespace foo_core
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+
+namespace foo_core {
+
+// The foo kernels, copies and CPU fallbacks can record what they did into
+// per-thread ring buffers. Tracing is compiled in with the FOO_WITH_TRACING
+// CMake option and switched on at runtime with set_tracing_enabled() or
+// TORCH_FOO_TRACE=1 in the environment. While it is off, an instrumented
+// kernel only pays for one relaxed atomic load.
+
+// Returns whether tracing support was compiled in.
+bool is_tracing_available();
+
+bool is_tracing_enabled();
+void set_tracing_enabled(bool enabled);
+
+// Drops every recorded event.
+void clear_trace();
+
+// Returns the recorded events in the Chrome trace event format, which can be
+// opened with chrome://tracing or Perfetto. Each thread only keeps its most
+// recent events.
+std::string export_chrome_trace();
+
+}  // namespace foo_core
@@ -0,0 +1,73 @@
+#include "FooAlias.h"
+
+#include <c10/core/Allocator.h>
+#include <c10/core/CPUAllocator.h>
+#include <c10/core/DispatchKeySet.h>
+#include <c10/core/TensorImpl.h>
+#include <c10/util/Exception.h>
+
+namespace foo_core {
+
+namespace {
+
+// The DataPtr context of an alias is a heap allocated reference to the storage
+// that owns the memory.
+void delete_storage_context(void* ctx)
+{
+    delete static_cast<c10::Storage*>(ctx);
+}
+
+c10::Storage alias_storage(const c10::Storage& owner, c10::Device device, c10::Allocator* allocator)
+{
+    void* data = owner.unsafeGetStorageImpl()->mutable_data();
+    c10::DataPtr data_ptr(data, new c10::Storage(owner), &delete_storage_context, device);
+    return c10::Storage(
+        c10::Storage::use_byte_size_t(),
+        owner.nbytes(),
+        std::move(data_ptr),
+        allocator,
+        /*resizable=*/true);
+}
+
+at::Tensor make_alias(const at::Tensor& like, c10::Storage storage, c10::DispatchKey key)
+{
+    at::Tensor alias = at::detail::make_tensor<c10::TensorImpl>(
+        std::move(storage), c10::DispatchKeySet(key), like.dtype());
+    alias.unsafeGetTensorImpl()->set_sizes_and_strides(like.sizes(), like.strides(), like.storage_offset());
+    return alias;
+}
+
+} // namespace
+
+c10::Storage cpu_alias_storage(const c10::Storage& foo_storage)
+{
+    return alias_storage(foo_storage, c10::Device(c10::DeviceType::CPU), c10::GetCPUAllocator());
+}
+
+at::Tensor cpu_alias(const at::Tensor& self)
+{
+    return cpu_alias(self, cpu_alias_storage(self.storage()));
+}
+
+at::Tensor cpu_alias(const at::Tensor& self, const c10::Storage& cpu_storage)
+{
+    return make_alias(self, cpu_storage, c10::DispatchKey::CPU);
+}
+
+c10::Storage foo_wrap_storage(const c10::Storage& cpu_storage, c10::Device device)
+{
+    TORCH_INTERNAL_ASSERT(device.is_privateuseone());
+    return alias_storage(cpu_storage, device, c10::GetAllocator(c10::DeviceType::PrivateUse1));
+}
+
+at::Tensor foo_view(const at::Tensor& cpu, const c10::Storage& foo_storage)
+{
+    return make_alias(cpu, foo_storage, c10::DispatchKey::PrivateUse1);
+}
+
+at::Tensor foo_wrap(const at::Tensor& cpu, c10::Device device)
+{
+    return foo_view(cpu, foo_wrap_storage(cpu.storage(), device));
+}
+
+} // namespace foo_core
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <ATen/core/Tensor.h>
+#include <c10/core/Device.h>
+#include <c10/core/Storage.h>
+
+namespace foo_core {
+
+// =====================================
+// ========= Host aliases ==============
+// =====================================
+
+// Foo storages are host memory, so a CPU kernel can run directly on them as
+// long as it sees a CPU tensor. These helpers build such aliases in both
+// directions without copying any data. Each alias keeps the storage it points
+// into alive for as long as the alias itself is alive.
+
+// Returns a CPU storage that aliases the memory of `foo_storage`. The alias is
+// resizable through the CPU allocator; growing it moves it to fresh CPU memory,
+// which callers detect by comparing data pointers.
+c10::Storage cpu_alias_storage(const c10::Storage& foo_storage);
+
+// Returns a CPU tensor with the sizes, strides, offset and dtype of `self`
+// viewing the same memory.
+at::Tensor cpu_alias(const at::Tensor& self);
+
+// Returns a CPU tensor with the metadata of `self` viewing `cpu_storage`,
+// usually an alias created by cpu_alias_storage().
+at::Tensor cpu_alias(const at::Tensor& self, const c10::Storage& cpu_storage);
+
+// Returns a foo storage on `device` that takes shared ownership of the memory
+// of `cpu_storage`.
+c10::Storage foo_wrap_storage(const c10::Storage& cpu_storage, c10::Device device);
+
+// Returns a foo tensor with the metadata of `cpu` viewing `foo_storage`.
+at::Tensor foo_view(const at::Tensor& cpu, const c10::Storage& foo_storage);
+
+// Returns a foo tensor on `device` viewing the memory of the CPU tensor `cpu`.
+at::Tensor foo_wrap(const at::Tensor& cpu, c10::Device device);
+
+} // namespace foo_core
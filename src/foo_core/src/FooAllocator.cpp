@@ -1,9 +1,22 @@
-#include <ATen/Context.h> // delete soon
 #include <c10/core/Allocator.h>
 #include <c10/core/DeviceType.h>
-#include <c10/core/StorageImpl.h>
-#include <iostream>
-#include <c10/core/impl/alloc_cpu.h>
+#include <c10/util/Exception.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "foo_core/allocator.h"
+#include "FooDeviceGuardImpl.h"
+#include "FooTopology.h"
 
 namespace foo_core {
 
@@ -15,30 +28,536 @@ namespace foo_core {
 // You can create one by inheriting from the c10::Allocator class,
 // and registering your allocator for the particular device type
 // (PrivateUse1 for open registration devices)
+//
+// Our device memory is plain host memory, but going to malloc/free for every
+// tensor is far too slow once the empty kernels run thousands of times per
+// step. Instead we use a caching allocator modelled after
+// c10/cuda/CUDACachingAllocator.cpp:
+//
+// - Each device owns its own pools of cached blocks guarded by its own mutex.
+// - Requests are rounded up to multiples of 512 bytes and served from one of
+//   two pools: a "small" pool for requests of at most 1 MiB and a "large" pool
+//   for everything else.
+// - Memory is requested from the system in segments. Small requests are packed
+//   into 2 MiB segments, requests between 1 MiB and 10 MiB into 20 MiB
+//   segments, and larger requests get a segment rounded up to 2 MiB.
+// - A cached block larger than the request is split, and the remainder goes
+//   back into the pool. On free, a block is coalesced with its free neighbours
+//   from the same segment.
+// - Segments are only returned to the system by empty_cache(), or when a
+//   segment allocation fails and we retry after releasing the cache.
+// - Segments are allocated on the NUMA node of their device (FooTopology.h).
+// - Every change is counted in the per-device DeviceStats (foo_core/allocator.h)
+//   and, while history recording is on, each block remembers where it was
+//   allocated for memory_snapshot().
+namespace {
+
+constexpr size_t kMinBlockSize = 512;       // all sizes are rounded to at least 512 bytes
+constexpr size_t kSmallSize = 1048576;      // largest "small" allocation is 1 MiB
+constexpr size_t kSmallBuffer = 2097152;    // "small" allocations are packed in 2 MiB segments
+constexpr size_t kLargeBuffer = 20971520;   // "large" allocations may be packed in 20 MiB segments
+constexpr size_t kMinLargeAlloc = 10485760; // allocations between 1 and 10 MiB may use kLargeBuffer
+constexpr size_t kRoundLarge = 2097152;     // round up large allocations to 2 MiB
+
+struct Block;
+using BlockComparator = bool (*)(const Block*, const Block*);
+
+struct BlockPool {
+    BlockPool(BlockComparator comparator, bool small) : blocks(comparator), is_small(small) {}
+    std::set<Block*, BlockComparator> blocks;
+    const bool is_small;
+};
+
+struct Block {
+    c10::DeviceIndex device;
+    size_t size;            // block size in bytes
+    BlockPool* pool;        // owning memory pool
+    void* ptr;              // memory address
+    bool allocated = false; // in-use flag
+    size_t requested_size = 0; // size the caller asked for while allocated
+    AllocationContext context; // where the block was allocated, if recorded
+    Block* prev = nullptr;  // prev block if split from a larger segment
+    Block* next = nullptr;  // next block if split from a larger segment
+
+    Block(c10::DeviceIndex device, size_t size, BlockPool* pool, void* ptr)
+        : device(device), size(size), pool(pool), ptr(ptr) {}
+
+    // constructor for search key
+    Block(c10::DeviceIndex device, size_t size) : device(device), size(size), pool(nullptr), ptr(nullptr) {}
+
+    bool is_split() const
+    {
+        return (prev != nullptr) || (next != nullptr);
+    }
+};
+
+bool BlockComparatorSize(const Block* a, const Block* b)
+{
+    if (a->size != b->size) {
+        return a->size < b->size;
+    }
+    return reinterpret_cast<uintptr_t>(a->ptr) < reinterpret_cast<uintptr_t>(b->ptr);
+}
+
+size_t round_size(size_t size)
+{
+    if (size < kMinBlockSize) {
+        return kMinBlockSize;
+    }
+    return kMinBlockSize * ((size + kMinBlockSize - 1) / kMinBlockSize);
+}
+
+void update_stat(Stat& stat, int64_t amount)
+{
+    stat.current += amount;
+    stat.peak = std::max(stat.peak, stat.current);
+    if (amount > 0) {
+        stat.allocated += amount;
+    } else {
+        stat.freed -= amount;
+    }
+}
+
+// Updates the "all" entry and the entry of the pool the block belongs to.
+void update_stat_array(StatArray& stats, int64_t amount, bool is_small)
+{
+    update_stat(stats[static_cast<size_t>(StatType::All)], amount);
+    update_stat(stats[static_cast<size_t>(is_small ? StatType::SmallPool : StatType::LargePool)], amount);
+}
+
+// The recorder installed by record_memory_history(), if any. Kept behind a
+// mutex since it is swapped while other threads allocate; the flag keeps the
+// common case of no recording lock free.
+std::atomic<bool> recording_history{false};
+
+std::mutex& recorder_mutex()
+{
+    static std::mutex* mutex = new std::mutex();
+    return *mutex;
+}
+
+ContextRecorder& context_recorder()
+{
+    static ContextRecorder* recorder = new ContextRecorder();
+    return *recorder;
+}
+
+// The context set by the AllocationContextGuard of this thread, if any.
+std::optional<AllocationContext>& guarded_context()
+{
+    thread_local std::optional<AllocationContext> context;
+    return context;
+}
+
+AllocationContext record_context()
+{
+    if (!recording_history.load(std::memory_order_relaxed)) {
+        return nullptr;
+    }
+    if (guarded_context().has_value()) {
+        return *guarded_context();
+    }
+    ContextRecorder recorder;
+    {
+        std::lock_guard<std::mutex> lock(recorder_mutex());
+        recorder = context_recorder();
+    }
+    return recorder ? recorder() : nullptr;
+}
+
+size_t get_allocation_size(size_t size)
+{
+    if (size <= kSmallSize) {
+        return kSmallBuffer;
+    } else if (size < kMinLargeAlloc) {
+        return kLargeBuffer;
+    }
+    return kRoundLarge * ((size + kRoundLarge - 1) / kRoundLarge);
+}
+
+// The cached blocks and segments of a single device.
+class DeviceCachingAllocator {
+public:
+    explicit DeviceCachingAllocator(c10::DeviceIndex device)
+        : device_(device),
+          large_blocks_(BlockComparatorSize, /*small=*/false),
+          small_blocks_(BlockComparatorSize, /*small=*/true) {}
+
+    Block* malloc(size_t orig_size)
+    {
+        AllocationContext context = record_context();
+        std::lock_guard<std::mutex> lock(mutex_);
+        const size_t size = round_size(orig_size);
+        BlockPool& pool = get_pool(size);
+
+        Block* block = get_free_block(pool, size);
+        if (block == nullptr) {
+            const size_t alloc_size = get_allocation_size(size);
+            void* ptr = alloc_segment(alloc_size);
+            block = new Block(device_, alloc_size, &pool, ptr);
+            update_stat_array(stats_.segment, 1, pool.is_small);
+            update_stat_array(stats_.reserved_bytes, alloc_size, pool.is_small);
+        }
+
+        if (should_split(block, size)) {
+            Block* remaining = block;
+            block = new Block(device_, size, &pool, remaining->ptr);
+            block->prev = remaining->prev;
+            if (block->prev) {
+                block->prev->next = block;
+            }
+            block->next = remaining;
+            remaining->prev = block;
+            remaining->ptr = static_cast<char*>(remaining->ptr) + size;
+            remaining->size -= size;
+            insert_free_block(pool, remaining);
+        }
+        block->allocated = true;
+        block->requested_size = orig_size;
+        block->context = std::move(context);
+        active_blocks_.insert(block);
+        update_stat_array(stats_.allocation, 1, pool.is_small);
+        update_stat_array(stats_.allocated_bytes, block->size, pool.is_small);
+        update_stat_array(stats_.requested_bytes, orig_size, pool.is_small);
+        return block;
+    }
+
+    void free(Block* block)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        BlockPool& pool = *block->pool;
+        update_stat_array(stats_.allocation, -1, pool.is_small);
+        update_stat_array(stats_.allocated_bytes, -static_cast<int64_t>(block->size), pool.is_small);
+        update_stat_array(stats_.requested_bytes, -static_cast<int64_t>(block->requested_size), pool.is_small);
+        active_blocks_.erase(block);
+        block->allocated = false;
+        block->requested_size = 0;
+        block->context.reset();
+        const std::array<Block*, 2> merge_candidates = {block->prev, block->next};
+        for (Block* merge_candidate : merge_candidates) {
+            try_merge_blocks(block, merge_candidate, pool);
+        }
+        insert_free_block(pool, block);
+    }
+
+    void empty_cache()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        release_cached_blocks();
+    }
+
+    DeviceStats get_stats()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
 
-// A dummy allocator for our custom device, that secretly uses the CPU
+    void reset_peak_stats()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (StatArray* stats : stat_arrays()) {
+            for (Stat& stat : *stats) {
+                stat.peak = stat.current;
+            }
+        }
+    }
+
+    void reset_accumulated_stats()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (StatArray* stats : stat_arrays()) {
+            for (Stat& stat : *stats) {
+                stat.allocated = 0;
+                stat.freed = 0;
+            }
+        }
+        stats_.num_alloc_retries = 0;
+        stats_.num_ooms = 0;
+    }
+
+    // Appends every segment of this device to `segments`. The segments are
+    // found through their first block, which is either handed out or cached.
+    void snapshot(std::vector<SegmentInfo>& segments)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<const Block*> heads;
+        for (const Block* block : active_blocks_) {
+            if (block->prev == nullptr) {
+                heads.push_back(block);
+            }
+        }
+        for (const BlockPool* pool : {&large_blocks_, &small_blocks_}) {
+            for (const Block* block : pool->blocks) {
+                if (block->prev == nullptr) {
+                    heads.push_back(block);
+                }
+            }
+        }
+        std::sort(heads.begin(), heads.end(), [](const Block* a, const Block* b) { return a->ptr < b->ptr; });
+        for (const Block* head : heads) {
+            SegmentInfo segment{device_, reinterpret_cast<uintptr_t>(head->ptr), 0, 0, head->pool->is_small, {}};
+            for (const Block* block = head; block != nullptr; block = block->next) {
+                segment.total_size += block->size;
+                if (block->allocated) {
+                    segment.allocated_size += block->size;
+                }
+                segment.blocks.push_back({reinterpret_cast<uintptr_t>(block->ptr), block->size,
+                    block->requested_size, block->allocated, block->context});
+            }
+            segments.push_back(std::move(segment));
+        }
+    }
+
+private:
+    BlockPool& get_pool(size_t size)
+    {
+        return size <= kSmallSize ? small_blocks_ : large_blocks_;
+    }
+
+    std::array<StatArray*, 7> stat_arrays()
+    {
+        return {&stats_.allocation, &stats_.segment, &stats_.inactive_split, &stats_.allocated_bytes,
+            &stats_.requested_bytes, &stats_.reserved_bytes, &stats_.inactive_split_bytes};
+    }
+
+    // Free blocks that share their segment with other blocks are what
+    // fragments the cache, so they are counted as they enter and leave a pool.
+    void update_inactive_split(const Block* block, int64_t sign)
+    {
+        if (block->is_split()) {
+            update_stat_array(stats_.inactive_split, sign, block->pool->is_small);
+            update_stat_array(stats_.inactive_split_bytes, sign * static_cast<int64_t>(block->size),
+                block->pool->is_small);
+        }
+    }
+
+    void insert_free_block(BlockPool& pool, Block* block)
+    {
+        pool.blocks.insert(block);
+        update_inactive_split(block, 1);
+    }
+
+    // Finds the smallest cached block that fits, removing it from the pool.
+    Block* get_free_block(BlockPool& pool, size_t size)
+    {
+        Block key(device_, size);
+        auto it = pool.blocks.lower_bound(&key);
+        if (it == pool.blocks.end()) {
+            return nullptr;
+        }
+        Block* block = *it;
+        pool.blocks.erase(it);
+        update_inactive_split(block, -1);
+        return block;
+    }
+
+    static bool should_split(const Block* block, size_t size)
+    {
+        const size_t remaining = block->size - size;
+        if (block->pool->is_small) {
+            return remaining >= kMinBlockSize;
+        }
+        return remaining > kSmallSize;
+    }
+
+    // Requests a new segment from the system. If that fails, every unused
+    // cached segment is released and the request is retried once.
+    void* alloc_segment(size_t size)
+    {
+        void* ptr = alloc_device_memory(device_, size);
+        if (ptr == nullptr) {
+            release_cached_blocks();
+            ptr = alloc_device_memory(device_, size);
+            if (ptr != nullptr) {
+                stats_.num_alloc_retries += 1;
+            }
+        }
+        if (ptr == nullptr) {
+            stats_.num_ooms += 1;
+            constexpr size_t all = static_cast<size_t>(StatType::All);
+            TORCH_CHECK_WITH(OutOfMemoryError, false, "foo caching allocator: failed to allocate ", size,
+                " bytes on device ", static_cast<int>(device_), " (", stats_.allocated_bytes[all].current,
+                " bytes allocated, ", stats_.reserved_bytes[all].current, " bytes reserved)");
+        }
+        return ptr;
+    }
+
+    // Merges src into dst if src is free. dst must not be in a pool.
+    void try_merge_blocks(Block* dst, Block* src, BlockPool& pool)
+    {
+        if (!src || src->allocated) {
+            return;
+        }
+        update_inactive_split(src, -1);
+        if (dst->prev == src) {
+            dst->ptr = src->ptr;
+            dst->prev = src->prev;
+            if (dst->prev) {
+                dst->prev->next = dst;
+            }
+        } else {
+            dst->next = src->next;
+            if (dst->next) {
+                dst->next->prev = dst;
+            }
+        }
+        dst->size += src->size;
+        pool.blocks.erase(src);
+        delete src;
+    }
+
+    void release_blocks(BlockPool& pool)
+    {
+        // Only whole segments (blocks that were never split or have been fully
+        // coalesced again) can be handed back to the system.
+        auto it = pool.blocks.begin();
+        while (it != pool.blocks.end()) {
+            Block* block = *it;
+            if (block->is_split()) {
+                ++it;
+                continue;
+            }
+            free_device_memory(block->ptr, block->size);
+            update_stat_array(stats_.segment, -1, pool.is_small);
+            update_stat_array(stats_.reserved_bytes, -static_cast<int64_t>(block->size), pool.is_small);
+            it = pool.blocks.erase(it);
+            delete block;
+        }
+    }
+
+    void release_cached_blocks()
+    {
+        release_blocks(large_blocks_);
+        release_blocks(small_blocks_);
+    }
+
+    const c10::DeviceIndex device_;
+    std::mutex mutex_;
+    BlockPool large_blocks_;
+    BlockPool small_blocks_;
+    std::unordered_set<Block*> active_blocks_;
+    DeviceStats stats_;
+};
+
+// Maps the pointers handed out by the allocator back to their blocks.
+// The map is sharded to reduce lock contention between threads.
+constexpr size_t kNumMutexShard = 67;
+
+struct alignas(64) AllocatedBlocksShard {
+    std::mutex mutex;
+    std::unordered_map<void*, Block*> blocks;
+};
+
+class FooCachingAllocator {
+public:
+    Block* malloc(c10::DeviceIndex device, size_t size)
+    {
+        Block* block = device_allocator(device).malloc(size);
+        AllocatedBlocksShard& shard = get_shard(block->ptr);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.blocks[block->ptr] = block;
+        return block;
+    }
+
+    void free(void* ptr)
+    {
+        Block* block = nullptr;
+        {
+            AllocatedBlocksShard& shard = get_shard(ptr);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto it = shard.blocks.find(ptr);
+            TORCH_CHECK(it != shard.blocks.end(), "invalid foo device pointer: ", ptr);
+            block = it->second;
+            shard.blocks.erase(it);
+        }
+        device_allocator(block->device).free(block);
+    }
+
+    void empty_cache()
+    {
+        init();
+        for (auto& device_allocator : device_allocators_) {
+            device_allocator->empty_cache();
+        }
+    }
+
+    std::vector<SegmentInfo> snapshot()
+    {
+        init();
+        std::vector<SegmentInfo> segments;
+        for (auto& device_allocator : device_allocators_) {
+            device_allocator->snapshot(segments);
+        }
+        return segments;
+    }
+
+    DeviceCachingAllocator& device_allocator(c10::DeviceIndex device)
+    {
+        init();
+        TORCH_CHECK(
+            device >= 0 && static_cast<size_t>(device) < device_allocators_.size(),
+            "Invalid foo device index ", static_cast<int>(device));
+        return *device_allocators_[device];
+    }
+
+private:
+    void init()
+    {
+        std::call_once(init_flag_, [this]() {
+            const c10::DeviceIndex device_count = FooDeviceGuardImpl().deviceCount();
+            device_allocators_.reserve(device_count);
+            for (c10::DeviceIndex i = 0; i < device_count; ++i) {
+                device_allocators_.emplace_back(std::make_unique<DeviceCachingAllocator>(i));
+            }
+        });
+    }
+
+    AllocatedBlocksShard& get_shard(void* ptr)
+    {
+        return shards_[std::hash<void*>{}(ptr) % kNumMutexShard];
+    }
+
+    std::once_flag init_flag_;
+    std::vector<std::unique_ptr<DeviceCachingAllocator>> device_allocators_;
+    std::array<AllocatedBlocksShard, kNumMutexShard> shards_;
+};
+
+// Intentionally leaked: tensors may still be freed during static destruction.
+FooCachingAllocator& caching_allocator()
+{
+    static FooCachingAllocator* allocator = new FooCachingAllocator();
+    return *allocator;
+}
+
+} // namespace
+
+// The c10::Allocator registered for our custom device. The DataPtr context is
+// the data pointer itself, so raw_deleter() works for raw_allocate() users.
 struct FooAllocator final : c10::Allocator {
     FooAllocator() = default;
 
     c10::DataPtr allocate(size_t nbytes) override
     {
-        std::cout << "Custom allocator's allocate() called!" << std::endl;
-        void* data = c10::alloc_cpu(nbytes);
-        return {data, data, &ReportAndDelete, at::Device(at::DeviceType::PrivateUse1, 0)};
+        const c10::DeviceIndex device = FooDeviceGuardImpl().getDevice().index();
+        const c10::Device data_device(c10::DeviceType::PrivateUse1, device);
+        if (nbytes == 0) {
+            return {nullptr, nullptr, &local_raw_delete, data_device};
+        }
+        void* data = caching_allocator().malloc(device, nbytes)->ptr;
+        return {data, data, &local_raw_delete, data_device};
     }
 
-    static void ReportAndDelete(void* ptr)
+    static void local_raw_delete(void* ptr)
     {
         if (!ptr) {
             return;
         }
-        std::cout << "Custom allocator's delete() called!" << std::endl;
-        c10::free_cpu(ptr);
+        caching_allocator().free(ptr);
     }
 
     c10::DeleterFnPtr raw_deleter() const override
     {
-        return &ReportAndDelete;
+        return &local_raw_delete;
     }
 
     void copy_data(void* dest, const void* src, std::size_t count) const final
@@ -47,38 +566,58 @@ struct FooAllocator final : c10::Allocator {
     }
 };
 
+void empty_cache()
+{
+    caching_allocator().empty_cache();
+}
 
-c10::intrusive_ptr<c10::StorageImpl> make_custom_storage_impl(
-    c10::StorageImpl::use_byte_size_t,
-    c10::SymInt size_bytes,
-    c10::DataPtr data_ptr,
-    c10::Allocator* allocator,
-    bool resizable)
+DeviceStats get_device_stats(c10::DeviceIndex device)
 {
-    c10::intrusive_ptr<c10::StorageImpl> custom_storage_impl;
-    std::cout << "make_storage_impl, bytes = "<< size_bytes << std::endl;
-    if (data_ptr == nullptr){
-        custom_storage_impl = c10::make_intrusive<c10::StorageImpl>(c10::StorageImpl::use_byte_size_t(), size_bytes, allocator, resizable);
-    } else {
-        custom_storage_impl = c10::make_intrusive<c10::StorageImpl>(c10::StorageImpl::use_byte_size_t(), size_bytes, std::move(data_ptr), allocator, resizable);
-    }
-    return custom_storage_impl;
+    return caching_allocator().device_allocator(device).get_stats();
 }
 
+void reset_peak_stats(c10::DeviceIndex device)
+{
+    caching_allocator().device_allocator(device).reset_peak_stats();
+}
 
-// Register the allocator
-// static FooAllocator global_foo_alloc;
-// REGISTER_ALLOCATOR(c10::DeviceType::PrivateUse1, &global_foo_alloc);
-// Use the CPU Allocator
-REGISTER_ALLOCATOR(c10::DeviceType::PrivateUse1, at::getCPUAllocator())
+void reset_accumulated_stats(c10::DeviceIndex device)
+{
+    caching_allocator().device_allocator(device).reset_accumulated_stats();
+}
+
+void record_memory_history(ContextRecorder recorder)
+{
+    std::lock_guard<std::mutex> lock(recorder_mutex());
+    recording_history.store(static_cast<bool>(recorder));
+    context_recorder() = std::move(recorder);
+}
 
-// int register_storage() {
-//     std::cout << "Registered storage" << std::endl;
-//     c10::SetStorageImplCreate(c10::DeviceType::PrivateUse1, &make_custom_storage_impl);
-//     return 0;
-// }
-// static const int _temp_ = register_storage();
+AllocationContextGuard::AllocationContextGuard()
+{
+    if (!recording_history.load(std::memory_order_relaxed)) {
+        return;
+    }
+    AllocationContext context = record_context();
+    previous_ = std::move(guarded_context());
+    guarded_context() = std::move(context);
+    active_ = true;
+}
 
+AllocationContextGuard::~AllocationContextGuard()
+{
+    if (active_) {
+        guarded_context() = std::move(previous_);
+    }
+}
 
+std::vector<SegmentInfo> memory_snapshot()
+{
+    return caching_allocator().snapshot();
+}
+
+// Register the allocator
+static FooAllocator global_foo_alloc;
+REGISTER_ALLOCATOR(c10::DeviceType::PrivateUse1, &global_foo_alloc);
 
 } // namespace foo_core
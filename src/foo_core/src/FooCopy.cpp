@@ -0,0 +1,160 @@
+#include "FooCopy.h"
+
+#include <ATen/Parallel.h>
+#include <c10/util/Exception.h>
+
+#include <cstring>
+#include <optional>
+
+#include "FooAlias.h"
+#include "FooDeviceGuard.h"
+#include "FooHostAllocator.h"
+#include "FooLazy.h"
+#include "FooParallel.h"
+#include "FooStorageImpl.h"
+#include "FooStream.h"
+#include "FooTrace.h"
+
+namespace foo_core {
+
+namespace {
+
+// Copies below this size are not worth splitting across threads.
+constexpr int64_t kParallelCopyThreshold = 1 << 20;
+// Bytes copied by each task of a parallel copy.
+constexpr int64_t kCopyChunkSize = 1 << 18;
+
+void parallel_memcpy(void* dst, const void* src, int64_t nbytes)
+{
+    if (nbytes < kParallelCopyThreshold) {
+        std::memcpy(dst, src, nbytes);
+        return;
+    }
+    device_parallel_for(0, nbytes, kCopyChunkSize, [&](int64_t begin, int64_t end) {
+        std::memcpy(static_cast<char*>(dst) + begin, static_cast<const char*>(src) + begin, end - begin);
+    });
+}
+
+// A copy between tensors with the same dtype and the same dense layout is a
+// copy of the contiguous byte range both of them cover.
+bool is_flat_copy(const at::Tensor& dst, const at::Tensor& src)
+{
+    return dst.scalar_type() == src.scalar_type()
+        && dst.sizes().equals(src.sizes())
+        && dst.strides().equals(src.strides())
+        && dst.is_non_overlapping_and_dense()
+        && dst.is_conj() == src.is_conj()
+        && dst.is_neg() == src.is_neg();
+}
+
+void host_copy(const at::Tensor& dst, const at::Tensor& src)
+{
+    if (is_flat_copy(dst, src)) {
+        parallel_memcpy(dst.mutable_data_ptr(), src.const_data_ptr(), static_cast<int64_t>(dst.nbytes()));
+    } else {
+        dst.copy_(src);
+    }
+}
+
+// A copy out of a storage with a pending fill writes the constant into `dst`
+// instead of reading the source. Returns the constant when that gives the
+// same elements as copy_, i.e. for the same dtype and for conversions to
+// float or double that can't overflow.
+std::optional<c10::Scalar> pending_constant(const at::Tensor& dst, const at::Tensor& src)
+{
+    std::optional<PendingFill> fill = get_pending_fill(src);
+    if (!fill.has_value() || fill->dtype != src.scalar_type() || src.is_neg() || src.is_conj()) {
+        return std::nullopt;
+    }
+    const c10::ScalarType from = src.scalar_type();
+    const c10::ScalarType to = dst.scalar_type();
+    const bool exact = from == to
+        || (!at::isComplexType(from) && (to == at::kDouble || (to == at::kFloat && from != at::kDouble)));
+    if (!exact || dst.is_neg() || dst.is_conj()) {
+        return std::nullopt;
+    }
+    return fill->value;
+}
+
+void check_copy_device(const at::Tensor& tensor)
+{
+    TORCH_CHECK(tensor.is_cpu() || tensor.is_privateuseone(),
+        "foo copies only support CPU and foo tensors, got a tensor on ", tensor.device());
+}
+
+} // namespace
+
+void foo_copy(const at::Tensor& dst, const at::Tensor& src, bool non_blocking)
+{
+    check_copy_device(dst);
+    check_copy_device(src);
+    TORCH_INTERNAL_ASSERT(dst.is_privateuseone() || src.is_privateuseone());
+    flush_lazy();
+    if (dst.numel() == 0) {
+        return;
+    }
+
+    const std::optional<c10::Scalar> constant = pending_constant(dst, src);
+    if (constant.has_value() && dst.is_privateuseone()) {
+        foo_fill_(dst, *constant);
+        return;
+    }
+    if (!constant.has_value()) {
+        // The copy reads all of src and writes all of dst.
+        materialize_fills(src);
+        materialize_fill_for_write(dst);
+    }
+
+    const c10::Device device = dst.is_privateuseone() ? dst.device() : src.device();
+    const FooDeviceGuard guard(device);
+    const c10::Stream stream = get_current_stream(device.index());
+    // Peer copies run on the destination's stream, so on the cores of the
+    // NUMA node whose memory they write, once the work already enqueued on
+    // the source's stream is done. The host doesn't wait for them.
+    std::optional<c10::Stream> peer_stream;
+    if (!constant.has_value() && src.is_privateuseone() && src.device() != device) {
+        peer_stream = get_current_stream(src.device().index());
+        stream_wait_stream(stream, *peer_stream);
+    }
+
+    const at::Tensor dst_host = dst.is_privateuseone() ? cpu_alias(dst) : dst;
+    at::Tensor src_host = src;
+    if (constant.has_value()) {
+        launch(stream, [dst_host, value = *constant, device]() {
+            FOO_TRACE_SCOPE_SIZES("foo::fill", device, dst_host.sizes(), dst_host.scalar_type());
+            dst_host.fill_(value);
+        });
+    } else if (src.is_privateuseone()) {
+        // Share the alias storage when both sides view the same foo storage so
+        // the CPU kernel sees their overlap.
+        const bool same_storage = dst.is_privateuseone()
+            && src.storage().unsafeGetStorageImpl() == dst.storage().unsafeGetStorageImpl();
+        src_host = same_storage ? cpu_alias(src, dst_host.storage()) : cpu_alias(src);
+    }
+
+    if (!constant.has_value()) {
+        launch(stream, [dst_host, src_host, device]() {
+            FOO_TRACE_SCOPE_SIZES("foo::copy", device, dst_host.sizes(), dst_host.scalar_type());
+            host_copy(dst_host, src_host);
+        });
+    }
+    if (dst.is_privateuseone() && src.is_privateuseone()) {
+        if (peer_stream.has_value()) {
+            // Like CUDA peer copies: work enqueued later on the source's
+            // stream, which may overwrite src, waits for the copy.
+            stream_wait_stream(*peer_stream, stream);
+        }
+        return;
+    }
+    // Like CUDA, only copies from or to pinned memory run asynchronously: the
+    // caller is then responsible for not touching the host buffer before the
+    // copy is done, and the pinned allocator won't reuse it before that.
+    const void* host_data = (dst.is_cpu() ? dst : src).storage().data();
+    if (non_blocking && is_pinned_ptr(host_data)) {
+        record_host_use(host_data, stream);
+    } else {
+        synchronize_stream(stream);
+    }
+}
+
+} // namespace foo_core
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <ATen/core/Tensor.h>
+
+namespace foo_core {
+
+// =====================================
+// ============ Copy engine ============
+// =====================================
+
+// Copies `src` into `dst` where each side lives on the CPU or a foo device.
+// Foo memory is host memory, so the copy runs directly on CPU aliases of the
+// foo tensors: same-layout copies become a parallel chunked memcpy of just the
+// bytes the tensors cover, and anything else (strides, offsets, broadcasting,
+// dtype conversion) goes through the CPU copy kernel. Nothing is materialized
+// in between.
+//
+// The copy is enqueued on the current stream of the foo device involved (the
+// destination's for foo->foo copies). Copies from or to CPU memory wait for it
+// unless `non_blocking` is set and the CPU memory is pinned. Copies between two
+// foo devices never block the host: the destination's stream waits for the
+// source's one, and the source's stream then waits for the copy.
+void foo_copy(const at::Tensor& dst, const at::Tensor& src, bool non_blocking);
+
+} // namespace foo_core
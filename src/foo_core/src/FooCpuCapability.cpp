@@ -0,0 +1,93 @@
+#include "FooCpuCapability.h"
+
+#include <c10/util/Exception.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <string>
+
+#include "foo_core/device.h"
+
+namespace foo_core {
+
+namespace {
+
+// The best level this build has kernels for and the host can run.
+CpuCapability detect_cpu_capability()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    // __builtin_cpu_supports also checks that the OS saves the wider registers.
+#ifdef FOO_HAVE_AVX512
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl")
+        && __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("fma")) {
+        return CpuCapability::AVX512;
+    }
+#endif
+#ifdef FOO_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return CpuCapability::AVX2;
+    }
+#endif
+#endif
+    return CpuCapability::DEFAULT;
+}
+
+// Read from static initializers (the foreach kernels are registered through a
+// stub), so a bad value is ignored instead of thrown.
+CpuCapability compute_cpu_capability()
+{
+    const CpuCapability detected = detect_cpu_capability();
+    const char* env = std::getenv("TORCH_FOO_CPU_CAPABILITY");
+    if (env == nullptr) {
+        return detected;
+    }
+    std::string requested(env);
+    std::transform(requested.begin(), requested.end(), requested.begin(),
+        [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    for (int i = 0; i < static_cast<int>(CpuCapability::NUM_OPTIONS); ++i) {
+        const auto capability = static_cast<CpuCapability>(i);
+        if (requested != cpu_capability_name(capability)) {
+            continue;
+        }
+        if (capability > detected) {
+            TORCH_WARN("TORCH_FOO_CPU_CAPABILITY=", env, " is not supported by this host or build, using ",
+                cpu_capability_name(detected));
+            return detected;
+        }
+        return capability;
+    }
+    TORCH_WARN("Ignoring TORCH_FOO_CPU_CAPABILITY='", env, "', expected 'default', 'avx2' or 'avx512'");
+    return detected;
+}
+
+} // namespace
+
+CpuCapability get_cpu_capability()
+{
+    static const CpuCapability capability = compute_cpu_capability();
+    return capability;
+}
+
+const char* cpu_capability_name(CpuCapability capability)
+{
+    switch (capability) {
+        case CpuCapability::DEFAULT:
+            return "default";
+        case CpuCapability::AVX2:
+            return "avx2";
+        case CpuCapability::AVX512:
+            return "avx512";
+        case CpuCapability::NUM_OPTIONS:
+            break;
+    }
+    TORCH_INTERNAL_ASSERT(false, "unexpected cpu capability");
+    return "";
+}
+
+std::string cpu_capability()
+{
+    return cpu_capability_name(get_cpu_capability());
+}
+
+} // namespace foo_core
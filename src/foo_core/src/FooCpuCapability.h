@@ -0,0 +1,118 @@
+#pragma once
+
+#include <c10/macros/Macros.h>
+
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+namespace foo_core {
+
+// =====================================
+// ======= Runtime ISA dispatch ========
+// =====================================
+
+// The kernel sources under src/cpu are compiled once per instruction set
+// level, like ATen's native/cpu kernels: each copy sees CPU_CAPABILITY defined
+// to DEFAULT, AVX2 or AVX512 (and CPU_CAPABILITY_AVX2 / CPU_CAPABILITY_AVX512
+// for the vector ones), so at::vec::Vectorized and the copies' own symbols live
+// in distinct namespaces. Every copy registers its entry points in the
+// FooDispatchStubs below, which pick the best variant the host supports on
+// first use. TORCH_FOO_CPU_CAPABILITY=default|avx2|avx512 pins a lower level.
+//
+// Only x86-64 builds have the AVX2 and AVX512 variants; FOO_HAVE_AVX2 and
+// FOO_HAVE_AVX512 tell which ones were compiled.
+
+enum class CpuCapability : uint8_t {
+    DEFAULT,
+    AVX2,
+    AVX512,
+    NUM_OPTIONS,
+};
+
+// The level the kernels run at, detected once per process.
+CpuCapability get_cpu_capability();
+
+// "default", "avx2" or "avx512", the spelling TORCH_FOO_CPU_CAPABILITY takes.
+const char* cpu_capability_name(CpuCapability capability);
+
+template <typename FnPtr, typename T>
+struct FooDispatchStub {
+    static_assert(std::is_pointer_v<FnPtr>, "FooDispatchStub expects a function pointer type");
+    using FnPtrType = FnPtr;
+
+    FooDispatchStub() = default;
+    FooDispatchStub(const FooDispatchStub&) = delete;
+    FooDispatchStub& operator=(const FooDispatchStub&) = delete;
+
+    template <typename... ArgTypes>
+    decltype(auto) operator()(ArgTypes&&... args)
+    {
+        return get()(std::forward<ArgTypes>(args)...);
+    }
+
+    FnPtr get()
+    {
+        FnPtr fn = fn_.load(std::memory_order_relaxed);
+        if (C10_UNLIKELY(fn == nullptr)) {
+            fn = choose();
+            fn_.store(fn, std::memory_order_relaxed);
+        }
+        return fn;
+    }
+
+    // One variant per compiled level, defined by FOO_REGISTER_DISPATCH in the
+    // kernel sources. Being constant-initialized they are already set when
+    // static initializers, such as TORCH_LIBRARY_IMPL blocks, call the stub.
+    static FnPtr DEFAULT;
+#ifdef FOO_HAVE_AVX2
+    static FnPtr AVX2;
+#endif
+#ifdef FOO_HAVE_AVX512
+    static FnPtr AVX512;
+#endif
+
+private:
+    static FnPtr choose()
+    {
+        switch (get_cpu_capability()) {
+#ifdef FOO_HAVE_AVX512
+            case CpuCapability::AVX512:
+                return AVX512;
+#endif
+#ifdef FOO_HAVE_AVX2
+            case CpuCapability::AVX2:
+                return AVX2;
+#endif
+            default:
+                return DEFAULT;
+        }
+    }
+
+    std::atomic<FnPtr> fn_{nullptr};
+};
+
+// Declares a stub in a header, defines it in exactly one baseline source, and
+// registers the kernel of the current CPU_CAPABILITY in a src/cpu source:
+//
+//   using mymul_fn = void (*)(at::TensorIteratorBase&);
+//   FOO_DECLARE_DISPATCH(mymul_fn, mymul_stub);
+//   FOO_DEFINE_DISPATCH(mymul_stub);
+//   FOO_REGISTER_DISPATCH(mymul_stub, &mymul_kernel);
+#define FOO_DECLARE_DISPATCH(fn_type, name)                                              \
+    struct name##_foo_dispatch_type                                                      \
+        : ::foo_core::FooDispatchStub<fn_type, struct name##_foo_dispatch_type> {};      \
+    extern struct name##_foo_dispatch_type name
+
+#define FOO_DEFINE_DISPATCH(name) struct name##_foo_dispatch_type name
+
+// Must be used at foo_core namespace scope, outside of anonymous namespaces.
+#define FOO_REGISTER_ARCH_DISPATCH(name, arch, fn)                                       \
+    template <>                                                                          \
+    name##_foo_dispatch_type::FnPtrType                                                  \
+        FooDispatchStub<name##_foo_dispatch_type::FnPtrType, struct name##_foo_dispatch_type>::arch = fn
+
+#define FOO_REGISTER_DISPATCH(name, fn) FOO_REGISTER_ARCH_DISPATCH(name, CPU_CAPABILITY, fn)
+
+} // namespace foo_core
@@ -1,3 +1,5 @@
+#pragma once
+
 #include "FooDeviceGuardImpl.h"
 #include <c10/core/DeviceType.h>
 #include <c10/core/impl/InlineDeviceGuard.h>
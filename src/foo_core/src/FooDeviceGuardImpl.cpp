@@ -1,4 +1,6 @@
 #include "FooDeviceGuardImpl.h"
+#include "FooStream.h"
+#include "FooTopology.h"
 #include <c10/core/Device.h>
 #include <c10/core/Stream.h>
 #include <c10/core/impl/DeviceGuardImplInterface.h>
@@ -9,7 +11,8 @@
 
 namespace foo_core {
 
-static uint16_t CURR_DEVICE = -1;
+// The current device is per thread, like cudaSetDevice(), and starts at 0.
+thread_local c10::DeviceIndex CURR_DEVICE = 0;
 
 FooDeviceGuardImpl::FooDeviceGuardImpl(c10::DeviceType t)
 {
@@ -19,7 +22,7 @@ FooDeviceGuardImpl::FooDeviceGuardImpl(c10::DeviceType t)
 c10::Device FooDeviceGuardImpl::exchangeDevice(c10::Device d) const
 {
     TORCH_INTERNAL_ASSERT(d.type() == c10::DeviceType::PrivateUse1);
-    TORCH_INTERNAL_ASSERT(d.index() < deviceCount(), "Error: device index ", d.index(), " does not exist");
+    TORCH_CHECK(d.index() >= 0 && d.index() < deviceCount(), "Error: device index ", static_cast<int>(d.index()), " does not exist");
     c10::Device old_device = getDevice();
     if (old_device.index() != d.index()) {
         // set the active device
@@ -36,7 +39,7 @@ c10::Device FooDeviceGuardImpl::getDevice() const
 void FooDeviceGuardImpl::setDevice(c10::Device d) const
 {
     TORCH_INTERNAL_ASSERT(d.type() == c10::DeviceType::PrivateUse1);
-    TORCH_INTERNAL_ASSERT(d.index() < deviceCount(), "Error: device index ", d.index(), " does not exist.");
+    TORCH_CHECK(d.index() >= 0 && d.index() < deviceCount(), "Error: device index ", static_cast<int>(d.index()), " does not exist.");
     c10::Device current_device = getDevice();
     if (current_device != d) {
         CURR_DEVICE = d.index();
@@ -53,50 +56,89 @@ void FooDeviceGuardImpl::uncheckedSetDevice(c10::Device d) const noexcept
 
 c10::Stream FooDeviceGuardImpl::getStream(c10::Device d) const noexcept
 {
-    // no-op
-    return c10::Stream(c10::Stream::DEFAULT, d);
+    return get_current_stream(d.index());
 }
 
-c10::Stream FooDeviceGuardImpl::exchangeStream(c10::Stream) const noexcept
+c10::Stream FooDeviceGuardImpl::getDefaultStream(c10::Device d) const
 {
-    // no-op
-    return c10::Stream(c10::Stream::DEFAULT, c10::Device(c10::DeviceType::PrivateUse1, CURR_DEVICE));
+    return get_default_stream(d.index());
+}
+
+c10::Stream FooDeviceGuardImpl::getStreamFromGlobalPool(c10::Device d, bool /*isHighPriority*/) const
+{
+    return get_stream_from_pool(d.index());
+}
+
+c10::Stream FooDeviceGuardImpl::getNewStream(c10::Device d, int /*priority*/) const
+{
+    return get_stream_from_pool(d.index());
+}
+
+c10::Stream FooDeviceGuardImpl::exchangeStream(c10::Stream s) const noexcept
+{
+    c10::Stream old_stream = get_current_stream(s.device_index());
+    set_current_stream(s);
+    return old_stream;
 }
 
 c10::DeviceIndex FooDeviceGuardImpl::deviceCount() const noexcept
 {
-    // Hardcoding the number of "valid" devices here at 2.
-    return 2;
+    // One device per NUMA node, see FooTopology.h.
+    return topology_device_count();
 }
 
-// Event-related functions, determine if need to actually support
+// Event-related functions. Events are recorded by enqueueing a marker task on
+// the stream, see FooStream.cpp.
 void FooDeviceGuardImpl::record(
-    void** /*event*/,
-    const at::Stream& /*stream*/,
-    const at::DeviceIndex /*device_index*/,
+    void** event,
+    const at::Stream& stream,
+    const at::DeviceIndex device_index,
     const c10::EventFlag /*flag*/) const
 {
-    TORCH_CHECK(false, at::DeviceType::PrivateUse1, " backend doesn't support events.");
+    TORCH_CHECK(device_index == -1 || device_index == stream.device_index(),
+        "Event device index ", device_index, " does not match recording stream's device index ",
+        stream.device_index(), ".");
+    record_event(event, stream);
+}
+
+void FooDeviceGuardImpl::block(void* event, const at::Stream& stream) const
+{
+    block_event(event, stream);
+}
+
+bool FooDeviceGuardImpl::queryEvent(void* event) const
+{
+    return query_event(event);
 }
 
-void FooDeviceGuardImpl::block(void* /*event*/, const at::Stream& /*stream*/) const
+void FooDeviceGuardImpl::destroyEvent(void* event, const at::DeviceIndex /*device_index*/) const noexcept
 {
-    TORCH_CHECK(false, at::DeviceType::PrivateUse1, " backend doesn't support events.")
+    destroy_event(event);
 }
 
-bool FooDeviceGuardImpl::queryEvent(void* /*event*/) const
+void FooDeviceGuardImpl::synchronizeEvent(void* event) const
 {
-    TORCH_CHECK(false, at::DeviceType::PrivateUse1, " backend doesn't support events.")
+    synchronize_event(event);
 }
-void FooDeviceGuardImpl::destroyEvent(void* /*event*/, const at::DeviceIndex /*device_index*/) const noexcept  {}
 
-bool FooDeviceGuardImpl::queryStream(const at::Stream& /*stream*/) const
+double FooDeviceGuardImpl::elapsedTime(void* event1, void* event2, const at::DeviceIndex /*device_index*/) const
 {
-    return true;
+    return event_elapsed_time(event1, event2);
 }
-void FooDeviceGuardImpl::synchronizeStream(const at::Stream& /*stream*/) const
+
+bool FooDeviceGuardImpl::queryStream(const at::Stream& stream) const
+{
+    return query_stream(stream);
+}
+
+void FooDeviceGuardImpl::synchronizeStream(const at::Stream& stream) const
+{
+    synchronize_stream(stream);
+}
+
+void FooDeviceGuardImpl::synchronizeDevice(const at::DeviceIndex device_index) const
 {
-    // Don't wait for anything.
+    synchronize(device_index);
 }
 
 // Register our DeviceGuardImpl so kernels can use it
@@ -50,20 +50,25 @@ struct FooDeviceGuardImpl final : public c10::impl::DeviceGuardImplInterface {
     void uncheckedSetDevice(c10::Device d) const noexcept override;
 
     c10::Stream getStream(c10::Device d) const noexcept override;
+    c10::Stream getDefaultStream(c10::Device d) const override;
+    c10::Stream getStreamFromGlobalPool(c10::Device d, bool isHighPriority = false) const override;
+    c10::Stream getNewStream(c10::Device d, int priority = 0) const override;
 
     // NB: These do NOT set the current device
     c10::Stream exchangeStream(c10::Stream s) const noexcept override;
     c10::DeviceIndex deviceCount() const noexcept override;
-    bool queryStream(const c10::Stream& strema) const override;
+    bool queryStream(const c10::Stream& stream) const override;
     void synchronizeStream(const c10::Stream& stream) const override;
+    void synchronizeDevice(const c10::DeviceIndex device_index) const override;
 
     // Event-related functions
     void record(void** event, const c10::Stream &stream, const c10::DeviceIndex device_index,
                 const c10::EventFlag flag) const override;
     void block(void* event, const c10::Stream &stream) const override;
     void destroyEvent(void* event, const c10::DeviceIndex device_index) const noexcept override;
-    // Stream-related functions
     bool queryEvent(void *event) const override;
+    void synchronizeEvent(void* event) const override;
+    double elapsedTime(void* event1, void* event2, const c10::DeviceIndex device_index) const override;
 };
 
 } // foo_core
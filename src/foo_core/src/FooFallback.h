@@ -0,0 +1,13 @@
+#pragma once
+
+#include <ATen/core/dispatch/Dispatcher.h>
+#include <ATen/core/stack.h>
+
+namespace foo_core {
+
+// The boxed kernel registered as the PrivateUse1 fallback, which runs ops
+// without a foo kernel on the CPU (see foo_core/fallback.h). Native kernels
+// call it for the inputs they don't handle.
+void cpu_fallback(const c10::OperatorHandle& op, torch::jit::Stack* stack);
+
+} // namespace foo_core
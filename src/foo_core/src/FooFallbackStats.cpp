@@ -0,0 +1,111 @@
+#include "FooFallbackStats.h"
+#include "foo_core/fallback.h"
+
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+namespace foo_core {
+
+namespace {
+
+// The counters are keyed by the address of the operator's schema, which is
+// owned by the dispatcher and stable for as long as the operator is
+// registered. Lookups only take a shared lock, and new operators are rare.
+class FallbackRegistry {
+public:
+    FallbackCounters& get(const c10::FunctionSchema& schema)
+    {
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex_);
+            auto it = counters_.find(&schema);
+            if (it != counters_.end()) {
+                return *it->second;
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto result = counters_.emplace(&schema, nullptr);
+        if (result.second) {
+            result.first->second = std::make_unique<FallbackCounters>(c10::toString(schema.operator_name()));
+        }
+        return *result.first->second;
+    }
+
+    std::vector<FallbackOpStats> snapshot()
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        std::vector<FallbackOpStats> stats;
+        for (const auto& entry : counters_) {
+            const FallbackCounters& counters = *entry.second;
+            const uint64_t calls = counters.calls.load(std::memory_order_relaxed);
+            if (calls == 0) {
+                continue;
+            }
+            stats.push_back(FallbackOpStats{
+                counters.name,
+                calls,
+                counters.total_ns.load(std::memory_order_relaxed),
+                counters.max_ns.load(std::memory_order_relaxed),
+                counters.bytes_to_cpu.load(std::memory_order_relaxed),
+                counters.bytes_to_foo.load(std::memory_order_relaxed),
+            });
+        }
+        return stats;
+    }
+
+    // Entries are kept, fallback_counters() handed out references to them;
+    // their counts restart from zero and accumulate until the next reset.
+    void reset()
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        for (const auto& entry : counters_) {
+            FallbackCounters& counters = *entry.second;
+            counters.calls.store(0, std::memory_order_relaxed);
+            counters.total_ns.store(0, std::memory_order_relaxed);
+            counters.max_ns.store(0, std::memory_order_relaxed);
+            counters.bytes_to_cpu.store(0, std::memory_order_relaxed);
+            counters.bytes_to_foo.store(0, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    std::shared_mutex mutex_;
+    std::unordered_map<const c10::FunctionSchema*, std::unique_ptr<FallbackCounters>> counters_;
+};
+
+FallbackRegistry& registry()
+{
+    static FallbackRegistry* registry = new FallbackRegistry();
+    return *registry;
+}
+
+} // namespace
+
+void FallbackCounters::record(uint64_t elapsed_ns, uint64_t to_cpu, uint64_t to_foo)
+{
+    calls.fetch_add(1, std::memory_order_relaxed);
+    total_ns.fetch_add(elapsed_ns, std::memory_order_relaxed);
+    bytes_to_cpu.fetch_add(to_cpu, std::memory_order_relaxed);
+    bytes_to_foo.fetch_add(to_foo, std::memory_order_relaxed);
+    uint64_t current_max = max_ns.load(std::memory_order_relaxed);
+    while (elapsed_ns > current_max && !max_ns.compare_exchange_weak(current_max, elapsed_ns, std::memory_order_relaxed)) {
+    }
+}
+
+FallbackCounters& fallback_counters(const c10::FunctionSchema& schema)
+{
+    return registry().get(schema);
+}
+
+std::vector<FallbackOpStats> get_fallback_stats()
+{
+    return registry().snapshot();
+}
+
+void reset_fallback_stats()
+{
+    registry().reset();
+}
+
+} // namespace foo_core
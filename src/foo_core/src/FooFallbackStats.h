@@ -0,0 +1,34 @@
+#pragma once
+
+#include <ATen/core/function_schema.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace foo_core {
+
+// =====================================
+// ======= Fallback statistics =========
+// =====================================
+
+// Counters of a single operator going through the CPU fallback. They are
+// updated with relaxed atomics so recording never takes a lock.
+struct FallbackCounters {
+    explicit FallbackCounters(std::string name) : name(std::move(name)) {}
+
+    const std::string name;
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> total_ns{0};
+    std::atomic<uint64_t> max_ns{0};
+    std::atomic<uint64_t> bytes_to_cpu{0};
+    std::atomic<uint64_t> bytes_to_foo{0};
+
+    void record(uint64_t elapsed_ns, uint64_t to_cpu, uint64_t to_foo);
+};
+
+// Returns the counters of the operator with `schema`, creating them on first
+// use. The returned reference stays valid for the lifetime of the process.
+FallbackCounters& fallback_counters(const c10::FunctionSchema& schema);
+
+} // namespace foo_core
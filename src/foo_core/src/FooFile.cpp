@@ -0,0 +1,125 @@
+#include "foo_core/file.h"
+
+#include <ATen/EmptyTensor.h>
+#include <c10/core/Allocator.h>
+#include <c10/core/DispatchKeySet.h>
+#include <c10/core/TensorImpl.h>
+#include <c10/util/Exception.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "FooDeviceGuard.h"
+#include "FooStorageImpl.h"
+#include "FooTrace.h"
+#include "foo_core/device.h"
+
+namespace foo_core {
+
+namespace {
+
+class FileDescriptor {
+public:
+    explicit FileDescriptor(const std::string& path) : fd_(::open(path.c_str(), O_RDONLY | O_CLOEXEC))
+    {
+        TORCH_CHECK(fd_ >= 0, "from_file: can't open '", path, "': ", std::strerror(errno));
+    }
+    ~FileDescriptor()
+    {
+        ::close(fd_);
+    }
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+    int get() const
+    {
+        return fd_;
+    }
+
+private:
+    int fd_;
+};
+
+// The DataPtr context of a mapped storage: the whole mapping, which starts at
+// the page holding the first byte of the tensor.
+struct Mapping {
+    void* base;
+    size_t length;
+};
+
+void delete_mapping(void* ctx)
+{
+    auto* mapping = static_cast<Mapping*>(ctx);
+    ::munmap(mapping->base, mapping->length);
+    delete mapping;
+}
+
+c10::Storage map_storage(const FileDescriptor& file, int64_t offset, size_t nbytes, c10::Device device)
+{
+    c10::Allocator* allocator = c10::GetAllocator(c10::DeviceType::PrivateUse1);
+    if (nbytes == 0) {
+        return c10::Storage(c10::make_intrusive<FooStorageImpl>(
+            c10::StorageImpl::use_byte_size_t(), 0, allocator->allocate(0), allocator, /*resizable=*/false));
+    }
+    static const int64_t page_size = ::sysconf(_SC_PAGESIZE);
+    const int64_t start = offset / page_size * page_size;
+    const size_t length = nbytes + (offset - start);
+    // MAP_PRIVATE makes the pages copy-on-write.
+    void* base = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, file.get(), start);
+    TORCH_CHECK(base != MAP_FAILED, "from_file: mmap failed: ", std::strerror(errno));
+    void* data = static_cast<char*>(base) + (offset - start);
+    c10::DataPtr data_ptr(data, new Mapping{base, length}, &delete_mapping, device);
+    return c10::Storage(c10::make_intrusive<FooStorageImpl>(
+        c10::StorageImpl::use_byte_size_t(), nbytes, std::move(data_ptr), allocator, /*resizable=*/false));
+}
+
+c10::Storage read_storage(const FileDescriptor& file, int64_t offset, size_t nbytes)
+{
+    c10::Storage storage = make_foo_storage(nbytes);
+    auto* data = static_cast<char*>(storage.mutable_data());
+    size_t done = 0;
+    while (done < nbytes) {
+        const ssize_t n = ::pread(file.get(), data + done, nbytes - done, offset + static_cast<off_t>(done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        TORCH_CHECK(n > 0, "from_file: read failed: ", n == 0 ? "unexpected end of file" : std::strerror(errno));
+        done += static_cast<size_t>(n);
+    }
+    return storage;
+}
+
+} // namespace
+
+at::Tensor from_file(const std::string& path, int64_t offset, c10::IntArrayRef sizes, c10::ScalarType dtype,
+    c10::DeviceIndex device)
+{
+    const c10::Device foo_device(c10::DeviceType::PrivateUse1, device < 0 ? current_device() : device);
+    const FooDeviceGuard guard(foo_device);
+    FOO_TRACE_SCOPE_SIZES("foo::from_file", foo_device, sizes, dtype);
+    TORCH_CHECK(offset >= 0, "from_file: offset must be non-negative, got ", offset);
+    at::detail::check_size_nonnegative(sizes);
+    const caffe2::TypeMeta type_meta = c10::scalarTypeToTypeMeta(dtype);
+    const size_t nbytes = at::detail::computeStorageNbytesContiguous(sizes, type_meta.itemsize());
+
+    const FileDescriptor file(path);
+    struct stat info;
+    TORCH_CHECK(::fstat(file.get(), &info) == 0, "from_file: can't stat '", path, "': ", std::strerror(errno));
+    TORCH_CHECK(static_cast<uint64_t>(offset) + nbytes <= static_cast<uint64_t>(info.st_size), "from_file: '", path,
+        "' has ", info.st_size, " bytes, but the tensor needs ", nbytes, " bytes from offset ", offset);
+
+    c10::Storage storage = offset % static_cast<int64_t>(type_meta.itemsize()) == 0
+        ? map_storage(file, offset, nbytes, foo_device)
+        : read_storage(file, offset, nbytes);
+    constexpr c10::DispatchKeySet private_use_ks(c10::DispatchKey::PrivateUse1);
+    at::Tensor tensor = at::detail::make_tensor<c10::TensorImpl>(std::move(storage), private_use_ks, type_meta);
+    tensor.unsafeGetTensorImpl()->set_sizes_contiguous(sizes);
+    return tensor;
+}
+
+} // namespace foo_core
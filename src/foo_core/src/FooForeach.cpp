@@ -0,0 +1,17 @@
+#include <torch/library.h>
+
+#include "FooKernels.h"
+
+namespace foo_core {
+
+FOO_DEFINE_DISPATCH(register_foreach_kernels_stub);
+
+// The _foreach_* ops and fused Adam(W) live in cpu/ForeachKernels.cpp, which is
+// compiled once per CPU capability. Each copy registers its own instantiation
+// of every op, and the stub picks the one matching the host here, once.
+TORCH_LIBRARY_IMPL(aten, PrivateUse1, m)
+{
+    register_foreach_kernels_stub(m);
+}
+
+} // namespace foo_core
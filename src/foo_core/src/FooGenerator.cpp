@@ -0,0 +1,131 @@
+#include "FooGenerator.h"
+
+#include <ATen/core/GeneratorForPrivateuseone.h>
+#include <ATen/ops/empty.h>
+#include <c10/core/DispatchKeySet.h>
+#include <c10/util/Exception.h>
+
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "foo_core/device.h"
+#include "foo_core/random.h"
+
+namespace foo_core {
+
+namespace {
+
+constexpr size_t kStateSize = 2 * sizeof(uint64_t);
+
+c10::DeviceIndex resolve_device(c10::DeviceIndex device)
+{
+    const c10::DeviceIndex index = device == -1 ? current_device() : device;
+    TORCH_CHECK(index >= 0 && index < device_count(), "Invalid foo device index ", static_cast<int>(device));
+    return index;
+}
+
+// Backs torch.Generator(device="foo").
+at::Generator make_foo_generator(c10::DeviceIndex device)
+{
+    return at::make_generator<FooGeneratorImpl>(resolve_device(device));
+}
+
+REGISTER_GENERATOR_PRIVATEUSE1(make_foo_generator)
+
+} // namespace
+
+FooGeneratorImpl::FooGeneratorImpl(c10::DeviceIndex device_index, uint64_t seed)
+    : c10::GeneratorImpl(
+          c10::Device(c10::DeviceType::PrivateUse1, device_index), c10::DispatchKeySet(c10::DispatchKey::PrivateUse1)),
+      seed_(seed)
+{
+}
+
+void FooGeneratorImpl::set_current_seed(uint64_t seed)
+{
+    seed_ = seed;
+    offset_ = 0;
+}
+
+uint64_t FooGeneratorImpl::current_seed() const
+{
+    return seed_;
+}
+
+uint64_t FooGeneratorImpl::seed()
+{
+    const uint64_t random = c10::detail::getNonDeterministicRandom(true);
+    set_current_seed(random);
+    return random;
+}
+
+void FooGeneratorImpl::set_offset(uint64_t offset)
+{
+    offset_ = offset;
+}
+
+uint64_t FooGeneratorImpl::get_offset() const
+{
+    return offset_;
+}
+
+void FooGeneratorImpl::set_state(const c10::TensorImpl& new_state)
+{
+    at::detail::check_rng_state(new_state);
+    TORCH_CHECK(new_state.numel() == static_cast<int64_t>(kStateSize), "RNG state of a foo generator must be ",
+        kStateSize, " bytes, got ", new_state.numel());
+    const auto* data = static_cast<const uint8_t*>(new_state.data());
+    std::memcpy(&seed_, data, sizeof(uint64_t));
+    std::memcpy(&offset_, data + sizeof(uint64_t), sizeof(uint64_t));
+}
+
+c10::intrusive_ptr<c10::TensorImpl> FooGeneratorImpl::get_state() const
+{
+    at::Tensor state = at::empty({static_cast<int64_t>(kStateSize)}, at::TensorOptions().dtype(at::kByte));
+    auto* data = state.mutable_data_ptr<uint8_t>();
+    std::memcpy(data, &seed_, sizeof(uint64_t));
+    std::memcpy(data + sizeof(uint64_t), &offset_, sizeof(uint64_t));
+    return state.getIntrusivePtr();
+}
+
+PhiloxState FooGeneratorImpl::reserve(uint64_t blocks)
+{
+    const PhiloxState state{seed_, offset_};
+    offset_ += blocks;
+    return state;
+}
+
+c10::DeviceType FooGeneratorImpl::device_type()
+{
+    return c10::DeviceType::PrivateUse1;
+}
+
+FooGeneratorImpl* FooGeneratorImpl::clone_impl() const
+{
+    auto* gen = new FooGeneratorImpl(device().index(), seed_);
+    gen->offset_ = offset_;
+    return gen;
+}
+
+const at::Generator& default_generator(c10::DeviceIndex device)
+{
+    // Seeded like the CUDA default generators until torch.manual_seed.
+    static const std::vector<at::Generator> generators = []() {
+        std::vector<at::Generator> result;
+        for (c10::DeviceIndex i = 0; i < device_count(); ++i) {
+            result.push_back(at::make_generator<FooGeneratorImpl>(i));
+        }
+        return result;
+    }();
+    return generators[resolve_device(device)];
+}
+
+PhiloxState reserve_philox(const std::optional<at::Generator>& generator, c10::DeviceIndex device, uint64_t blocks)
+{
+    auto* gen = at::get_generator_or_default<FooGeneratorImpl>(generator, default_generator(device));
+    std::lock_guard<std::mutex> lock(gen->mutex_);
+    return gen->reserve(blocks);
+}
+
+} // namespace foo_core
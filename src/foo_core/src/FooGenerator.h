@@ -0,0 +1,64 @@
+#pragma once
+
+#include <ATen/core/Generator.h>
+#include <c10/core/Device.h>
+#include <c10/core/GeneratorImpl.h>
+#include <c10/core/TensorImpl.h>
+
+#include <cstdint>
+#include <optional>
+
+namespace foo_core {
+
+// =====================================
+// ========= Random numbers ============
+// =====================================
+
+// Foo devices generate random numbers with Philox4x32-10, a counter-based
+// generator: the n-th 128-bit block of the stream is a pure function of the
+// seed and n. A generator is therefore just a seed and the offset of the next
+// unused block. Each random op reserves the blocks it needs when it is
+// enqueued, and every element draws from a fixed position in that range, so
+// the kernels can split the work across any number of threads and still
+// produce the same values.
+
+// Where a random op draws from: the blocks from `offset` on of the stream of
+// `seed`.
+struct PhiloxState {
+    uint64_t seed;
+    uint64_t offset;
+};
+
+class FooGeneratorImpl final : public c10::GeneratorImpl {
+public:
+    explicit FooGeneratorImpl(c10::DeviceIndex device_index = -1, uint64_t seed = c10::default_rng_seed_val);
+    ~FooGeneratorImpl() override = default;
+
+    void set_current_seed(uint64_t seed) override;
+    uint64_t current_seed() const override;
+    // Picks a non-deterministic seed.
+    uint64_t seed() override;
+    // The offset is counted in 128-bit blocks.
+    void set_offset(uint64_t offset) override;
+    uint64_t get_offset() const override;
+    // 16 bytes: the seed and the offset.
+    void set_state(const c10::TensorImpl& new_state) override;
+    c10::intrusive_ptr<c10::TensorImpl> get_state() const override;
+
+    // Reserves the next `blocks` blocks. Callers hold mutex_.
+    PhiloxState reserve(uint64_t blocks);
+
+    static c10::DeviceType device_type();
+
+private:
+    FooGeneratorImpl* clone_impl() const override;
+
+    uint64_t seed_;
+    uint64_t offset_ = 0;
+};
+
+// Reserves `blocks` blocks from `generator`, or from the default generator of
+// `device` if it is not given.
+PhiloxState reserve_philox(const std::optional<at::Generator>& generator, c10::DeviceIndex device, uint64_t blocks);
+
+} // namespace foo_core
@@ -0,0 +1,34 @@
+#include "FooHooksInterface.h"
+#include "FooHostAllocator.h"
+#include "foo_core/random.h"
+
+namespace foo_core {
+
+// Foo devices need no per-device initialization.
+bool FooHooksInterface::hasPrimaryContext(c10::DeviceIndex /*device_index*/) const
+{
+    return true;
+}
+
+const at::Generator& FooHooksInterface::getDefaultGenerator(c10::DeviceIndex device_index) const
+{
+    return default_generator(device_index);
+}
+
+bool FooHooksInterface::isPinnedPtr(const void* data) const
+{
+    return is_pinned_ptr(data);
+}
+
+c10::Allocator* FooHooksInterface::getPinnedMemoryAllocator() const
+{
+    return get_host_allocator();
+}
+
+// Intentionally leaked, ATen keeps a raw pointer to the hooks.
+static const bool foo_hooks_registered = []() {
+    at::RegisterPrivateUse1HooksInterface(new FooHooksInterface());
+    return true;
+}();
+
+} // namespace foo_core
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <ATen/detail/PrivateUse1HooksInterface.h>
+
+namespace foo_core {
+
+// =====================================
+// ========= Backend hooks =============
+// =====================================
+
+// The hooks ATen queries for backend services that aren't operators, such as
+// the pinned memory allocator behind Tensor.pin_memory("foo") or the default
+// generators.
+struct FooHooksInterface : public at::PrivateUse1HooksInterface {
+    bool hasPrimaryContext(c10::DeviceIndex device_index) const override;
+    const at::Generator& getDefaultGenerator(c10::DeviceIndex device_index) const override;
+    bool isPinnedPtr(const void* data) const override;
+    c10::Allocator* getPinnedMemoryAllocator() const override;
+};
+
+} // namespace foo_core
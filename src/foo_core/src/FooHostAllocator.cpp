@@ -0,0 +1,260 @@
+#include "FooHostAllocator.h"
+
+#include <c10/util/Exception.h>
+#include <c10/util/llvmMathExtras.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <set>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "foo_core/allocator.h"
+#include "FooStream.h"
+
+namespace foo_core {
+
+// Pinned memory lets copies between the host and a device run asynchronously:
+// the page-locked memory can't move while the device reads or writes it, and
+// the caller keeps it alive until the copy is known to be done. Our devices
+// are host memory too, so page-locking is less critical than for a PCIe
+// device, but it still keeps input pipelines from stalling on page faults and
+// is what marks a host buffer as safe for non_blocking copies.
+//
+// Like at::cuda::CachingHostAllocator:
+//
+// - Requests are rounded up to a power of two (and at least a page), and
+//   blocks are cached by size. Memory comes from mmap() and is mlock()ed.
+// - A block remembers the streams of the asynchronous copies that used it.
+//   When freed, it records an event on each of them and stays pending until
+//   they all completed; only then is it available again. Blocks that stay
+//   allocated for long, like staging buffers, don't accumulate events.
+// - Cached blocks are only returned to the system by host_empty_cache().
+namespace {
+
+struct HostBlock {
+    HostBlock(size_t size, void* ptr) : size(size), ptr(ptr) {}
+
+    size_t size;
+    void* ptr;
+    bool allocated = false;
+    std::unordered_set<c10::Stream> streams; // used the block since it was allocated
+    std::vector<void*> events;               // recorded on those streams when freed
+};
+
+class CachingHostAllocator {
+public:
+    void* malloc(size_t nbytes)
+    {
+        const size_t size = round_size(nbytes);
+        std::lock_guard<std::mutex> lock(mutex_);
+        process_pending();
+        auto it = free_blocks_.lower_bound(std::make_pair(size, static_cast<HostBlock*>(nullptr)));
+        if (it != free_blocks_.end() && it->first == size) {
+            HostBlock* block = it->second;
+            free_blocks_.erase(it);
+            block->allocated = true;
+            return block->ptr;
+        }
+        void* ptr = map_pinned(size);
+        if (ptr == nullptr) {
+            release_cached_blocks();
+            ptr = map_pinned(size);
+        }
+        TORCH_CHECK(ptr != nullptr, "foo pinned host allocator: failed to allocate ", size, " bytes");
+        HostBlock* block = new HostBlock(size, ptr);
+        block->allocated = true;
+        blocks_.emplace(ptr, block);
+        return ptr;
+    }
+
+    void free(void* ptr)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = blocks_.find(ptr);
+        TORCH_INTERNAL_ASSERT(it != blocks_.end(), "foo pinned host allocator: freeing an unknown pointer");
+        HostBlock* block = it->second;
+        block->allocated = false;
+        for (const c10::Stream& stream : block->streams) {
+            void* event = nullptr;
+            record_event(&event, stream);
+            block->events.push_back(event);
+        }
+        block->streams.clear();
+        if (block->events.empty()) {
+            free_blocks_.emplace(block->size, block);
+        } else {
+            pending_blocks_.push_back(block);
+        }
+    }
+
+    bool is_pinned(const void* ptr)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return find_block(ptr) != nullptr;
+    }
+
+    void record_use(const void* ptr, const c10::Stream& stream)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        HostBlock* block = find_block(ptr);
+        if (block == nullptr) {
+            return;
+        }
+        block->streams.insert(stream);
+    }
+
+    void empty_cache()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        process_pending();
+        release_cached_blocks();
+    }
+
+private:
+    static size_t round_size(size_t nbytes)
+    {
+        static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        return std::max(page_size, static_cast<size_t>(c10::llvm::PowerOf2Ceil(nbytes)));
+    }
+
+    static void* map_pinned(size_t size)
+    {
+        void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) {
+            return nullptr;
+        }
+        if (mlock(ptr, size) != 0) {
+            // Usually RLIMIT_MEMLOCK. The block still works, it just may be paged out.
+            TORCH_WARN_ONCE("foo pinned host allocator: mlock failed (", std::strerror(errno),
+                "), pinned memory will not be page-locked. Consider raising `ulimit -l`.");
+        }
+        return ptr;
+    }
+
+    // The block whose memory contains `ptr`, which may point into the middle
+    // of a block (e.g. for a view of a pinned tensor).
+    HostBlock* find_block(const void* ptr)
+    {
+        auto it = blocks_.upper_bound(const_cast<void*>(ptr));
+        if (it == blocks_.begin()) {
+            return nullptr;
+        }
+        HostBlock* block = std::prev(it)->second;
+        const char* begin = static_cast<const char*>(block->ptr);
+        return static_cast<const char*>(ptr) < begin + block->size ? block : nullptr;
+    }
+
+    // Moves the freed blocks whose events have all completed to the cache.
+    void process_pending()
+    {
+        for (auto it = pending_blocks_.begin(); it != pending_blocks_.end();) {
+            HostBlock* block = *it;
+            auto& events = block->events;
+            events.erase(std::remove_if(events.begin(), events.end(), [](void* event) {
+                if (!query_event(event)) {
+                    return false;
+                }
+                destroy_event(event);
+                return true;
+            }), events.end());
+            if (events.empty()) {
+                free_blocks_.emplace(block->size, block);
+                it = pending_blocks_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void release_cached_blocks()
+    {
+        for (const auto& entry : free_blocks_) {
+            HostBlock* block = entry.second;
+            munlock(block->ptr, block->size);
+            munmap(block->ptr, block->size);
+            blocks_.erase(block->ptr);
+            delete block;
+        }
+        free_blocks_.clear();
+    }
+
+    std::mutex mutex_;
+    std::map<void*, HostBlock*> blocks_;                      // every block, by address
+    std::set<std::pair<size_t, HostBlock*>> free_blocks_;     // cached blocks, by size
+    std::deque<HostBlock*> pending_blocks_;                   // freed, waiting for events
+};
+
+// Intentionally leaked: pinned tensors may still be freed during static destruction.
+CachingHostAllocator& host_allocator()
+{
+    static CachingHostAllocator* allocator = new CachingHostAllocator();
+    return *allocator;
+}
+
+// Pinned memory is CPU memory, so the DataPtrs are on the CPU device.
+struct FooHostAllocator final : c10::Allocator {
+    c10::DataPtr allocate(size_t nbytes) override
+    {
+        const c10::Device device(c10::DeviceType::CPU);
+        if (nbytes == 0) {
+            return {nullptr, nullptr, &local_raw_delete, device};
+        }
+        void* data = host_allocator().malloc(nbytes);
+        return {data, data, &local_raw_delete, device};
+    }
+
+    static void local_raw_delete(void* ptr)
+    {
+        if (!ptr) {
+            return;
+        }
+        host_allocator().free(ptr);
+    }
+
+    c10::DeleterFnPtr raw_deleter() const override
+    {
+        return &local_raw_delete;
+    }
+
+    void copy_data(void* dest, const void* src, std::size_t count) const final
+    {
+        default_copy_data(dest, src, count);
+    }
+};
+
+} // namespace
+
+c10::Allocator* get_host_allocator()
+{
+    static FooHostAllocator allocator;
+    return &allocator;
+}
+
+bool is_pinned_ptr(const void* ptr)
+{
+    return ptr != nullptr && host_allocator().is_pinned(ptr);
+}
+
+void record_host_use(const void* ptr, const c10::Stream& stream)
+{
+    if (ptr != nullptr) {
+        host_allocator().record_use(ptr, stream);
+    }
+}
+
+void host_empty_cache()
+{
+    host_allocator().empty_cache();
+}
+
+} // namespace foo_core
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <c10/core/Allocator.h>
+#include <c10/core/Stream.h>
+
+namespace foo_core {
+
+// =====================================
+// ======== Pinned host memory =========
+// =====================================
+
+// Returns the allocator behind pin_memory() / pin_memory=True for foo.
+c10::Allocator* get_host_allocator();
+
+// Returns whether `ptr` points into a block of the pinned host allocator.
+bool is_pinned_ptr(const void* ptr);
+
+// Marks the pinned block containing `ptr` as used by the work enqueued on
+// `stream` so far. Once freed, the block is only reused after that work has
+// completed. Does nothing for other pointers.
+void record_host_use(const void* ptr, const c10::Stream& stream);
+
+} // namespace foo_core
@@ -0,0 +1,38 @@
+#include "foo_core/interop.h"
+
+#include <c10/util/Exception.h>
+
+#include "FooAlias.h"
+#include "FooDeviceGuard.h"
+#include "FooLazy.h"
+#include "FooStorageImpl.h"
+#include "FooStream.h"
+#include "foo_core/device.h"
+
+namespace foo_core {
+
+at::Tensor host_view(const at::Tensor& self)
+{
+    TORCH_CHECK(self.is_privateuseone(), "host_view: expected a foo tensor, got one on ", self.device());
+    // Like to_dlpack: the bits would be read without their conjugation or
+    // negation.
+    TORCH_CHECK(!self.is_conj() && !self.is_neg(),
+        "host_view: tensors with the conjugate or negative bit set can't be viewed; call resolve_conj() and "
+        "resolve_neg() first");
+    const FooDeviceGuard guard(self.device());
+    flush_lazy();
+    materialize_fill(self);
+    synchronize_stream(get_current_stream(self.device().index()));
+    return cpu_alias(self);
+}
+
+at::Tensor wrap_host(const at::Tensor& cpu, c10::DeviceIndex device)
+{
+    TORCH_CHECK(cpu.is_cpu(), "wrap_host: expected a CPU tensor, got one on ", cpu.device());
+    TORCH_CHECK(!cpu.is_conj() && !cpu.is_neg(),
+        "wrap_host: tensors with the conjugate or negative bit set can't be wrapped; call resolve_conj() and "
+        "resolve_neg() first");
+    return foo_wrap(cpu, c10::Device(c10::DeviceType::PrivateUse1, device < 0 ? current_device() : device));
+}
+
+} // namespace foo_core
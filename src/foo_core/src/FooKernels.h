@@ -0,0 +1,120 @@
+#pragma once
+
+#include <ATen/TensorIterator.h>
+#include <torch/library.h>
+
+#include "FooCpuCapability.h"
+#include "FooGenerator.h"
+#include "FooLazy.h"
+
+namespace foo_core {
+
+// The kernels compiled once per CPU capability, see FooCpuCapability.h. Their
+// sources are under src/cpu; the stubs are defined next to the ops that call
+// them.
+
+// ===== Pointwise ops (operations.cpp) =====
+using mymuladd_fn = void (*)(at::TensorIteratorBase& iter, double c);
+using pointwise_fn = void (*)(at::TensorIteratorBase& iter);
+
+FOO_DECLARE_DISPATCH(mymuladd_fn, mymuladd_stub);
+FOO_DECLARE_DISPATCH(pointwise_fn, mymul_stub);
+FOO_DECLARE_DISPATCH(pointwise_fn, myadd_stub);
+// Two outputs, grad * b and grad * a, from the inputs grad, a and b.
+FOO_DECLARE_DISPATCH(pointwise_fn, mymul_backward_stub);
+
+// ===== Fused lazy programs (FooLazy.cpp) =====
+using lazy_kernel_fn = LazyKernelFn (*)(LazyOp op);
+
+// Returns the chunk kernel of a lazy op, which must not be LazyOp::Input.
+FOO_DECLARE_DISPATCH(lazy_kernel_fn, lazy_kernel_stub);
+
+// ===== Foreach ops (FooForeach.cpp) =====
+// The _foreach_* and _fused_adam(w)_ kernels are templates over the op, so
+// rather than a stub per kernel the variant of the whole set is picked once,
+// when it is registered for PrivateUse1.
+using register_kernels_fn = void (*)(torch::Library& m);
+
+FOO_DECLARE_DISPATCH(register_kernels_fn, register_foreach_kernels_stub);
+
+// ===== Random ops (FooRandom.cpp) =====
+// Fill the contiguous host tensor `out` from the Philox stream at `philox`.
+// Element i uses the 32-bit values from random_draws() * i on, whatever thread
+// computes it.
+using uniform_fn = void (*)(const at::Tensor& out, PhiloxState philox, double from, double to);
+using normal_fn = void (*)(const at::Tensor& out, PhiloxState philox, double mean, double std);
+using bernoulli_scalar_fn = void (*)(const at::Tensor& out, PhiloxState philox, double p);
+// `p` is a contiguous double tensor with the shape of out.
+using bernoulli_tensor_fn = void (*)(const at::Tensor& out, PhiloxState philox, const at::Tensor& p);
+using randperm_fn = void (*)(const at::Tensor& out, PhiloxState philox);
+
+enum class RandomOp { Uniform, Normal, Bernoulli, Randperm };
+
+// The 32-bit values an element of `dtype` takes: one per uniform number for
+// reduced precision and float outputs and two (53 bits) for double ones, two
+// uniform numbers per normal one, and always two for bernoulli_ and randperm.
+inline int64_t random_draws(RandomOp op, c10::ScalarType dtype)
+{
+    const int64_t uniform = dtype == at::kDouble ? 2 : 1;
+    switch (op) {
+        case RandomOp::Uniform:
+            return uniform;
+        case RandomOp::Normal:
+            return 2 * uniform;
+        case RandomOp::Bernoulli:
+        case RandomOp::Randperm:
+            return 2;
+    }
+    return 2;
+}
+
+FOO_DECLARE_DISPATCH(uniform_fn, uniform_stub);
+FOO_DECLARE_DISPATCH(normal_fn, normal_stub);
+FOO_DECLARE_DISPATCH(bernoulli_scalar_fn, bernoulli_scalar_stub);
+FOO_DECLARE_DISPATCH(bernoulli_tensor_fn, bernoulli_tensor_stub);
+FOO_DECLARE_DISPATCH(randperm_fn, randperm_stub);
+
+// ===== Reductions, softmax and layer norm (FooReduce.cpp) =====
+// The inputs are contiguous host tensors viewed as [outer, size, inner], and
+// the kernels work over the middle dimension. Results only depend on the
+// shape and the CPU capability, never on the number of threads.
+
+// What a reduction combines: x, |x|, x^2 or (x - center)^2 summed, or the
+// maximum or minimum of x or |x|.
+enum class ReduceOp : uint8_t { Sum, AbsSum, SquareSum, CenteredSquareSum, Max, Min, AbsMax };
+
+// Writes the [outer * inner] results to the contiguous `acc`, whose dtype is
+// the op math type of `in`. `center` is only read by CenteredSquareSum and has
+// the layout and dtype of `acc`.
+using reduce_fn = void (*)(const at::Tensor& acc, const at::Tensor& in, ReduceOp op, const at::Tensor& center);
+// `out` has the layout of `in` and its dtype or its op math type.
+using softmax_fn = void (*)(const at::Tensor& out, const at::Tensor& in, bool log);
+// Normalizes the [rows, n] `in` into `out`; `mean` and `rstd` have [rows]
+// elements and, like the optional `weight` and `bias` of [n], the dtype of
+// `in` or its op math type.
+using layer_norm_fn = void (*)(const at::Tensor& out, const at::Tensor& mean, const at::Tensor& rstd,
+    const at::Tensor& in, const at::Tensor& weight, const at::Tensor& bias, double eps);
+
+FOO_DECLARE_DISPATCH(reduce_fn, reduce_stub);
+FOO_DECLARE_DISPATCH(softmax_fn, softmax_stub);
+FOO_DECLARE_DISPATCH(layer_norm_fn, layer_norm_stub);
+
+// ===== Matrix multiplication (FooMatmul.cpp) =====
+// float32 only. B is packed into panels of gemm_panel_width_stub() columns:
+// panel p holds columns [p * width, (p + 1) * width) of the [K, N] `b`, row
+// by row, zero-padded past N, so the packed buffer has ceil(N / width) * K *
+// width floats. The packing only depends on the CPU capability.
+using gemm_panel_width_fn = int64_t (*)();
+using gemm_pack_b_fn = void (*)(float* packed, const at::Tensor& b);
+// out = alpha * a @ B (+ out when `accumulate`), with `out` a [M, N] host
+// tensor whose rows are contiguous, `a` a [M, K] one with any strides and
+// `packed_b` the packed [K, N] B. Results don't depend on the number of
+// threads.
+using gemm_fn = void (*)(const at::Tensor& out, const at::Tensor& a, const float* packed_b, float alpha,
+    bool accumulate);
+
+FOO_DECLARE_DISPATCH(gemm_panel_width_fn, gemm_panel_width_stub);
+FOO_DECLARE_DISPATCH(gemm_pack_b_fn, gemm_pack_b_stub);
+FOO_DECLARE_DISPATCH(gemm_fn, gemm_stub);
+
+} // namespace foo_core
@@ -0,0 +1,608 @@
+#include "FooLazy.h"
+
+#include <ATen/Parallel.h>
+#include <ATen/ops/empty.h>
+#include <c10/core/StorageImpl.h>
+#include <c10/util/Exception.h>
+#include <c10/util/intrusive_ptr.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "FooKernels.h"
+#include "FooParallel.h"
+#include "FooStorageImpl.h"
+#include "FooStream.h"
+#include "FooTrace.h"
+
+namespace foo_core {
+
+FOO_DEFINE_DISPATCH(lazy_kernel_stub);
+
+// Lazy mode keeps one process-wide graph of pending elementwise ops. Every
+// recorded op gets a real, freshly allocated output tensor right away; only
+// the computation is deferred. When the graph runs:
+//
+// - Its nodes are grouped by device and element count, and each group becomes
+//   one fused program that walks the elements once, in cache-sized chunks.
+// - A result is only written back if its storage is still alive. The
+//   temporaries of an expression like `a * b + c` are gone by then, so they
+//   live in per-chunk scratch registers instead of memory.
+// - Programs are cached by the structure of their group (ops, operands and
+//   which results are written back). Scalars are passed at run time, so a
+//   training loop compiles each of its chains once.
+//
+// Pending results are tracked by their StorageImpl. The graph holds weak
+// references to them, which keep the StorageImpl addresses from being reused
+// while they are registry keys, and strong references to its inputs.
+namespace {
+
+// Elements processed at a time by a fused program.
+constexpr int64_t kChunkSize = 2048;
+// The graph runs on its own once this many ops are pending.
+constexpr size_t kMaxPendingNodes = 256;
+constexpr size_t kMaxCachedPrograms = 1024;
+
+bool is_binary(LazyOp op)
+{
+    return op == LazyOp::Add || op == LazyOp::Sub || op == LazyOp::Mul || op == LazyOp::Div
+        || op == LazyOp::MulAddScalar;
+}
+
+// ===== Fused programs =====
+
+// Where a fused instruction reads or writes a chunk: an input tensor, an
+// output storage, or a scratch register.
+struct Operand {
+    enum class Kind : uint8_t { Input, Output, Register };
+    Kind kind = Kind::Register;
+    int index = -1;
+};
+
+struct FusedInstr {
+    LazyKernelFn kernel;
+    Operand dst;
+    Operand a;
+    Operand b; // index -1 for unary ops
+};
+
+struct FusedProgram {
+    std::vector<FusedInstr> code;
+    int num_registers = 0;
+
+    void run(const std::vector<const float*>& inputs, const std::vector<float*>& outputs,
+             const std::vector<float>& scalars, int64_t numel) const
+    {
+        device_parallel_for(0, numel, kChunkSize, [&](int64_t begin, int64_t end) {
+            std::vector<float> scratch(static_cast<size_t>(num_registers) * kChunkSize);
+            for (int64_t chunk = begin; chunk < end; chunk += kChunkSize) {
+                const int64_t n = std::min(kChunkSize, end - chunk);
+                auto resolve = [&](const Operand& operand) -> float* {
+                    switch (operand.kind) {
+                        case Operand::Kind::Input:
+                            return const_cast<float*>(inputs[operand.index]) + chunk;
+                        case Operand::Kind::Output:
+                            return outputs[operand.index] + chunk;
+                        case Operand::Kind::Register:
+                            break;
+                    }
+                    return operand.index < 0 ? nullptr : scratch.data() + operand.index * kChunkSize;
+                };
+                for (size_t i = 0; i < code.size(); ++i) {
+                    const FusedInstr& instr = code[i];
+                    instr.kernel(resolve(instr.dst), resolve(instr.a), resolve(instr.b), scalars[i], n);
+                }
+            }
+        });
+    }
+};
+
+// The structure of one node of a group, which is all a program depends on.
+// Operands are positions within the group.
+struct ProgramNode {
+    LazyOp op;
+    int a;
+    int b;
+    bool is_output;
+};
+
+std::string program_signature(const std::vector<ProgramNode>& nodes)
+{
+    std::string signature;
+    for (const ProgramNode& node : nodes) {
+        signature += std::to_string(static_cast<int>(node.op)) + "," + std::to_string(node.a) + ","
+            + std::to_string(node.b) + (node.is_output ? "o;" : ";");
+    }
+    return signature;
+}
+
+// Assigns every result a location. Results that are written back are computed
+// straight into their output, the others into scratch registers that are
+// reused once their last reader ran.
+std::shared_ptr<const FusedProgram> compile_program(const std::vector<ProgramNode>& nodes)
+{
+    auto program = std::make_shared<FusedProgram>();
+    std::vector<int> last_use(nodes.size(), -1);
+    for (size_t p = 0; p < nodes.size(); ++p) {
+        for (int arg : {nodes[p].a, nodes[p].b}) {
+            if (arg >= 0) {
+                last_use[arg] = static_cast<int>(p);
+            }
+        }
+    }
+
+    std::vector<Operand> location(nodes.size());
+    std::vector<int> free_registers;
+    int num_inputs = 0;
+    int num_outputs = 0;
+    for (size_t p = 0; p < nodes.size(); ++p) {
+        const ProgramNode& node = nodes[p];
+        if (node.op == LazyOp::Input) {
+            location[p] = Operand{Operand::Kind::Input, num_inputs++};
+            continue;
+        }
+        FusedInstr instr{lazy_kernel_stub(node.op), Operand{}, location[node.a], node.b >= 0 ? location[node.b] : Operand{}};
+        // The kernels are elementwise, so the result may overwrite an operand
+        // read for the last time.
+        for (int arg : {node.a, node.b}) {
+            if (arg >= 0 && last_use[arg] == static_cast<int>(p) && location[arg].kind == Operand::Kind::Register
+                && std::find(free_registers.begin(), free_registers.end(), location[arg].index) == free_registers.end()) {
+                free_registers.push_back(location[arg].index);
+            }
+        }
+        if (node.is_output) {
+            instr.dst = Operand{Operand::Kind::Output, num_outputs++};
+        } else if (!free_registers.empty()) {
+            instr.dst = Operand{Operand::Kind::Register, free_registers.back()};
+            free_registers.pop_back();
+        } else {
+            instr.dst = Operand{Operand::Kind::Register, program->num_registers++};
+        }
+        location[p] = instr.dst;
+        program->code.push_back(instr);
+    }
+    return program;
+}
+
+// ===== The graph =====
+
+struct LazyNode {
+    LazyNode(LazyOp op, c10::Device device, int64_t numel) : op(op), device(device), numel(numel) {}
+
+    LazyOp op;
+    c10::Device device;
+    int64_t numel;
+    int a = -1;
+    int b = -1;
+    float scalar = 0.f;
+    at::Tensor input;                                                 // inputs only
+    std::optional<c10::weak_intrusive_ptr<c10::StorageImpl>> output; // results only
+};
+
+bool is_lazy_candidate(const at::Tensor& tensor)
+{
+    return tensor.defined() && tensor.is_privateuseone() && tensor.scalar_type() == at::kFloat
+        && tensor.is_contiguous() && !tensor.is_conj() && !tensor.is_neg();
+}
+
+class LazyGraph {
+public:
+    // Records the nodes `build` adds for one op, whose result looks like
+    // `like`. Returns the result, or an undefined tensor if `build` found an
+    // operand it can't record (then nothing is recorded).
+    template <typename BuildFn>
+    at::Tensor record(const at::Tensor& like, const BuildFn& build)
+    {
+        if (!is_lazy_candidate(like)) {
+            return {};
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        like_ = &like;
+        const size_t mark = nodes_.size();
+        const int result = build(*this);
+        like_ = nullptr;
+        if (result < 0) {
+            nodes_.resize(mark);
+            for (auto it = inputs_.begin(); it != inputs_.end();) {
+                it = it->second >= static_cast<int>(mark) ? inputs_.erase(it) : std::next(it);
+            }
+            return {};
+        }
+
+        at::Tensor out = at::empty(like.sizes(), like.options().memory_format(c10::MemoryFormat::Contiguous));
+        nodes_[result].output = c10::weak_intrusive_ptr<c10::StorageImpl>(out.storage().getIntrusivePtr());
+        results_[out.storage().unsafeGetStorageImpl()] = result;
+        ++stats_.recorded_ops;
+        lazy_pending_flag().store(true, std::memory_order_release);
+        if (nodes_.size() >= kMaxPendingNodes) {
+            flush_locked();
+        }
+        return out;
+    }
+
+    // Returns the node reading `tensor`, or -1 if it can't be an operand.
+    int input(const at::Tensor& tensor)
+    {
+        if (!is_lazy_candidate(tensor) || tensor.device() != like_->device() || tensor.sizes() != like_->sizes()) {
+            return -1;
+        }
+        auto result = results_.find(tensor.storage().unsafeGetStorageImpl());
+        if (result != results_.end()) {
+            // Only the pending result itself can be fused, not other views of
+            // it: a prefix would land in another group than the result.
+            const bool whole = tensor.storage_offset() == 0 && tensor.numel() == nodes_[result->second].numel;
+            return whole ? result->second : -1;
+        }
+        const std::pair<const void*, int64_t> key(tensor.const_data_ptr(), tensor.numel());
+        auto it = inputs_.find(key);
+        if (it != inputs_.end()) {
+            return it->second;
+        }
+        // The fused kernel reads the input's memory directly.
+        materialize_fill(tensor);
+        const int node = add_node(LazyOp::Input);
+        nodes_[node].input = tensor;
+        inputs_.emplace(key, node);
+        return node;
+    }
+
+    int op(LazyOp op, int a, int b = -1, float scalar = 0.f)
+    {
+        if (a < 0 || (is_binary(op) && b < 0)) {
+            return -1;
+        }
+        const int node = add_node(op);
+        nodes_[node].a = a;
+        nodes_[node].b = b;
+        nodes_[node].scalar = scalar;
+        return node;
+    }
+
+    void flush()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        flush_locked();
+    }
+
+    LazyStats stats()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+    void reset_stats()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_ = LazyStats{};
+    }
+
+private:
+    int add_node(LazyOp op)
+    {
+        nodes_.emplace_back(op, like_->device(), like_->numel());
+        return static_cast<int>(nodes_.size()) - 1;
+    }
+
+    void flush_locked()
+    {
+        std::vector<LazyNode> nodes;
+        nodes.swap(nodes_);
+        results_.clear();
+        inputs_.clear();
+        lazy_pending_flag().store(false, std::memory_order_release);
+
+        std::map<std::pair<c10::DeviceIndex, int64_t>, std::vector<int>> groups;
+        for (size_t idx = 0; idx < nodes.size(); ++idx) {
+            groups[{nodes[idx].device.index(), nodes[idx].numel}].push_back(static_cast<int>(idx));
+        }
+        for (const auto& group : groups) {
+            run_group(nodes, group.second);
+        }
+    }
+
+    void run_group(const std::vector<LazyNode>& nodes, const std::vector<int>& members)
+    {
+        // Walk backwards from the results that are still referenced to find
+        // everything they need.
+        std::vector<bool> needed(nodes.size(), false);
+        std::unordered_map<int, c10::Storage> live_outputs;
+        for (auto it = members.rbegin(); it != members.rend(); ++it) {
+            const LazyNode& node = nodes[*it];
+            if (node.output) {
+                c10::intrusive_ptr<c10::StorageImpl> storage = node.output->lock();
+                if (storage) {
+                    live_outputs.emplace(*it, c10::Storage(std::move(storage)));
+                    needed[*it] = true;
+                }
+            }
+            if (needed[*it]) {
+                for (int arg : {node.a, node.b}) {
+                    if (arg >= 0) {
+                        needed[arg] = true;
+                    }
+                }
+            }
+        }
+
+        std::vector<int> position(nodes.size(), -1);
+        std::vector<ProgramNode> program_nodes;
+        std::vector<at::Tensor> inputs;
+        std::vector<c10::Storage> outputs;
+        std::vector<float> scalars;
+        for (int idx : members) {
+            if (!needed[idx]) {
+                continue;
+            }
+            const LazyNode& node = nodes[idx];
+            position[idx] = static_cast<int>(program_nodes.size());
+            auto output = live_outputs.find(idx);
+            program_nodes.push_back(ProgramNode{
+                node.op,
+                node.a >= 0 ? position[node.a] : -1,
+                node.b >= 0 ? position[node.b] : -1,
+                output != live_outputs.end()});
+            if (node.op == LazyOp::Input) {
+                inputs.push_back(node.input);
+            } else {
+                scalars.push_back(node.scalar);
+            }
+            if (output != live_outputs.end()) {
+                outputs.push_back(std::move(output->second));
+            }
+        }
+        const c10::Device device = nodes[members.front()].device;
+        const int64_t numel = nodes[members.front()].numel;
+        if (outputs.empty() || numel == 0) {
+            return;
+        }
+
+        std::shared_ptr<const FusedProgram> program = get_program(program_nodes);
+        ++stats_.fused_kernels;
+        launch(get_current_stream(device.index()), [program, inputs, outputs, scalars, numel, device]() {
+            FOO_TRACE_SCOPE_SIZES("foo::lazy_fused", device, c10::IntArrayRef(numel), at::kFloat);
+            std::vector<const float*> input_ptrs;
+            input_ptrs.reserve(inputs.size());
+            for (const at::Tensor& input : inputs) {
+                input_ptrs.push_back(input.const_data_ptr<float>());
+            }
+            std::vector<float*> output_ptrs;
+            output_ptrs.reserve(outputs.size());
+            for (const c10::Storage& output : outputs) {
+                output_ptrs.push_back(static_cast<float*>(output.mutable_data()));
+            }
+            program->run(input_ptrs, output_ptrs, scalars, numel);
+        });
+    }
+
+    std::shared_ptr<const FusedProgram> get_program(const std::vector<ProgramNode>& nodes)
+    {
+        std::string signature = program_signature(nodes);
+        auto it = programs_.find(signature);
+        if (it != programs_.end()) {
+            return it->second;
+        }
+        if (programs_.size() >= kMaxCachedPrograms) {
+            programs_.clear();
+        }
+        std::shared_ptr<const FusedProgram> program = compile_program(nodes);
+        programs_.emplace(std::move(signature), program);
+        return program;
+    }
+
+    std::mutex mutex_;
+    const at::Tensor* like_ = nullptr; // the result of the op being recorded
+    std::vector<LazyNode> nodes_;
+    std::unordered_map<const c10::StorageImpl*, int> results_; // pending results by storage
+    std::map<std::pair<const void*, int64_t>, int> inputs_;    // inputs by data pointer and size
+    std::unordered_map<std::string, std::shared_ptr<const FusedProgram>> programs_;
+    LazyStats stats_{};
+};
+
+// Intentionally leaked, like the streams the pending work runs on.
+LazyGraph& graph()
+{
+    static LazyGraph* graph = new LazyGraph();
+    return *graph;
+}
+
+bool lazy_from_env()
+{
+    const char* env = std::getenv("TORCH_FOO_LAZY");
+    return env != nullptr && std::string(env) != "0" && std::string(env) != "";
+}
+
+std::atomic<bool>& lazy_mode()
+{
+    static std::atomic<bool> enabled(lazy_from_env());
+    return enabled;
+}
+
+// ===== Recording aten ops =====
+
+// A Python number passed where a tensor is expected, e.g. the 2 in `x * 2`.
+std::optional<float> wrapped_scalar(const c10::IValue& ivalue)
+{
+    if (!ivalue.isTensor()) {
+        return std::nullopt;
+    }
+    const at::Tensor& tensor = ivalue.toTensor();
+    if (!tensor.unsafeGetTensorImpl()->is_wrapped_number() || tensor.is_complex()) {
+        return std::nullopt;
+    }
+    return tensor.item<float>();
+}
+
+std::optional<float> real_scalar(const c10::IValue& ivalue)
+{
+    const c10::Scalar scalar = ivalue.toScalar();
+    if (scalar.isComplex()) {
+        return std::nullopt;
+    }
+    return scalar.to<float>();
+}
+
+// add/sub/mul/div.Tensor(Tensor self, Tensor other[, Scalar alpha])
+template <LazyOp kOp>
+at::Tensor record_binary(c10::ArrayRef<c10::IValue> args)
+{
+    const std::optional<float> alpha = args.size() > 2 ? real_scalar(args[2]) : std::optional<float>(1.f);
+    if (!args[0].isTensor() || !args[1].isTensor() || wrapped_scalar(args[0]) || !alpha) {
+        return {};
+    }
+    const at::Tensor& self = args[0].toTensor();
+    const at::Tensor& other = args[1].toTensor();
+    const std::optional<float> scalar = wrapped_scalar(args[1]);
+    return graph().record(self, [&](LazyGraph& g) {
+        const int a = g.input(self);
+        if (scalar) {
+            switch (kOp) {
+                case LazyOp::Add: return g.op(LazyOp::AddScalar, a, -1, *scalar * *alpha);
+                case LazyOp::Sub: return g.op(LazyOp::AddScalar, a, -1, -*scalar * *alpha);
+                case LazyOp::Mul: return g.op(LazyOp::MulScalar, a, -1, *scalar);
+                default: return g.op(LazyOp::DivScalar, a, -1, *scalar);
+            }
+        }
+        int b = g.input(other);
+        if (*alpha != 1.f) {
+            b = g.op(LazyOp::MulScalar, b, -1, *alpha);
+        }
+        return g.op(kOp, a, b);
+    });
+}
+
+// add/mul/div.Scalar(Tensor self, Scalar other[, Scalar alpha])
+template <LazyOp kOp>
+at::Tensor record_binary_scalar(c10::ArrayRef<c10::IValue> args)
+{
+    const std::optional<float> scalar = real_scalar(args[1]);
+    const std::optional<float> alpha = args.size() > 2 ? real_scalar(args[2]) : std::optional<float>(1.f);
+    if (!args[0].isTensor() || !scalar || !alpha) {
+        return {};
+    }
+    const at::Tensor& self = args[0].toTensor();
+    const float value = kOp == LazyOp::AddScalar ? *scalar * *alpha : *scalar;
+    return graph().record(self, [&](LazyGraph& g) { return g.op(kOp, g.input(self), -1, value); });
+}
+
+template <LazyOp kOp>
+at::Tensor record_unary(c10::ArrayRef<c10::IValue> args)
+{
+    if (!args[0].isTensor()) {
+        return {};
+    }
+    const at::Tensor& self = args[0].toTensor();
+    return graph().record(self, [&](LazyGraph& g) { return g.op(kOp, g.input(self)); });
+}
+
+// sub.Scalar(Tensor self, Scalar other, Scalar alpha)
+at::Tensor record_sub_scalar(c10::ArrayRef<c10::IValue> args)
+{
+    const std::optional<float> scalar = real_scalar(args[1]);
+    const std::optional<float> alpha = real_scalar(args[2]);
+    if (!args[0].isTensor() || !scalar || !alpha) {
+        return {};
+    }
+    const at::Tensor& self = args[0].toTensor();
+    return graph().record(self, [&](LazyGraph& g) {
+        return g.op(LazyOp::AddScalar, g.input(self), -1, -*scalar * *alpha);
+    });
+}
+
+using RecordFn = at::Tensor (*)(c10::ArrayRef<c10::IValue>);
+
+const std::unordered_map<c10::OperatorName, RecordFn>& recorders()
+{
+    static const std::unordered_map<c10::OperatorName, RecordFn> recorders = {
+        {{"aten::add", "Tensor"}, &record_binary<LazyOp::Add>},
+        {{"aten::sub", "Tensor"}, &record_binary<LazyOp::Sub>},
+        {{"aten::mul", "Tensor"}, &record_binary<LazyOp::Mul>},
+        {{"aten::div", "Tensor"}, &record_binary<LazyOp::Div>},
+        {{"aten::add", "Scalar"}, &record_binary_scalar<LazyOp::AddScalar>},
+        {{"aten::sub", "Scalar"}, &record_sub_scalar},
+        {{"aten::mul", "Scalar"}, &record_binary_scalar<LazyOp::MulScalar>},
+        {{"aten::div", "Scalar"}, &record_binary_scalar<LazyOp::DivScalar>},
+        {{"aten::neg", ""}, &record_unary<LazyOp::Neg>},
+        {{"aten::abs", ""}, &record_unary<LazyOp::Abs>},
+        {{"aten::exp", ""}, &record_unary<LazyOp::Exp>},
+        {{"aten::sqrt", ""}, &record_unary<LazyOp::Sqrt>},
+        {{"aten::relu", ""}, &record_unary<LazyOp::Relu>},
+        {{"aten::sigmoid", ""}, &record_unary<LazyOp::Sigmoid>},
+        {{"aten::tanh", ""}, &record_unary<LazyOp::Tanh>},
+    };
+    return recorders;
+}
+
+} // namespace
+
+std::atomic<bool>& lazy_pending_flag()
+{
+    static std::atomic<bool> pending(false);
+    return pending;
+}
+
+bool is_lazy_mode()
+{
+    return lazy_mode().load(std::memory_order_relaxed);
+}
+
+void set_lazy_mode(bool enabled)
+{
+    lazy_mode().store(enabled, std::memory_order_relaxed);
+}
+
+void lazy_sync()
+{
+    graph().flush();
+}
+
+LazyStats get_lazy_stats()
+{
+    return graph().stats();
+}
+
+void reset_lazy_stats()
+{
+    graph().reset_stats();
+}
+
+bool lazy_record(const c10::OperatorHandle& op, torch::jit::Stack* stack)
+{
+    if (!is_lazy_mode()) {
+        return false;
+    }
+    auto it = recorders().find(op.operator_name());
+    if (it == recorders().end()) {
+        return false;
+    }
+    const size_t num_arguments = op.schema().arguments().size();
+    at::Tensor result = it->second(torch::jit::last(*stack, num_arguments));
+    if (!result.defined()) {
+        return false;
+    }
+    torch::jit::drop(*stack, num_arguments);
+    torch::jit::push(*stack, std::move(result));
+    return true;
+}
+
+at::Tensor lazy_record_muladd(const at::Tensor& a, const at::Tensor& b, const double* c)
+{
+    if (!is_lazy_mode()) {
+        return {};
+    }
+    return graph().record(a, [&](LazyGraph& g) {
+        const int x = g.input(a);
+        const int y = g.input(b);
+        return c != nullptr ? g.op(LazyOp::MulAddScalar, x, y, static_cast<float>(*c)) : g.op(LazyOp::Mul, x, y);
+    });
+}
+
+} // namespace foo_core
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <ATen/core/Tensor.h>
+#include <ATen/core/dispatch/Dispatcher.h>
+#include <ATen/core/stack.h>
+
+#include <atomic>
+#include <cstdint>
+
+#include "foo_core/lazy.h"
+
+namespace foo_core {
+
+// =====================================
+// ============ Lazy mode ==============
+// =====================================
+
+// Set while lazy ops are pending, so flush_lazy() is a single atomic load in
+// the common case.
+std::atomic<bool>& lazy_pending_flag();
+
+// Runs the pending lazy ops. Every kernel that reads or writes foo memory
+// outside of lazy mode calls this first.
+inline void flush_lazy()
+{
+    if (lazy_pending_flag().load(std::memory_order_acquire)) {
+        lazy_sync();
+    }
+}
+
+// Records the boxed call of `op` on `stack` if lazy mode is on and the op is a
+// supported elementwise op, replacing its arguments on the stack by the result
+// as if it had run. Returns false, without touching the stack, otherwise.
+bool lazy_record(const c10::OperatorHandle& op, torch::jit::Stack* stack);
+
+// Records a * b + c, or a * b when `c` is not given, for the foo operators.
+// Returns an undefined tensor when the call can't be recorded.
+at::Tensor lazy_record_muladd(const at::Tensor& a, const at::Tensor& b, const double* c);
+
+// ===== Fused programs =====
+
+// The node kinds of the lazy graph.
+enum class LazyOp : uint8_t {
+    Input,
+    Add,
+    Sub,
+    Mul,
+    Div,
+    AddScalar,
+    MulScalar,
+    DivScalar,
+    MulAddScalar, // a * b + scalar, with a single rounding like foo::mymuladd
+    Neg,
+    Abs,
+    Exp,
+    Sqrt,
+    Relu,
+    Sigmoid,
+    Tanh,
+};
+
+// Computes one op of a fused program over n contiguous floats. `b` is null for
+// unary ops and `scalar` is ignored by ops without one.
+using LazyKernelFn = void (*)(float* out, const float* a, const float* b, float scalar, int64_t n);
+
+} // namespace foo_core
@@ -0,0 +1,354 @@
+#include <ATen/Parallel.h>
+#include <ATen/core/Tensor.h>
+#include <ATen/native/CPUFallback.h>
+#include <ATen/ops/addmm.h>
+#include <ATen/ops/addmm_ops.h>
+#include <ATen/ops/bmm.h>
+#include <ATen/ops/bmm_ops.h>
+#include <ATen/ops/empty.h>
+#include <ATen/ops/mm.h>
+#include <ATen/ops/mm_ops.h>
+#include <c10/core/StorageImpl.h>
+#include <c10/util/Exception.h>
+#include <c10/util/intrusive_ptr.h>
+#include <torch/library.h>
+
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "FooAlias.h"
+#include "FooDeviceGuard.h"
+#include "FooFallback.h"
+#include "FooKernels.h"
+#include "FooLazy.h"
+#include "FooParallel.h"
+#include "FooStorageImpl.h"
+#include "FooTrace.h"
+#include "foo_core/matmul.h"
+#include "foo_core/stream.h"
+
+namespace foo_core {
+
+FOO_DEFINE_DISPATCH(gemm_panel_width_stub);
+FOO_DEFINE_DISPATCH(gemm_pack_b_stub);
+FOO_DEFINE_DISPATCH(gemm_stub);
+
+// mm, addmm and bmm of foo tensors. float32 runs on the GEMM of
+// cpu/GemmKernels.cpp; other dtypes run ATen's CPU kernels on the aliases from
+// the stream. linear and matmul decompose into these.
+namespace {
+
+// ===== Weight prepacking =====
+
+bool prepack_from_env()
+{
+    const char* env = std::getenv("TORCH_FOO_PREPACK_WEIGHTS");
+    return env != nullptr && std::string(env) != "0" && std::string(env) != "";
+}
+
+std::atomic<bool>& prepack_enabled()
+{
+    static std::atomic<bool> enabled(prepack_from_env());
+    return enabled;
+}
+
+// The storage, offset, sizes and strides of a [K, N] operand.
+using PrepackKey = std::pair<const c10::StorageImpl*, std::array<int64_t, 5>>;
+
+// Taken on the host when the op is called: the version is the one the stream
+// task will read, since any later write is enqueued after it.
+struct WeightRef {
+    c10::weak_intrusive_ptr<c10::StorageImpl> storage;
+    PrepackKey key;
+    uint32_t version;
+};
+
+at::Tensor pack_b(const at::Tensor& b)
+{
+    const int64_t width = gemm_panel_width_stub();
+    const int64_t panels = (b.size(1) + width - 1) / width;
+    at::Tensor packed = at::empty({panels * b.size(0) * width}, b.options());
+    gemm_pack_b_stub(packed.mutable_data_ptr<float>(), b);
+    return packed;
+}
+
+// The packed copies of the weights, one per storage and layout, and the
+// storages marked with prepack_weight(). Entries and marks hold a weak
+// reference to their storage, so the StorageImpl their key points to can't be
+// reused by another storage while they exist. Entries are replaced when the
+// version of the weight moves; both are dropped once their storage is freed,
+// which is checked whenever something is added and every kSweepInterval
+// lookups, so freed weights don't keep their packed copies alive in loops
+// that never miss.
+class PrepackCache {
+public:
+    // Returns the packed `b`, the CPU alias of the weight `ref` was taken from.
+    at::Tensor get(const WeightRef& ref, const at::Tensor& b)
+    {
+        {
+            const std::lock_guard<std::mutex> lock(mutex_);
+            if (++lookups_ % kSweepInterval == 0) {
+                sweep();
+            }
+            auto it = entries_.find(ref.key);
+            if (it != entries_.end() && it->second.version == ref.version && !it->second.storage.expired()) {
+                return it->second.packed;
+            }
+        }
+        // Packed outside the lock so streams of other devices don't wait on it.
+        at::Tensor packed = pack_b(b);
+        const std::lock_guard<std::mutex> lock(mutex_);
+        sweep();
+        entries_.insert_or_assign(ref.key, Entry{ref.storage, ref.version, packed});
+        return packed;
+    }
+
+    void mark(const c10::intrusive_ptr<c10::StorageImpl>& storage)
+    {
+        const std::lock_guard<std::mutex> lock(mutex_);
+        sweep();
+        marked_.insert_or_assign(storage.get(), c10::weak_intrusive_ptr<c10::StorageImpl>(storage));
+    }
+
+    bool is_marked(const c10::StorageImpl* storage)
+    {
+        const std::lock_guard<std::mutex> lock(mutex_);
+        auto it = marked_.find(storage);
+        return it != marked_.end() && !it->second.expired();
+    }
+
+    void clear()
+    {
+        const std::lock_guard<std::mutex> lock(mutex_);
+        entries_.clear();
+        marked_.clear();
+    }
+
+private:
+    static constexpr uint64_t kSweepInterval = 256;
+
+    struct Entry {
+        c10::weak_intrusive_ptr<c10::StorageImpl> storage;
+        uint32_t version;
+        at::Tensor packed;
+    };
+
+    // Drops the entries and marks of freed storages. Called with the lock held.
+    void sweep()
+    {
+        for (auto it = entries_.begin(); it != entries_.end();) {
+            it = it->second.storage.expired() ? entries_.erase(it) : std::next(it);
+        }
+        for (auto it = marked_.begin(); it != marked_.end();) {
+            it = it->second.expired() ? marked_.erase(it) : std::next(it);
+        }
+    }
+
+    std::mutex mutex_;
+    std::map<PrepackKey, Entry> entries_;
+    std::map<const c10::StorageImpl*, c10::weak_intrusive_ptr<c10::StorageImpl>> marked_;
+    uint64_t lookups_ = 0;
+};
+
+PrepackCache& prepack_cache()
+{
+    static PrepackCache cache;
+    return cache;
+}
+
+// Parameters are written by the optimizer's in-place updates, which bump their
+// version, and not by the forward pass, so they are the operands worth
+// caching. Linear layers multiply by a view of the weight, so views count as
+// the tensor they view.
+bool is_parameter(const at::Tensor& tensor)
+{
+    const at::Tensor& root = tensor.is_view() ? tensor._base() : tensor;
+    return root.is_leaf() && root.requires_grad();
+}
+
+// Only parameters, with prepacking on, and the weights marked with
+// prepack_weight() are prepacked. Inference tensors don't track their version,
+// so they never are.
+std::optional<WeightRef> weight_ref(const at::Tensor& weight)
+{
+    if (weight.scalar_type() != at::kFloat || weight.is_inference()) {
+        return std::nullopt;
+    }
+    const c10::intrusive_ptr<c10::StorageImpl>& storage = weight.storage().getIntrusivePtr();
+    if (!(prepack_enabled().load(std::memory_order_relaxed) && is_parameter(weight))
+        && !prepack_cache().is_marked(storage.get())) {
+        return std::nullopt;
+    }
+    return WeightRef{c10::weak_intrusive_ptr<c10::StorageImpl>(storage),
+        {storage.get(),
+            {weight.storage_offset(), weight.size(0), weight.size(1), weight.stride(0), weight.stride(1)}},
+        weight.unsafeGetTensorImpl()->version_counter().current_version()};
+}
+
+// ===== Kernels =====
+
+bool is_native_operand(const at::Tensor& tensor, const at::Tensor& first)
+{
+    return tensor.is_privateuseone() && tensor.device() == first.device() && !tensor.is_conj() && !tensor.is_neg();
+}
+
+void check_mm_operands(const char* name1, const at::Tensor& mat1, const char* name2, const at::Tensor& mat2)
+{
+    TORCH_CHECK(mat1.dim() == 2, name1, " must be a matrix, got ", mat1.dim(), "-D tensor");
+    TORCH_CHECK(mat2.dim() == 2, name2, " must be a matrix, got ", mat2.dim(), "-D tensor");
+    TORCH_CHECK(mat1.size(1) == mat2.size(0), "mat1 and mat2 shapes cannot be multiplied (", mat1.size(0), "x",
+        mat1.size(1), " and ", mat2.size(0), "x", mat2.size(1), ")");
+    TORCH_CHECK(mat1.scalar_type() == mat2.scalar_type(), "expected ", name1, " and ", name2,
+        " to have the same dtype, but got: ", mat1.scalar_type(), " != ", mat2.scalar_type());
+}
+
+// Enqueues result = beta * bias + alpha * mat1 @ mat2, or mat1 @ mat2 when
+// `bias` is undefined.
+at::Tensor launch_gemm(const char* name, const at::Tensor& result, const at::Tensor& mat1, const at::Tensor& mat2,
+    const at::Tensor& bias, const at::Scalar& beta, const at::Scalar& alpha)
+{
+    if (result.numel() == 0) {
+        return result;
+    }
+    materialize_fills(mat1, mat2, bias);
+    auto host = [](const at::Tensor& tensor) { return tensor.defined() ? cpu_alias(tensor) : at::Tensor(); };
+    launch([name, out = cpu_alias(result), a = cpu_alias(mat1), b = cpu_alias(mat2), bias = host(bias), beta, alpha,
+               weight = weight_ref(mat2), device = result.device()]() {
+        FOO_TRACE_SCOPE_SIZES(name, device, out.sizes(), out.scalar_type());
+        if (out.scalar_type() != at::kFloat) {
+            if (bias.defined()) {
+                at::addmm_out(out, bias, a, b, beta, alpha);
+            } else {
+                at::mm_out(out, a, b);
+            }
+            return;
+        }
+        // beta == 0 ignores the bias, NaNs included, like ATen.
+        const bool accumulate = bias.defined() && beta.toDouble() != 0;
+        if (accumulate) {
+            out.copy_(bias);
+            if (beta.toDouble() != 1) {
+                out.mul_(beta);
+            }
+        }
+        const at::Tensor packed = weight.has_value() ? prepack_cache().get(*weight, b) : pack_b(b);
+        gemm_stub(out, a, packed.const_data_ptr<float>(), alpha.toFloat(), accumulate);
+    });
+    return result;
+}
+
+at::Tensor foo_mm(const at::Tensor& self, const at::Tensor& mat2)
+{
+    if (!is_native_operand(self, self) || !is_native_operand(mat2, self)) {
+        return at::native::call_fallback_fn<&cpu_fallback, at::_ops::mm>::call(self, mat2);
+    }
+    const FooDeviceGuard guard(self.device());
+    flush_lazy();
+    check_mm_operands("self", self, "mat2", mat2);
+    const at::Tensor result = at::empty({self.size(0), mat2.size(1)}, self.options());
+    return launch_gemm("aten::mm", result, self, mat2, at::Tensor(), 0, 1);
+}
+
+at::Tensor foo_addmm(const at::Tensor& self, const at::Tensor& mat1, const at::Tensor& mat2, const at::Scalar& beta,
+    const at::Scalar& alpha)
+{
+    if (!is_native_operand(self, mat1) || !is_native_operand(mat1, mat1) || !is_native_operand(mat2, mat1)
+        || beta.isComplex() || alpha.isComplex()) {
+        return at::native::call_fallback_fn<&cpu_fallback, at::_ops::addmm>::call(self, mat1, mat2, beta, alpha);
+    }
+    const FooDeviceGuard guard(mat1.device());
+    flush_lazy();
+    check_mm_operands("mat1", mat1, "mat2", mat2);
+    TORCH_CHECK(self.scalar_type() == mat1.scalar_type(), "self and mat2 must have the same dtype, but got ",
+        self.scalar_type(), " and ", mat1.scalar_type());
+    const at::Tensor bias = self.expand({mat1.size(0), mat2.size(1)});
+    const at::Tensor result = at::empty(bias.sizes(), mat1.options());
+    return launch_gemm("aten::addmm", result, mat1, mat2, bias, beta, alpha);
+}
+
+// Below this many multiply-adds per matrix, batches are spread over threads;
+// above, they run one after the other and each GEMM uses every thread.
+constexpr int64_t kParallelBatchWork = int64_t{1} << 18;
+
+at::Tensor foo_bmm(const at::Tensor& self, const at::Tensor& mat2)
+{
+    if (!is_native_operand(self, self) || !is_native_operand(mat2, self)) {
+        return at::native::call_fallback_fn<&cpu_fallback, at::_ops::bmm>::call(self, mat2);
+    }
+    const FooDeviceGuard guard(self.device());
+    flush_lazy();
+    TORCH_CHECK(self.dim() == 3, "batch1 must be a 3D tensor");
+    TORCH_CHECK(mat2.dim() == 3, "batch2 must be a 3D tensor");
+    const int64_t batch = self.size(0);
+    TORCH_CHECK(mat2.size(0) == batch && mat2.size(1) == self.size(2),
+        "Expected size for first two dimensions of batch2 tensor to be: [", batch, ", ", self.size(2), "] but got: [",
+        mat2.size(0), ", ", mat2.size(1), "].");
+    TORCH_CHECK(self.scalar_type() == mat2.scalar_type(), "expected scalar type ", self.scalar_type(),
+        " but found ", mat2.scalar_type());
+    const at::Tensor result = at::empty({batch, self.size(1), mat2.size(2)}, self.options());
+    if (result.numel() == 0) {
+        return result;
+    }
+    materialize_fills(self, mat2);
+    launch([out = cpu_alias(result), a = cpu_alias(self), b = cpu_alias(mat2), device = self.device()]() {
+        FOO_TRACE_SCOPE_SIZES("aten::bmm", device, out.sizes(), out.scalar_type());
+        if (out.scalar_type() != at::kFloat) {
+            at::bmm_out(out, a, b);
+            return;
+        }
+        auto multiply = [&](int64_t begin, int64_t end) {
+            for (int64_t i = begin; i < end; ++i) {
+                gemm_stub(out[i], a[i], pack_b(b[i]).const_data_ptr<float>(), 1.0f, false);
+            }
+        };
+        const int64_t work = a.size(1) * a.size(2) * b.size(2);
+        if (work >= kParallelBatchWork) {
+            // Not through parallel_for, which would run the GEMMs as a parallel
+            // region and keep them from using the other threads.
+            multiply(0, out.size(0));
+        } else {
+            device_parallel_for(0, out.size(0), std::max<int64_t>(1, kParallelBatchWork / std::max<int64_t>(work, 1)),
+                multiply);
+        }
+    });
+    return result;
+}
+
+} // namespace
+
+bool is_weight_prepacking()
+{
+    return prepack_enabled().load(std::memory_order_relaxed);
+}
+
+void set_weight_prepacking(bool enabled)
+{
+    prepack_enabled().store(enabled, std::memory_order_relaxed);
+}
+
+void prepack_weight(const at::Tensor& weight)
+{
+    TORCH_CHECK(weight.is_privateuseone(), "prepack_weight expects a foo tensor, got one on ", weight.device());
+    TORCH_CHECK(!weight.is_inference(), "prepack_weight can't track writes to inference tensors");
+    prepack_cache().mark(weight.storage().getIntrusivePtr());
+}
+
+void clear_prepacked_weights()
+{
+    prepack_cache().clear();
+}
+
+TORCH_LIBRARY_IMPL(aten, PrivateUse1, m)
+{
+    m.impl("mm", TORCH_FN(foo_mm));
+    m.impl("addmm", TORCH_FN(foo_addmm));
+    m.impl("bmm", TORCH_FN(foo_bmm));
+}
+
+} // namespace foo_core
@@ -0,0 +1,118 @@
+#include "FooParallel.h"
+
+#include <c10/core/thread_pool.h>
+#include <c10/util/Exception.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace foo_core {
+
+namespace {
+
+// Set while the thread runs a chunk, so nested calls don't wait on the pool
+// they are running on.
+thread_local bool in_parallel_chunk = false;
+
+// One pool per NUMA node, shared by the devices on it. The calling thread runs
+// a chunk too, so a pool has a thread less than its node has cores.
+std::vector<std::shared_ptr<c10::ThreadPool>> make_node_pools()
+{
+    const std::vector<FooDeviceTopology>& topology = device_topology();
+    std::map<int, std::shared_ptr<c10::ThreadPool>> by_node;
+    std::vector<std::shared_ptr<c10::ThreadPool>> pools;
+    for (size_t device = 0; device < topology.size(); ++device) {
+        std::shared_ptr<c10::ThreadPool>& pool = by_node[topology[device].numa_node];
+        if (!pool) {
+            const int threads = std::max<int>(1, static_cast<int>(topology[device].cpus.size()) - 1);
+            const auto index = static_cast<c10::DeviceIndex>(device);
+            pool = std::make_shared<c10::ThreadPool>(threads, -1, [index]() { bind_thread_to_device(index); });
+        }
+        pools.push_back(pool);
+    }
+    return pools;
+}
+
+// Intentionally leaked, like the stream workers that use them.
+c10::ThreadPool& node_pool(c10::DeviceIndex device)
+{
+    static const auto* pools = new std::vector<std::shared_ptr<c10::ThreadPool>>(make_node_pools());
+    return *(*pools)[device];
+}
+
+struct ChunkGuard {
+    ChunkGuard() : previous(in_parallel_chunk)
+    {
+        in_parallel_chunk = true;
+    }
+    ~ChunkGuard()
+    {
+        in_parallel_chunk = previous;
+    }
+    const bool previous;
+};
+
+} // namespace
+
+void node_parallel_for(c10::DeviceIndex device, int64_t begin, int64_t end, int64_t grain_size,
+    const std::function<void(int64_t, int64_t)>& f)
+{
+    TORCH_CHECK(grain_size >= 0, "node_parallel_for: grain_size must be non-negative");
+    if (begin >= end) {
+        return;
+    }
+    c10::ThreadPool& pool = node_pool(device);
+    const int64_t range = end - begin;
+    const int64_t max_tasks = static_cast<int64_t>(pool.size()) + 1;
+    const int64_t tasks = std::min(max_tasks, (range + std::max<int64_t>(grain_size, 1) - 1)
+        / std::max<int64_t>(grain_size, 1));
+    if (in_parallel_chunk || tasks <= 1) {
+        const ChunkGuard guard;
+        f(begin, end);
+        return;
+    }
+    const int64_t chunk = (range + tasks - 1) / tasks;
+
+    struct State {
+        std::mutex mutex;
+        std::condition_variable done;
+        int64_t remaining;
+        std::exception_ptr error;
+    } state;
+    state.remaining = tasks;
+    auto run_chunk = [&](int64_t task) {
+        try {
+            const ChunkGuard guard;
+            const int64_t chunk_begin = begin + task * chunk;
+            if (chunk_begin < end) {
+                f(chunk_begin, std::min(end, chunk_begin + chunk));
+            }
+        } catch (...) {
+            const std::lock_guard<std::mutex> lock(state.mutex);
+            if (!state.error) {
+                state.error = std::current_exception();
+            }
+        }
+        const std::lock_guard<std::mutex> lock(state.mutex);
+        if (--state.remaining == 0) {
+            state.done.notify_all();
+        }
+    };
+    for (int64_t task = 1; task < tasks; ++task) {
+        pool.run([&run_chunk, task]() { run_chunk(task); });
+    }
+    run_chunk(0);
+    std::unique_lock<std::mutex> lock(state.mutex);
+    state.done.wait(lock, [&]() { return state.remaining == 0; });
+    if (state.error) {
+        std::rethrow_exception(state.error);
+    }
+}
+
+} // namespace foo_core
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "FooTopology.h"
+#include "foo_core/device.h"
+
+#include <ATen/Parallel.h>
+
+#include <cstdint>
+#include <functional>
+
+namespace foo_core {
+
+// ======================================
+// ========== Parallel kernels ==========
+// ======================================
+
+// Runs f over [begin, end) in chunks of at least grain_size on the pool of the
+// node of `device`. Calls made from inside a chunk run serially, like nested
+// at::parallel_for.
+void node_parallel_for(c10::DeviceIndex device, int64_t begin, int64_t end, int64_t grain_size,
+    const std::function<void(int64_t, int64_t)>& f);
+
+// at::parallel_for for foo kernels. ATen's intra-op pool is shared by the
+// whole process and sized for every core of the host, so on multi node hosts
+// foo kernels run on a pool per node instead, whose threads are bound to the
+// node once when they start: the work stays next to the memory of the device
+// and a node isn't given more threads than it has cores. Single node hosts use
+// ATen's pool. Code that goes through ATen's own kernels (TensorIterator on
+// CPU aliases, the CPU fallback) still runs on ATen's pool.
+template <typename F>
+void device_parallel_for(int64_t begin, int64_t end, int64_t grain_size, const F& f)
+{
+    if (!is_multi_node()) {
+        at::parallel_for(begin, end, grain_size, f);
+        return;
+    }
+    node_parallel_for(current_device(), begin, end, grain_size, f);
+}
+
+} // namespace foo_core
@@ -0,0 +1,280 @@
+#include <ATen/core/Tensor.h>
+#include <ATen/core/dispatch/Dispatcher.h>
+#include <ATen/core/stack.h>
+#include <ATen/native/Resize.h>
+#include <ATen/ops/empty.h>
+#include <ATen/ops/empty_like.h>
+#include <ATen/ops/empty_strided.h>
+#include <c10/core/DispatchKey.h>
+#include <c10/core/DispatchKeySet.h>
+#include <c10/util/Exception.h>
+#include <torch/library.h>
+
+#include <cstring>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "FooAlias.h"
+#include "FooDeviceGuard.h"
+#include "FooFallback.h"
+#include "FooLazy.h"
+#include "FooPointwiseOps.h"
+#include "FooStorageImpl.h"
+#include "FooTrace.h"
+#include "foo_core/stream.h"
+
+namespace foo_core {
+
+// One boxed kernel runs every op of FooPointwiseOps.h. On the host it checks
+// the arguments and computes the result's shape, dtype and strides with the
+// op's Meta kernel, which also raises the errors the op would (bad broadcast,
+// a result type an in-place op can't cast to, ...). The computation itself is
+// enqueued on the current stream, where the op's CPU kernel runs on CPU aliases
+// of the foo tensors: broadcasting, type promotion, vectorization and
+// parallelism are ATen's, the memory is foo's and nothing is copied. Errors of
+// the CPU kernel itself (e.g. a dtype it doesn't support) surface at the next
+// synchronization, like errors of asynchronous CUDA kernels.
+namespace {
+
+enum class PointwiseKind {
+    Functional, // runs the out= overload into a new foo tensor
+    Inplace,
+    Out,
+    ViaInplace, // copies self into a new foo tensor and runs the in-place op on it
+};
+
+struct PointwiseOp {
+    PointwiseKind kind;
+    // What runs on the CPU aliases: the op itself, or its out= or in-place
+    // overload for functional ops.
+    c10::OperatorHandle cpu_op;
+    // The argument the op writes, for in-place and out= ops.
+    std::optional<size_t> mutable_index;
+    std::string name;
+};
+
+// "add.Tensor" -> the aten::add.Tensor operator.
+c10::OperatorHandle find_aten_op(const char* name)
+{
+    const char* dot = std::strchr(name, '.');
+    const std::string op_name = dot == nullptr ? std::string(name) : std::string(name, dot);
+    return c10::Dispatcher::singleton().findSchemaOrThrow(("aten::" + op_name).c_str(), dot == nullptr ? "" : dot + 1);
+}
+
+std::optional<size_t> find_mutable_argument(const c10::FunctionSchema& schema)
+{
+    for (size_t idx = 0; idx < schema.arguments().size(); ++idx) {
+        const c10::AliasInfo* alias_info = schema.arguments()[idx].alias_info();
+        if (alias_info && alias_info->isWrite()) {
+            return idx;
+        }
+    }
+    return std::nullopt;
+}
+
+void add_pointwise_op(std::unordered_map<c10::OperatorName, PointwiseOp>& ops, const char* name, const char* cpu_name,
+    PointwiseKind kind)
+{
+    const c10::OperatorHandle op = find_aten_op(name);
+    const c10::OperatorHandle cpu_op = find_aten_op(cpu_name);
+    const std::optional<size_t> mutable_index = find_mutable_argument(op.schema());
+    // The out= overload takes the arguments of the functional op, then `out`.
+    TORCH_INTERNAL_ASSERT(kind != PointwiseKind::Functional
+        || (cpu_op.schema().arguments().size() == op.schema().arguments().size() + 1
+            && find_mutable_argument(cpu_op.schema()) == op.schema().arguments().size()));
+    TORCH_INTERNAL_ASSERT(mutable_index.has_value() == (kind == PointwiseKind::Inplace || kind == PointwiseKind::Out));
+    ops.emplace(op.operator_name(), PointwiseOp{kind, cpu_op, mutable_index, c10::toString(op.operator_name())});
+}
+
+const std::unordered_map<c10::OperatorName, PointwiseOp>& pointwise_ops()
+{
+    static const std::unordered_map<c10::OperatorName, PointwiseOp> ops = [] {
+        std::unordered_map<c10::OperatorName, PointwiseOp> ops;
+#define FOO_ADD_POINTWISE_OP(functional, out)                          \
+    add_pointwise_op(ops, functional, out, PointwiseKind::Functional); \
+    add_pointwise_op(ops, out, out, PointwiseKind::Out);
+#define FOO_ADD_POINTWISE_INPLACE_OP(inplace) add_pointwise_op(ops, inplace, inplace, PointwiseKind::Inplace);
+#define FOO_ADD_POINTWISE_OP_VIA_INPLACE(functional, inplace) \
+    add_pointwise_op(ops, functional, inplace, PointwiseKind::ViaInplace);
+        FOO_FORALL_POINTWISE_OPS(FOO_ADD_POINTWISE_OP)
+        FOO_FORALL_POINTWISE_INPLACE_OPS(FOO_ADD_POINTWISE_INPLACE_OP)
+        FOO_FORALL_POINTWISE_OPS_VIA_INPLACE(FOO_ADD_POINTWISE_OP_VIA_INPLACE)
+#undef FOO_ADD_POINTWISE_OP
+#undef FOO_ADD_POINTWISE_INPLACE_OP
+#undef FOO_ADD_POINTWISE_OP_VIA_INPLACE
+        return ops;
+    }();
+    return ops;
+}
+
+// The device the op runs on natively, or nothing if the fallback has to take
+// it: the tensor arguments must be foo tensors on one device, or 0-dim CPU
+// tensors (scalars) other than the one the op writes.
+std::optional<c10::Device> native_device(const c10::OperatorHandle& op, const PointwiseOp& pointwise,
+    c10::ArrayRef<c10::IValue> arguments)
+{
+    if (pointwise.kind != PointwiseKind::ViaInplace && !op.hasComputedKernelForDispatchKey(c10::DispatchKey::Meta)) {
+        return std::nullopt;
+    }
+    std::optional<c10::Device> device;
+    for (size_t idx = 0; idx < arguments.size(); ++idx) {
+        if (!arguments[idx].isTensor()) {
+            continue;
+        }
+        const at::Tensor& tensor = arguments[idx].toTensor();
+        if (!tensor.defined()) {
+            continue;
+        }
+        if (tensor.is_privateuseone()) {
+            if (tensor.is_conj() || tensor.is_neg() || (device.has_value() && tensor.device() != *device)) {
+                return std::nullopt;
+            }
+            device = tensor.device();
+        } else if (!tensor.is_cpu() || tensor.dim() != 0 || idx == pointwise.mutable_index) {
+            return std::nullopt;
+        }
+    }
+    return device;
+}
+
+at::Tensor to_meta(const at::Tensor& tensor)
+{
+    return at::empty_strided(tensor.sizes(), tensor.strides(), tensor.options().device(c10::kMeta));
+}
+
+// Runs the Meta kernel of `op` on `arguments` and returns the foo tensor the
+// op writes: a new one for functional ops, the argument for the others. Out
+// arguments are resized if needed. Returns an undefined tensor if the Meta
+// kernel turns out not to be implemented.
+at::Tensor prepare_result(const c10::OperatorHandle& op, const PointwiseOp& pointwise,
+    const std::vector<c10::IValue>& arguments, c10::Device device)
+{
+    if (pointwise.kind == PointwiseKind::ViaInplace) {
+        return at::empty_like(arguments[0].toTensor());
+    }
+    torch::jit::Stack meta_stack;
+    meta_stack.reserve(arguments.size());
+    for (const c10::IValue& ivalue : arguments) {
+        const bool is_foo = ivalue.isTensor() && ivalue.toTensor().is_privateuseone();
+        meta_stack.push_back(is_foo ? c10::IValue(to_meta(ivalue.toTensor())) : ivalue);
+    }
+    if (pointwise.kind == PointwiseKind::Out) {
+        // An empty out tensor lets the Meta kernel pick the result shape
+        // without warning about resizing.
+        const at::Tensor& out = arguments[*pointwise.mutable_index].toTensor();
+        meta_stack[*pointwise.mutable_index] = at::empty({0}, out.options().device(c10::kMeta));
+    }
+    try {
+        op.redispatchBoxed(c10::DispatchKeySet(c10::DispatchKey::Meta), &meta_stack);
+    } catch (const c10::NotImplementedError&) {
+        // A composite Meta kernel calling an op that has none.
+        return at::Tensor();
+    }
+    const at::Tensor meta = meta_stack.back().toTensor();
+    switch (pointwise.kind) {
+    case PointwiseKind::Functional:
+        return at::empty_strided(meta.sizes(), meta.strides(), meta.options().device(device));
+    case PointwiseKind::Out: {
+        const at::Tensor& out = arguments[*pointwise.mutable_index].toTensor();
+        at::native::resize_output(out, meta.sizes());
+        return out;
+    }
+    default:
+        return arguments[*pointwise.mutable_index].toTensor();
+    }
+}
+
+// The argument as the CPU kernel sees it. CPU scalars are copied, the caller
+// may change them before the kernel runs; wrapped numbers are temporaries.
+c10::IValue to_cpu_argument(const c10::IValue& ivalue)
+{
+    if (!ivalue.isTensor()) {
+        return ivalue;
+    }
+    const at::Tensor& tensor = ivalue.toTensor();
+    if (!tensor.defined() || tensor.unsafeGetTensorImpl()->is_wrapped_number()) {
+        return ivalue;
+    }
+    return tensor.is_privateuseone() ? cpu_alias(tensor) : tensor.clone();
+}
+
+void foo_pointwise(const c10::OperatorHandle& op, torch::jit::Stack* stack)
+{
+    // In lazy mode, elementwise ops are recorded instead of run.
+    if (lazy_record(op, stack)) {
+        return;
+    }
+    const PointwiseOp& pointwise = pointwise_ops().at(op.operator_name());
+    const size_t num_arguments = op.schema().arguments().size();
+    const std::optional<c10::Device> device = native_device(op, pointwise, torch::jit::last(*stack, num_arguments));
+    if (!device.has_value()) {
+        cpu_fallback(op, stack);
+        return;
+    }
+    flush_lazy();
+    const FooDeviceGuard guard(*device);
+    std::vector<c10::IValue> arguments = torch::jit::pop(*stack, num_arguments);
+    const at::Tensor result = prepare_result(op, pointwise, arguments, *device);
+    if (!result.defined()) {
+        stack->insert(stack->end(), arguments.begin(), arguments.end());
+        cpu_fallback(op, stack);
+        return;
+    }
+
+    for (size_t idx = 0; idx < num_arguments; ++idx) {
+        if (idx == pointwise.mutable_index && pointwise.kind == PointwiseKind::Out) {
+            materialize_fill_for_write(result);
+        } else if (arguments[idx].isTensor() && arguments[idx].toTensor().is_privateuseone()) {
+            materialize_fill(arguments[idx].toTensor());
+        }
+    }
+
+    if (result.numel() != 0) {
+        std::vector<c10::IValue> cpu_arguments;
+        cpu_arguments.reserve(num_arguments + 1);
+        for (const c10::IValue& ivalue : arguments) {
+            cpu_arguments.push_back(to_cpu_argument(ivalue));
+        }
+        const at::Tensor cpu_result = cpu_alias(result);
+        at::Tensor cpu_source;
+        if (pointwise.kind == PointwiseKind::Functional) {
+            cpu_arguments.emplace_back(cpu_result);
+        } else if (pointwise.kind == PointwiseKind::ViaInplace) {
+            cpu_source = cpu_arguments[0].toTensor();
+            cpu_arguments[0] = cpu_result;
+        }
+        launch([cpu_op = pointwise.cpu_op, name = pointwise.name.c_str(), device = *device,
+                   cpu_arguments = std::move(cpu_arguments), cpu_result, cpu_source]() {
+            FOO_TRACE_SCOPE_SIZES(name, device, cpu_result.sizes(), cpu_result.scalar_type());
+            if (cpu_source.defined()) {
+                cpu_result.copy_(cpu_source);
+            }
+            torch::jit::Stack cpu_stack(cpu_arguments);
+            cpu_op.redispatchBoxed(c10::DispatchKeySet(c10::DispatchKey::CPU), &cpu_stack);
+        });
+    }
+    torch::jit::push(*stack, result);
+}
+
+} // namespace
+
+// The elementwise ops of FooPointwiseOps.h, instead of the CPU fallback.
+TORCH_LIBRARY_IMPL(aten, PrivateUse1, m)
+{
+#define FOO_REGISTER_POINTWISE_OP(name) m.impl(name, torch::CppFunction::makeFromBoxedFunction<&foo_pointwise>());
+#define FOO_REGISTER_POINTWISE_OP_PAIR(name, other_name) \
+    FOO_REGISTER_POINTWISE_OP(name)                      \
+    FOO_REGISTER_POINTWISE_OP(other_name)
+#define FOO_REGISTER_POINTWISE_OP_VIA_INPLACE(name, inplace_name) FOO_REGISTER_POINTWISE_OP(name)
+    FOO_FORALL_POINTWISE_OPS(FOO_REGISTER_POINTWISE_OP_PAIR)
+    FOO_FORALL_POINTWISE_INPLACE_OPS(FOO_REGISTER_POINTWISE_OP)
+    FOO_FORALL_POINTWISE_OPS_VIA_INPLACE(FOO_REGISTER_POINTWISE_OP_VIA_INPLACE)
+#undef FOO_REGISTER_POINTWISE_OP_VIA_INPLACE
+#undef FOO_REGISTER_POINTWISE_OP_PAIR
+#undef FOO_REGISTER_POINTWISE_OP
+}
+
+} // namespace foo_core
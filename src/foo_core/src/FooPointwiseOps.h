@@ -0,0 +1,137 @@
+#pragma once
+
+// =====================================
+// ======= Native pointwise ops ========
+// =====================================
+
+// The elementwise ATen ops that run natively on foo tensors (FooPointwise.cpp)
+// instead of going through the CPU fallback. Adding an op is a line here: the
+// kernel is generic over the schema and runs the ATen CPU kernel of the op,
+// TensorIterator and all, on CPU aliases of the foo tensors from a stream task.
+// Every op needs a Meta kernel, which computes the shape, dtype and layout of
+// the result on the host.
+
+// _(functional, out): a functional op and the out= overload it runs on the CPU
+// into the foo result. Both are registered.
+#define FOO_FORALL_POINTWISE_OPS(_)                                              \
+    /* unary */                                                                  \
+    _("abs", "abs.out")                                                          \
+    _("neg", "neg.out")                                                          \
+    _("sgn", "sgn.out")                                                          \
+    _("sign", "sign.out")                                                        \
+    _("reciprocal", "reciprocal.out")                                            \
+    _("exp", "exp.out")                                                          \
+    _("exp2", "exp2.out")                                                        \
+    _("expm1", "expm1.out")                                                      \
+    _("log", "log.out")                                                          \
+    _("log2", "log2.out")                                                        \
+    _("log10", "log10.out")                                                      \
+    _("log1p", "log1p.out")                                                      \
+    _("sqrt", "sqrt.out")                                                        \
+    _("rsqrt", "rsqrt.out")                                                      \
+    _("sin", "sin.out")                                                          \
+    _("cos", "cos.out")                                                          \
+    _("tan", "tan.out")                                                          \
+    _("asin", "asin.out")                                                        \
+    _("acos", "acos.out")                                                        \
+    _("atan", "atan.out")                                                        \
+    _("sinh", "sinh.out")                                                        \
+    _("cosh", "cosh.out")                                                        \
+    _("tanh", "tanh.out")                                                        \
+    _("erf", "erf.out")                                                          \
+    _("erfc", "erfc.out")                                                        \
+    _("ceil", "ceil.out")                                                        \
+    _("floor", "floor.out")                                                      \
+    _("round", "round.out")                                                      \
+    _("trunc", "trunc.out")                                                      \
+    _("frac", "frac.out")                                                        \
+    _("nan_to_num", "nan_to_num.out")                                            \
+    _("logical_not", "logical_not.out")                                          \
+    _("bitwise_not", "bitwise_not.out")                                          \
+    /* activations and their backward */                                         \
+    _("sigmoid", "sigmoid.out")                                                  \
+    _("gelu", "gelu.out")                                                        \
+    _("silu", "silu.out")                                                        \
+    _("mish", "mish.out")                                                        \
+    _("elu", "elu.out")                                                          \
+    _("leaky_relu", "leaky_relu.out")                                            \
+    _("hardtanh", "hardtanh.out")                                                \
+    _("hardsigmoid", "hardsigmoid.out")                                          \
+    _("hardswish", "hardswish.out")                                              \
+    _("softplus", "softplus.out")                                                \
+    _("threshold_backward", "threshold_backward.grad_input")                     \
+    _("sigmoid_backward", "sigmoid_backward.grad_input")                         \
+    _("tanh_backward", "tanh_backward.grad_input")                               \
+    _("gelu_backward", "gelu_backward.grad_input")                               \
+    _("silu_backward", "silu_backward.grad_input")                               \
+    /* not elementwise, but shaped like their inputs (see FooReduce.cpp) */      \
+    _("_softmax_backward_data", "_softmax_backward_data.out")                    \
+    _("_log_softmax_backward_data", "_log_softmax_backward_data.out")            \
+    /* binary */                                                                 \
+    _("add.Tensor", "add.out")                                                   \
+    _("sub.Tensor", "sub.out")                                                   \
+    _("mul.Tensor", "mul.out")                                                   \
+    _("div.Tensor", "div.out")                                                   \
+    _("div.Tensor_mode", "div.out_mode")                                         \
+    _("remainder.Tensor", "remainder.Tensor_out")                                \
+    _("fmod.Tensor", "fmod.Tensor_out")                                          \
+    _("pow.Tensor_Tensor", "pow.Tensor_Tensor_out")                              \
+    _("pow.Tensor_Scalar", "pow.Tensor_Scalar_out")                              \
+    _("atan2", "atan2.out")                                                      \
+    _("copysign.Tensor", "copysign.out")                                         \
+    _("maximum", "maximum.out")                                                  \
+    _("minimum", "minimum.out")                                                  \
+    _("bitwise_and.Tensor", "bitwise_and.Tensor_out")                            \
+    _("bitwise_or.Tensor", "bitwise_or.Tensor_out")                              \
+    _("bitwise_xor.Tensor", "bitwise_xor.Tensor_out")                            \
+    _("logical_and", "logical_and.out")                                          \
+    _("logical_or", "logical_or.out")                                            \
+    _("logical_xor", "logical_xor.out")                                          \
+    _("eq.Tensor", "eq.Tensor_out")                                              \
+    _("ne.Tensor", "ne.Tensor_out")                                              \
+    _("lt.Tensor", "lt.Tensor_out")                                              \
+    _("le.Tensor", "le.Tensor_out")                                              \
+    _("gt.Tensor", "gt.Tensor_out")                                              \
+    _("ge.Tensor", "ge.Tensor_out")                                              \
+    _("eq.Scalar", "eq.Scalar_out")                                              \
+    _("ne.Scalar", "ne.Scalar_out")                                              \
+    _("lt.Scalar", "lt.Scalar_out")                                              \
+    _("le.Scalar", "le.Scalar_out")                                              \
+    _("gt.Scalar", "gt.Scalar_out")                                              \
+    _("ge.Scalar", "ge.Scalar_out")                                              \
+    /* ternary */                                                                \
+    _("where.self", "where.self_out")                                            \
+    _("addcmul", "addcmul.out")                                                  \
+    _("addcdiv", "addcdiv.out")                                                  \
+    _("lerp.Scalar", "lerp.Scalar_out")                                          \
+    _("lerp.Tensor", "lerp.Tensor_out")                                          \
+    _("clamp", "clamp.out")                                                      \
+    _("clamp.Tensor", "clamp.Tensor_out")                                        \
+    _("clamp_min", "clamp_min.out")                                              \
+    _("clamp_max", "clamp_max.out")
+
+// _(inplace): in-place ops, run as they are on the CPU aliases.
+#define FOO_FORALL_POINTWISE_INPLACE_OPS(_)                                      \
+    _("abs_") _("neg_") _("sgn_") _("sign_") _("reciprocal_")                    \
+    _("exp_") _("exp2_") _("expm1_") _("log_") _("log2_") _("log10_")            \
+    _("log1p_") _("sqrt_") _("rsqrt_") _("sin_") _("cos_") _("tan_")             \
+    _("asin_") _("acos_") _("atan_") _("sinh_") _("cosh_") _("tanh_")            \
+    _("erf_") _("erfc_") _("ceil_") _("floor_") _("round_") _("trunc_")          \
+    _("frac_") _("nan_to_num_") _("logical_not_") _("bitwise_not_")              \
+    _("relu_") _("sigmoid_") _("gelu_") _("silu_") _("mish_") _("elu_")          \
+    _("leaky_relu_") _("hardtanh_") _("hardsigmoid_") _("hardswish_")            \
+    _("add_.Tensor") _("sub_.Tensor") _("mul_.Tensor") _("div_.Tensor")          \
+    _("div_.Tensor_mode") _("remainder_.Tensor") _("fmod_.Tensor")               \
+    _("pow_.Tensor") _("pow_.Scalar") _("atan2_") _("copysign_.Tensor")          \
+    _("bitwise_and_.Tensor") _("bitwise_or_.Tensor") _("bitwise_xor_.Tensor")    \
+    _("logical_and_") _("logical_or_") _("logical_xor_")                         \
+    _("eq_.Tensor") _("ne_.Tensor") _("lt_.Tensor") _("le_.Tensor")              \
+    _("gt_.Tensor") _("ge_.Tensor") _("eq_.Scalar") _("ne_.Scalar")              \
+    _("lt_.Scalar") _("le_.Scalar") _("gt_.Scalar") _("ge_.Scalar")              \
+    _("addcmul_") _("addcdiv_") _("lerp_.Scalar") _("lerp_.Tensor")              \
+    _("clamp_") _("clamp_.Tensor") _("clamp_min_") _("clamp_max_")
+
+// _(functional, inplace): functional ops without an out= overload, run by
+// copying the input into the foo result and applying the in-place op there.
+#define FOO_FORALL_POINTWISE_OPS_VIA_INPLACE(_) \
+    _("relu", "relu_")
@@ -0,0 +1,608 @@
+#include "foo_core/distributed.h"
+
+#include <ATen/core/ivalue.h>
+#include <ATen/ops/from_blob.h>
+#include <ATen/ops/maximum.h>
+#include <ATen/ops/minimum.h>
+#include <c10/util/Exception.h>
+#include <torch/csrc/distributed/c10d/Work.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FooAlias.h"
+#include "FooDeviceGuard.h"
+#include "FooLazy.h"
+#include "FooStorageImpl.h"
+#include "FooStream.h"
+#include "FooTrace.h"
+#include "foo_core/device.h"
+
+namespace foo_core {
+
+namespace {
+
+constexpr size_t kCacheLine = 64;
+constexpr size_t kDefaultSlotBytes = size_t{4} << 20;
+// Enough for one element of every dtype per rank in reduce_scatter.
+constexpr size_t kMinSlotBytes = 4096;
+
+size_t slot_bytes_from_env()
+{
+    const char* env = std::getenv("TORCH_FOO_SHM_SLOT_BYTES");
+    if (env == nullptr) {
+        return kDefaultSlotBytes;
+    }
+    const long long requested = std::atoll(env);
+    if (requested <= 0) {
+        TORCH_WARN("Ignoring TORCH_FOO_SHM_SLOT_BYTES='", env, "', expected a positive number of bytes");
+        return kDefaultSlotBytes;
+    }
+    const size_t bytes = std::max(static_cast<size_t>(requested), kMinSlotBytes);
+    return (bytes + kCacheLine - 1) / kCacheLine * kCacheLine;
+}
+
+std::vector<uint8_t> to_bytes(const std::string& str)
+{
+    return std::vector<uint8_t>(str.begin(), str.end());
+}
+
+std::string from_bytes(const std::vector<uint8_t>& bytes)
+{
+    return std::string(bytes.begin(), bytes.end());
+}
+
+// ===== Shared memory arena =====
+
+// A POSIX shared memory segment mapped by every rank: an arrival counter per
+// rank, each on its own cache line, then a slot of slot_bytes per rank and one
+// more for reduced results. Rank 0 creates it and publishes its name and slot
+// size through the store, so the ranks agree on the layout whatever their
+// environments; it is unlinked as soon as every rank has mapped it, so it goes
+// away with the processes whatever happens to them.
+class SharedArena {
+public:
+    SharedArena(const c10::intrusive_ptr<c10d::Store>& store, int rank, int size)
+        : rank_(rank), size_(size)
+    {
+        static_assert(std::atomic<uint64_t>::is_always_lock_free, "the barrier needs address-free atomics");
+        if (rank_ == 0) {
+            slot_bytes_ = slot_bytes_from_env();
+            store->set("foo_shm/slot_bytes", to_bytes(std::to_string(slot_bytes_)));
+        } else {
+            slot_bytes_ = std::stoull(from_bytes(store->get("foo_shm/slot_bytes")));
+        }
+        length_ = size_ * kCacheLine + (size_ + 1) * slot_bytes_;
+
+        char host[256] = {};
+        ::gethostname(host, sizeof(host) - 1);
+        std::string name;
+        int fd = -1;
+        if (rank_ == 0) {
+            static std::atomic<int> counter{0};
+            name = "/torch_foo_" + std::to_string(::getpid()) + "_" + std::to_string(counter++);
+            fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+            TORCH_CHECK(fd >= 0, "ProcessGroupFoo: can't create shared memory ", name, ": ", std::strerror(errno));
+            if (::ftruncate(fd, static_cast<off_t>(length_)) != 0) {
+                const int error = errno;
+                ::close(fd);
+                ::shm_unlink(name.c_str());
+                TORCH_CHECK(false, "ProcessGroupFoo: can't size shared memory to ", length_, " bytes: ",
+                    std::strerror(error));
+            }
+            store->set("foo_shm/host", to_bytes(host));
+            store->set("foo_shm/name", to_bytes(name));
+        } else {
+            const std::string root_host = from_bytes(store->get("foo_shm/host"));
+            TORCH_CHECK(root_host == host, "ProcessGroupFoo only connects processes on one host, but rank ", rank_,
+                " runs on ", host, " and rank 0 on ", root_host);
+            name = from_bytes(store->get("foo_shm/name"));
+            fd = ::shm_open(name.c_str(), O_RDWR, 0600);
+            TORCH_CHECK(fd >= 0, "ProcessGroupFoo: can't open shared memory ", name, ": ", std::strerror(errno));
+        }
+        base_ = ::mmap(nullptr, length_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        const int error = errno;
+        ::close(fd);
+        if (base_ == MAP_FAILED && rank_ == 0) {
+            ::shm_unlink(name.c_str());
+        }
+        TORCH_CHECK(base_ != MAP_FAILED, "ProcessGroupFoo: can't map shared memory: ", std::strerror(error));
+
+        store->set("foo_shm/mapped/" + std::to_string(rank_), to_bytes("1"));
+        if (rank_ == 0) {
+            std::vector<std::string> keys;
+            for (int r = 0; r < size_; ++r) {
+                keys.push_back("foo_shm/mapped/" + std::to_string(r));
+            }
+            store->wait(keys);
+            ::shm_unlink(name.c_str());
+        }
+    }
+
+    ~SharedArena()
+    {
+        ::munmap(base_, length_);
+    }
+
+    SharedArena(const SharedArena&) = delete;
+    SharedArena& operator=(const SharedArena&) = delete;
+
+    size_t slot_bytes() const
+    {
+        return slot_bytes_;
+    }
+
+    // The slot of rank `r` viewed as `numel` elements of `dtype` from byte
+    // `offset` on; `r` == size for the result slot.
+    at::Tensor slot(int r, c10::ScalarType dtype, int64_t numel, size_t offset = 0) const
+    {
+        char* data = static_cast<char*>(base_) + size_ * kCacheLine + r * slot_bytes_ + offset;
+        return at::from_blob(data, {numel}, at::TensorOptions().dtype(dtype));
+    }
+
+    at::Tensor result(c10::ScalarType dtype, int64_t numel) const
+    {
+        return slot(size_, dtype, numel);
+    }
+
+    // Returns once every rank has called barrier(seq). Ranks call it with the
+    // same increasing sequence.
+    void barrier(uint64_t seq, std::chrono::steady_clock::time_point deadline) const
+    {
+        constexpr int kSpinsPerCheck = 1024;
+        arrived(rank_).store(seq, std::memory_order_release);
+        for (int r = 0; r < size_; ++r) {
+            int spins = 0;
+            while (arrived(r).load(std::memory_order_acquire) < seq) {
+                if (++spins < kSpinsPerCheck) {
+                    continue;
+                }
+                spins = 0;
+                std::this_thread::yield();
+                TORCH_CHECK(std::chrono::steady_clock::now() < deadline, "ProcessGroupFoo: timed out waiting for rank ",
+                    r, " in a collective");
+            }
+        }
+    }
+
+private:
+    std::atomic<uint64_t>& arrived(int r) const
+    {
+        return *reinterpret_cast<std::atomic<uint64_t>*>(static_cast<char*>(base_) + r * kCacheLine);
+    }
+
+    const int rank_;
+    const int size_;
+    size_t slot_bytes_;
+    size_t length_;
+    void* base_ = nullptr;
+};
+
+// ===== Work =====
+
+// The collective completes its future from the stream task, so waiting on the
+// work blocks the host while the future also orders the streams of its users.
+class FooWork : public c10d::Work {
+public:
+    FooWork(int rank, c10d::OpType type, c10::intrusive_ptr<c10::ivalue::Future> future)
+        : c10d::Work(rank, type), future_(std::move(future))
+    {}
+
+    bool isCompleted() override
+    {
+        return future_->completed();
+    }
+
+    std::exception_ptr exception() const override
+    {
+        return future_->exception_ptr();
+    }
+
+    // The collective enforces the process group timeout itself; a timeout here
+    // only bounds how long the caller waits for it.
+    bool wait(std::chrono::milliseconds timeout) override
+    {
+        if (timeout == kNoTimeout) {
+            future_->wait();
+        } else {
+            struct Done {
+                std::mutex mutex;
+                std::condition_variable cv;
+                bool done = false;
+            };
+            auto done = std::make_shared<Done>();
+            future_->addCallback([done](c10::ivalue::Future& /*future*/) {
+                std::lock_guard<std::mutex> lock(done->mutex);
+                done->done = true;
+                done->cv.notify_all();
+            });
+            std::unique_lock<std::mutex> lock(done->mutex);
+            TORCH_CHECK(done->cv.wait_for(lock, timeout, [&]() { return done->done; }),
+                "ProcessGroupFoo: timed out after ", timeout.count(), " ms waiting for a collective");
+        }
+        if (future_->hasError()) {
+            std::rethrow_exception(future_->exception_ptr());
+        }
+        return true;
+    }
+
+    c10::intrusive_ptr<c10::ivalue::Future> getFuture() override
+    {
+        return future_;
+    }
+
+private:
+    c10::intrusive_ptr<c10::ivalue::Future> future_;
+};
+
+// ===== Process group =====
+
+void combine(const at::Tensor& acc, const at::Tensor& other, c10d::ReduceOp::RedOpType op)
+{
+    switch (op) {
+        case c10d::ReduceOp::SUM:
+        case c10d::ReduceOp::AVG:
+            acc.add_(other);
+            return;
+        case c10d::ReduceOp::PRODUCT:
+            acc.mul_(other);
+            return;
+        case c10d::ReduceOp::MIN:
+            at::minimum_out(acc, acc, other);
+            return;
+        case c10d::ReduceOp::MAX:
+            at::maximum_out(acc, acc, other);
+            return;
+        case c10d::ReduceOp::BAND:
+            acc.bitwise_and_(other);
+            return;
+        case c10d::ReduceOp::BOR:
+            acc.bitwise_or_(other);
+            return;
+        case c10d::ReduceOp::BXOR:
+            acc.bitwise_xor_(other);
+            return;
+        default:
+            TORCH_CHECK(false, "ProcessGroupFoo: unsupported reduce op");
+    }
+}
+
+void check_reduce_op(const c10d::ReduceOp& op, const at::Tensor& tensor)
+{
+    const c10d::ReduceOp::RedOpType type = op.op_;
+    TORCH_CHECK(type != c10d::ReduceOp::PREMUL_SUM && type != c10d::ReduceOp::UNUSED,
+        "ProcessGroupFoo does not support this reduce op");
+    TORCH_CHECK(type != c10d::ReduceOp::AVG || at::isFloatingType(tensor.scalar_type())
+            || at::isComplexType(tensor.scalar_type()),
+        "ProcessGroupFoo: ReduceOp.AVG needs floating point tensors, got ", tensor.scalar_type());
+}
+
+class ProcessGroupFoo final : public c10d::Backend {
+public:
+    ProcessGroupFoo(const c10::intrusive_ptr<c10d::Store>& store, int rank, int size, std::chrono::milliseconds timeout)
+        : c10d::Backend(rank, size), arena_(store, rank, size), timeout_(timeout)
+    {}
+
+    const std::string getBackendName() const override
+    {
+        return "foo";
+    }
+
+    c10::intrusive_ptr<c10d::Work> broadcast(std::vector<at::Tensor>& tensors,
+        const c10d::BroadcastOptions& opts) override
+    {
+        check_single(tensors);
+        const int root = static_cast<int>(opts.rootRank);
+        TORCH_CHECK(root >= 0 && root < size_, "ProcessGroupFoo: invalid root rank ", root);
+        return enqueue("foo::broadcast", c10d::OpType::BROADCAST, tensors, tensors,
+            [this, root](const std::vector<at::Tensor>& /*in*/, const std::vector<at::Tensor>& out,
+                std::chrono::steady_clock::time_point deadline) {
+                const at::Tensor flat = out[0].view(-1);
+                for_each_chunk(flat, arena_.slot_bytes(), [&](int64_t begin, int64_t len) {
+                    const at::Tensor part = flat.narrow(0, begin, len);
+                    if (rank_ == root) {
+                        arena_.slot(root, part.scalar_type(), len).copy_(part);
+                    }
+                    next_barrier(deadline);
+                    if (rank_ != root) {
+                        part.copy_(arena_.slot(root, part.scalar_type(), len));
+                    }
+                    next_barrier(deadline);
+                });
+            });
+    }
+
+    c10::intrusive_ptr<c10d::Work> allreduce(std::vector<at::Tensor>& tensors,
+        const c10d::AllreduceOptions& opts) override
+    {
+        check_single(tensors);
+        check_reduce_op(opts.reduceOp, tensors[0]);
+        const c10d::ReduceOp::RedOpType op = opts.reduceOp.op_;
+        return enqueue("foo::allreduce", c10d::OpType::ALLREDUCE, tensors, tensors,
+            [this, op](const std::vector<at::Tensor>& /*in*/, const std::vector<at::Tensor>& out,
+                std::chrono::steady_clock::time_point deadline) {
+                const at::Tensor flat = out[0].view(-1);
+                const c10::ScalarType dtype = flat.scalar_type();
+                for_each_chunk(flat, arena_.slot_bytes(), [&](int64_t begin, int64_t len) {
+                    const at::Tensor part = flat.narrow(0, begin, len);
+                    arena_.slot(rank_, dtype, len).copy_(part);
+                    next_barrier(deadline);
+                    // Each rank reduces its share of the chunk into the result
+                    // slot, then every rank copies all of it.
+                    const int64_t share_begin = len * rank_ / size_;
+                    const int64_t share_len = len * (rank_ + 1) / size_ - share_begin;
+                    if (share_len > 0) {
+                        reduce_slots(arena_.result(dtype, len).narrow(0, share_begin, share_len), dtype, len,
+                            share_begin, 0, op);
+                    }
+                    next_barrier(deadline);
+                    part.copy_(arena_.result(dtype, len));
+                });
+            });
+    }
+
+    c10::intrusive_ptr<c10d::Work> allgather(std::vector<std::vector<at::Tensor>>& outputTensors,
+        std::vector<at::Tensor>& inputTensors, const c10d::AllgatherOptions& /*opts*/) override
+    {
+        check_single(inputTensors);
+        TORCH_CHECK(outputTensors.size() == 1, "ProcessGroupFoo takes one list of output tensors");
+        std::vector<at::Tensor>& outputs = outputTensors[0];
+        TORCH_CHECK(static_cast<int>(outputs.size()) == size_, "ProcessGroupFoo: allgather needs ", size_,
+            " output tensors, got ", outputs.size());
+        for (const at::Tensor& output : outputs) {
+            check_like(output, inputTensors[0], inputTensors[0].numel());
+        }
+        return enqueue("foo::allgather", c10d::OpType::ALLGATHER, inputTensors, outputs,
+            [this](const std::vector<at::Tensor>& in, const std::vector<at::Tensor>& out,
+                std::chrono::steady_clock::time_point deadline) { allgather_chunks(in[0], out, deadline); });
+    }
+
+    c10::intrusive_ptr<c10d::Work> _allgather_base(at::Tensor& outputBuffer, at::Tensor& inputBuffer,
+        const c10d::AllgatherOptions& /*opts*/) override
+    {
+        check_tensor(inputBuffer);
+        check_like(outputBuffer, inputBuffer, inputBuffer.numel() * size_);
+        return enqueue("foo::_allgather_base", c10d::OpType::_ALLGATHER_BASE, {inputBuffer}, {outputBuffer},
+            [this](const std::vector<at::Tensor>& in, const std::vector<at::Tensor>& out,
+                std::chrono::steady_clock::time_point deadline) {
+                allgather_chunks(in[0], split(out[0], size_), deadline);
+            });
+    }
+
+    c10::intrusive_ptr<c10d::Work> reduce_scatter(std::vector<at::Tensor>& outputTensors,
+        std::vector<std::vector<at::Tensor>>& inputTensors, const c10d::ReduceScatterOptions& opts) override
+    {
+        check_single(outputTensors);
+        TORCH_CHECK(inputTensors.size() == 1, "ProcessGroupFoo takes one list of input tensors");
+        std::vector<at::Tensor>& inputs = inputTensors[0];
+        TORCH_CHECK(static_cast<int>(inputs.size()) == size_, "ProcessGroupFoo: reduce_scatter needs ", size_,
+            " input tensors, got ", inputs.size());
+        for (const at::Tensor& input : inputs) {
+            check_like(input, outputTensors[0], outputTensors[0].numel());
+        }
+        check_reduce_op(opts.reduceOp, outputTensors[0]);
+        const c10d::ReduceOp::RedOpType op = opts.reduceOp.op_;
+        return enqueue("foo::reduce_scatter", c10d::OpType::REDUCE_SCATTER, inputs, outputTensors,
+            [this, op](const std::vector<at::Tensor>& in, const std::vector<at::Tensor>& out,
+                std::chrono::steady_clock::time_point deadline) { reduce_scatter_chunks(in, out[0], op, deadline); });
+    }
+
+    c10::intrusive_ptr<c10d::Work> _reduce_scatter_base(at::Tensor& outputBuffer, at::Tensor& inputBuffer,
+        const c10d::ReduceScatterOptions& opts) override
+    {
+        check_tensor(outputBuffer);
+        check_like(inputBuffer, outputBuffer, outputBuffer.numel() * size_);
+        check_reduce_op(opts.reduceOp, outputBuffer);
+        const c10d::ReduceOp::RedOpType op = opts.reduceOp.op_;
+        return enqueue("foo::_reduce_scatter_base", c10d::OpType::_REDUCE_SCATTER_BASE, {inputBuffer},
+            {outputBuffer},
+            [this, op](const std::vector<at::Tensor>& in, const std::vector<at::Tensor>& out,
+                std::chrono::steady_clock::time_point deadline) {
+                reduce_scatter_chunks(split(in[0], size_), out[0], op, deadline);
+            });
+    }
+
+    c10::intrusive_ptr<c10d::Work> barrier(const c10d::BarrierOptions& /*opts*/) override
+    {
+        return enqueue("foo::barrier", c10d::OpType::BARRIER, {}, {},
+            [this](const std::vector<at::Tensor>& /*in*/, const std::vector<at::Tensor>& /*out*/,
+                std::chrono::steady_clock::time_point deadline) { next_barrier(deadline); });
+    }
+
+private:
+    using Collective = std::function<void(const std::vector<at::Tensor>& in, const std::vector<at::Tensor>& out,
+        std::chrono::steady_clock::time_point deadline)>;
+
+    void check_tensor(const at::Tensor& tensor) const
+    {
+        TORCH_CHECK(tensor.is_privateuseone(), "ProcessGroupFoo only takes foo tensors, got one on ",
+            tensor.device());
+        TORCH_CHECK(tensor.is_contiguous(), "ProcessGroupFoo: tensors must be contiguous");
+        TORCH_CHECK(!tensor.is_conj() && !tensor.is_neg(),
+            "ProcessGroupFoo: tensors with the conjugate or negative bit set must be resolved first");
+    }
+
+    void check_single(const std::vector<at::Tensor>& tensors) const
+    {
+        TORCH_CHECK(tensors.size() == 1, "ProcessGroupFoo takes one tensor per collective, got ", tensors.size());
+        check_tensor(tensors[0]);
+    }
+
+    void check_like(const at::Tensor& tensor, const at::Tensor& like, int64_t numel) const
+    {
+        check_tensor(tensor);
+        TORCH_CHECK(tensor.scalar_type() == like.scalar_type(), "ProcessGroupFoo: tensors must all have the dtype ",
+            like.scalar_type(), ", got ", tensor.scalar_type());
+        TORCH_CHECK(tensor.device() == like.device(), "ProcessGroupFoo: tensors must all be on ", like.device(),
+            ", got one on ", tensor.device());
+        TORCH_CHECK(tensor.numel() == numel, "ProcessGroupFoo: expected a tensor of ", numel,
+            " elements, got one of ", tensor.numel());
+    }
+
+    // Collectives run in order on one stream of the device of the first one,
+    // so every rank goes through the barriers in the same sequence.
+    c10::Stream stream_for(c10::DeviceIndex device)
+    {
+        if (!stream_.has_value()) {
+            stream_ = get_stream_from_pool(device);
+        }
+        TORCH_CHECK(stream_->device_index() == device, "ProcessGroupFoo: every collective of a process group must "
+            "use one device, foo:", static_cast<int>(stream_->device_index()), ", got foo:", static_cast<int>(device));
+        return *stream_;
+    }
+
+    c10::intrusive_ptr<c10d::Work> enqueue(const char* name, c10d::OpType type, const std::vector<at::Tensor>& inputs,
+        const std::vector<at::Tensor>& outputs, Collective collective)
+    {
+        const c10::DeviceIndex device = inputs.empty() ? (stream_.has_value() ? stream_->device_index()
+                                                                                 : current_device())
+                                                       : inputs[0].device().index();
+        const FooDeviceGuard guard(c10::Device(c10::DeviceType::PrivateUse1, device));
+        const c10::Stream stream = stream_for(device);
+        flush_lazy();
+        materialize_fills(inputs);
+        for (const at::Tensor& output : outputs) {
+            materialize_fill_for_write(output);
+        }
+        std::vector<at::Tensor> in;
+        std::vector<at::Tensor> out;
+        for (const at::Tensor& input : inputs) {
+            in.push_back(cpu_alias(input));
+        }
+        for (const at::Tensor& output : outputs) {
+            out.push_back(cpu_alias(output));
+        }
+        auto future = c10::make_intrusive<c10::ivalue::Future>(c10::ListType::create(c10::TensorType::get()),
+            std::vector<c10::Device>{c10::Device(c10::DeviceType::PrivateUse1, device)});
+        const c10::Stream current = get_current_stream(device);
+        stream_wait_stream(stream, current);
+        // The task holds a reference, so the group outlives its collectives.
+        launch(stream, [self = c10::intrusive_ptr<ProcessGroupFoo>::unsafe_reclaim_from_nonowning(this), name,
+                           in = std::move(in), out = std::move(out), results = outputs, future,
+                           collective = std::move(collective), device]() {
+            FOO_TRACE_SCOPE_SIZES(name, c10::Device(c10::DeviceType::PrivateUse1, device),
+                out.empty() ? c10::IntArrayRef() : out[0].sizes(),
+                out.empty() ? at::kByte : out[0].scalar_type());
+            try {
+                // A rank that gave up mid-collective leaves the others'
+                // barriers out of step.
+                TORCH_CHECK(!self->failed_, "ProcessGroupFoo: an earlier collective failed, the group is unusable");
+                collective(in, out, std::chrono::steady_clock::now() + self->timeout_);
+                future->markCompleted(c10::IValue(results));
+            } catch (...) {
+                self->failed_ = true;
+                future->setError(std::current_exception());
+            }
+        });
+        stream_wait_stream(current, stream);
+        return c10::make_intrusive<FooWork>(rank_, type, std::move(future));
+    }
+
+    void next_barrier(std::chrono::steady_clock::time_point deadline)
+    {
+        arena_.barrier(++seq_, deadline);
+    }
+
+    // The `parts` equal parts of the flattened `tensor`.
+    static std::vector<at::Tensor> split(const at::Tensor& tensor, int parts)
+    {
+        const at::Tensor flat = tensor.view(-1);
+        const int64_t len = flat.numel() / parts;
+        std::vector<at::Tensor> result;
+        for (int r = 0; r < parts; ++r) {
+            result.push_back(flat.narrow(0, r * len, len));
+        }
+        return result;
+    }
+
+    // Calls body(begin, len) for the chunks of `flat` that fit in `bytes`.
+    template <typename Body>
+    static void for_each_chunk(const at::Tensor& flat, size_t bytes, const Body& body)
+    {
+        const int64_t chunk = static_cast<int64_t>(bytes / flat.element_size());
+        for (int64_t begin = 0; begin < flat.numel(); begin += chunk) {
+            body(begin, std::min(chunk, flat.numel() - begin));
+        }
+    }
+
+    // acc = op over the ranks, in rank order, of the `acc.numel()` elements
+    // from `begin` of the `len` elements each rank put at byte `offset` of its
+    // slot.
+    void reduce_slots(const at::Tensor& acc, c10::ScalarType dtype, int64_t len, int64_t begin, size_t offset,
+        c10d::ReduceOp::RedOpType op) const
+    {
+        auto share = [&](int r) { return arena_.slot(r, dtype, len, offset).narrow(0, begin, acc.numel()); };
+        acc.copy_(share(0));
+        for (int r = 1; r < size_; ++r) {
+            combine(acc, share(r), op);
+        }
+        if (op == c10d::ReduceOp::AVG) {
+            acc.div_(size_);
+        }
+    }
+
+    void allgather_chunks(const at::Tensor& input, const std::vector<at::Tensor>& outputs,
+        std::chrono::steady_clock::time_point deadline)
+    {
+        const at::Tensor flat = input.view(-1);
+        const c10::ScalarType dtype = flat.scalar_type();
+        for_each_chunk(flat, arena_.slot_bytes(), [&](int64_t begin, int64_t len) {
+            arena_.slot(rank_, dtype, len).copy_(flat.narrow(0, begin, len));
+            next_barrier(deadline);
+            for (int r = 0; r < size_; ++r) {
+                outputs[r].view(-1).narrow(0, begin, len).copy_(arena_.slot(r, dtype, len));
+            }
+            next_barrier(deadline);
+        });
+    }
+
+    // Each rank puts its `size` inputs side by side in its slot, then reduces
+    // the ones for itself.
+    void reduce_scatter_chunks(const std::vector<at::Tensor>& inputs, const at::Tensor& output,
+        c10d::ReduceOp::RedOpType op, std::chrono::steady_clock::time_point deadline)
+    {
+        const at::Tensor flat = output.view(-1);
+        const c10::ScalarType dtype = flat.scalar_type();
+        const size_t part_bytes = arena_.slot_bytes() / size_ / flat.element_size() * flat.element_size();
+        for_each_chunk(flat, part_bytes, [&](int64_t begin, int64_t len) {
+            for (int r = 0; r < size_; ++r) {
+                arena_.slot(rank_, dtype, len, r * part_bytes).copy_(inputs[r].view(-1).narrow(0, begin, len));
+            }
+            next_barrier(deadline);
+            reduce_slots(flat.narrow(0, begin, len), dtype, len, 0, rank_ * part_bytes, op);
+            next_barrier(deadline);
+        });
+    }
+
+    SharedArena arena_;
+    const std::chrono::milliseconds timeout_;
+    std::optional<c10::Stream> stream_;
+    // Only touched by the collectives, which run in order on stream_.
+    uint64_t seq_ = 0;
+    std::atomic<bool> failed_{false};
+};
+
+} // namespace
+
+c10::intrusive_ptr<c10d::Backend> create_process_group(const c10::intrusive_ptr<c10d::Store>& store, int rank,
+    int size, std::chrono::milliseconds timeout)
+{
+    return c10::make_intrusive<ProcessGroupFoo>(store, rank, size, timeout);
+}
+
+} // namespace foo_core
@@ -0,0 +1,165 @@
+#include <ATen/core/Tensor.h>
+#include <ATen/native/TensorFactories.h>
+#include <ATen/ops/empty.h>
+#include <ATen/ops/empty_like.h>
+#include <ATen/ops/ones_like.h>
+#include <c10/util/Exception.h>
+#include <torch/library.h>
+
+#include <optional>
+#include <tuple>
+
+#include "FooAlias.h"
+#include "FooDeviceGuard.h"
+#include "FooGenerator.h"
+#include "FooKernels.h"
+#include "FooLazy.h"
+#include "FooStorageImpl.h"
+#include "FooTrace.h"
+#include "foo_core/stream.h"
+
+namespace foo_core {
+
+FOO_DEFINE_DISPATCH(uniform_stub);
+FOO_DEFINE_DISPATCH(normal_stub);
+FOO_DEFINE_DISPATCH(bernoulli_scalar_stub);
+FOO_DEFINE_DISPATCH(bernoulli_tensor_stub);
+FOO_DEFINE_DISPATCH(randperm_stub);
+
+namespace {
+
+// Reserves the Philox blocks for every element of `self` and enqueues
+// kernel(out, philox) on the current stream. The kernels number the elements
+// in logical order, so tensors of any layout get the same values; other than
+// contiguous ones are generated into a temporary.
+template <typename Kernel>
+void launch_random(const char* name, const at::Tensor& self, const std::optional<at::Generator>& generator,
+    int64_t draws, Kernel kernel)
+{
+    if (self.numel() == 0) {
+        return;
+    }
+    flush_lazy();
+    materialize_fill_for_write(self);
+    const c10::Device device = self.device();
+    const FooDeviceGuard guard(device);
+    const uint64_t blocks = (static_cast<uint64_t>(self.numel()) * draws + 3) / 4;
+    const PhiloxState philox = reserve_philox(generator, device.index(), blocks);
+    launch([name, alias = cpu_alias(self), philox, kernel, device]() {
+        FOO_TRACE_SCOPE_SIZES(name, device, alias.sizes(), alias.scalar_type());
+        if (alias.is_contiguous()) {
+            kernel(alias, philox);
+        } else {
+            const at::Tensor out = at::empty(alias.sizes(), alias.options());
+            kernel(out, philox);
+            alias.copy_(out);
+        }
+    });
+}
+
+void check_floating(const char* name, const at::Tensor& self)
+{
+    TORCH_CHECK(at::isFloatingType(self.scalar_type()), name, " expects a floating point foo tensor, got ",
+        self.scalar_type());
+}
+
+at::Tensor& foo_uniform_(at::Tensor& self, double from, double to, std::optional<at::Generator> generator)
+{
+    check_floating("uniform_", self);
+    TORCH_CHECK(from <= to, "uniform_ expects to return a [from, to) range, but found from=", from, " > to=", to);
+    launch_random("aten::uniform_", self, generator, random_draws(RandomOp::Uniform, self.scalar_type()),
+        [from, to](const at::Tensor& out, PhiloxState philox) { uniform_stub(out, philox, from, to); });
+    return self;
+}
+
+at::Tensor& foo_normal_(at::Tensor& self, double mean, double std, std::optional<at::Generator> generator)
+{
+    check_floating("normal_", self);
+    TORCH_CHECK(std >= 0.0, "normal expects std >= 0.0, but found std ", std);
+    launch_random("aten::normal_", self, generator, random_draws(RandomOp::Normal, self.scalar_type()),
+        [mean, std](const at::Tensor& out, PhiloxState philox) { normal_stub(out, philox, mean, std); });
+    return self;
+}
+
+at::Tensor& foo_bernoulli_scalar_(at::Tensor& self, double p, std::optional<at::Generator> generator)
+{
+    TORCH_CHECK(0 <= p && p <= 1, "bernoulli_ expects p to be in [0, 1], but got p=", p);
+    launch_random("aten::bernoulli_.float", self, generator, random_draws(RandomOp::Bernoulli, self.scalar_type()),
+        [p](const at::Tensor& out, PhiloxState philox) { bernoulli_scalar_stub(out, philox, p); });
+    return self;
+}
+
+at::Tensor& foo_bernoulli_tensor_(at::Tensor& self, const at::Tensor& p, std::optional<at::Generator> generator)
+{
+    TORCH_CHECK(at::isFloatingType(p.scalar_type()), "expected probabilities tensor to have floating type, got ",
+        p.scalar_type());
+    TORCH_CHECK(p.is_cpu() || p.device() == self.device(), "bernoulli_: expected p on the CPU or on ",
+        self.device(), ", got ", p.device());
+    const at::IntArrayRef sizes = self.sizes();
+    at::Tensor p_host;
+    if (p.is_cpu()) {
+        // Copied now, the caller may change it before the kernel runs.
+        p_host = p.expand(sizes).to(at::kDouble, /*non_blocking=*/false, /*copy=*/true).contiguous();
+    } else {
+        flush_lazy();
+        materialize_fill(p);
+        p_host = cpu_alias(p).expand(sizes);
+    }
+    launch_random("aten::bernoulli_.Tensor", self, generator, random_draws(RandomOp::Bernoulli, self.scalar_type()),
+        [p_host](const at::Tensor& out, PhiloxState philox) {
+            bernoulli_tensor_stub(out, philox, p_host.to(at::kDouble).contiguous());
+        });
+    return self;
+}
+
+at::Tensor& foo_randperm_out(int64_t n, std::optional<at::Generator> generator, at::Tensor& result)
+{
+    TORCH_CHECK(n >= 0, "n must be non-negative, got", n);
+    at::native::check_supported_max_int_with_precision(n, result);
+    result.resize_({n});
+    launch_random("aten::randperm.generator_out", result, generator,
+        random_draws(RandomOp::Randperm, result.scalar_type()),
+        [](const at::Tensor& out, PhiloxState philox) { randperm_stub(out, philox); });
+    return result;
+}
+
+// Like ATen's CPU kernels, with the mask drawn by foo_bernoulli_scalar_ and
+// the products running as foo pointwise ops. The mask is bool, as the Meta
+// kernel says.
+std::tuple<at::Tensor, at::Tensor> foo_native_dropout(const at::Tensor& input, double p, std::optional<bool> train)
+{
+    if (input.numel() == 0) {
+        return {input, at::empty_like(input, input.options().dtype(at::kBool))};
+    }
+    if (train.has_value() && !*train) {
+        return {input.clone(), at::ones_like(input, input.options().dtype(at::kBool))};
+    }
+    const double p1m = 1. - p;
+    // p == 1 zeroes everything instead of dividing by zero.
+    const double scale = p1m == 0 ? 0. : 1. / p1m;
+    at::Tensor mask = at::empty_like(input, input.options().dtype(at::kBool), c10::MemoryFormat::Contiguous);
+    mask.bernoulli_(p1m);
+    return {input.mul(mask).mul_(scale), mask};
+}
+
+at::Tensor foo_native_dropout_backward(const at::Tensor& grad_output, const at::Tensor& mask, double scale)
+{
+    return grad_output.mul(mask).mul_(scale);
+}
+
+} // namespace
+
+// torch.rand, randn, randperm, bernoulli and dropout on foo run these instead
+// of the CPU fallback, which would draw from the CPU generator.
+TORCH_LIBRARY_IMPL(aten, PrivateUse1, m)
+{
+    m.impl("uniform_", TORCH_FN(foo_uniform_));
+    m.impl("normal_", TORCH_FN(foo_normal_));
+    m.impl("bernoulli_.float", TORCH_FN(foo_bernoulli_scalar_));
+    m.impl("bernoulli_.Tensor", TORCH_FN(foo_bernoulli_tensor_));
+    m.impl("randperm.generator_out", TORCH_FN(foo_randperm_out));
+    m.impl("native_dropout", TORCH_FN(foo_native_dropout));
+    m.impl("native_dropout_backward", TORCH_FN(foo_native_dropout_backward));
+}
+
+} // namespace foo_core
@@ -0,0 +1,364 @@
+#include <ATen/OpMathType.h>
+#include <ATen/WrapDimUtils.h>
+#include <ATen/WrapDimUtilsMulti.h>
+#include <ATen/core/Tensor.h>
+#include <ATen/native/CPUFallback.h>
+#include <ATen/native/layer_norm.h>
+#include <ATen/ops/_log_softmax_ops.h>
+#include <ATen/ops/_softmax_ops.h>
+#include <ATen/ops/amax_ops.h>
+#include <ATen/ops/amin_ops.h>
+#include <ATen/ops/empty.h>
+#include <ATen/ops/linalg_vector_norm_ops.h>
+#include <ATen/ops/mean_ops.h>
+#include <ATen/ops/native_layer_norm_ops.h>
+#include <ATen/ops/std_ops.h>
+#include <ATen/ops/sum_ops.h>
+#include <ATen/ops/var_ops.h>
+#include <c10/core/ScalarType.h>
+#include <c10/util/Exception.h>
+#include <torch/library.h>
+
+#include <cmath>
+#include <optional>
+#include <tuple>
+#include <vector>
+
+#include "FooAlias.h"
+#include "FooDeviceGuard.h"
+#include "FooFallback.h"
+#include "FooKernels.h"
+#include "FooLazy.h"
+#include "FooStorageImpl.h"
+#include "FooTrace.h"
+#include "foo_core/stream.h"
+
+namespace foo_core {
+
+FOO_DEFINE_DISPATCH(reduce_stub);
+FOO_DEFINE_DISPATCH(softmax_stub);
+FOO_DEFINE_DISPATCH(layer_norm_stub);
+
+// Reductions, softmax and layer norm of floating point foo tensors run on the
+// kernels of cpu/ReduceKernels.cpp, which give the same bits for any number of
+// threads. Other dtypes and arguments go through the CPU fallback.
+namespace {
+
+bool is_native_dtype(c10::ScalarType dtype)
+{
+    return dtype == at::kFloat || dtype == at::kDouble || dtype == at::kHalf || dtype == at::kBFloat16;
+}
+
+bool is_native_input(const at::Tensor& self)
+{
+    return is_native_dtype(self.scalar_type()) && !self.is_neg();
+}
+
+// A dtype= argument the kernels can honor: one accumulated like the input.
+bool is_native_dtype_arg(const at::Tensor& self, std::optional<c10::ScalarType> dtype)
+{
+    return !dtype.has_value()
+        || (is_native_dtype(*dtype) && at::toOpMathType(*dtype) == at::toOpMathType(self.scalar_type()));
+}
+
+// The sorted dimensions reduced over: all of them when `dim` is empty.
+std::vector<int64_t> reduced_dims(const at::Tensor& self, at::OptionalIntArrayRef dim)
+{
+    std::vector<int64_t> dims;
+    if (!dim.has_value() || dim->empty()) {
+        for (int64_t d = 0; d < self.dim(); ++d) {
+            dims.push_back(d);
+        }
+        return dims;
+    }
+    const auto mask = at::dim_list_to_bitset(*dim, self.dim());
+    for (int64_t d = 0; d < self.dim(); ++d) {
+        if (mask[d]) {
+            dims.push_back(d);
+        }
+    }
+    return dims;
+}
+
+std::vector<int64_t> reduced_shape(const at::Tensor& self, const std::vector<int64_t>& dims, bool keepdim)
+{
+    std::vector<int64_t> shape;
+    size_t next = 0;
+    for (int64_t d = 0; d < self.dim(); ++d) {
+        if (next < dims.size() && dims[next] == d) {
+            ++next;
+            if (keepdim) {
+                shape.push_back(1);
+            }
+        } else {
+            shape.push_back(self.size(d));
+        }
+    }
+    return shape;
+}
+
+int64_t reduced_numel(const at::Tensor& self, const std::vector<int64_t>& dims)
+{
+    int64_t numel = 1;
+    for (const int64_t d : dims) {
+        numel *= self.size(d);
+    }
+    return numel;
+}
+
+// Views the host tensor `in` as the contiguous [outer, size, inner] tensor
+// the kernels take, `size` covering `dims`. Contiguous inputs reduced over
+// adjacent dimensions are viewed as they are; others are first copied with
+// the reduced dimensions moved last.
+at::Tensor reduction_view(const at::Tensor& in, const std::vector<int64_t>& dims)
+{
+    if (dims.empty()) {
+        return in.reshape({-1, 1, 1});
+    }
+    const int64_t first = dims.front();
+    const int64_t last = dims.back();
+    const c10::IntArrayRef sizes = in.sizes();
+    if (in.is_contiguous() && last - first + 1 == static_cast<int64_t>(dims.size())) {
+        const int64_t outer = c10::multiply_integers(sizes.slice(0, first));
+        const int64_t inner = c10::multiply_integers(sizes.slice(last + 1));
+        return in.view({outer, -1, inner});
+    }
+    std::vector<int64_t> order;
+    int64_t outer = 1;
+    size_t next = 0;
+    for (int64_t d = 0; d < in.dim(); ++d) {
+        if (next < dims.size() && dims[next] == d) {
+            ++next;
+        } else {
+            order.push_back(d);
+            outer *= sizes[d];
+        }
+    }
+    order.insert(order.end(), dims.begin(), dims.end());
+    return in.permute(order).contiguous().view({outer, -1, 1});
+}
+
+// Enqueues the reduction of `self` over `dims` into the new foo tensor
+// `result`. compute(in) runs on the stream with the [outer, size, inner] view
+// of `self` and returns the [outer * inner] results in the op math type.
+template <typename Compute>
+at::Tensor launch_reduction(const char* name, const at::Tensor& self, std::vector<int64_t> dims,
+    const at::Tensor& result, Compute compute)
+{
+    if (result.numel() == 0) {
+        return result;
+    }
+    materialize_fill(self);
+    launch([name, in = cpu_alias(self), dims = std::move(dims), out = cpu_alias(result), device = self.device(),
+               compute]() {
+        FOO_TRACE_SCOPE_SIZES(name, device, in.sizes(), in.scalar_type());
+        const at::Tensor acc = compute(reduction_view(in, dims));
+        out.copy_(acc.view(out.sizes()));
+    });
+    return result;
+}
+
+at::Tensor empty_acc(const at::Tensor& in)
+{
+    return at::empty({in.size(0) * in.size(2)}, in.options().dtype(at::toOpMathType(in.scalar_type())));
+}
+
+// Runs `op` over the middle dimension of `in`, see launch_reduction().
+at::Tensor run_reduce(const at::Tensor& in, ReduceOp op, const at::Tensor& center = at::Tensor())
+{
+    at::Tensor acc = empty_acc(in);
+    reduce_stub(acc, in, op, center);
+    return acc;
+}
+
+at::Tensor new_result(const at::Tensor& self, const std::vector<int64_t>& dims, bool keepdim, c10::ScalarType dtype)
+{
+    return at::empty(reduced_shape(self, dims, keepdim), self.options().dtype(dtype));
+}
+
+at::Tensor foo_sum(const at::Tensor& self, at::OptionalIntArrayRef dim, bool keepdim,
+    std::optional<c10::ScalarType> dtype)
+{
+    if (!is_native_input(self) || !is_native_dtype_arg(self, dtype)) {
+        return at::native::call_fallback_fn<&cpu_fallback, at::_ops::sum_dim_IntList>::call(self, dim, keepdim, dtype);
+    }
+    const FooDeviceGuard guard(self.device());
+    flush_lazy();
+    std::vector<int64_t> dims = reduced_dims(self, dim);
+    const at::Tensor result = new_result(self, dims, keepdim, dtype.value_or(self.scalar_type()));
+    return launch_reduction("aten::sum.dim_IntList", self, std::move(dims), result,
+        [](const at::Tensor& in) { return run_reduce(in, ReduceOp::Sum); });
+}
+
+at::Tensor foo_mean(const at::Tensor& self, at::OptionalIntArrayRef dim, bool keepdim,
+    std::optional<c10::ScalarType> dtype)
+{
+    if (!is_native_input(self) || !is_native_dtype_arg(self, dtype)) {
+        return at::native::call_fallback_fn<&cpu_fallback, at::_ops::mean_dim>::call(self, dim, keepdim, dtype);
+    }
+    const FooDeviceGuard guard(self.device());
+    flush_lazy();
+    std::vector<int64_t> dims = reduced_dims(self, dim);
+    const at::Tensor result = new_result(self, dims, keepdim, dtype.value_or(self.scalar_type()));
+    return launch_reduction("aten::mean.dim", self, std::move(dims), result, [](const at::Tensor& in) {
+        // 0 / 0 gives NaN for empty reductions, like ATen.
+        return run_reduce(in, ReduceOp::Sum).div_(static_cast<double>(in.size(1)));
+    });
+}
+
+template <ReduceOp op>
+at::Tensor foo_amax_amin(const at::Tensor& self, at::IntArrayRef dim, bool keepdim)
+{
+    constexpr bool is_max = op == ReduceOp::Max;
+    if (!is_native_input(self)) {
+        using fallback_op = std::conditional_t<is_max, at::_ops::amax, at::_ops::amin>;
+        return at::native::call_fallback_fn<&cpu_fallback, fallback_op>::call(self, dim, keepdim);
+    }
+    const FooDeviceGuard guard(self.device());
+    flush_lazy();
+    std::vector<int64_t> dims = reduced_dims(self, dim);
+    const at::Tensor result = new_result(self, dims, keepdim, self.scalar_type());
+    TORCH_CHECK(result.numel() == 0 || reduced_numel(self, dims) > 0, is_max ? "amax" : "amin",
+        "(): Expected reduction dim to have non-zero size.");
+    return launch_reduction(is_max ? "aten::amax" : "aten::amin", self, std::move(dims), result,
+        [](const at::Tensor& in) { return run_reduce(in, op); });
+}
+
+// var() and std(): the mean, then the sum of squared deviations from it.
+template <bool take_sqrt>
+at::Tensor foo_var_std(const at::Tensor& self, at::OptionalIntArrayRef dim, const std::optional<at::Scalar>& correction,
+    bool keepdim)
+{
+    if (!is_native_input(self)) {
+        using fallback_op = std::conditional_t<take_sqrt, at::_ops::std_correction, at::_ops::var_correction>;
+        return at::native::call_fallback_fn<&cpu_fallback, fallback_op>::call(self, dim, correction, keepdim);
+    }
+    const FooDeviceGuard guard(self.device());
+    flush_lazy();
+    std::vector<int64_t> dims = reduced_dims(self, dim);
+    const at::Tensor result = new_result(self, dims, keepdim, self.scalar_type());
+    const double correction_value = correction.has_value() ? correction->toDouble() : 1.0;
+    return launch_reduction(take_sqrt ? "aten::std.correction" : "aten::var.correction", self, std::move(dims), result,
+        [correction_value](const at::Tensor& in) {
+            const auto size = static_cast<double>(in.size(1));
+            const at::Tensor mean = run_reduce(in, ReduceOp::Sum).div_(size);
+            at::Tensor acc = run_reduce(in, ReduceOp::CenteredSquareSum, mean);
+            acc.div_(std::max(size - correction_value, 0.0));
+            return take_sqrt ? acc.sqrt_() : acc;
+        });
+}
+
+// The 1, 2 and infinity norms; others go through the fallback.
+at::Tensor foo_linalg_vector_norm(const at::Tensor& self, const at::Scalar& ord, at::OptionalIntArrayRef dim,
+    bool keepdim, std::optional<c10::ScalarType> dtype)
+{
+    const double p = ord.toDouble();
+    const bool is_native_ord = p == 1 || p == 2 || (std::isinf(p) && p > 0);
+    if (!is_native_input(self) || !is_native_dtype_arg(self, dtype) || !is_native_ord) {
+        return at::native::call_fallback_fn<&cpu_fallback, at::_ops::linalg_vector_norm>::call(self, ord, dim, keepdim,
+            dtype);
+    }
+    const FooDeviceGuard guard(self.device());
+    flush_lazy();
+    std::vector<int64_t> dims = reduced_dims(self, dim);
+    const at::Tensor result = new_result(self, dims, keepdim, dtype.value_or(self.scalar_type()));
+    TORCH_CHECK(!std::isinf(p) || result.numel() == 0 || reduced_numel(self, dims) > 0,
+        "linalg.vector_norm cannot compute the inf norm on an empty tensor because the operation does not have an "
+        "identity");
+    return launch_reduction("aten::linalg_vector_norm", self, std::move(dims), result, [p](const at::Tensor& in) {
+        if (p == 1) {
+            return run_reduce(in, ReduceOp::AbsSum);
+        }
+        if (p == 2) {
+            return run_reduce(in, ReduceOp::SquareSum).sqrt_();
+        }
+        return run_reduce(in, ReduceOp::AbsMax);
+    });
+}
+
+// _softmax and _log_softmax. half_to_float, which the autocast policy of CUDA
+// uses, is supported as well.
+template <bool log>
+at::Tensor foo_softmax(const at::Tensor& self, int64_t dim, bool half_to_float)
+{
+    if (!is_native_input(self) || (half_to_float && !at::isReducedFloatingType(self.scalar_type()))) {
+        using fallback_op = std::conditional_t<log, at::_ops::_log_softmax, at::_ops::_softmax>;
+        return at::native::call_fallback_fn<&cpu_fallback, fallback_op>::call(self, dim, half_to_float);
+    }
+    const FooDeviceGuard guard(self.device());
+    flush_lazy();
+    const int64_t wrapped = at::maybe_wrap_dim(dim, self.dim());
+    const c10::ScalarType dtype = half_to_float ? at::kFloat : self.scalar_type();
+    const at::Tensor result = at::empty(self.sizes(), self.options().dtype(dtype));
+    if (result.numel() == 0) {
+        return result;
+    }
+    materialize_fill(self);
+    const c10::IntArrayRef sizes = self.sizes();
+    const std::vector<int64_t> shape = self.dim() == 0
+        ? std::vector<int64_t>{1, 1, 1}
+        : std::vector<int64_t>{c10::multiply_integers(sizes.slice(0, wrapped)), sizes[wrapped],
+              c10::multiply_integers(sizes.slice(wrapped + 1))};
+    launch([in = cpu_alias(self), out = cpu_alias(result), shape, device = self.device()]() {
+        FOO_TRACE_SCOPE_SIZES(log ? "aten::_log_softmax" : "aten::_softmax", device, in.sizes(), in.scalar_type());
+        softmax_stub(out.view(shape), in.contiguous().view(shape), log);
+    });
+    return result;
+}
+
+std::tuple<at::Tensor, at::Tensor, at::Tensor> foo_native_layer_norm(const at::Tensor& input,
+    at::IntArrayRef normalized_shape, const std::optional<at::Tensor>& weight_opt,
+    const std::optional<at::Tensor>& bias_opt, double eps)
+{
+    const c10::MaybeOwned<at::Tensor> weight = at::borrow_from_optional_tensor(weight_opt);
+    const c10::MaybeOwned<at::Tensor> bias = at::borrow_from_optional_tensor(bias_opt);
+    auto is_float = [](const at::Tensor& param) { return param.defined() && param.scalar_type() == at::kFloat; };
+    const bool is_mixed = at::isReducedFloatingType(input.scalar_type()) && (is_float(*weight) || is_float(*bias));
+    const c10::ScalarType param_dtype = is_mixed ? at::kFloat : input.scalar_type();
+    auto is_native_param = [&](const at::Tensor& param) {
+        return !param.defined()
+            || (param.is_privateuseone() && param.device() == input.device() && param.scalar_type() == param_dtype);
+    };
+    if (!is_native_input(input) || !is_native_param(*weight) || !is_native_param(*bias) || input.numel() == 0) {
+        return at::native::call_fallback_fn<&cpu_fallback, at::_ops::native_layer_norm>::call(input, normalized_shape,
+            weight_opt, bias_opt, eps);
+    }
+    const FooDeviceGuard guard(input.device());
+    flush_lazy();
+    const auto [rows, n] = at::native::_check_layer_norm_inputs(input, normalized_shape, *weight, *bias);
+    const at::Tensor out = at::empty(input.sizes(), input.options());
+    std::vector<int64_t> stat_shape(input.sizes().begin(), input.sizes().end() - normalized_shape.size());
+    stat_shape.resize(input.dim(), 1);
+    const at::Tensor mean = at::empty(stat_shape, input.options().dtype(param_dtype));
+    const at::Tensor rstd = at::empty(stat_shape, input.options().dtype(param_dtype));
+    materialize_fills(input, *weight, *bias);
+    auto host = [](const at::Tensor& tensor) { return tensor.defined() ? cpu_alias(tensor) : at::Tensor(); };
+    launch([in = cpu_alias(input), w = host(*weight), b = host(*bias), out = cpu_alias(out), mean = cpu_alias(mean),
+               rstd = cpu_alias(rstd), rows = rows, n = n, eps, device = input.device()]() {
+        FOO_TRACE_SCOPE_SIZES("aten::native_layer_norm", device, in.sizes(), in.scalar_type());
+        auto flat = [](const at::Tensor& tensor, c10::IntArrayRef shape) {
+            return tensor.defined() ? tensor.contiguous().view(shape) : at::Tensor();
+        };
+        layer_norm_stub(out.view({rows, n}), mean.view({rows}), rstd.view({rows}), flat(in, {rows, n}),
+            flat(w, {n}), flat(b, {n}), eps);
+    });
+    return {out, mean, rstd};
+}
+
+} // namespace
+
+TORCH_LIBRARY_IMPL(aten, PrivateUse1, m)
+{
+    m.impl("sum.dim_IntList", TORCH_FN(foo_sum));
+    m.impl("mean.dim", TORCH_FN(foo_mean));
+    m.impl("amax", TORCH_FN(foo_amax_amin<ReduceOp::Max>));
+    m.impl("amin", TORCH_FN(foo_amax_amin<ReduceOp::Min>));
+    m.impl("var.correction", TORCH_FN(foo_var_std<false>));
+    m.impl("std.correction", TORCH_FN(foo_var_std<true>));
+    m.impl("linalg_vector_norm", TORCH_FN(foo_linalg_vector_norm));
+    m.impl("_softmax", TORCH_FN(foo_softmax<false>));
+    m.impl("_log_softmax", TORCH_FN(foo_softmax<true>));
+    m.impl("native_layer_norm", TORCH_FN(foo_native_layer_norm));
+}
+
+} // namespace foo_core
@@ -0,0 +1,216 @@
+#include "FooStorageImpl.h"
+
+#include <ATen/core/TensorBody.h>
+#include <c10/core/DispatchKeySet.h>
+#include <c10/core/TensorImpl.h>
+#include <c10/util/Exception.h>
+
+#include <utility>
+
+#include "FooAlias.h"
+#include "FooDeviceGuard.h"
+#include "FooStream.h"
+#include "FooTrace.h"
+
+namespace foo_core {
+
+namespace {
+
+// Converts `value` to `dtype` the way fill_ does, so that reading the constant
+// back later gives exactly the stored elements. Returns nullopt for dtypes
+// that are always filled eagerly.
+std::optional<c10::Scalar> convert_fill_value(const c10::Scalar& value, c10::ScalarType dtype)
+{
+    switch (dtype) {
+#define FOO_CONVERT_FILL_VALUE(type, name) \
+        case c10::ScalarType::name:        \
+            return c10::Scalar(value.to<type>());
+        AT_FORALL_SCALAR_TYPES_WITH_COMPLEX(FOO_CONVERT_FILL_VALUE)
+#undef FOO_CONVERT_FILL_VALUE
+        default:
+            return std::nullopt;
+    }
+}
+
+FooStorageImpl* foo_storage_impl(const at::Tensor& tensor)
+{
+    if (!tensor.defined() || !tensor.has_storage()) {
+        return nullptr;
+    }
+    return dynamic_cast<FooStorageImpl*>(tensor.storage().unsafeGetStorageImpl());
+}
+
+c10::intrusive_ptr<c10::StorageImpl> make_foo_storage_impl(
+    c10::StorageImpl::use_byte_size_t,
+    c10::SymInt size_bytes,
+    c10::DataPtr data_ptr,
+    c10::Allocator* allocator,
+    bool resizable)
+{
+    if (data_ptr == nullptr) {
+        return c10::make_intrusive<FooStorageImpl>(
+            c10::StorageImpl::use_byte_size_t(), size_bytes, allocator, resizable);
+    }
+    return c10::make_intrusive<FooStorageImpl>(
+        c10::StorageImpl::use_byte_size_t(), size_bytes, std::move(data_ptr), allocator, resizable);
+}
+
+// Storages created from Python (torch.UntypedStorage(n, device="foo")) and by
+// ATen helpers go through c10::make_storage_impl, which asks this hook.
+[[maybe_unused]] const bool storage_impl_registered = []() {
+    c10::SetStorageImplCreate(c10::DeviceType::PrivateUse1, &make_foo_storage_impl);
+    return true;
+}();
+
+} // namespace
+
+FooStorageImpl::~FooStorageImpl()
+{
+    if (pending_fill_.has_value()) {
+        pending_fill_count().fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+std::optional<PendingFill> FooStorageImpl::pending_fill() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_fill_;
+}
+
+void FooStorageImpl::set_pending_fill(PendingFill fill)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!pending_fill_.has_value()) {
+        pending_fill_count().fetch_add(1, std::memory_order_release);
+    }
+    pending_fill_ = std::move(fill);
+}
+
+std::optional<PendingFill> FooStorageImpl::take_pending_fill()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::optional<PendingFill> fill = std::move(pending_fill_);
+    if (fill.has_value()) {
+        pending_fill_.reset();
+        pending_fill_count().fetch_sub(1, std::memory_order_relaxed);
+    }
+    return fill;
+}
+
+c10::Storage make_foo_storage(size_t nbytes)
+{
+    c10::Allocator* allocator = c10::GetAllocator(c10::DeviceType::PrivateUse1);
+    return c10::Storage(c10::make_intrusive<FooStorageImpl>(
+        c10::StorageImpl::use_byte_size_t(), nbytes, allocator->allocate(nbytes), allocator, /*resizable=*/true));
+}
+
+std::atomic<int64_t>& pending_fill_count()
+{
+    static std::atomic<int64_t> count{0};
+    return count;
+}
+
+std::optional<PendingFill> get_pending_fill(const at::Tensor& tensor)
+{
+    if (pending_fill_count().load(std::memory_order_acquire) == 0) {
+        return std::nullopt;
+    }
+    FooStorageImpl* storage = foo_storage_impl(tensor);
+    return storage != nullptr ? storage->pending_fill() : std::nullopt;
+}
+
+bool covers_storage(const at::Tensor& tensor)
+{
+    return tensor.storage_offset() == 0 && tensor.is_non_overlapping_and_dense()
+        && tensor.nbytes() == tensor.storage().nbytes();
+}
+
+bool try_record_fill(const at::Tensor& self, const c10::Scalar& value)
+{
+    FooStorageImpl* storage = foo_storage_impl(self);
+    if (storage == nullptr || self.numel() == 0 || self.is_neg() || self.is_conj() || !covers_storage(self)) {
+        return false;
+    }
+    std::optional<c10::Scalar> converted = convert_fill_value(value, self.scalar_type());
+    if (!converted.has_value()) {
+        return false;
+    }
+    storage->set_pending_fill(PendingFill{self.scalar_type(), *converted});
+    return true;
+}
+
+void materialize_fill(const at::Tensor& tensor)
+{
+    if (pending_fill_count().load(std::memory_order_acquire) == 0) {
+        return;
+    }
+    FooStorageImpl* storage = foo_storage_impl(tensor);
+    if (storage == nullptr) {
+        return;
+    }
+    std::optional<PendingFill> fill = storage->take_pending_fill();
+    if (!fill.has_value()) {
+        return;
+    }
+    // The constant covers the storage as a flat array of its dtype, whatever
+    // views of it exist now.
+    const int64_t itemsize = static_cast<int64_t>(c10::elementSize(fill->dtype));
+    const int64_t nbytes = static_cast<int64_t>(storage->nbytes());
+    TORCH_INTERNAL_ASSERT(nbytes % itemsize == 0, "foo storage of ", nbytes, " bytes was filled as ", fill->dtype);
+    at::Tensor flat = at::detail::make_tensor<c10::TensorImpl>(
+        cpu_alias_storage(tensor.storage()), c10::DispatchKeySet(c10::DispatchKey::CPU),
+        c10::scalarTypeToTypeMeta(fill->dtype));
+    flat.unsafeGetTensorImpl()->set_sizes_contiguous({nbytes / itemsize});
+
+    const c10::Device device = tensor.device();
+    const FooDeviceGuard guard(device);
+    launch([flat, value = std::move(fill->value), device]() {
+        FOO_TRACE_SCOPE_SIZES("foo::materialize_fill", device, flat.sizes(), flat.scalar_type());
+        flat.fill_(value);
+    });
+}
+
+void materialize_fills(at::TensorList tensors)
+{
+    for (const at::Tensor& tensor : tensors) {
+        materialize_fill(tensor);
+    }
+}
+
+void materialize_fill_for_write(const at::Tensor& tensor)
+{
+    if (pending_fill_count().load(std::memory_order_acquire) == 0) {
+        return;
+    }
+    FooStorageImpl* storage = foo_storage_impl(tensor);
+    if (storage == nullptr) {
+        return;
+    }
+    if (covers_storage(tensor)) {
+        storage->take_pending_fill();
+    } else {
+        materialize_fill(tensor);
+    }
+}
+
+void foo_fill_(const at::Tensor& self, const c10::Scalar& value)
+{
+    if (self.numel() == 0 || try_record_fill(self, value)) {
+        return;
+    }
+    materialize_fill(self);
+    // The CPU alias doesn't carry the conjugate and negative bits, so fill it
+    // with the value as stored in memory.
+    c10::Scalar stored = self.is_neg() ? -value : value;
+    if (self.is_conj()) {
+        stored = stored.conj();
+    }
+    const c10::Device device = self.device();
+    const FooDeviceGuard guard(device);
+    launch([alias = cpu_alias(self), stored, device]() {
+        FOO_TRACE_SCOPE_SIZES("foo::fill", device, alias.sizes(), alias.scalar_type());
+        alias.fill_(stored);
+    });
+}
+
+} // namespace foo_core
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <ATen/core/Tensor.h>
+#include <c10/core/Allocator.h>
+#include <c10/core/Scalar.h>
+#include <c10/core/ScalarType.h>
+#include <c10/core/StorageImpl.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+namespace foo_core {
+
+// =====================================
+// ======= Constant-fill storages ======
+// =====================================
+
+// A fill_ that covers a whole foo storage (torch.zeros, torch.full, zero_()
+// on a fresh gradient, ...) doesn't write anything. The storage remembers the
+// constant instead, so its memory stays untouched and the pages of a fresh
+// segment are not even faulted in. The constant is written out, on the
+// current stream, right before a kernel reads the storage or overwrites part
+// of it. Kernels that can use the constant directly do so: copies out of the
+// storage become fills of their destination, and writes that cover the whole
+// storage just drop the constant.
+//
+// Every foo kernel therefore calls materialize_fills() on its inputs and
+// materialize_fill_for_write() on its outputs, next to flush_lazy(). Memory
+// reached through a raw data_ptr() outside of foo_core must be materialized
+// the same way first.
+
+struct PendingFill {
+    c10::ScalarType dtype; // the element type the storage was filled as
+    c10::Scalar value;     // already converted to dtype
+};
+
+// The StorageImpl of foo tensors created by the foo factories and of foo
+// storages created through c10::make_storage_impl.
+class FooStorageImpl final : public c10::StorageImpl {
+public:
+    using c10::StorageImpl::StorageImpl;
+    ~FooStorageImpl() override;
+
+    std::optional<PendingFill> pending_fill() const;
+    void set_pending_fill(PendingFill fill);
+    // Clears the pending fill and returns it.
+    std::optional<PendingFill> take_pending_fill();
+
+private:
+    mutable std::mutex mutex_;
+    std::optional<PendingFill> pending_fill_;
+};
+
+// Creates a FooStorageImpl of `nbytes` bytes from the foo allocator, on the
+// current device.
+c10::Storage make_foo_storage(size_t nbytes);
+
+// The number of storages with a pending fill, so the checks below are a
+// single atomic load while there are none.
+std::atomic<int64_t>& pending_fill_count();
+
+// Returns the pending fill of the storage of `tensor`, if any.
+std::optional<PendingFill> get_pending_fill(const at::Tensor& tensor);
+
+// Whether writing every element of `tensor` overwrites every byte of its
+// storage.
+bool covers_storage(const at::Tensor& tensor);
+
+// Records `value` as the pending fill of the storage of `self` if `self`
+// covers it. Returns false, without doing anything, otherwise.
+bool try_record_fill(const at::Tensor& self, const c10::Scalar& value);
+
+// Enqueues the pending fill of the storage of `tensor`, if any, on the current
+// stream of its device.
+void materialize_fill(const at::Tensor& tensor);
+
+// Like materialize_fill() for a tensor the caller is about to overwrite: when
+// the tensor covers its whole storage, the pending fill is dropped instead.
+// Inputs that may share the storage must be materialized first.
+void materialize_fill_for_write(const at::Tensor& tensor);
+
+template <typename... Tensors>
+void materialize_fills(const at::Tensor& tensor, const Tensors&... tensors)
+{
+    materialize_fill(tensor);
+    (materialize_fill(tensors), ...);
+}
+
+void materialize_fills(at::TensorList tensors);
+
+// fill_ for foo tensors: records the constant when `self` covers its storage,
+// and enqueues a fill of just its elements otherwise.
+void foo_fill_(const at::Tensor& self, const c10::Scalar& value);
+
+} // namespace foo_core
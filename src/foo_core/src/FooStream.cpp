@@ -0,0 +1,381 @@
+#include "FooStream.h"
+#include "FooDeviceGuardImpl.h"
+#include "FooLazy.h"
+#include "FooTopology.h"
+
+#include <ATen/Parallel.h>
+#include <c10/util/Exception.h>
+#include <c10/util/thread_name.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace foo_core {
+
+// Our device is host memory, so a "stream" is simply a FIFO queue of host
+// tasks executed by a dedicated worker thread. This gives the same ordering
+// guarantees as CUDA streams: work on one stream runs in order, work on
+// different streams may overlap, and the host only waits when it synchronizes.
+//
+// Stream ids: 0 is the default stream of a device and 1..kStreamsPerPool are
+// the pool streams. Workers are created lazily on first use.
+namespace {
+
+constexpr int kStreamsPerPool = 8;
+
+// Set on stream worker threads. Work launched from inside a running task is
+// executed inline, since that task is already ordered on its stream.
+thread_local bool in_stream_worker = false;
+
+class StreamWorker {
+public:
+    explicit StreamWorker(c10::DeviceIndex device) : device_(device), thread_(&StreamWorker::run, this) {}
+
+    void enqueue(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(std::move(task));
+            ++enqueued_;
+        }
+        work_cv_.notify_one();
+    }
+
+    bool query()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return completed_ == enqueued_;
+    }
+
+    // Waits for everything enqueued so far. An exception thrown by a task is
+    // reported by the next synchronize on its stream.
+    void synchronize()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        const uint64_t target = enqueued_;
+        done_cv_.wait(lock, [&]() { return completed_ >= target; });
+        if (error_) {
+            std::exception_ptr error = error_;
+            error_ = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    void run()
+    {
+        c10::setThreadName("foo_stream_" + std::to_string(device_));
+        // Run the device's work on the cores of its NUMA node. ATen's intra-op
+        // pool is shared by the whole process, so kernels split their work over
+        // the pool of the node with device_parallel_for().
+        bind_thread_to_device(device_);
+        FooDeviceGuardImpl().setDevice(c10::Device(c10::DeviceType::PrivateUse1, device_));
+        at::init_num_threads();
+        in_stream_worker = true;
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            work_cv_.wait(lock, [&]() { return !queue_.empty(); });
+            std::function<void()> task = std::move(queue_.front());
+            queue_.pop_front();
+            lock.unlock();
+
+            std::exception_ptr error;
+            try {
+                task();
+            } catch (...) {
+                error = std::current_exception();
+            }
+            // Drop the captured state (e.g. tensors) before reporting completion.
+            task = nullptr;
+
+            lock.lock();
+            if (error && !error_) {
+                error_ = error;
+            }
+            ++completed_;
+            done_cv_.notify_all();
+        }
+    }
+
+    const c10::DeviceIndex device_;
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    std::deque<std::function<void()>> queue_;
+    uint64_t enqueued_ = 0;
+    uint64_t completed_ = 0;
+    std::exception_ptr error_;
+    std::thread thread_; // must be initialized last
+};
+
+struct DeviceStreams {
+    std::array<std::once_flag, kStreamsPerPool + 1> init_flags;
+    std::array<std::atomic<StreamWorker*>, kStreamsPerPool + 1> workers{};
+    std::atomic<uint32_t> next_pool_stream{0};
+};
+
+c10::DeviceIndex device_count()
+{
+    return FooDeviceGuardImpl().deviceCount();
+}
+
+c10::DeviceIndex normalize_device(c10::DeviceIndex device)
+{
+    if (device < 0) {
+        device = FooDeviceGuardImpl().getDevice().index();
+    }
+    if (device < 0) {
+        device = 0;
+    }
+    TORCH_CHECK(device < device_count(), "Invalid foo device index ", static_cast<int>(device));
+    return device;
+}
+
+// Intentionally leaked: the worker threads outlive static destruction.
+std::vector<DeviceStreams>& device_streams()
+{
+    static std::vector<DeviceStreams>* streams = new std::vector<DeviceStreams>(device_count());
+    return *streams;
+}
+
+void check_stream(const c10::Stream& stream)
+{
+    TORCH_CHECK(stream.device_type() == c10::DeviceType::PrivateUse1, "Expected a foo stream, got ", stream);
+    TORCH_CHECK(stream.id() >= 0 && stream.id() <= kStreamsPerPool, "Invalid foo stream id ", stream.id());
+}
+
+StreamWorker* get_worker_if_created(const c10::Stream& stream)
+{
+    check_stream(stream);
+    DeviceStreams& streams = device_streams()[normalize_device(stream.device_index())];
+    return streams.workers[stream.id()].load(std::memory_order_acquire);
+}
+
+// Workers are intentionally leaked, like the streams vector above.
+StreamWorker& get_worker(const c10::Stream& stream)
+{
+    check_stream(stream);
+    const c10::DeviceIndex device = normalize_device(stream.device_index());
+    DeviceStreams& streams = device_streams()[device];
+    std::call_once(streams.init_flags[stream.id()], [&]() {
+        streams.workers[stream.id()].store(new StreamWorker(device), std::memory_order_release);
+    });
+    return *streams.workers[stream.id()].load(std::memory_order_acquire);
+}
+
+std::vector<c10::StreamId>& current_stream_ids()
+{
+    thread_local std::vector<c10::StreamId> ids(device_count(), 0);
+    return ids;
+}
+
+c10::Stream make_stream(c10::DeviceIndex device, c10::StreamId id)
+{
+    return c10::Stream(c10::Stream::UNSAFE, c10::Device(c10::DeviceType::PrivateUse1, device), id);
+}
+
+// The shared state of an event. Tasks enqueued by record/block hold on to it,
+// so it outlives the c10::Event that created it.
+struct EventState {
+    std::mutex mutex;
+    std::condition_variable cv;
+    uint64_t recorded = 0;  // version of the latest record()
+    uint64_t completed = 0; // version of the latest record() that has run
+    std::chrono::steady_clock::time_point completion_time;
+
+    void wait_for(uint64_t version)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]() { return completed >= version; });
+    }
+};
+
+struct FooEvent {
+    std::shared_ptr<EventState> state = std::make_shared<EventState>();
+};
+
+} // namespace
+
+c10::Stream get_current_stream(c10::DeviceIndex device)
+{
+    device = normalize_device(device);
+    return make_stream(device, current_stream_ids()[device]);
+}
+
+void set_current_stream(const c10::Stream& stream)
+{
+    check_stream(stream);
+    current_stream_ids()[normalize_device(stream.device_index())] = stream.id();
+}
+
+c10::Stream get_default_stream(c10::DeviceIndex device)
+{
+    return make_stream(normalize_device(device), 0);
+}
+
+c10::Stream get_stream_from_pool(c10::DeviceIndex device)
+{
+    device = normalize_device(device);
+    const uint32_t index = device_streams()[device].next_pool_stream++ % kStreamsPerPool;
+    return make_stream(device, static_cast<c10::StreamId>(index) + 1);
+}
+
+void launch(const c10::Stream& stream, std::function<void()> task)
+{
+    if (in_stream_worker) {
+        task();
+        return;
+    }
+    get_worker(stream).enqueue(std::move(task));
+}
+
+void launch(std::function<void()> task)
+{
+    launch(get_current_stream(), std::move(task));
+}
+
+bool query_stream(const c10::Stream& stream)
+{
+    StreamWorker* worker = get_worker_if_created(stream);
+    return worker == nullptr || worker->query();
+}
+
+void synchronize_stream(const c10::Stream& stream)
+{
+    if (in_stream_worker) {
+        return;
+    }
+    StreamWorker* worker = get_worker_if_created(stream);
+    if (worker != nullptr) {
+        worker->synchronize();
+    }
+}
+
+void synchronize(c10::DeviceIndex device)
+{
+    flush_lazy();
+    device = normalize_device(device);
+    for (c10::StreamId id = 0; id <= kStreamsPerPool; ++id) {
+        synchronize_stream(make_stream(device, id));
+    }
+}
+
+void synchronize_current_streams()
+{
+    const std::vector<c10::StreamId>& ids = current_stream_ids();
+    for (c10::DeviceIndex device = 0; device < static_cast<c10::DeviceIndex>(ids.size()); ++device) {
+        synchronize_stream(make_stream(device, ids[device]));
+    }
+}
+
+void stream_wait_stream(const c10::Stream& waiter, const c10::Stream& waited)
+{
+    if (waiter == waited) {
+        return;
+    }
+    // The tasks hold on to the event state, so the event can go right away.
+    void* event = nullptr;
+    record_event(&event, waited);
+    block_event(event, waiter);
+    destroy_event(event);
+}
+
+void record_event(void** event, const c10::Stream& stream)
+{
+    if (*event == nullptr) {
+        *event = new FooEvent();
+    }
+    std::shared_ptr<EventState> state = static_cast<FooEvent*>(*event)->state;
+    uint64_t version = 0;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        version = ++state->recorded;
+    }
+    launch(stream, [state, version]() {
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->completed = std::max(state->completed, version);
+            state->completion_time = std::chrono::steady_clock::now();
+        }
+        state->cv.notify_all();
+    });
+}
+
+void block_event(void* event, const c10::Stream& stream)
+{
+    if (event == nullptr) {
+        return;
+    }
+    std::shared_ptr<EventState> state = static_cast<FooEvent*>(event)->state;
+    uint64_t version = 0;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        version = state->recorded;
+    }
+    if (version == 0) {
+        return;
+    }
+    launch(stream, [state, version]() { state->wait_for(version); });
+}
+
+bool query_event(void* event)
+{
+    if (event == nullptr) {
+        return true;
+    }
+    EventState& state = *static_cast<FooEvent*>(event)->state;
+    std::lock_guard<std::mutex> lock(state.mutex);
+    return state.completed >= state.recorded;
+}
+
+void synchronize_event(void* event)
+{
+    if (event == nullptr) {
+        return;
+    }
+    EventState& state = *static_cast<FooEvent*>(event)->state;
+    uint64_t version = 0;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        version = state.recorded;
+    }
+    state.wait_for(version);
+}
+
+double event_elapsed_time(void* start_event, void* end_event)
+{
+    TORCH_CHECK(start_event && end_event, "Both events must be recorded before calculating elapsed time.");
+    EventState& start = *static_cast<FooEvent*>(start_event)->state;
+    EventState& end = *static_cast<FooEvent*>(end_event)->state;
+    std::chrono::steady_clock::time_point start_time;
+    std::chrono::steady_clock::time_point end_time;
+    {
+        std::lock_guard<std::mutex> lock(start.mutex);
+        TORCH_CHECK(start.recorded > 0 && start.completed >= start.recorded, "Start event has not completed yet.");
+        start_time = start.completion_time;
+    }
+    {
+        std::lock_guard<std::mutex> lock(end.mutex);
+        TORCH_CHECK(end.recorded > 0 && end.completed >= end.recorded, "End event has not completed yet.");
+        end_time = end.completion_time;
+    }
+    return std::chrono::duration<double, std::milli>(end_time - start_time).count();
+}
+
+void destroy_event(void* event) noexcept
+{
+    delete static_cast<FooEvent*>(event);
+}
+
+} // namespace foo_core
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <c10/core/Device.h>
+#include <c10/core/Stream.h>
+
+#include "foo_core/stream.h"
+
+namespace foo_core {
+
+// =====================================
+// ========= Streams and Events ========
+// =====================================
+
+// Internal stream and event primitives backing FooDeviceGuardImpl. Events are
+// opaque pointers owned by the caller (c10::Event), created lazily by the
+// first record_event() call and released with destroy_event().
+
+bool query_stream(const c10::Stream& stream);
+void synchronize_stream(const c10::Stream& stream);
+
+// Waits for the current stream of every device used by this thread. Host code
+// that reads or writes foo memory directly (e.g. the CPU fallback) calls this
+// first so it observes all work previously enqueued by this thread.
+void synchronize_current_streams();
+
+// Makes the work enqueued on `waiter` from now on wait for the work already
+// enqueued on `waited`, without blocking the host.
+void stream_wait_stream(const c10::Stream& waiter, const c10::Stream& waited);
+
+void record_event(void** event, const c10::Stream& stream);
+void block_event(void* event, const c10::Stream& stream);
+bool query_event(void* event);
+void synchronize_event(void* event);
+double event_elapsed_time(void* start_event, void* end_event);
+void destroy_event(void* event) noexcept;
+
+} // namespace foo_core
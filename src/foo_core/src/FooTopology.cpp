@@ -0,0 +1,205 @@
+#include "FooTopology.h"
+#include "FooDeviceGuardImpl.h"
+#include "foo_core/device.h"
+
+#include <c10/core/impl/alloc_cpu.h>
+#include <c10/util/Exception.h>
+
+#include <dirent.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <string>
+
+namespace foo_core {
+
+namespace {
+
+// From <numaif.h>, which would pull in a libnuma dependency just for mbind().
+constexpr int kMpolPreferred = 1;
+constexpr unsigned kMpolMfMove = 1 << 1;
+
+constexpr size_t kMinDeviceCount = 2;
+
+// Parses a sysfs cpu list such as "0-3,8,10-11".
+std::vector<int> parse_cpu_list(const std::string& list)
+{
+    std::vector<int> cpus;
+    std::stringstream ranges(list);
+    std::string range;
+    while (std::getline(ranges, range, ',')) {
+        if (range.empty() || range == "\n") {
+            continue;
+        }
+        const size_t dash = range.find('-');
+        const int first = std::stoi(range.substr(0, dash));
+        const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// The online NUMA nodes with at least one core we are allowed to run on.
+std::vector<FooDeviceTopology> read_numa_nodes()
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    const bool has_affinity = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+    auto is_allowed = [&](int cpu) { return !has_affinity || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)); };
+
+    std::vector<FooDeviceTopology> nodes;
+    if (DIR* dir = opendir("/sys/devices/system/node")) {
+        while (const dirent* entry = readdir(dir)) {
+            const std::string name(entry->d_name);
+            if (name.compare(0, 4, "node") != 0 || name.size() == 4
+                || !std::all_of(name.begin() + 4, name.end(), [](unsigned char c) { return std::isdigit(c); })) {
+                continue;
+            }
+            std::ifstream file("/sys/devices/system/node/" + name + "/cpulist");
+            std::string list;
+            std::getline(file, list);
+            std::vector<int> cpus = parse_cpu_list(list);
+            cpus.erase(std::remove_if(cpus.begin(), cpus.end(), [&](int cpu) { return !is_allowed(cpu); }), cpus.end());
+            if (!cpus.empty()) {
+                nodes.push_back(FooDeviceTopology{std::stoi(name.substr(4)), std::move(cpus)});
+            }
+        }
+        closedir(dir);
+    }
+    std::sort(nodes.begin(), nodes.end(), [](const FooDeviceTopology& a, const FooDeviceTopology& b) {
+        return a.numa_node < b.numa_node;
+    });
+
+    if (nodes.empty()) {
+        FooDeviceTopology node{0, {}};
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (has_affinity && CPU_ISSET(cpu, &allowed)) {
+                node.cpus.push_back(cpu);
+            }
+        }
+        nodes.push_back(std::move(node));
+    }
+    return nodes;
+}
+
+std::vector<FooDeviceTopology> read_topology()
+{
+    const std::vector<FooDeviceTopology> nodes = read_numa_nodes();
+    size_t count = std::max(nodes.size(), kMinDeviceCount);
+    if (const char* env = std::getenv("TORCH_FOO_DEVICE_COUNT")) {
+        // Read from noexcept code (deviceCount()), so a bad value is ignored.
+        const int requested = std::atoi(env);
+        if (requested > 0 && requested <= std::numeric_limits<c10::DeviceIndex>::max()) {
+            count = static_cast<size_t>(requested);
+        } else {
+            TORCH_WARN("Ignoring TORCH_FOO_DEVICE_COUNT='", env, "', expected a positive device count");
+        }
+    }
+    std::vector<FooDeviceTopology> devices;
+    devices.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        devices.push_back(nodes[i % nodes.size()]);
+    }
+    return devices;
+}
+
+} // namespace
+
+bool is_multi_node()
+{
+    static const bool multi_node = read_numa_nodes().size() > 1;
+    return multi_node;
+}
+
+const std::vector<FooDeviceTopology>& device_topology()
+{
+    static const std::vector<FooDeviceTopology> topology = read_topology();
+    return topology;
+}
+
+c10::DeviceIndex topology_device_count()
+{
+    return static_cast<c10::DeviceIndex>(device_topology().size());
+}
+
+c10::DeviceIndex device_count()
+{
+    return topology_device_count();
+}
+
+c10::DeviceIndex current_device()
+{
+    return FooDeviceGuardImpl().getDevice().index();
+}
+
+void set_device(c10::DeviceIndex device)
+{
+    FooDeviceGuardImpl().setDevice(c10::Device(c10::DeviceType::PrivateUse1, device));
+}
+
+int device_numa_node(c10::DeviceIndex device)
+{
+    TORCH_CHECK(device >= 0 && device < topology_device_count(), "Invalid foo device index ", static_cast<int>(device));
+    return device_topology()[device].numa_node;
+}
+
+void* alloc_device_memory(c10::DeviceIndex device, size_t size)
+{
+    if (!is_multi_node()) {
+        try {
+            return c10::alloc_cpu(size);
+        } catch (const c10::Error&) {
+            return nullptr;
+        }
+    }
+    // mbind() needs page aligned memory whose pages haven't been touched yet,
+    // so go to mmap() directly instead of the CPU allocator.
+    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return nullptr;
+    }
+    const int node = device_topology()[device].numa_node;
+    unsigned long nodemask[16] = {};
+    if (node < static_cast<int>(sizeof(nodemask) * 8)) {
+        nodemask[node / (sizeof(unsigned long) * 8)] |= 1UL << (node % (sizeof(unsigned long) * 8));
+        // Preferred rather than bound: running out of memory on the node
+        // falls back to other nodes instead of failing.
+        syscall(SYS_mbind, ptr, size, kMpolPreferred, nodemask, sizeof(nodemask) * 8, kMpolMfMove);
+    }
+    return ptr;
+}
+
+void free_device_memory(void* ptr, size_t size)
+{
+    if (!is_multi_node()) {
+        c10::free_cpu(ptr);
+        return;
+    }
+    munmap(ptr, size);
+}
+
+void bind_thread_to_device(c10::DeviceIndex device)
+{
+    if (!is_multi_node()) {
+        return;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu : device_topology()[device].cpus) {
+        CPU_SET(cpu, &cpus);
+    }
+    // Best effort: a failure only costs locality.
+    sched_setaffinity(0, sizeof(cpus), &cpus);
+}
+
+} // namespace foo_core
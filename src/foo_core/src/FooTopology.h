@@ -0,0 +1,46 @@
+#pragma once
+
+#include <c10/core/Device.h>
+
+#include <cstddef>
+#include <vector>
+
+namespace foo_core {
+
+// =====================================
+// ========== Device topology ==========
+// =====================================
+
+// Each foo device is bound to a NUMA node of the host: foo:N uses the memory
+// and cores of node N. The nodes are read from /sys/devices/system/node, and
+// machines without NUMA information look like a single node with every core
+// the process may run on.
+//
+// There are as many devices as nodes, but at least two, so code that moves
+// tensors between devices runs on single node hosts too. TORCH_FOO_DEVICE_COUNT=N
+// overrides the number. Devices beyond the number of nodes wrap around, so
+// e.g. the two devices of a single node host share its memory and cores.
+struct FooDeviceTopology {
+    int numa_node;         // the NUMA node backing the device
+    std::vector<int> cpus; // the cores of that node
+};
+
+// The topology of every device, read once.
+const std::vector<FooDeviceTopology>& device_topology();
+
+c10::DeviceIndex topology_device_count();
+
+// Allocates `size` bytes of memory local to the node of `device`. Returns
+// nullptr on failure. Memory must be released with free_device_memory().
+void* alloc_device_memory(c10::DeviceIndex device, size_t size);
+void free_device_memory(void* ptr, size_t size);
+
+// Whether the host has more than one NUMA node.
+bool is_multi_node();
+
+// Restricts the calling thread to the cores of the node of `device` for good,
+// as stream workers and the node pools of device_parallel_for() do. Does
+// nothing on single node hosts.
+void bind_thread_to_device(c10::DeviceIndex device);
+
+} // namespace foo_core
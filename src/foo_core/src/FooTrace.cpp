@@ -0,0 +1,207 @@
+#include "FooTrace.h"
+
+#include <c10/util/Exception.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace foo_core {
+
+#ifdef FOO_WITH_TRACING
+
+namespace {
+
+// Events kept per thread; older events are overwritten.
+constexpr uint64_t kTraceBufferSize = 4096;
+
+// A single-producer ring buffer. Only the owning thread writes events, and it
+// publishes them by advancing `head`, so recording never takes a lock.
+// Readers copy the slots below `head` and then drop the ones the writer may
+// have overwritten in the meantime.
+struct TraceBuffer {
+    explicit TraceBuffer(int tid) : tid(tid) {}
+
+    std::array<TraceEvent, kTraceBufferSize> events;
+    std::atomic<uint64_t> head{0}; // number of events ever recorded
+    std::atomic<uint64_t> tail{0}; // events below this were cleared
+    const int tid;
+};
+
+struct TraceRegistry {
+    std::mutex mutex;
+    std::vector<TraceBuffer*> buffers;
+};
+
+// Intentionally leaked, along with the buffers: the events of a thread stay
+// exportable after the thread exits.
+TraceRegistry& registry()
+{
+    static TraceRegistry* registry = new TraceRegistry();
+    return *registry;
+}
+
+TraceBuffer& thread_buffer()
+{
+    thread_local TraceBuffer* buffer = []() {
+        TraceRegistry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.buffers.push_back(new TraceBuffer(static_cast<int>(r.buffers.size())));
+        return r.buffers.back();
+    }();
+    return *buffer;
+}
+
+bool tracing_from_env()
+{
+    const char* env = std::getenv("TORCH_FOO_TRACE");
+    return env != nullptr && std::string(env) != "0" && std::string(env) != "";
+}
+
+void write_escaped(std::ostream& out, const char* str)
+{
+    for (; *str != '\0'; ++str) {
+        if (*str == '"' || *str == '\\') {
+            out << '\\';
+        }
+        out << *str;
+    }
+}
+
+void write_event(std::ostream& out, const TraceEvent& event, int tid)
+{
+    out << "{\"name\":\"";
+    write_escaped(out, event.name);
+    out << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << tid
+        << ",\"ts\":" << static_cast<double>(event.begin_ns) / 1000.0
+        << ",\"dur\":" << static_cast<double>(event.end_ns - event.begin_ns) / 1000.0
+        << ",\"args\":{\"device\":\"foo:" << static_cast<int>(event.device) << "\",\"shape\":[";
+    const int ndim = event.ndim < 0 ? kTraceMaxDims : event.ndim;
+    for (int dim = 0; dim < ndim; ++dim) {
+        out << (dim > 0 ? "," : "") << event.shape[dim];
+    }
+    if (event.ndim < 0) {
+        out << ",\"...\"";
+    }
+    out << "],\"bytes\":" << event.bytes << "}}";
+}
+
+} // namespace
+
+std::atomic<bool>& tracing_flag()
+{
+    static std::atomic<bool> enabled(tracing_from_env());
+    return enabled;
+}
+
+int64_t trace_now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void record_trace_event(const TraceEvent& event)
+{
+    TraceBuffer& buffer = thread_buffer();
+    const uint64_t head = buffer.head.load(std::memory_order_relaxed);
+    buffer.events[head % kTraceBufferSize] = event;
+    buffer.head.store(head + 1, std::memory_order_release);
+}
+
+void TraceScope::begin(const char* name, c10::Device device, c10::IntArrayRef sizes, int64_t bytes)
+{
+    event_.name = name;
+    event_.device = static_cast<int8_t>(device.has_index() ? device.index() : -1);
+    event_.bytes = bytes;
+    const size_t ndim = std::min(sizes.size(), static_cast<size_t>(kTraceMaxDims));
+    std::copy(sizes.begin(), sizes.begin() + ndim, event_.shape);
+    event_.ndim = sizes.size() > ndim ? -1 : static_cast<int8_t>(ndim);
+    event_.begin_ns = trace_now_ns();
+}
+
+bool is_tracing_available()
+{
+    return true;
+}
+
+bool is_tracing_enabled()
+{
+    return tracing_enabled();
+}
+
+void set_tracing_enabled(bool enabled)
+{
+    tracing_flag().store(enabled, std::memory_order_relaxed);
+}
+
+void clear_trace()
+{
+    TraceRegistry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    for (TraceBuffer* buffer : r.buffers) {
+        buffer->tail.store(buffer->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+}
+
+std::string export_chrome_trace()
+{
+    std::ostringstream out;
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    std::vector<TraceEvent> events;
+    TraceRegistry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    for (TraceBuffer* buffer : r.buffers) {
+        const uint64_t head = buffer->head.load(std::memory_order_acquire);
+        const uint64_t oldest = head > kTraceBufferSize ? head - kTraceBufferSize : 0;
+        const uint64_t begin = std::max(oldest, buffer->tail.load(std::memory_order_relaxed));
+        events.clear();
+        for (uint64_t idx = begin; idx < head; ++idx) {
+            events.push_back(buffer->events[idx % kTraceBufferSize]);
+        }
+        // Skip the slots the owning thread overwrote while they were copied,
+        // including the one it may be writing right now.
+        const uint64_t new_head = buffer->head.load(std::memory_order_acquire);
+        const uint64_t overwritten = new_head + 1 > kTraceBufferSize ? new_head + 1 - kTraceBufferSize : 0;
+        for (uint64_t idx = std::max(begin, overwritten); idx < head; ++idx) {
+            out << (first ? "" : ",");
+            write_event(out, events[idx - begin], buffer->tid);
+            first = false;
+        }
+    }
+    out << "]}";
+    return out.str();
+}
+
+#else
+
+bool is_tracing_available()
+{
+    return false;
+}
+
+bool is_tracing_enabled()
+{
+    return false;
+}
+
+void set_tracing_enabled(bool enabled)
+{
+    TORCH_CHECK(!enabled, "torch_foo was built without tracing support (FOO_WITH_TRACING=OFF)");
+}
+
+void clear_trace() {}
+
+std::string export_chrome_trace()
+{
+    return "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[]}";
+}
+
+#endif
+
+} // namespace foo_core
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <ATen/core/Tensor.h>
+#include <c10/core/Device.h>
+#include <c10/core/ScalarType.h>
+#include <c10/util/ArrayRef.h>
+#include <c10/util/accumulate.h>
+
+#include <atomic>
+#include <cstdint>
+
+#include "foo_core/trace.h"
+
+namespace foo_core {
+
+// =====================================
+// ============= Tracing ===============
+// =====================================
+
+// Instrument a kernel with FOO_TRACE_SCOPE("name", tensor), where `tensor` is
+// the tensor whose device, shape and size describe the work. The event is
+// recorded when the scope ends. FOO_TRACE_SCOPE_SIZES(name, device, sizes,
+// dtype) does the same for factories. Names must be string literals (or
+// otherwise outlive the trace). Without FOO_WITH_TRACING both macros expand to
+// nothing.
+#ifdef FOO_WITH_TRACING
+
+constexpr int kTraceMaxDims = 6;
+
+struct TraceEvent {
+    const char* name;
+    int64_t begin_ns;
+    int64_t end_ns;
+    int64_t bytes;
+    int64_t shape[kTraceMaxDims];
+    int8_t ndim; // -1 when the shape was truncated
+    int8_t device;
+};
+
+std::atomic<bool>& tracing_flag();
+
+inline bool tracing_enabled()
+{
+    return tracing_flag().load(std::memory_order_relaxed);
+}
+
+int64_t trace_now_ns();
+
+// Appends `event` to the ring buffer of the calling thread.
+void record_trace_event(const TraceEvent& event);
+
+// Captures the device, shape and size of the work when it is constructed and
+// records the event, with its duration, when it is destroyed.
+class TraceScope {
+public:
+    TraceScope(const char* name, const at::Tensor& tensor)
+    {
+        if (tracing_enabled() && tensor.defined()) {
+            begin(name, tensor.device(), tensor.sizes(), static_cast<int64_t>(tensor.nbytes()));
+        }
+    }
+
+    // For factories, which have no tensor to describe yet.
+    TraceScope(const char* name, c10::Device device, c10::IntArrayRef sizes, c10::ScalarType dtype)
+    {
+        if (tracing_enabled()) {
+            begin(name, device, sizes, c10::multiply_integers(sizes) * static_cast<int64_t>(c10::elementSize(dtype)));
+        }
+    }
+
+    ~TraceScope()
+    {
+        if (event_.name != nullptr) {
+            event_.end_ns = trace_now_ns();
+            record_trace_event(event_);
+        }
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    void begin(const char* name, c10::Device device, c10::IntArrayRef sizes, int64_t bytes);
+
+    TraceEvent event_{};
+};
+
+#define FOO_TRACE_CONCAT_(a, b) a##b
+#define FOO_TRACE_CONCAT(a, b) FOO_TRACE_CONCAT_(a, b)
+#define FOO_TRACE_SCOPE(name, tensor) \
+    const ::foo_core::TraceScope FOO_TRACE_CONCAT(foo_trace_scope_, __LINE__)(name, tensor)
+#define FOO_TRACE_SCOPE_SIZES(name, device, sizes, dtype) \
+    const ::foo_core::TraceScope FOO_TRACE_CONCAT(foo_trace_scope_, __LINE__)(name, device, sizes, dtype)
+
+#else
+
+#define FOO_TRACE_SCOPE(name, tensor) ((void)0)
+#define FOO_TRACE_SCOPE_SIZES(name, device, sizes, dtype) ((void)0)
+
+#endif
+
+} // namespace foo_core
@@ -2,6 +2,7 @@
 #include <ATen/EmptyTensor.h>
 #include <ATen/core/TensorBody.h>
 #include <ATen/ops/_to_copy_native.h>
+#include <ATen/ops/resize_native.h>
 #include <c10/core/Allocator.h>
 #include <c10/core/Device.h>
 #include <c10/core/DeviceGuard.h>
@@ -12,13 +13,16 @@
 #include <c10/core/ScalarType.h>
 #include <c10/core/TensorOptions.h>
 #include <c10/util/ArrayRef.h>
-#include <cstring>
-#include <iostream>
 #include <optional>
 #include <torch/library.h>
 #include <torch/torch.h>
 
+#include "FooCopy.h"
 #include "FooDeviceGuard.h"
+#include "FooLazy.h"
+#include "FooStorageImpl.h"
+#include "FooStream.h"
+#include "FooTrace.h"
 
 namespace foo_core {
 
@@ -31,15 +35,17 @@ inline bool is_foo(const at::Tensor& tensor)
 // ============= KERNELS ===============
 // =====================================
 
-// basic dummy empty function, so we can directly construct tensors on the custom device
-// This dummy test device will just use the CPU allocator, and ignores pinned memory.
+// The empty kernels construct tensors directly on the foo device. Their memory
+// comes from the foo caching allocator (FooAllocator.cpp), which serves blocks
+// from per-device pools of host memory on the device's NUMA node. Pinned
+// memory only exists on the host side (FooHostAllocator.cpp), so asking for it
+// here is an error.
 //
-// Note: this kernel is very simple because our "custom device" just uses the normal TensorImpl object
-// to store data under the hood.
-// In PyTorch core today, both cpu and cuda are implemented with an ordinary TensorImpl class.
-// Sometimes, backends prefer to subclass TensorImpl in order to store extra information.
-// If this is the case, then this kernel is where you'll be responsible for creating and returning
-// a fresh at::Tensor object, that properly stores a TensorImpl of your subclass.
+// Foo tensors use the ordinary TensorImpl, like CPU and CUDA tensors; a backend
+// that needs extra state per tensor would create its TensorImpl subclass here.
+// Only the storage is specialized: a FooStorageImpl can hold a pending
+// constant fill instead of written memory (see FooStorageImpl.h), so the
+// factories build their tensors on make_foo_storage().
 
 // Empty Tensor Factories
 at::Tensor custom_empty_memory_format(c10::IntArrayRef size, std::optional<c10::ScalarType> dtype_opt, std::optional<c10::Layout> layout_opt, std::optional<c10::Device> device_opt, std::optional<bool> pin_memory_opt, std::optional<c10::MemoryFormat> memory_format_opt)
@@ -56,10 +62,22 @@ at::Tensor custom_empty_memory_format(c10::IntArrayRef size, std::optional<c10::
         "Pin memory can only be on CPU"
     )
     const FooDeviceGuard guard(device); // Example of using our specialized device guard
-    auto allocator = c10::GetAllocator(c10::DeviceType::PrivateUse1); // Will get the foo allocator we registered
+    FOO_TRACE_SCOPE_SIZES("aten::empty.memory_format", device, size, dtype);
+    // Same as at::detail::empty_generic, but with a FooStorageImpl.
+    at::detail::check_size_nonnegative(size);
+    const caffe2::TypeMeta type_meta = c10::scalarTypeToTypeMeta(dtype);
+    const size_t nbytes = at::detail::computeStorageNbytesContiguous(size, type_meta.itemsize());
     constexpr c10::DispatchKeySet private_use_ks(c10::DispatchKey::PrivateUse1);
-    std::cout << "Custom aten::empty.memory_format() called!" << std::endl;
-    return at::detail::empty_generic(size, allocator, private_use_ks, c10::dtype_or_default(dtype), memory_format_opt);
+    at::Tensor tensor = at::detail::make_tensor<c10::TensorImpl>(make_foo_storage(nbytes), private_use_ks, type_meta);
+    // A fresh TensorImpl has sizes [0].
+    if (size.size() != 1 || size[0] != 0) {
+        tensor.unsafeGetTensorImpl()->set_sizes_contiguous(size);
+    }
+    const c10::MemoryFormat memory_format = memory_format_opt.value_or(c10::MemoryFormat::Contiguous);
+    if (memory_format != c10::MemoryFormat::Contiguous) {
+        tensor.unsafeGetTensorImpl()->empty_tensor_restride(memory_format);
+    }
+    return tensor;
 }
 
 at::Tensor custom_empty_strided(c10::IntArrayRef size, c10::IntArrayRef stride, std::optional<c10::ScalarType> dtype_opt, std::optional<c10::Layout> layout_opt, std::optional<c10::Device> device_opt, std::optional<bool> pin_memory_opt)
@@ -74,102 +92,105 @@ at::Tensor custom_empty_strided(c10::IntArrayRef size, c10::IntArrayRef stride,
         !c10::pinned_memory_or_default(pin_memory_opt),
         "Pin memory can only be on CPU");
     const FooDeviceGuard guard(device);
+    FOO_TRACE_SCOPE_SIZES("aten::empty_strided", device, size, dtype);
+    at::detail::check_size_nonnegative(size);
+    const caffe2::TypeMeta type_meta = c10::scalarTypeToTypeMeta(dtype);
+    const size_t nbytes = at::detail::computeStorageNbytes(size, stride, type_meta.itemsize());
     constexpr c10::DispatchKeySet private_use_ks(c10::DispatchKey::PrivateUse1);
-    auto allocator = c10::GetAllocator(c10::DeviceType::PrivateUse1);
-    std::cout << "Custom aten::empty.strided() called!" << std::endl;
-    return at::detail::empty_strided_generic(size, stride, allocator, private_use_ks, dtype);
+    at::Tensor tensor = at::detail::make_tensor<c10::TensorImpl>(make_foo_storage(nbytes), private_use_ks, type_meta);
+    tensor.unsafeGetTensorImpl()->set_sizes_and_strides(size, stride);
+    return tensor;
 }
 
+// All host<->foo and foo<->foo copies go through the copy engine (FooCopy.h).
+// copy_ dispatches here when either side is a foo tensor.
 at::Tensor& custom_copy_(at::Tensor& self, const at::Tensor& src, bool non_blocking)
 {
-    const FooDeviceGuard guard(self.device());
-    std::cout << "Custom aten::copy_() called!" << std::endl;
-    TORCH_CHECK(is_foo(self), "self must be on a foo device to dispatch here");
-
-    if (self.numel() == 0) {
-        return self;
-    }
-    // Secretly Just perform the CPU copy
-    return at::native::copy_(self, src, non_blocking);
-
+    FOO_TRACE_SCOPE("aten::copy_", self);
+    foo_copy(self, src, non_blocking);
+    return self;
 }
 
 at::Tensor custom__to_copy(const at::Tensor& self, std::optional<c10::ScalarType> dtype_opt, std::optional<c10::Layout> layout_opt, std::optional<c10::Device> device_opt, std::optional<bool> pin_memory_opt, bool non_blocking, std::optional<c10::MemoryFormat> memory_format_opt)
 {
-    const c10::ScalarType dtype = c10::dtype_or_default(dtype_opt);
-    const c10::Device device = c10::device_or_default(device_opt);
-
-    std::cout << "Custom aten::_to_copy() called!" << std::endl;
-    if (is_foo(self) && device.type() == c10::DeviceType::CPU) {
-        // Foo -> CPU
-        auto cpu_tensor = at::empty_like(self, self.options().device(c10::DeviceType::CPU));
-        cpu_tensor.copy_(self);
-        return cpu_tensor;
-
-    } else if (self.is_cpu() && device.is_privateuseone()) {
-        // CPU -> Foo
-        auto cpu_copy = self.to(self.options().device(at::kCPU), non_blocking, true, memory_format_opt);
-        auto copy = custom_empty_strided(self.sizes(), self.strides(), dtype_opt, layout_opt, device_opt, pin_memory_opt);
-        std::memcpy(copy.storage().data_ptr().get(), self.storage().data_ptr().get(), self.storage().nbytes());
-        return copy;
-    } else {
-        // Unsupported
-        TORCH_CHECK(false, "Unsupported");
-        return self;
-    }
+    FOO_TRACE_SCOPE("aten::_to_copy", self);
+    TORCH_CHECK(
+        c10::layout_or_default(layout_opt) == c10::Layout::Strided,
+        "Non strided layout not supported");
+    const c10::TensorOptions options = self.options()
+        .dtype(dtype_opt.value_or(self.scalar_type()))
+        .device(device_opt.value_or(self.device()))
+        .pinned_memory(pin_memory_opt);
+    // empty_like keeps the strides of dense inputs for MemoryFormat::Preserve.
+    at::Tensor copy = at::empty_like(self, options, memory_format_opt.value_or(c10::MemoryFormat::Preserve));
+    foo_copy(copy, self, non_blocking);
+    return copy;
 }
 
 at::Tensor custom__copy_from(const at::Tensor& self, const at::Tensor& dst, bool non_blocking)
 {
-    const at::OptionalDeviceGuard guard(at::device_of(self));
-    std::cout << "Custom aten::_copy_from() called!" << std::endl;
-    TORCH_CHECK(self.is_cpu() || self.device().type() == c10::DeviceType::PrivateUse1, "Dummy test only allows copy from cpu -> dummy device.");
-    TORCH_CHECK(dst.is_cpu() || dst.device().type() == c10::DeviceType::PrivateUse1, "Dummy test only allows copy from cpu -> dummy device.");
-    // Some dummy asserts for the basic use case: inputs are the same size / dtype, all contiguous.
-    TORCH_CHECK(self.sizes() == dst.sizes());
-    TORCH_CHECK(self.scalar_type() == dst.scalar_type());
-    TORCH_CHECK(self.is_contiguous() && dst.is_contiguous());
-
-    std::memcpy(dst.storage().data_ptr().get(), self.storage().data_ptr().get(), self.storage().nbytes());
+    FOO_TRACE_SCOPE("aten::_copy_from", self);
+    foo_copy(dst, self, non_blocking);
+    return dst;
+}
+
+at::Tensor custom__copy_from_and_resize(const at::Tensor& self, const at::Tensor& dst)
+{
+    FOO_TRACE_SCOPE("aten::_copy_from_and_resize", self);
+    if (dst.sizes() != self.sizes()) {
+        dst.resize_(self.sizes());
+    }
+    foo_copy(dst, self, /*non_blocking=*/false);
     return dst;
 }
 
-at::Tensor & custom_fill__scalar(at::Tensor & self, const at::Scalar & value) {
-  const at::OptionalDeviceGuard device_guard(at::device_of(self));
-  std::cout << "Custom aten::fill_.Scalar() called!" << std::endl;
-  // Not bothering to implement.
-  // Should fill the tensor's data with "value".
-  return self;
+// Growing a storage copies its old contents on the host, so the work already
+// enqueued on it has to finish first.
+const at::Tensor& custom_resize_(const at::Tensor& self, c10::IntArrayRef size, std::optional<c10::MemoryFormat> memory_format)
+{
+    flush_lazy();
+    materialize_fills(self);
+    const FooDeviceGuard guard(self.device());
+    synchronize_stream(get_current_stream(self.device().index()));
+    return at::native::resize_(self, size, memory_format);
 }
 
-// Adds two tensors (A + (B * 2)), ignore alpha for now.
-at::Tensor custom_add(const at::Tensor& self_, const at::Tensor& other_, const at::Scalar & alpha) {
-    const at::OptionalDeviceGuard guard(at::device_of(self_));
-    std::cout << "Custom aten::add.Tensor() called!" << std::endl;
-    TORCH_CHECK(self_.sizes() == other_.sizes());
-    TORCH_INTERNAL_ASSERT(self_.device().type() == c10::DeviceType::PrivateUse1); // These device guards will become different once we implement PrivateUse1 device guards
-    TORCH_INTERNAL_ASSERT(other_.device().type() == c10::DeviceType::PrivateUse1);
-    at::Tensor self = self_.contiguous();
-    at::Tensor other = other_.contiguous();
-    at::Tensor result = torch::empty(self.sizes(), self.options());
-    const float* self_ptr = self.data_ptr<float>();
-    const float* other_ptr = other.data_ptr<float>();
-    float* result_ptr = result.data_ptr<float>();
-    for (int64_t i = 0; i < result.numel(); i++) {
-    result_ptr[i] = self_ptr[i] + other_ptr[i] * 2;
-    }
-    return result;
+// Fills of whole storages are deferred until the memory is read, see
+// FooStorageImpl.h.
+at::Tensor& custom_fill__scalar(at::Tensor& self, const at::Scalar& value)
+{
+    const FooDeviceGuard guard(self.device());
+    FOO_TRACE_SCOPE("aten::fill_.Scalar", self);
+    flush_lazy();
+    foo_fill_(self, value);
+    return self;
+}
+
+at::Tensor& custom_fill__tensor(at::Tensor& self, const at::Tensor& value)
+{
+    TORCH_CHECK(value.dim() == 0, "fill_ only supports 0-dimension value tensor but got tensor with ", value.dim(),
+        " dimensions.");
+    return custom_fill__scalar(self, value.item());
+}
+
+at::Tensor& custom_zero_(at::Tensor& self)
+{
+    return custom_fill__scalar(self, 0);
 }
 
 TORCH_LIBRARY_IMPL(aten, PrivateUse1, m) {
-    // m.impl("add.Tensor", TORCH_FN(custom_add));
     m.impl("empty.memory_format", TORCH_FN(custom_empty_memory_format));
     m.impl("empty_strided", TORCH_FN(custom_empty_strided));
     m.impl("copy_", TORCH_FN(custom_copy_));
     m.impl("_to_copy", TORCH_FN(custom__to_copy));
 
+    m.impl("_copy_from", TORCH_FN(custom__copy_from));
+    m.impl("_copy_from_and_resize", TORCH_FN(custom__copy_from_and_resize));
+    m.impl("resize_", TORCH_FN(custom_resize_));
+
     m.impl("fill_.Scalar", TORCH_FN(custom_fill__scalar));
-    // m.impl("_copy_from", TORCH_FN(custom__copy_from));
+    m.impl("fill_.Tensor", TORCH_FN(custom_fill__tensor));
+    m.impl("zero_", TORCH_FN(custom_zero_));
 }
 
 } // namespace foo_core
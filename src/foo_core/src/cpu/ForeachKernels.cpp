@@ -0,0 +1,967 @@
+#include <ATen/Dispatch.h>
+#include <ATen/OpMathType.h>
+#include <ATen/Parallel.h>
+#include <ATen/core/Tensor.h>
+#include <ATen/cpu/vec/functional.h>
+#include <ATen/cpu/vec/vec.h>
+#include <c10/util/irange.h>
+#include <torch/library.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <vector>
+
+#include "FooDeviceGuard.h"
+#include "FooKernels.h"
+#include "FooLazy.h"
+#include "FooParallel.h"
+#include "FooStorageImpl.h"
+#include "FooTrace.h"
+#include "foo_core/stream.h"
+
+namespace foo_core {
+
+// =====================================
+// ========= Multi-tensor apply ========
+// =====================================
+
+// Optimizers call the _foreach_* ops on lists of hundreds of parameters. On the
+// fast path a whole list is handled by a single stream launch: every tensor is
+// cut into chunks of kChunkSize elements and the chunks of all tensors are
+// spread over the intra-op thread pool together, so many small tensors cost
+// about as much as one large one. Lists the fast path can't take (mixed
+// devices or dtypes, non-dense layouts, integer dtypes, ...) fall back to one
+// regular op per tensor, which is what ATen's own slow path does.
+
+namespace {
+
+using at::vec::Vectorized;
+
+constexpr int64_t kChunkSize = 1 << 16;
+
+template <typename T>
+struct OpmathTag {
+    using type = T;
+};
+
+template <typename T>
+T vsqrt(const T& x)
+{
+    return std::sqrt(x);
+}
+
+template <typename T>
+Vectorized<T> vsqrt(const Vectorized<T>& x)
+{
+    return x.sqrt();
+}
+
+template <typename T>
+T vneg(const T& x)
+{
+    return -x;
+}
+
+template <typename T>
+Vectorized<T> vneg(const Vectorized<T>& x)
+{
+    return x.neg();
+}
+
+// NaN propagating maximum, like at::maximum.
+template <typename T>
+T vmaximum(const T& a, const T& b)
+{
+    return (a != a || b != b) ? std::numeric_limits<T>::quiet_NaN() : std::max(a, b);
+}
+
+template <typename T>
+Vectorized<T> vmaximum(const Vectorized<T>& a, const Vectorized<T>& b)
+{
+    return at::vec::maximum(a, b);
+}
+
+// Runs `op` over `n` elements of the arrays in `ptrs`. The first n_out arrays
+// are outputs and are stored back after op has updated their values; when
+// load_out is false they are write-only and are not read first. op sees the
+// values in the op math type of scalar_t, either one lane at a time or as
+// Vectorized, so it has to be generic over both.
+template <size_t n_out, bool load_out, typename scalar_t, size_t N, typename op_t>
+void foreach_loop(const std::array<scalar_t*, N>& ptrs, int64_t n, const op_t& op)
+{
+    using opmath_t = at::opmath_type<scalar_t>;
+    using Vec = Vectorized<scalar_t>;
+    constexpr size_t first_load = load_out ? 0 : n_out;
+    int64_t i = 0;
+    for (; i + Vec::size() <= n; i += Vec::size()) {
+        if constexpr (std::is_same_v<scalar_t, opmath_t>) {
+            std::array<Vec, N> values;
+            for (size_t k = first_load; k < N; ++k) {
+                values[k] = Vec::loadu(ptrs[k] + i);
+            }
+            op(values);
+            for (size_t k = 0; k < n_out; ++k) {
+                values[k].store(ptrs[k] + i);
+            }
+        } else {
+            std::array<Vectorized<opmath_t>, N> lo;
+            std::array<Vectorized<opmath_t>, N> hi;
+            for (size_t k = first_load; k < N; ++k) {
+                std::tie(lo[k], hi[k]) = at::vec::convert_to_float<scalar_t>(Vec::loadu(ptrs[k] + i));
+            }
+            op(lo);
+            op(hi);
+            for (size_t k = 0; k < n_out; ++k) {
+                at::vec::convert_from_float<scalar_t>(lo[k], hi[k]).store(ptrs[k] + i);
+            }
+        }
+    }
+    for (; i < n; ++i) {
+        std::array<opmath_t, N> values;
+        for (size_t k = first_load; k < N; ++k) {
+            values[k] = static_cast<opmath_t>(ptrs[k][i]);
+        }
+        op(values);
+        for (size_t k = 0; k < n_out; ++k) {
+            ptrs[k][i] = static_cast<scalar_t>(values[k]);
+        }
+    }
+}
+
+struct Chunk {
+    size_t tensor;
+    int64_t begin;
+    int64_t end;
+};
+
+std::vector<Chunk> make_chunks(const std::vector<at::Tensor>& tensors)
+{
+    std::vector<Chunk> chunks;
+    for (const auto i : c10::irange(tensors.size())) {
+        const int64_t numel = tensors[i].numel();
+        for (int64_t begin = 0; begin < numel; begin += kChunkSize) {
+            chunks.push_back({i, begin, std::min(begin + kChunkSize, numel)});
+        }
+    }
+    return chunks;
+}
+
+// Launches `op` over every element of the tensors in `lists` on the current
+// stream of their device. lists[k][i] are the operands of tensor i; they all
+// have the same layout so their elements line up in memory. make_op is called
+// on the stream with an OpmathTag<opmath_t> and returns the per-element op,
+// which is called as op(values, tensor_index) so it can pick per-tensor
+// scalars. The outputs are the first n_out lists.
+template <size_t n_out, bool load_out, size_t N, typename make_op_t>
+void multi_tensor_apply(const char* name, std::array<std::vector<at::Tensor>, N> lists, make_op_t make_op)
+{
+    for (const std::vector<at::Tensor>& list : lists) {
+        materialize_fills(list);
+    }
+    const FooDeviceGuard guard(lists[0][0].device());
+    launch([name, lists = std::move(lists), make_op]() {
+        FOO_TRACE_SCOPE(name, lists[0][0]);
+        const std::vector<Chunk> chunks = make_chunks(lists[0]);
+        int64_t total = 0;
+        for (const at::Tensor& t : lists[0]) {
+            total += t.numel();
+        }
+        // Give each thread at least GRAIN_SIZE elements of work.
+        const int64_t grain = std::max<int64_t>(
+            1, static_cast<int64_t>(chunks.size()) * at::internal::GRAIN_SIZE / std::max<int64_t>(total, 1));
+        AT_DISPATCH_FLOATING_TYPES_AND2(at::kBFloat16, at::kHalf, lists[0][0].scalar_type(), "foo_foreach", [&]() {
+            const auto op = make_op(OpmathTag<at::opmath_type<scalar_t>>());
+            device_parallel_for(0, static_cast<int64_t>(chunks.size()), grain, [&](int64_t begin, int64_t end) {
+                for (const auto c : c10::irange(begin, end)) {
+                    const Chunk& chunk = chunks[c];
+                    std::array<scalar_t*, N> ptrs;
+                    for (const auto k : c10::irange(N)) {
+                        ptrs[k] = static_cast<scalar_t*>(lists[k][chunk.tensor].data_ptr()) + chunk.begin;
+                    }
+                    foreach_loop<n_out, load_out>(ptrs, chunk.end - chunk.begin, [&](auto& values) {
+                        op(values, chunk.tensor);
+                    });
+                }
+            });
+        });
+    });
+}
+
+// Whether `lists` can take the fast path: equally long lists of floating
+// point foo tensors on one device with one dtype, where the tensors at each
+// index have identical dense layouts.
+bool can_use_fast_path(std::initializer_list<at::TensorList> lists)
+{
+    const at::TensorList self = *lists.begin();
+    if (self.empty() || !self[0].defined()) {
+        return false;
+    }
+    const c10::Device device = self[0].device();
+    const c10::ScalarType dtype = self[0].scalar_type();
+    const bool supported_dtype = dtype == at::kFloat || dtype == at::kDouble || dtype == at::kBFloat16 ||
+        dtype == at::kHalf;
+    if (!device.is_privateuseone() || !supported_dtype) {
+        return false;
+    }
+    for (const at::TensorList list : lists) {
+        if (list.size() != self.size()) {
+            return false;
+        }
+        for (const auto i : c10::irange(list.size())) {
+            const at::Tensor& t = list[i];
+            if (!t.defined() || t.device() != device || t.scalar_type() != dtype ||
+                !t.is_non_overlapping_and_dense() || t.sizes() != self[i].sizes() ||
+                t.strides() != self[i].strides()) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void check_lists(const char* name, std::initializer_list<at::TensorList> lists)
+{
+    const size_t size = lists.begin()->size();
+    for (const at::TensorList list : lists) {
+        TORCH_CHECK(list.size() == size, name, ": tensor lists must have the same length, got ", size, " and ",
+            list.size());
+    }
+}
+
+void check_scalars(const char* name, at::TensorList self, at::ArrayRef<at::Scalar> scalars)
+{
+    TORCH_CHECK(scalars.size() == self.size(), name, ": expected ", self.size(), " scalars, got ", scalars.size());
+}
+
+std::vector<at::Tensor> to_vector(at::TensorList list)
+{
+    return std::vector<at::Tensor>(list.begin(), list.end());
+}
+
+std::vector<at::Tensor> empty_like_list(at::TensorList list)
+{
+    std::vector<at::Tensor> result;
+    result.reserve(list.size());
+    for (const at::Tensor& t : list) {
+        result.push_back(at::empty_like(t));
+    }
+    return result;
+}
+
+template <typename opmath_t>
+std::vector<opmath_t> to_opmath(const std::vector<at::Scalar>& scalars)
+{
+    std::vector<opmath_t> result;
+    result.reserve(scalars.size());
+    for (const at::Scalar& s : scalars) {
+        result.push_back(s.to<opmath_t>());
+    }
+    return result;
+}
+
+bool any_complex(at::ArrayRef<at::Scalar> scalars)
+{
+    return std::any_of(scalars.begin(), scalars.end(), [](const at::Scalar& s) { return s.isComplex(); });
+}
+
+} // namespace
+
+// =====================================
+// ========= Binary ops ================
+// =====================================
+
+namespace {
+
+enum class BinaryOp { Add, Sub, Mul, Div };
+
+template <BinaryOp op, typename V>
+V apply_binary(const V& a, const V& b)
+{
+    switch (op) {
+        case BinaryOp::Add: return a + b;
+        case BinaryOp::Sub: return a - b;
+        case BinaryOp::Mul: return a * b;
+        case BinaryOp::Div: return a / b;
+    }
+    return a;
+}
+
+// The regular op for one tensor, used on the slow path.
+template <BinaryOp op, typename other_t>
+at::Tensor binary_slow(const at::Tensor& self, const other_t& other)
+{
+    switch (op) {
+        case BinaryOp::Add: return at::add(self, other);
+        case BinaryOp::Sub: return at::sub(self, other);
+        case BinaryOp::Mul: return at::mul(self, other);
+        case BinaryOp::Div: return at::div(self, other);
+    }
+    return self;
+}
+
+template <BinaryOp op, typename other_t>
+void binary_slow_(const at::Tensor& self, const other_t& other)
+{
+    switch (op) {
+        case BinaryOp::Add: self.add_(other); break;
+        case BinaryOp::Sub: self.sub_(other); break;
+        case BinaryOp::Mul: self.mul_(other); break;
+        case BinaryOp::Div: self.div_(other); break;
+    }
+}
+
+// out = self <op> scalar
+template <BinaryOp op, bool inplace>
+std::vector<at::Tensor> foreach_binary_scalar_impl(at::TensorList self, const at::Scalar& scalar)
+{
+    if (!can_use_fast_path({self}) || scalar.isComplex()) {
+        std::vector<at::Tensor> result;
+        for (const at::Tensor& t : self) {
+            if constexpr (inplace) {
+                binary_slow_<op>(t, scalar);
+            } else {
+                result.push_back(binary_slow<op>(t, scalar));
+            }
+        }
+        return result;
+    }
+    flush_lazy();
+    const auto make_op = [scalar](auto tag) {
+        using opmath_t = typename decltype(tag)::type;
+        const opmath_t s = scalar.to<opmath_t>();
+        return [s](auto& v, size_t) {
+            using V = std::decay_t<decltype(v[0])>;
+            v[0] = apply_binary<op>(v[inplace ? 0 : 1], V(s));
+        };
+    };
+    if constexpr (inplace) {
+        multi_tensor_apply<1, true, 1>("aten::_foreach_binary_.Scalar", {to_vector(self)}, make_op);
+        return {};
+    } else {
+        std::vector<at::Tensor> result = empty_like_list(self);
+        multi_tensor_apply<1, false, 2>("aten::_foreach_binary.Scalar", {result, to_vector(self)}, make_op);
+        return result;
+    }
+}
+
+// out = self <op> scalars[i]
+template <BinaryOp op, bool inplace>
+std::vector<at::Tensor> foreach_binary_scalarlist_impl(at::TensorList self, at::ArrayRef<at::Scalar> scalars)
+{
+    check_scalars("_foreach_binary.ScalarList", self, scalars);
+    if (!can_use_fast_path({self}) || any_complex(scalars)) {
+        std::vector<at::Tensor> result;
+        for (const auto i : c10::irange(self.size())) {
+            if constexpr (inplace) {
+                binary_slow_<op>(self[i], scalars[i]);
+            } else {
+                result.push_back(binary_slow<op>(self[i], scalars[i]));
+            }
+        }
+        return result;
+    }
+    flush_lazy();
+    const auto make_op = [scalars = scalars.vec()](auto tag) {
+        using opmath_t = typename decltype(tag)::type;
+        return [s = to_opmath<opmath_t>(scalars)](auto& v, size_t i) {
+            using V = std::decay_t<decltype(v[0])>;
+            v[0] = apply_binary<op>(v[inplace ? 0 : 1], V(s[i]));
+        };
+    };
+    if constexpr (inplace) {
+        multi_tensor_apply<1, true, 1>("aten::_foreach_binary_.ScalarList", {to_vector(self)}, make_op);
+        return {};
+    } else {
+        std::vector<at::Tensor> result = empty_like_list(self);
+        multi_tensor_apply<1, false, 2>("aten::_foreach_binary.ScalarList", {result, to_vector(self)}, make_op);
+        return result;
+    }
+}
+
+// out = self <op> alpha * other for add and sub, self <op> other otherwise
+template <BinaryOp op, bool inplace>
+std::vector<at::Tensor> foreach_binary_list_impl(at::TensorList self, at::TensorList other, const at::Scalar& alpha)
+{
+    check_lists("_foreach_binary.List", {self, other});
+    if (!can_use_fast_path({self, other}) || alpha.isComplex()) {
+        std::vector<at::Tensor> result;
+        for (const auto i : c10::irange(self.size())) {
+            const at::Tensor& t = self[i];
+            if constexpr (op == BinaryOp::Add) {
+                inplace ? (void)t.add_(other[i], alpha) : result.push_back(at::add(t, other[i], alpha));
+            } else if constexpr (op == BinaryOp::Sub) {
+                inplace ? (void)t.sub_(other[i], alpha) : result.push_back(at::sub(t, other[i], alpha));
+            } else if constexpr (inplace) {
+                binary_slow_<op>(t, other[i]);
+            } else {
+                result.push_back(binary_slow<op>(t, other[i]));
+            }
+        }
+        return result;
+    }
+    flush_lazy();
+    const auto make_op = [alpha](auto tag) {
+        using opmath_t = typename decltype(tag)::type;
+        const opmath_t a = alpha.to<opmath_t>();
+        return [a](auto& v, size_t) {
+            using V = std::decay_t<decltype(v[0])>;
+            constexpr size_t self_slot = inplace ? 0 : 1;
+            const V& rhs = v[self_slot + 1];
+            if constexpr (op == BinaryOp::Add || op == BinaryOp::Sub) {
+                v[0] = apply_binary<op>(v[self_slot], a == opmath_t(1) ? rhs : rhs * V(a));
+            } else {
+                v[0] = apply_binary<op>(v[self_slot], rhs);
+            }
+        };
+    };
+    if constexpr (inplace) {
+        multi_tensor_apply<1, true, 2>("aten::_foreach_binary_.List", {to_vector(self), to_vector(other)}, make_op);
+        return {};
+    } else {
+        std::vector<at::Tensor> result = empty_like_list(self);
+        multi_tensor_apply<1, false, 3>(
+            "aten::_foreach_binary.List", {result, to_vector(self), to_vector(other)}, make_op);
+        return result;
+    }
+}
+
+template <BinaryOp op>
+void foreach_binary_scalar_(at::TensorList self, const at::Scalar& scalar)
+{
+    foreach_binary_scalar_impl<op, true>(self, scalar);
+}
+
+template <BinaryOp op>
+std::vector<at::Tensor> foreach_binary_scalar(at::TensorList self, const at::Scalar& scalar)
+{
+    return foreach_binary_scalar_impl<op, false>(self, scalar);
+}
+
+template <BinaryOp op>
+void foreach_binary_scalarlist_(at::TensorList self, at::ArrayRef<at::Scalar> scalars)
+{
+    foreach_binary_scalarlist_impl<op, true>(self, scalars);
+}
+
+template <BinaryOp op>
+std::vector<at::Tensor> foreach_binary_scalarlist(at::TensorList self, at::ArrayRef<at::Scalar> scalars)
+{
+    return foreach_binary_scalarlist_impl<op, false>(self, scalars);
+}
+
+template <BinaryOp op>
+void foreach_binary_list_alpha_(at::TensorList self, at::TensorList other, const at::Scalar& alpha)
+{
+    foreach_binary_list_impl<op, true>(self, other, alpha);
+}
+
+template <BinaryOp op>
+std::vector<at::Tensor> foreach_binary_list_alpha(at::TensorList self, at::TensorList other, const at::Scalar& alpha)
+{
+    return foreach_binary_list_impl<op, false>(self, other, alpha);
+}
+
+template <BinaryOp op>
+void foreach_binary_list_(at::TensorList self, at::TensorList other)
+{
+    foreach_binary_list_impl<op, true>(self, other, 1);
+}
+
+template <BinaryOp op>
+std::vector<at::Tensor> foreach_binary_list(at::TensorList self, at::TensorList other)
+{
+    return foreach_binary_list_impl<op, false>(self, other, 1);
+}
+
+} // namespace
+
+// =====================================
+// ========= Pointwise ops =============
+// =====================================
+
+namespace {
+
+enum class PointwiseOp { Addcmul, Addcdiv };
+
+// out = self + value * tensor1 * tensor2 (addcmul) or
+// out = self + value * tensor1 / tensor2 (addcdiv), evaluated in the same
+// order as the ATen CPU kernels.
+template <PointwiseOp op, bool inplace>
+std::vector<at::Tensor> foreach_pointwise_impl(
+    at::TensorList self, at::TensorList tensor1, at::TensorList tensor2, std::vector<at::Scalar> scalars)
+{
+    check_lists("_foreach_pointwise", {self, tensor1, tensor2});
+    check_scalars("_foreach_pointwise", self, scalars);
+    if (!can_use_fast_path({self, tensor1, tensor2}) || any_complex(scalars)) {
+        std::vector<at::Tensor> result;
+        for (const auto i : c10::irange(self.size())) {
+            if constexpr (op == PointwiseOp::Addcmul) {
+                inplace ? (void)self[i].addcmul_(tensor1[i], tensor2[i], scalars[i])
+                        : result.push_back(at::addcmul(self[i], tensor1[i], tensor2[i], scalars[i]));
+            } else {
+                inplace ? (void)self[i].addcdiv_(tensor1[i], tensor2[i], scalars[i])
+                        : result.push_back(at::addcdiv(self[i], tensor1[i], tensor2[i], scalars[i]));
+            }
+        }
+        return result;
+    }
+    flush_lazy();
+    const auto make_op = [scalars = std::move(scalars)](auto tag) {
+        using opmath_t = typename decltype(tag)::type;
+        return [s = to_opmath<opmath_t>(scalars)](auto& v, size_t i) {
+            using V = std::decay_t<decltype(v[0])>;
+            constexpr size_t self_slot = inplace ? 0 : 1;
+            const V value(s[i]);
+            if constexpr (op == PointwiseOp::Addcmul) {
+                v[0] = v[self_slot] + value * v[self_slot + 1] * v[self_slot + 2];
+            } else {
+                v[0] = v[self_slot] + value * v[self_slot + 1] / v[self_slot + 2];
+            }
+        };
+    };
+    if constexpr (inplace) {
+        multi_tensor_apply<1, true, 3>(
+            "aten::_foreach_pointwise_", {to_vector(self), to_vector(tensor1), to_vector(tensor2)}, make_op);
+        return {};
+    } else {
+        std::vector<at::Tensor> result = empty_like_list(self);
+        multi_tensor_apply<1, false, 4>(
+            "aten::_foreach_pointwise", {result, to_vector(self), to_vector(tensor1), to_vector(tensor2)}, make_op);
+        return result;
+    }
+}
+
+template <PointwiseOp op>
+void foreach_pointwise_scalar_(
+    at::TensorList self, at::TensorList tensor1, at::TensorList tensor2, const at::Scalar& value)
+{
+    foreach_pointwise_impl<op, true>(self, tensor1, tensor2, std::vector<at::Scalar>(self.size(), value));
+}
+
+template <PointwiseOp op>
+std::vector<at::Tensor> foreach_pointwise_scalar(
+    at::TensorList self, at::TensorList tensor1, at::TensorList tensor2, const at::Scalar& value)
+{
+    return foreach_pointwise_impl<op, false>(self, tensor1, tensor2, std::vector<at::Scalar>(self.size(), value));
+}
+
+template <PointwiseOp op>
+void foreach_pointwise_scalarlist_(
+    at::TensorList self, at::TensorList tensor1, at::TensorList tensor2, at::ArrayRef<at::Scalar> scalars)
+{
+    foreach_pointwise_impl<op, true>(self, tensor1, tensor2, scalars.vec());
+}
+
+template <PointwiseOp op>
+std::vector<at::Tensor> foreach_pointwise_scalarlist(
+    at::TensorList self, at::TensorList tensor1, at::TensorList tensor2, at::ArrayRef<at::Scalar> scalars)
+{
+    return foreach_pointwise_impl<op, false>(self, tensor1, tensor2, scalars.vec());
+}
+
+// out = self + weight * (end - self), with the same two-sided formula as
+// at::lerp so that weights close to 1 stay accurate.
+template <bool inplace>
+std::vector<at::Tensor> foreach_lerp_scalar_impl(at::TensorList self, at::TensorList end, const at::Scalar& weight)
+{
+    check_lists("_foreach_lerp", {self, end});
+    if (!can_use_fast_path({self, end}) || weight.isComplex()) {
+        std::vector<at::Tensor> result;
+        for (const auto i : c10::irange(self.size())) {
+            inplace ? (void)self[i].lerp_(end[i], weight) : result.push_back(at::lerp(self[i], end[i], weight));
+        }
+        return result;
+    }
+    flush_lazy();
+    const auto make_op = [weight](auto tag) {
+        using opmath_t = typename decltype(tag)::type;
+        const opmath_t w = weight.to<opmath_t>();
+        return [w](auto& v, size_t) {
+            using V = std::decay_t<decltype(v[0])>;
+            constexpr size_t self_slot = inplace ? 0 : 1;
+            const V diff = v[self_slot + 1] - v[self_slot];
+            if (std::abs(w) < opmath_t(0.5)) {
+                v[0] = v[self_slot] + V(w) * diff;
+            } else {
+                v[0] = v[self_slot + 1] - diff * V(opmath_t(1) - w);
+            }
+        };
+    };
+    if constexpr (inplace) {
+        multi_tensor_apply<1, true, 2>("aten::_foreach_lerp_.Scalar", {to_vector(self), to_vector(end)}, make_op);
+        return {};
+    } else {
+        std::vector<at::Tensor> result = empty_like_list(self);
+        multi_tensor_apply<1, false, 3>(
+            "aten::_foreach_lerp.Scalar", {result, to_vector(self), to_vector(end)}, make_op);
+        return result;
+    }
+}
+
+void foreach_lerp_scalar_(at::TensorList self, at::TensorList end, const at::Scalar& weight)
+{
+    foreach_lerp_scalar_impl<true>(self, end, weight);
+}
+
+std::vector<at::Tensor> foreach_lerp_scalar(at::TensorList self, at::TensorList end, const at::Scalar& weight)
+{
+    return foreach_lerp_scalar_impl<false>(self, end, weight);
+}
+
+// out = maximum(self, other)
+template <bool inplace>
+std::vector<at::Tensor> foreach_maximum_list_impl(at::TensorList self, at::TensorList other)
+{
+    check_lists("_foreach_maximum", {self, other});
+    if (!can_use_fast_path({self, other})) {
+        std::vector<at::Tensor> result;
+        for (const auto i : c10::irange(self.size())) {
+            inplace ? (void)self[i].copy_(at::maximum(self[i], other[i]))
+                    : result.push_back(at::maximum(self[i], other[i]));
+        }
+        return result;
+    }
+    flush_lazy();
+    const auto make_op = [](auto /*tag*/) {
+        return [](auto& v, size_t) {
+            constexpr size_t self_slot = inplace ? 0 : 1;
+            v[0] = vmaximum(v[self_slot], v[self_slot + 1]);
+        };
+    };
+    if constexpr (inplace) {
+        multi_tensor_apply<1, true, 2>("aten::_foreach_maximum_.List", {to_vector(self), to_vector(other)}, make_op);
+        return {};
+    } else {
+        std::vector<at::Tensor> result = empty_like_list(self);
+        multi_tensor_apply<1, false, 3>(
+            "aten::_foreach_maximum.List", {result, to_vector(self), to_vector(other)}, make_op);
+        return result;
+    }
+}
+
+void foreach_maximum_list_(at::TensorList self, at::TensorList other)
+{
+    foreach_maximum_list_impl<true>(self, other);
+}
+
+std::vector<at::Tensor> foreach_maximum_list(at::TensorList self, at::TensorList other)
+{
+    return foreach_maximum_list_impl<false>(self, other);
+}
+
+} // namespace
+
+// =====================================
+// ========= Unary ops =================
+// =====================================
+
+namespace {
+
+enum class UnaryOp { Sqrt, Neg };
+
+template <UnaryOp op, bool inplace>
+std::vector<at::Tensor> foreach_unary_impl(at::TensorList self)
+{
+    if (!can_use_fast_path({self})) {
+        std::vector<at::Tensor> result;
+        for (const at::Tensor& t : self) {
+            if constexpr (op == UnaryOp::Sqrt) {
+                inplace ? (void)t.sqrt_() : result.push_back(at::sqrt(t));
+            } else {
+                inplace ? (void)t.neg_() : result.push_back(at::neg(t));
+            }
+        }
+        return result;
+    }
+    flush_lazy();
+    const auto make_op = [](auto /*tag*/) {
+        return [](auto& v, size_t) {
+            constexpr size_t self_slot = inplace ? 0 : 1;
+            if constexpr (op == UnaryOp::Sqrt) {
+                v[0] = vsqrt(v[self_slot]);
+            } else {
+                v[0] = vneg(v[self_slot]);
+            }
+        };
+    };
+    if constexpr (inplace) {
+        multi_tensor_apply<1, true, 1>("aten::_foreach_unary_", {to_vector(self)}, make_op);
+        return {};
+    } else {
+        std::vector<at::Tensor> result = empty_like_list(self);
+        multi_tensor_apply<1, false, 2>("aten::_foreach_unary", {result, to_vector(self)}, make_op);
+        return result;
+    }
+}
+
+template <UnaryOp op>
+void foreach_unary_(at::TensorList self)
+{
+    foreach_unary_impl<op, true>(self);
+}
+
+template <UnaryOp op>
+std::vector<at::Tensor> foreach_unary(at::TensorList self)
+{
+    return foreach_unary_impl<op, false>(self);
+}
+
+// Zeroing is a memset, so any dtype takes the fast path as long as the
+// tensors are dense.
+void foreach_zero_(at::TensorList self)
+{
+    const bool fast = !self.empty() && std::all_of(self.begin(), self.end(), [&](const at::Tensor& t) {
+        return t.device() == self[0].device() && t.device().is_privateuseone() && t.is_non_overlapping_and_dense();
+    });
+    if (!fast) {
+        for (const at::Tensor& t : self) {
+            t.zero_();
+        }
+        return;
+    }
+    flush_lazy();
+    // Tensors that cover their storage (all freshly allocated gradients) just
+    // record the zero fill.
+    std::vector<at::Tensor> tensors;
+    for (const at::Tensor& t : self) {
+        if (!try_record_fill(t, 0)) {
+            materialize_fill(t);
+            tensors.push_back(t);
+        }
+    }
+    if (tensors.empty()) {
+        return;
+    }
+    const FooDeviceGuard guard(self[0].device());
+    launch([tensors = std::move(tensors)]() {
+        FOO_TRACE_SCOPE("aten::_foreach_zero_", tensors[0]);
+        device_parallel_for(0, static_cast<int64_t>(tensors.size()), 1, [&](int64_t begin, int64_t end) {
+            for (const auto i : c10::irange(begin, end)) {
+                std::memset(tensors[i].data_ptr(), 0, tensors[i].nbytes());
+            }
+        });
+    });
+}
+
+} // namespace
+
+// =====================================
+// ========= Fused Adam(W) =============
+// =====================================
+
+namespace {
+
+enum class AdamMode { Adam, AdamW };
+
+// Reads a one element tensor that lives in host memory (CPU or foo) without
+// going through the dispatcher, which must not be re-entered from a stream
+// worker.
+double read_scalar(const at::Tensor& t)
+{
+    TORCH_CHECK(t.numel() == 1, "expected a tensor with a single element, got ", t.sizes());
+    double value = 0;
+    AT_DISPATCH_FLOATING_TYPES_AND2(at::kBFloat16, at::kHalf, t.scalar_type(), "read_scalar", [&]() {
+        value = static_cast<double>(*static_cast<const scalar_t*>(t.const_data_ptr()));
+    });
+    return value;
+}
+
+// One step of Adam or AdamW over all parameters in one launch, the same update
+// as torch.optim.Adam(W)(foreach=True) but with a single pass over memory:
+//   grad    = -grad if maximize, grad / grad_scale if given (stored back)
+//   Adam:  grad += weight_decay * param       AdamW: param *= 1 - lr * weight_decay
+//   exp_avg = lerp(exp_avg, grad, 1 - beta1)
+//   exp_avg_sq = beta2 * exp_avg_sq + (1 - beta2) * grad * grad
+//   max_exp_avg_sq = maximum(max_exp_avg_sq, exp_avg_sq)          (amsgrad)
+//   param -= lr / (1 - beta1^step) * exp_avg / (sqrt(v) / sqrt(1 - beta2^step) + eps)
+// where v is exp_avg_sq or max_exp_avg_sq. The step counts were already
+// incremented by the optimizer. The whole step is skipped when found_inf is 1.
+template <AdamMode mode>
+void fused_adam_(
+    at::TensorList params,
+    at::TensorList grads,
+    at::TensorList exp_avgs,
+    at::TensorList exp_avg_sqs,
+    at::TensorList max_exp_avg_sqs,
+    at::TensorList state_steps,
+    double lr,
+    double beta1,
+    double beta2,
+    double weight_decay,
+    double eps,
+    bool amsgrad,
+    bool maximize,
+    const std::optional<at::Tensor>& grad_scale,
+    const std::optional<at::Tensor>& found_inf)
+{
+    if (params.empty()) {
+        return;
+    }
+    check_lists("_fused_adam", {params, grads, exp_avgs, exp_avg_sqs, state_steps});
+    if (amsgrad) {
+        check_lists("_fused_adam", {params, max_exp_avg_sqs});
+    }
+    TORCH_CHECK(can_use_fast_path({params, grads, exp_avgs, exp_avg_sqs}) &&
+            (!amsgrad || can_use_fast_path({params, max_exp_avg_sqs})),
+        "_fused_adam: expected dense floating point foo tensors with matching layouts on one device");
+    for (const at::Tensor& step : state_steps) {
+        TORCH_CHECK(step.numel() == 1 && (step.is_cpu() || step.device() == params[0].device()),
+            "_fused_adam: expected single element step tensors on the CPU or on ", params[0].device());
+    }
+    flush_lazy();
+    // Foo step counts are read directly on the stream, unlike the lists
+    // multi_tensor_apply gets. CPU ones are read now: the optimizer increments
+    // them on the host, possibly before this step runs.
+    materialize_fills(state_steps);
+    std::vector<at::Tensor> device_steps(state_steps.size());
+    std::vector<double> cpu_steps(state_steps.size());
+    for (const auto i : c10::irange(state_steps.size())) {
+        if (state_steps[i].is_cpu()) {
+            cpu_steps[i] = read_scalar(state_steps[i]);
+        } else {
+            device_steps[i] = state_steps[i];
+        }
+    }
+
+    const at::Tensor scale = grad_scale.value_or(at::Tensor());
+    const at::Tensor inf = found_inf.value_or(at::Tensor());
+    materialize_fill(scale);
+    materialize_fill(inf);
+    const bool scaled = scale.defined();
+    const auto make_op = [=, device_steps = std::move(device_steps), cpu_steps = std::move(cpu_steps)](auto tag) {
+        using opmath_t = typename decltype(tag)::type;
+        struct TensorStep {
+            opmath_t step_size;
+            opmath_t bias_correction2_sqrt;
+        };
+        std::vector<TensorStep> per_tensor;
+        for (const auto i : c10::irange(device_steps.size())) {
+            const double step = device_steps[i].defined() ? read_scalar(device_steps[i]) : cpu_steps[i];
+            const double bias_correction1 = 1 - std::pow(beta1, step);
+            const double bias_correction2 = 1 - std::pow(beta2, step);
+            per_tensor.push_back({
+                static_cast<opmath_t>(lr / bias_correction1), static_cast<opmath_t>(std::sqrt(bias_correction2))});
+        }
+        const opmath_t inv_scale = scaled ? static_cast<opmath_t>(1 / read_scalar(scale)) : opmath_t(1);
+        const bool skip = inf.defined() && read_scalar(inf) == 1.0;
+        // slots: param, exp_avg, exp_avg_sq, [max_exp_avg_sq], grad
+        return [=, per_tensor = std::move(per_tensor)](auto& v, size_t i) {
+            using V = std::decay_t<decltype(v[0])>;
+            constexpr size_t grad_slot = std::tuple_size_v<std::decay_t<decltype(v)>> - 1;
+            if (skip) {
+                return;
+            }
+            if (scaled) {
+                v[grad_slot] = v[grad_slot] * V(inv_scale);
+            }
+            V grad = maximize ? vneg(v[grad_slot]) : v[grad_slot];
+            V& param = v[0];
+            V& exp_avg = v[1];
+            V& exp_avg_sq = v[2];
+            if (weight_decay != 0) {
+                if constexpr (mode == AdamMode::AdamW) {
+                    param = param * V(static_cast<opmath_t>(1 - lr * weight_decay));
+                } else {
+                    grad = grad + param * V(static_cast<opmath_t>(weight_decay));
+                }
+            }
+            const opmath_t one_minus_beta1 = static_cast<opmath_t>(1 - beta1);
+            const V diff = grad - exp_avg;
+            if (one_minus_beta1 < opmath_t(0.5)) {
+                exp_avg = exp_avg + V(one_minus_beta1) * diff;
+            } else {
+                exp_avg = grad - diff * V(static_cast<opmath_t>(beta1));
+            }
+            exp_avg_sq = exp_avg_sq * V(static_cast<opmath_t>(beta2)) +
+                V(static_cast<opmath_t>(1 - beta2)) * grad * grad;
+            V second_moment = exp_avg_sq;
+            if constexpr (grad_slot == 4) {
+                v[3] = vmaximum(v[3], exp_avg_sq);
+                second_moment = v[3];
+            }
+            const V denom = vsqrt(second_moment) / V(per_tensor[i].bias_correction2_sqrt) +
+                V(static_cast<opmath_t>(eps));
+            param = param - V(per_tensor[i].step_size) * exp_avg / denom;
+        };
+    };
+
+    const char* name = mode == AdamMode::AdamW ? "aten::_fused_adamw_" : "aten::_fused_adam_";
+    if (amsgrad) {
+        std::array<std::vector<at::Tensor>, 5> lists = {to_vector(params), to_vector(exp_avgs),
+            to_vector(exp_avg_sqs), to_vector(max_exp_avg_sqs), to_vector(grads)};
+        scaled ? multi_tensor_apply<5, true>(name, std::move(lists), make_op)
+               : multi_tensor_apply<4, true>(name, std::move(lists), make_op);
+    } else {
+        std::array<std::vector<at::Tensor>, 4> lists = {
+            to_vector(params), to_vector(exp_avgs), to_vector(exp_avg_sqs), to_vector(grads)};
+        scaled ? multi_tensor_apply<4, true>(name, std::move(lists), make_op)
+               : multi_tensor_apply<3, true>(name, std::move(lists), make_op);
+    }
+}
+
+} // namespace
+
+namespace {
+
+void register_foreach_kernels(torch::Library& m)
+{
+    m.impl("_foreach_add.Scalar", TORCH_FN(foreach_binary_scalar<BinaryOp::Add>));
+    m.impl("_foreach_add_.Scalar", TORCH_FN(foreach_binary_scalar_<BinaryOp::Add>));
+    m.impl("_foreach_sub.Scalar", TORCH_FN(foreach_binary_scalar<BinaryOp::Sub>));
+    m.impl("_foreach_sub_.Scalar", TORCH_FN(foreach_binary_scalar_<BinaryOp::Sub>));
+    m.impl("_foreach_mul.Scalar", TORCH_FN(foreach_binary_scalar<BinaryOp::Mul>));
+    m.impl("_foreach_mul_.Scalar", TORCH_FN(foreach_binary_scalar_<BinaryOp::Mul>));
+    m.impl("_foreach_div.Scalar", TORCH_FN(foreach_binary_scalar<BinaryOp::Div>));
+    m.impl("_foreach_div_.Scalar", TORCH_FN(foreach_binary_scalar_<BinaryOp::Div>));
+
+    m.impl("_foreach_add.ScalarList", TORCH_FN(foreach_binary_scalarlist<BinaryOp::Add>));
+    m.impl("_foreach_add_.ScalarList", TORCH_FN(foreach_binary_scalarlist_<BinaryOp::Add>));
+    m.impl("_foreach_sub.ScalarList", TORCH_FN(foreach_binary_scalarlist<BinaryOp::Sub>));
+    m.impl("_foreach_sub_.ScalarList", TORCH_FN(foreach_binary_scalarlist_<BinaryOp::Sub>));
+    m.impl("_foreach_mul.ScalarList", TORCH_FN(foreach_binary_scalarlist<BinaryOp::Mul>));
+    m.impl("_foreach_mul_.ScalarList", TORCH_FN(foreach_binary_scalarlist_<BinaryOp::Mul>));
+    m.impl("_foreach_div.ScalarList", TORCH_FN(foreach_binary_scalarlist<BinaryOp::Div>));
+    m.impl("_foreach_div_.ScalarList", TORCH_FN(foreach_binary_scalarlist_<BinaryOp::Div>));
+
+    m.impl("_foreach_add.List", TORCH_FN(foreach_binary_list_alpha<BinaryOp::Add>));
+    m.impl("_foreach_add_.List", TORCH_FN(foreach_binary_list_alpha_<BinaryOp::Add>));
+    m.impl("_foreach_sub.List", TORCH_FN(foreach_binary_list_alpha<BinaryOp::Sub>));
+    m.impl("_foreach_sub_.List", TORCH_FN(foreach_binary_list_alpha_<BinaryOp::Sub>));
+    m.impl("_foreach_mul.List", TORCH_FN(foreach_binary_list<BinaryOp::Mul>));
+    m.impl("_foreach_mul_.List", TORCH_FN(foreach_binary_list_<BinaryOp::Mul>));
+    m.impl("_foreach_div.List", TORCH_FN(foreach_binary_list<BinaryOp::Div>));
+    m.impl("_foreach_div_.List", TORCH_FN(foreach_binary_list_<BinaryOp::Div>));
+
+    m.impl("_foreach_addcmul.Scalar", TORCH_FN(foreach_pointwise_scalar<PointwiseOp::Addcmul>));
+    m.impl("_foreach_addcmul_.Scalar", TORCH_FN(foreach_pointwise_scalar_<PointwiseOp::Addcmul>));
+    m.impl("_foreach_addcmul.ScalarList", TORCH_FN(foreach_pointwise_scalarlist<PointwiseOp::Addcmul>));
+    m.impl("_foreach_addcmul_.ScalarList", TORCH_FN(foreach_pointwise_scalarlist_<PointwiseOp::Addcmul>));
+    m.impl("_foreach_addcdiv.Scalar", TORCH_FN(foreach_pointwise_scalar<PointwiseOp::Addcdiv>));
+    m.impl("_foreach_addcdiv_.Scalar", TORCH_FN(foreach_pointwise_scalar_<PointwiseOp::Addcdiv>));
+    m.impl("_foreach_addcdiv.ScalarList", TORCH_FN(foreach_pointwise_scalarlist<PointwiseOp::Addcdiv>));
+    m.impl("_foreach_addcdiv_.ScalarList", TORCH_FN(foreach_pointwise_scalarlist_<PointwiseOp::Addcdiv>));
+
+    m.impl("_foreach_lerp.Scalar", TORCH_FN(foreach_lerp_scalar));
+    m.impl("_foreach_lerp_.Scalar", TORCH_FN(foreach_lerp_scalar_));
+    m.impl("_foreach_maximum.List", TORCH_FN(foreach_maximum_list));
+    m.impl("_foreach_maximum_.List", TORCH_FN(foreach_maximum_list_));
+
+    m.impl("_foreach_sqrt", TORCH_FN(foreach_unary<UnaryOp::Sqrt>));
+    m.impl("_foreach_sqrt_", TORCH_FN(foreach_unary_<UnaryOp::Sqrt>));
+    m.impl("_foreach_neg", TORCH_FN(foreach_unary<UnaryOp::Neg>));
+    m.impl("_foreach_neg_", TORCH_FN(foreach_unary_<UnaryOp::Neg>));
+    m.impl("_foreach_zero_", TORCH_FN(foreach_zero_));
+
+    m.impl("_fused_adam_", TORCH_FN(fused_adam_<AdamMode::Adam>));
+    m.impl("_fused_adamw_", TORCH_FN(fused_adam_<AdamMode::AdamW>));
+}
+
+} // namespace
+
+FOO_REGISTER_DISPATCH(register_foreach_kernels_stub, &register_foreach_kernels);
+
+} // namespace foo_core
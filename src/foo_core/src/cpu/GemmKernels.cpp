@@ -0,0 +1,176 @@
+#include <ATen/Parallel.h>
+#include <ATen/core/Tensor.h>
+#include <ATen/cpu/vec/vec.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "FooKernels.h"
+#include "FooParallel.h"
+
+namespace foo_core {
+
+namespace {
+
+using at::vec::Vectorized;
+using Vec = Vectorized<float>;
+
+// The float32 GEMM follows the BLIS layout. A micro-kernel keeps a kMR x kNR
+// tile of C in registers (12 vector accumulators) and streams a kMR-row panel
+// of A and a kNR-column panel of B through it, kKC values of k at a time:
+//
+// - B is packed once per call, or once per weight with the prepack cache, into
+//   panels of kNR columns whose kKC-deep slices stay in L1.
+// - Each task packs kMC x kKC blocks of A, scaled by alpha, which stay in L2.
+// - Tasks are kMC x nc tiles of C; every element of C sees the blocks of k in
+//   the same order whatever the tiling, so results don't depend on the number
+//   of threads.
+constexpr int64_t kMR = 6;
+constexpr int64_t kNR = 2 * Vec::size();
+constexpr int64_t kMC = 72;
+constexpr int64_t kKC = 256;
+constexpr int64_t kMaxNC = 1024;
+
+int64_t panel_width()
+{
+    return kNR;
+}
+
+void pack_b(float* packed, const at::Tensor& b)
+{
+    const int64_t k = b.size(0);
+    const int64_t n = b.size(1);
+    const int64_t row_stride = b.stride(0);
+    const int64_t col_stride = b.stride(1);
+    const float* data = b.const_data_ptr<float>();
+    const int64_t panels = (n + kNR - 1) / kNR;
+    device_parallel_for(0, panels, std::max<int64_t>(1, at::internal::GRAIN_SIZE / std::max<int64_t>(k * kNR, 1)),
+        [&](int64_t begin, int64_t end) {
+            for (int64_t p = begin; p < end; ++p) {
+                const int64_t cols = std::min(kNR, n - p * kNR);
+                float* dst = packed + p * k * kNR;
+                for (int64_t row = 0; row < k; ++row) {
+                    const float* src = data + row * row_stride + p * kNR * col_stride;
+                    for (int64_t j = 0; j < cols; ++j) {
+                        dst[row * kNR + j] = src[j * col_stride];
+                    }
+                    std::fill(dst + row * kNR + cols, dst + (row + 1) * kNR, 0.0f);
+                }
+            }
+        });
+}
+
+// Packs rows [0, mc) and columns [0, kc) of A into panels of kMR rows.
+void pack_a(float* packed, const float* a, int64_t mc, int64_t kc, int64_t row_stride, int64_t col_stride, float alpha)
+{
+    for (int64_t ir = 0; ir < mc; ir += kMR) {
+        const int64_t rows = std::min(kMR, mc - ir);
+        float* dst = packed + ir * kc;
+        for (int64_t p = 0; p < kc; ++p) {
+            for (int64_t i = 0; i < rows; ++i) {
+                dst[p * kMR + i] = alpha * a[(ir + i) * row_stride + p * col_stride];
+            }
+            std::fill(dst + p * kMR + rows, dst + (p + 1) * kMR, 0.0f);
+        }
+    }
+}
+
+// C[0, mr) x [0, nr) = (accumulate ? C : 0) + A panel x B panel.
+void micro_kernel(int64_t kc, const float* a, const float* b, float* c, int64_t ldc, int64_t mr, int64_t nr,
+    bool accumulate)
+{
+    Vec acc[kMR][2];
+    for (int64_t i = 0; i < kMR; ++i) {
+        acc[i][0] = Vec(0.0f);
+        acc[i][1] = Vec(0.0f);
+    }
+    for (int64_t p = 0; p < kc; ++p) {
+        const Vec b0 = Vec::loadu(b + p * kNR);
+        const Vec b1 = Vec::loadu(b + p * kNR + Vec::size());
+        for (int64_t i = 0; i < kMR; ++i) {
+            const Vec ai(a[p * kMR + i]);
+            acc[i][0] = at::vec::fmadd(ai, b0, acc[i][0]);
+            acc[i][1] = at::vec::fmadd(ai, b1, acc[i][1]);
+        }
+    }
+    if (mr == kMR && nr == kNR) {
+        for (int64_t i = 0; i < kMR; ++i) {
+            float* row = c + i * ldc;
+            if (accumulate) {
+                acc[i][0] = Vec::loadu(row) + acc[i][0];
+                acc[i][1] = Vec::loadu(row + Vec::size()) + acc[i][1];
+            }
+            acc[i][0].store(row);
+            acc[i][1].store(row + Vec::size());
+        }
+        return;
+    }
+    float tile[kNR];
+    for (int64_t i = 0; i < mr; ++i) {
+        acc[i][0].store(tile);
+        acc[i][1].store(tile + Vec::size());
+        float* row = c + i * ldc;
+        for (int64_t j = 0; j < nr; ++j) {
+            row[j] = accumulate ? row[j] + tile[j] : tile[j];
+        }
+    }
+}
+
+void gemm(const at::Tensor& out, const at::Tensor& a, const float* packed_b, float alpha, bool accumulate)
+{
+    const int64_t m = a.size(0);
+    const int64_t k = a.size(1);
+    const int64_t n = out.size(1);
+    float* c = out.mutable_data_ptr<float>();
+    const int64_t ldc = out.stride(0);
+    if (k == 0) {
+        if (!accumulate) {
+            for (int64_t i = 0; i < m; ++i) {
+                std::fill(c + i * ldc, c + i * ldc + n, 0.0f);
+            }
+        }
+        return;
+    }
+    const float* a_data = a.const_data_ptr<float>();
+    const int64_t a_row_stride = a.stride(0);
+    const int64_t a_col_stride = a.stride(1);
+
+    // Enough column tiles for every thread to get one when M is small, as for
+    // inference batches.
+    const int64_t m_blocks = (m + kMC - 1) / kMC;
+    const int64_t wanted_n_blocks = std::max<int64_t>(1, at::get_num_threads() / m_blocks);
+    int64_t nc = (n + wanted_n_blocks - 1) / wanted_n_blocks;
+    nc = std::clamp((nc + kNR - 1) / kNR * kNR, kNR, kMaxNC);
+    const int64_t n_blocks = (n + nc - 1) / nc;
+    // Tiles are small enough that any two are worth running in parallel.
+    device_parallel_for(0, m_blocks * n_blocks, 1, [&](int64_t begin, int64_t end) {
+        std::vector<float> packed_a(kMC * kKC);
+        for (int64_t t = begin; t < end; ++t) {
+            const int64_t ic = t / n_blocks * kMC;
+            const int64_t jc = t % n_blocks * nc;
+            const int64_t mc = std::min(kMC, m - ic);
+            const int64_t ncur = std::min(nc, n - jc);
+            for (int64_t pc = 0; pc < k; pc += kKC) {
+                const int64_t kc = std::min(kKC, k - pc);
+                pack_a(packed_a.data(), a_data + ic * a_row_stride + pc * a_col_stride, mc, kc, a_row_stride,
+                    a_col_stride, alpha);
+                for (int64_t jr = 0; jr < ncur; jr += kNR) {
+                    const float* b_panel = packed_b + ((jc + jr) / kNR * k + pc) * kNR;
+                    for (int64_t ir = 0; ir < mc; ir += kMR) {
+                        micro_kernel(kc, packed_a.data() + ir * kc, b_panel, c + (ic + ir) * ldc + jc + jr, ldc,
+                            std::min(kMR, mc - ir), std::min(kNR, ncur - jr), accumulate || pc > 0);
+                    }
+                }
+            }
+        }
+    });
+}
+
+} // namespace
+
+FOO_REGISTER_DISPATCH(gemm_panel_width_stub, &panel_width);
+FOO_REGISTER_DISPATCH(gemm_pack_b_stub, &pack_b);
+FOO_REGISTER_DISPATCH(gemm_stub, &gemm);
+
+} // namespace foo_core
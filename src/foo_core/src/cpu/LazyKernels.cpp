@@ -0,0 +1,89 @@
+#include <ATen/cpu/vec/functional.h>
+#include <ATen/cpu/vec/vec.h>
+#include <c10/util/Exception.h>
+
+#include "FooKernels.h"
+
+namespace foo_core {
+
+namespace {
+
+using Vec = at::vec::Vectorized<float>;
+
+LazyKernelFn lazy_kernel(LazyOp op)
+{
+    using at::vec::map;
+    using at::vec::map2;
+    switch (op) {
+        case LazyOp::Add:
+            return [](float* out, const float* a, const float* b, float, int64_t n) {
+                map2([](Vec x, Vec y) { return x + y; }, out, a, b, n);
+            };
+        case LazyOp::Sub:
+            return [](float* out, const float* a, const float* b, float, int64_t n) {
+                map2([](Vec x, Vec y) { return x - y; }, out, a, b, n);
+            };
+        case LazyOp::Mul:
+            return [](float* out, const float* a, const float* b, float, int64_t n) {
+                map2([](Vec x, Vec y) { return x * y; }, out, a, b, n);
+            };
+        case LazyOp::Div:
+            return [](float* out, const float* a, const float* b, float, int64_t n) {
+                map2([](Vec x, Vec y) { return x / y; }, out, a, b, n);
+            };
+        case LazyOp::AddScalar:
+            return [](float* out, const float* a, const float*, float s, int64_t n) {
+                map([s](Vec x) { return x + Vec(s); }, out, a, n);
+            };
+        case LazyOp::MulScalar:
+            return [](float* out, const float* a, const float*, float s, int64_t n) {
+                map([s](Vec x) { return x * Vec(s); }, out, a, n);
+            };
+        case LazyOp::DivScalar:
+            return [](float* out, const float* a, const float*, float s, int64_t n) {
+                map([s](Vec x) { return x / Vec(s); }, out, a, n);
+            };
+        case LazyOp::MulAddScalar:
+            return [](float* out, const float* a, const float* b, float s, int64_t n) {
+                map2([s](Vec x, Vec y) { return at::vec::fmadd(x, y, Vec(s)); }, out, a, b, n);
+            };
+        case LazyOp::Neg:
+            return [](float* out, const float* a, const float*, float, int64_t n) {
+                map([](Vec x) { return x.neg(); }, out, a, n);
+            };
+        case LazyOp::Abs:
+            return [](float* out, const float* a, const float*, float, int64_t n) {
+                map([](Vec x) { return x.abs(); }, out, a, n);
+            };
+        case LazyOp::Exp:
+            return [](float* out, const float* a, const float*, float, int64_t n) {
+                map([](Vec x) { return x.exp(); }, out, a, n);
+            };
+        case LazyOp::Sqrt:
+            return [](float* out, const float* a, const float*, float, int64_t n) {
+                map([](Vec x) { return x.sqrt(); }, out, a, n);
+            };
+        case LazyOp::Relu:
+            return [](float* out, const float* a, const float*, float, int64_t n) {
+                map([](Vec x) { return at::vec::clamp_min(x, Vec(0.f)); }, out, a, n);
+            };
+        case LazyOp::Sigmoid:
+            return [](float* out, const float* a, const float*, float, int64_t n) {
+                map([](Vec x) { return (Vec(1.f) + x.neg().exp()).reciprocal(); }, out, a, n);
+            };
+        case LazyOp::Tanh:
+            return [](float* out, const float* a, const float*, float, int64_t n) {
+                map([](Vec x) { return x.tanh(); }, out, a, n);
+            };
+        case LazyOp::Input:
+            break;
+    }
+    TORCH_INTERNAL_ASSERT(false, "unexpected lazy op");
+    return nullptr;
+}
+
+} // namespace
+
+FOO_REGISTER_DISPATCH(lazy_kernel_stub, &lazy_kernel);
+
+} // namespace foo_core
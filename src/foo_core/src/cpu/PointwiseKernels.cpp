@@ -0,0 +1,112 @@
+#include <ATen/Dispatch.h>
+#include <ATen/OpMathType.h>
+#include <ATen/TensorIterator.h>
+#include <ATen/cpu/vec/vec.h>
+#include <ATen/native/cpu/Loops.h>
+
+#include <tuple>
+#include <type_traits>
+
+#include "FooKernels.h"
+
+namespace foo_core {
+
+namespace {
+
+using at::vec::Vectorized;
+
+// Applies a vectorized op in the op math type of scalar_t. For float and
+// double that is the type itself, while bf16 and fp16 lanes are widened to two
+// float vectors so that intermediate results are not rounded.
+template <typename scalar_t, typename op_t>
+Vectorized<scalar_t> vec_opmath(const Vectorized<scalar_t>& a, const Vectorized<scalar_t>& b, const op_t& op)
+{
+    if constexpr (std::is_same_v<scalar_t, at::opmath_type<scalar_t>>) {
+        return op(a, b);
+    } else {
+        auto [a0, a1] = at::vec::convert_to_float<scalar_t>(a);
+        auto [b0, b1] = at::vec::convert_to_float<scalar_t>(b);
+        return at::vec::convert_from_float<scalar_t>(op(a0, b0), op(a1, b1));
+    }
+}
+
+// fuse (a * b) + c pointwise
+void mymuladd_kernel(at::TensorIteratorBase& iter, double c)
+{
+    AT_DISPATCH_FLOATING_TYPES_AND2(at::kBFloat16, at::kHalf, iter.common_dtype(), "mymuladd", [&]() {
+        using opmath_t = at::opmath_type<scalar_t>;
+        const opmath_t c_scalar = static_cast<opmath_t>(c);
+        at::native::cpu_kernel_vec(
+            iter,
+            [=](scalar_t a_val, scalar_t b_val) -> scalar_t {
+                return static_cast<opmath_t>(a_val) * static_cast<opmath_t>(b_val) + c_scalar;
+            },
+            // A multiply and an add, not fmadd, which is fused on AVX2 and
+            // AVX-512 only: the scalar tail then rounds like the vector body
+            // at every CPU capability.
+            [=](Vectorized<scalar_t> a_vec, Vectorized<scalar_t> b_vec) {
+                return vec_opmath(a_vec, b_vec, [=](auto x, auto y) {
+                    using vec_t = decltype(x);
+                    return x * y + vec_t(c_scalar);
+                });
+            });
+    });
+}
+
+// (a * b) pointwise
+void mymul_kernel(at::TensorIteratorBase& iter)
+{
+    AT_DISPATCH_FLOATING_TYPES_AND2(at::kBFloat16, at::kHalf, iter.common_dtype(), "mymul", [&]() {
+        using opmath_t = at::opmath_type<scalar_t>;
+        at::native::cpu_kernel_vec(
+            iter,
+            [](scalar_t a_val, scalar_t b_val) -> scalar_t {
+                return static_cast<opmath_t>(a_val) * static_cast<opmath_t>(b_val);
+            },
+            [](Vectorized<scalar_t> a_vec, Vectorized<scalar_t> b_vec) {
+                return vec_opmath(a_vec, b_vec, [](auto x, auto y) { return x * y; });
+            });
+    });
+}
+
+// (a + b) pointwise
+void myadd_kernel(at::TensorIteratorBase& iter)
+{
+    AT_DISPATCH_FLOATING_TYPES_AND2(at::kBFloat16, at::kHalf, iter.common_dtype(), "myadd_out", [&]() {
+        using opmath_t = at::opmath_type<scalar_t>;
+        at::native::cpu_kernel_vec(
+            iter,
+            [](scalar_t a_val, scalar_t b_val) -> scalar_t {
+                return static_cast<opmath_t>(a_val) + static_cast<opmath_t>(b_val);
+            },
+            [](Vectorized<scalar_t> a_vec, Vectorized<scalar_t> b_vec) {
+                return vec_opmath(a_vec, b_vec, [](auto x, auto y) { return x + y; });
+            });
+    });
+}
+
+// grad * b and grad * a pointwise, the gradients of a * b with respect to a
+// and b, computed in a single pass over the three inputs.
+void mymul_backward_kernel(at::TensorIteratorBase& iter)
+{
+    AT_DISPATCH_FLOATING_TYPES_AND2(at::kBFloat16, at::kHalf, iter.common_dtype(), "mymul_backward", [&]() {
+        using opmath_t = at::opmath_type<scalar_t>;
+        at::native::cpu_kernel_multiple_outputs(
+            iter,
+            [](scalar_t grad, scalar_t a_val, scalar_t b_val) -> std::tuple<scalar_t, scalar_t> {
+                const opmath_t g = grad;
+                return std::make_tuple(
+                    static_cast<scalar_t>(g * static_cast<opmath_t>(b_val)),
+                    static_cast<scalar_t>(g * static_cast<opmath_t>(a_val)));
+            });
+    });
+}
+
+} // namespace
+
+FOO_REGISTER_DISPATCH(mymuladd_stub, &mymuladd_kernel);
+FOO_REGISTER_DISPATCH(mymul_stub, &mymul_kernel);
+FOO_REGISTER_DISPATCH(myadd_stub, &myadd_kernel);
+FOO_REGISTER_DISPATCH(mymul_backward_stub, &mymul_backward_kernel);
+
+} // namespace foo_core
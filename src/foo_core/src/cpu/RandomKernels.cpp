@@ -0,0 +1,159 @@
+#include <ATen/Dispatch.h>
+#include <ATen/OpMathType.h>
+#include <ATen/Parallel.h>
+#include <ATen/core/PhiloxRNGEngine.h>
+#include <ATen/core/Tensor.h>
+#include <c10/util/MathConstants.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "FooKernels.h"
+#include "FooParallel.h"
+
+namespace foo_core {
+
+namespace {
+
+// Random numbers cost more than a load and a store, so threads get smaller
+// ranges than at::internal::GRAIN_SIZE.
+constexpr int64_t kRandomGrainSize = 4096;
+
+// Calls fn(i, engine) for every i in [0, numel), in parallel, with `engine`
+// positioned at the draws * i-th 32-bit value from `philox` on. Each thread
+// seeks to the start of its range by counter, so the values an element gets
+// don't depend on the number of threads.
+template <typename F>
+void for_each_philox(int64_t numel, int64_t draws, PhiloxState philox, const F& fn)
+{
+    device_parallel_for(0, numel, kRandomGrainSize, [&](int64_t begin, int64_t end) {
+        const uint64_t first = static_cast<uint64_t>(begin) * static_cast<uint64_t>(draws);
+        at::philox_engine engine(philox.seed, /*subsequence=*/0, philox.offset + first / 4);
+        for (uint64_t skip = 0; skip < first % 4; ++skip) {
+            engine();
+        }
+        for (int64_t i = begin; i < end; ++i) {
+            fn(i, engine);
+        }
+    });
+}
+
+// Uniform numbers in [0, 1) from the top 24 bits of one value or 53 bits of
+// two, like at::uniform_real_distribution.
+float uniform_float(at::philox_engine& engine)
+{
+    return static_cast<float>(engine() >> 8) * (1.0f / (1 << 24));
+}
+
+double uniform_double(at::philox_engine& engine)
+{
+    const uint64_t hi = engine();
+    const uint64_t lo = engine();
+    return static_cast<double>(((hi << 32) | lo) >> 11) * (1.0 / (uint64_t(1) << 53));
+}
+
+template <typename opmath_t>
+opmath_t uniform(at::philox_engine& engine)
+{
+    if constexpr (std::is_same_v<opmath_t, double>) {
+        return uniform_double(engine);
+    } else {
+        return uniform_float(engine);
+    }
+}
+
+void uniform_kernel(const at::Tensor& out, PhiloxState philox, double from, double to)
+{
+    AT_DISPATCH_FLOATING_TYPES_AND2(at::kBFloat16, at::kHalf, out.scalar_type(), "uniform_", [&]() {
+        using opmath_t = at::opmath_type<scalar_t>;
+        const auto lo = static_cast<opmath_t>(from);
+        const auto range = static_cast<opmath_t>(to - from);
+        scalar_t* data = out.mutable_data_ptr<scalar_t>();
+        const int64_t draws = random_draws(RandomOp::Uniform, out.scalar_type());
+        for_each_philox(out.numel(), draws, philox, [&](int64_t i, at::philox_engine& engine) {
+            data[i] = static_cast<scalar_t>(uniform<opmath_t>(engine) * range + lo);
+        });
+    });
+}
+
+// Box-Muller, keeping only the cosine branch so that every element owns its
+// two uniform numbers.
+void normal_kernel(const at::Tensor& out, PhiloxState philox, double mean, double std)
+{
+    AT_DISPATCH_FLOATING_TYPES_AND2(at::kBFloat16, at::kHalf, out.scalar_type(), "normal_", [&]() {
+        using opmath_t = at::opmath_type<scalar_t>;
+        const auto m = static_cast<opmath_t>(mean);
+        const auto s = static_cast<opmath_t>(std);
+        const opmath_t two_pi = 2 * c10::pi<opmath_t>;
+        scalar_t* data = out.mutable_data_ptr<scalar_t>();
+        const int64_t draws = random_draws(RandomOp::Normal, out.scalar_type());
+        for_each_philox(out.numel(), draws, philox, [&](int64_t i, at::philox_engine& engine) {
+            const opmath_t u1 = uniform<opmath_t>(engine);
+            const opmath_t u2 = uniform<opmath_t>(engine);
+            // 1 - u1 is in (0, 1], so the log is finite.
+            const opmath_t radius = std::sqrt(opmath_t(-2) * std::log(opmath_t(1) - u1));
+            data[i] = static_cast<scalar_t>(radius * std::cos(two_pi * u2) * s + m);
+        });
+    });
+}
+
+void bernoulli_scalar_kernel(const at::Tensor& out, PhiloxState philox, double p)
+{
+    AT_DISPATCH_ALL_TYPES_AND3(at::kBool, at::kBFloat16, at::kHalf, out.scalar_type(), "bernoulli_", [&]() {
+        scalar_t* data = out.mutable_data_ptr<scalar_t>();
+        for_each_philox(out.numel(), random_draws(RandomOp::Bernoulli, out.scalar_type()), philox,
+            [&](int64_t i, at::philox_engine& engine) {
+                data[i] = static_cast<scalar_t>(uniform_double(engine) < p);
+            });
+    });
+}
+
+void bernoulli_tensor_kernel(const at::Tensor& out, PhiloxState philox, const at::Tensor& p)
+{
+    const double* p_data = p.const_data_ptr<double>();
+    AT_DISPATCH_ALL_TYPES_AND3(at::kBool, at::kBFloat16, at::kHalf, out.scalar_type(), "bernoulli_", [&]() {
+        scalar_t* data = out.mutable_data_ptr<scalar_t>();
+        for_each_philox(out.numel(), random_draws(RandomOp::Bernoulli, out.scalar_type()), philox,
+            [&](int64_t i, at::philox_engine& engine) {
+                data[i] = static_cast<scalar_t>(uniform_double(engine) < p_data[i]);
+            });
+    });
+}
+
+// Sorts the indices by a random 64-bit key each, like the CUDA randperm does
+// for large n. Equal keys keep the index order, so the permutation is still
+// a function of the keys alone.
+void randperm_kernel(const at::Tensor& out, PhiloxState philox)
+{
+    const int64_t n = out.numel();
+    std::vector<std::pair<uint64_t, int64_t>> keys(n);
+    for_each_philox(n, random_draws(RandomOp::Randperm, out.scalar_type()), philox,
+        [&](int64_t i, at::philox_engine& engine) {
+            const uint64_t hi = engine();
+            const uint64_t lo = engine();
+            keys[i] = {(hi << 32) | lo, i};
+        });
+    std::sort(keys.begin(), keys.end());
+    AT_DISPATCH_ALL_TYPES_AND2(at::kBFloat16, at::kHalf, out.scalar_type(), "randperm", [&]() {
+        scalar_t* data = out.mutable_data_ptr<scalar_t>();
+        device_parallel_for(0, n, at::internal::GRAIN_SIZE, [&](int64_t begin, int64_t end) {
+            for (int64_t i = begin; i < end; ++i) {
+                data[i] = static_cast<scalar_t>(keys[i].second);
+            }
+        });
+    });
+}
+
+} // namespace
+
+FOO_REGISTER_DISPATCH(uniform_stub, &uniform_kernel);
+FOO_REGISTER_DISPATCH(normal_stub, &normal_kernel);
+FOO_REGISTER_DISPATCH(bernoulli_scalar_stub, &bernoulli_scalar_kernel);
+FOO_REGISTER_DISPATCH(bernoulli_tensor_stub, &bernoulli_tensor_kernel);
+FOO_REGISTER_DISPATCH(randperm_stub, &randperm_kernel);
+
+} // namespace foo_core
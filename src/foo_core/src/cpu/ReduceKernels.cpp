@@ -0,0 +1,672 @@
+#include <ATen/Dispatch.h>
+#include <ATen/OpMathType.h>
+#include <ATen/Parallel.h>
+#include <ATen/core/Tensor.h>
+#include <ATen/cpu/vec/vec.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#include "FooKernels.h"
+#include "FooParallel.h"
+
+namespace foo_core {
+
+namespace {
+
+using at::vec::Vectorized;
+
+// Rows of a reduction are cut into blocks of kRowBlock elements, columns into
+// blocks of kColumnBlock rows. Every block gives a partial result, and the
+// partials of an output are combined by a fixed binary tree. Within a block the
+// elements are combined in a fixed order too, so the result depends on the
+// shape alone and never on how the blocks are spread over the threads.
+constexpr int64_t kRowBlock = 4096;
+constexpr int64_t kColumnBlock = 256;
+// Columns reduced together by one task, in vectors of scalar_t.
+constexpr int64_t kColumnVectors = 4;
+
+// Loads and stores Vectorized<scalar_t>::size() elements as op math vectors:
+// one for float and double, two for bf16 and fp16.
+template <typename scalar_t>
+struct OpmathVec {
+    using opmath_t = at::opmath_type<scalar_t>;
+    using Vec = Vectorized<opmath_t>;
+    static constexpr int64_t kStep = Vectorized<scalar_t>::size();
+    static constexpr int64_t kPieces = kStep / Vec::size();
+
+    static void load(const scalar_t* data, Vec* x)
+    {
+        if constexpr (std::is_same_v<scalar_t, opmath_t>) {
+            x[0] = Vec::loadu(data);
+        } else {
+            auto [lo, hi] = at::vec::convert_to_float<scalar_t>(Vectorized<scalar_t>::loadu(data));
+            x[0] = lo;
+            x[1] = hi;
+        }
+    }
+
+    // `out_t` is scalar_t or opmath_t.
+    template <typename out_t>
+    static void store(out_t* data, const Vec* y)
+    {
+        if constexpr (std::is_same_v<out_t, opmath_t>) {
+            for (int64_t p = 0; p < kPieces; ++p) {
+                y[p].store(data + p * Vec::size());
+            }
+        } else {
+            at::vec::convert_from_float<scalar_t>(y[0], y[1]).store(data);
+        }
+    }
+
+    // Loads kStep values of `param_t`, which is scalar_t or opmath_t.
+    template <typename param_t>
+    static void load_param(const param_t* data, Vec* x)
+    {
+        if constexpr (std::is_same_v<param_t, opmath_t>) {
+            for (int64_t p = 0; p < kPieces; ++p) {
+                x[p] = Vec::loadu(data + p * Vec::size());
+            }
+        } else {
+            load(data, x);
+        }
+    }
+};
+
+// ===== Reductions =====
+
+template <typename T>
+T abs_value(const T& x)
+{
+    if constexpr (std::is_arithmetic_v<T>) {
+        return std::abs(x);
+    } else {
+        return x.abs();
+    }
+}
+
+// Both propagate NaN, like at::vec::maximum and minimum.
+template <typename T>
+T max_value(const T& a, const T& b)
+{
+    if constexpr (std::is_arithmetic_v<T>) {
+        return (a != a || a > b) ? a : b;
+    } else {
+        return at::vec::maximum(a, b);
+    }
+}
+
+template <typename T>
+T min_value(const T& a, const T& b)
+{
+    if constexpr (std::is_arithmetic_v<T>) {
+        return (a != a || a < b) ? a : b;
+    } else {
+        return at::vec::minimum(a, b);
+    }
+}
+
+// map() turns an element into what is combined, combine() merges two partial
+// results. Both work on op math scalars and vectors alike.
+template <ReduceOp op>
+struct Reducer {
+    template <typename opmath_t>
+    static opmath_t identity()
+    {
+        if constexpr (op == ReduceOp::Max) {
+            return -std::numeric_limits<opmath_t>::infinity();
+        } else if constexpr (op == ReduceOp::Min) {
+            return std::numeric_limits<opmath_t>::infinity();
+        } else {
+            return opmath_t(0);
+        }
+    }
+
+    template <typename T>
+    static T map(const T& x, const T& center)
+    {
+        if constexpr (op == ReduceOp::AbsSum || op == ReduceOp::AbsMax) {
+            return abs_value(x);
+        } else if constexpr (op == ReduceOp::SquareSum) {
+            return x * x;
+        } else if constexpr (op == ReduceOp::CenteredSquareSum) {
+            const T d = x - center;
+            return d * d;
+        } else {
+            return x;
+        }
+    }
+
+    template <typename T>
+    static T combine(const T& a, const T& b)
+    {
+        if constexpr (op == ReduceOp::Max || op == ReduceOp::AbsMax) {
+            return max_value(a, b);
+        } else if constexpr (op == ReduceOp::Min) {
+            return min_value(a, b);
+        } else {
+            return a + b;
+        }
+    }
+};
+
+// Combines values[0, count) pairwise, in a fixed order, into values[0].
+template <typename R, typename T>
+T tree_combine(T* values, int64_t count)
+{
+    for (int64_t width = 1; width < count; width *= 2) {
+        for (int64_t i = 0; i + width < count; i += 2 * width) {
+            values[i] = R::combine(values[i], values[i + width]);
+        }
+    }
+    return values[0];
+}
+
+// Reduces the n <= kRowBlock contiguous elements at `data`, with four vector
+// accumulators to hide the latency of the adds.
+template <typename scalar_t, ReduceOp op>
+at::opmath_type<scalar_t> reduce_row_block(const scalar_t* data, int64_t n, at::opmath_type<scalar_t> center)
+{
+    using R = Reducer<op>;
+    using V = OpmathVec<scalar_t>;
+    using opmath_t = typename V::opmath_t;
+    using Vec = typename V::Vec;
+    constexpr int64_t kStep = V::kStep;
+    constexpr int64_t kPieces = V::kPieces;
+    const Vec c(center);
+    Vec acc[4 * kPieces];
+    std::fill(acc, acc + 4 * kPieces, Vec(R::template identity<opmath_t>()));
+    Vec x[kPieces];
+    int64_t i = 0;
+    for (; i + 4 * kStep <= n; i += 4 * kStep) {
+        for (int64_t k = 0; k < 4; ++k) {
+            V::load(data + i + k * kStep, x);
+            for (int64_t p = 0; p < kPieces; ++p) {
+                acc[k * kPieces + p] = R::combine(acc[k * kPieces + p], R::map(x[p], c));
+            }
+        }
+    }
+    for (; i + kStep <= n; i += kStep) {
+        V::load(data + i, x);
+        for (int64_t p = 0; p < kPieces; ++p) {
+            acc[p] = R::combine(acc[p], R::map(x[p], c));
+        }
+    }
+    opmath_t lanes[4 * kStep];
+    for (int64_t k = 0; k < 4 * kPieces; ++k) {
+        acc[k].store(lanes + k * Vec::size());
+    }
+    opmath_t result = tree_combine<R>(lanes, 4 * kStep);
+    for (; i < n; ++i) {
+        result = R::combine(result, R::map(static_cast<opmath_t>(data[i]), center));
+    }
+    return result;
+}
+
+// Reduces the contiguous rows of a [outer, size] input.
+template <typename scalar_t, ReduceOp op>
+void reduce_rows(at::opmath_type<scalar_t>* acc, const scalar_t* in, int64_t outer, int64_t size,
+    const at::opmath_type<scalar_t>* center)
+{
+    using R = Reducer<op>;
+    using opmath_t = at::opmath_type<scalar_t>;
+    const int64_t blocks = (size + kRowBlock - 1) / kRowBlock;
+    if (blocks <= 1) {
+        const int64_t grain = std::max<int64_t>(1, at::internal::GRAIN_SIZE / std::max<int64_t>(size, 1));
+        device_parallel_for(0, outer, grain, [&](int64_t begin, int64_t end) {
+            for (int64_t a = begin; a < end; ++a) {
+                acc[a] = reduce_row_block<scalar_t, op>(in + a * size, size, center ? center[a] : opmath_t(0));
+            }
+        });
+        return;
+    }
+    // Long rows: every block is a task of its own.
+    std::vector<opmath_t> partials(outer * blocks);
+    device_parallel_for(0, outer * blocks, at::internal::GRAIN_SIZE / kRowBlock, [&](int64_t begin, int64_t end) {
+        for (int64_t j = begin; j < end; ++j) {
+            const int64_t a = j / blocks;
+            const int64_t first = (j % blocks) * kRowBlock;
+            partials[j] = reduce_row_block<scalar_t, op>(in + a * size + first, std::min(kRowBlock, size - first),
+                center ? center[a] : opmath_t(0));
+        }
+    });
+    for (int64_t a = 0; a < outer; ++a) {
+        acc[a] = tree_combine<R>(partials.data() + a * blocks, blocks);
+    }
+}
+
+// Reduces `rows` rows, `stride` elements apart, of the `cols` columns at `in`
+// into out[j * out_stride]. The columns are the lanes of the accumulators.
+template <typename scalar_t, ReduceOp op>
+void reduce_column_block(at::opmath_type<scalar_t>* out, int64_t out_stride, const scalar_t* in, int64_t rows,
+    int64_t stride, int64_t cols, const at::opmath_type<scalar_t>* center)
+{
+    using R = Reducer<op>;
+    using V = OpmathVec<scalar_t>;
+    using opmath_t = typename V::opmath_t;
+    using Vec = typename V::Vec;
+    constexpr int64_t kStep = V::kStep;
+    constexpr int64_t kPieces = V::kPieces;
+    const opmath_t identity = R::template identity<opmath_t>();
+    const int64_t vectors = cols / kStep;
+    Vec acc[kColumnVectors * kPieces];
+    Vec c[kColumnVectors * kPieces];
+    for (int64_t k = 0; k < vectors * kPieces; ++k) {
+        acc[k] = Vec(identity);
+        c[k] = center ? Vec::loadu(center + k * Vec::size()) : Vec(0);
+    }
+    opmath_t tail[kStep];
+    std::fill(tail, tail + kStep, identity);
+    Vec x[kPieces];
+    for (int64_t r = 0; r < rows; ++r) {
+        const scalar_t* row = in + r * stride;
+        for (int64_t v = 0; v < vectors; ++v) {
+            V::load(row + v * kStep, x);
+            for (int64_t p = 0; p < kPieces; ++p) {
+                acc[v * kPieces + p] = R::combine(acc[v * kPieces + p], R::map(x[p], c[v * kPieces + p]));
+            }
+        }
+        for (int64_t j = vectors * kStep; j < cols; ++j) {
+            const opmath_t value = R::map(static_cast<opmath_t>(row[j]), center ? center[j] : opmath_t(0));
+            tail[j - vectors * kStep] = R::combine(tail[j - vectors * kStep], value);
+        }
+    }
+    opmath_t lanes[Vec::size()];
+    for (int64_t k = 0; k < vectors * kPieces; ++k) {
+        acc[k].store(lanes);
+        for (int64_t l = 0; l < Vec::size(); ++l) {
+            out[(k * Vec::size() + l) * out_stride] = lanes[l];
+        }
+    }
+    for (int64_t j = vectors * kStep; j < cols; ++j) {
+        out[j * out_stride] = tail[j - vectors * kStep];
+    }
+}
+
+// Reduces the middle dimension of an [outer, size, inner > 1] input.
+template <typename scalar_t, ReduceOp op>
+void reduce_columns(at::opmath_type<scalar_t>* acc, const scalar_t* in, int64_t outer, int64_t size, int64_t inner,
+    const at::opmath_type<scalar_t>* center)
+{
+    using R = Reducer<op>;
+    using opmath_t = at::opmath_type<scalar_t>;
+    constexpr int64_t kColumns = kColumnVectors * Vectorized<scalar_t>::size();
+    const int64_t column_blocks = (inner + kColumns - 1) / kColumns;
+    const int64_t row_blocks = std::max<int64_t>(1, (size + kColumnBlock - 1) / kColumnBlock);
+    const int64_t tasks = outer * column_blocks * row_blocks;
+    const int64_t grain = std::max<int64_t>(1, at::internal::GRAIN_SIZE / (kColumns * kColumnBlock));
+    // With a single row block, the partials are the results.
+    std::vector<opmath_t> partials(row_blocks > 1 ? outer * inner * row_blocks : 0);
+    device_parallel_for(0, tasks, grain, [&](int64_t begin, int64_t end) {
+        for (int64_t t = begin; t < end; ++t) {
+            const int64_t k = t % row_blocks;
+            const int64_t b = (t / row_blocks) % column_blocks * kColumns;
+            const int64_t a = t / (row_blocks * column_blocks);
+            const int64_t first = k * kColumnBlock;
+            const scalar_t* block = in + (a * size + first) * inner + b;
+            const opmath_t* block_center = center ? center + a * inner + b : nullptr;
+            const int64_t rows = std::min(kColumnBlock, size - first);
+            const int64_t cols = std::min(kColumns, inner - b);
+            if (row_blocks == 1) {
+                reduce_column_block<scalar_t, op>(acc + a * inner + b, 1, block, rows, inner, cols, block_center);
+            } else {
+                opmath_t* out = partials.data() + (a * inner + b) * row_blocks + k;
+                reduce_column_block<scalar_t, op>(out, row_blocks, block, rows, inner, cols, block_center);
+            }
+        }
+    });
+    if (row_blocks > 1) {
+        device_parallel_for(0, outer * inner, at::internal::GRAIN_SIZE / row_blocks + 1,
+            [&](int64_t begin, int64_t end) {
+                for (int64_t i = begin; i < end; ++i) {
+                    acc[i] = tree_combine<R>(partials.data() + i * row_blocks, row_blocks);
+                }
+            });
+    }
+}
+
+template <typename scalar_t, ReduceOp op>
+void reduce(const at::Tensor& acc, const at::Tensor& in, const at::Tensor& center)
+{
+    using opmath_t = at::opmath_type<scalar_t>;
+    const int64_t outer = in.size(0);
+    const int64_t size = in.size(1);
+    const int64_t inner = in.size(2);
+    opmath_t* acc_data = acc.mutable_data_ptr<opmath_t>();
+    const scalar_t* in_data = in.const_data_ptr<scalar_t>();
+    const opmath_t* center_data = center.defined() ? center.const_data_ptr<opmath_t>() : nullptr;
+    if (inner == 1) {
+        reduce_rows<scalar_t, op>(acc_data, in_data, outer, size, center_data);
+    } else {
+        reduce_columns<scalar_t, op>(acc_data, in_data, outer, size, inner, center_data);
+    }
+}
+
+void reduce_kernel(const at::Tensor& acc, const at::Tensor& in, ReduceOp op, const at::Tensor& center)
+{
+    AT_DISPATCH_FLOATING_TYPES_AND2(at::kBFloat16, at::kHalf, in.scalar_type(), "foo_reduce", [&]() {
+        switch (op) {
+            case ReduceOp::Sum:
+                return reduce<scalar_t, ReduceOp::Sum>(acc, in, center);
+            case ReduceOp::AbsSum:
+                return reduce<scalar_t, ReduceOp::AbsSum>(acc, in, center);
+            case ReduceOp::SquareSum:
+                return reduce<scalar_t, ReduceOp::SquareSum>(acc, in, center);
+            case ReduceOp::CenteredSquareSum:
+                return reduce<scalar_t, ReduceOp::CenteredSquareSum>(acc, in, center);
+            case ReduceOp::Max:
+                return reduce<scalar_t, ReduceOp::Max>(acc, in, center);
+            case ReduceOp::Min:
+                return reduce<scalar_t, ReduceOp::Min>(acc, in, center);
+            case ReduceOp::AbsMax:
+                return reduce<scalar_t, ReduceOp::AbsMax>(acc, in, center);
+        }
+    });
+}
+
+// ===== Softmax =====
+
+// The statistics come from one pass with a running maximum m and a sum s of
+// exp(x - m), rescaled whenever m grows; a second pass writes the output. m
+// starts at the lowest finite value rather than -inf, so that rows starting
+// with masked (-inf) elements don't compute -inf - -inf.
+
+template <typename scalar_t, typename out_t>
+void softmax_rows(out_t* out, const scalar_t* in, int64_t outer, int64_t size, bool log)
+{
+    using V = OpmathVec<scalar_t>;
+    using opmath_t = typename V::opmath_t;
+    using Vec = typename V::Vec;
+    constexpr int64_t kStep = V::kStep;
+    constexpr int64_t kPieces = V::kPieces;
+    const opmath_t lowest = std::numeric_limits<opmath_t>::lowest();
+    const int64_t grain = std::max<int64_t>(1, at::internal::GRAIN_SIZE / std::max<int64_t>(size, 1));
+    device_parallel_for(0, outer, grain, [&](int64_t begin, int64_t end) {
+        Vec x[kPieces];
+        Vec y[kPieces];
+        for (int64_t a = begin; a < end; ++a) {
+            const scalar_t* row = in + a * size;
+            out_t* out_row = out + a * size;
+            Vec m[kPieces];
+            Vec s[kPieces];
+            std::fill(m, m + kPieces, Vec(lowest));
+            std::fill(s, s + kPieces, Vec(0));
+            int64_t i = 0;
+            for (; i + kStep <= size; i += kStep) {
+                V::load(row + i, x);
+                for (int64_t p = 0; p < kPieces; ++p) {
+                    const Vec m_new = at::vec::maximum(m[p], x[p]);
+                    s[p] = s[p] * (m[p] - m_new).exp() + (x[p] - m_new).exp();
+                    m[p] = m_new;
+                }
+            }
+            opmath_t ms[kStep];
+            opmath_t ss[kStep];
+            for (int64_t p = 0; p < kPieces; ++p) {
+                m[p].store(ms + p * Vec::size());
+                s[p].store(ss + p * Vec::size());
+            }
+            opmath_t max = lowest;
+            for (int64_t l = 0; l < kStep; ++l) {
+                max = std::max(max, ms[l]);
+            }
+            opmath_t sum = 0;
+            for (int64_t l = 0; l < kStep; ++l) {
+                sum += ss[l] * std::exp(ms[l] - max);
+            }
+            for (int64_t j = i; j < size; ++j) {
+                const auto value = static_cast<opmath_t>(row[j]);
+                if (value > max) {
+                    sum *= std::exp(max - value);
+                    max = value;
+                }
+                sum += std::exp(value - max);
+            }
+
+            const opmath_t shift = log ? max + std::log(sum) : max;
+            const opmath_t scale = opmath_t(1) / sum;
+            for (i = 0; i + kStep <= size; i += kStep) {
+                V::load(row + i, x);
+                for (int64_t p = 0; p < kPieces; ++p) {
+                    y[p] = log ? x[p] - Vec(shift) : (x[p] - Vec(shift)).exp() * Vec(scale);
+                }
+                V::store(out_row + i, y);
+            }
+            for (; i < size; ++i) {
+                const opmath_t value = static_cast<opmath_t>(row[i]) - shift;
+                out_row[i] = static_cast<out_t>(log ? value : std::exp(value) * scale);
+            }
+        }
+    });
+}
+
+// Softmax over the middle dimension of [outer, size, inner > 1], with the
+// columns as the vector lanes.
+template <typename scalar_t, typename out_t>
+void softmax_columns(out_t* out, const scalar_t* in, int64_t outer, int64_t size, int64_t inner, bool log)
+{
+    using V = OpmathVec<scalar_t>;
+    using opmath_t = typename V::opmath_t;
+    using Vec = typename V::Vec;
+    constexpr int64_t kStep = V::kStep;
+    constexpr int64_t kPieces = V::kPieces;
+    const opmath_t lowest = std::numeric_limits<opmath_t>::lowest();
+    const int64_t column_blocks = (inner + kStep - 1) / kStep;
+    const int64_t grain = std::max<int64_t>(1, at::internal::GRAIN_SIZE / (kStep * std::max<int64_t>(size, 1)));
+    device_parallel_for(0, outer * column_blocks, grain, [&](int64_t begin, int64_t end) {
+        Vec x[kPieces];
+        Vec y[kPieces];
+        for (int64_t t = begin; t < end; ++t) {
+            const int64_t a = t / column_blocks;
+            const int64_t b = t % column_blocks * kStep;
+            const scalar_t* column = in + a * size * inner + b;
+            out_t* out_column = out + a * size * inner + b;
+            if (b + kStep <= inner) {
+                Vec m[kPieces];
+                Vec s[kPieces];
+                std::fill(m, m + kPieces, Vec(lowest));
+                std::fill(s, s + kPieces, Vec(0));
+                for (int64_t r = 0; r < size; ++r) {
+                    V::load(column + r * inner, x);
+                    for (int64_t p = 0; p < kPieces; ++p) {
+                        const Vec m_new = at::vec::maximum(m[p], x[p]);
+                        s[p] = s[p] * (m[p] - m_new).exp() + (x[p] - m_new).exp();
+                        m[p] = m_new;
+                    }
+                }
+                Vec shift[kPieces];
+                Vec scale[kPieces];
+                for (int64_t p = 0; p < kPieces; ++p) {
+                    shift[p] = log ? m[p] + s[p].log() : m[p];
+                    scale[p] = s[p].reciprocal();
+                }
+                for (int64_t r = 0; r < size; ++r) {
+                    V::load(column + r * inner, x);
+                    for (int64_t p = 0; p < kPieces; ++p) {
+                        y[p] = log ? x[p] - shift[p] : (x[p] - shift[p]).exp() * scale[p];
+                    }
+                    V::store(out_column + r * inner, y);
+                }
+                continue;
+            }
+            for (int64_t j = 0; j < inner - b; ++j) {
+                opmath_t max = lowest;
+                opmath_t sum = 0;
+                for (int64_t r = 0; r < size; ++r) {
+                    const auto value = static_cast<opmath_t>(column[r * inner + j]);
+                    if (value > max) {
+                        sum *= std::exp(max - value);
+                        max = value;
+                    }
+                    sum += std::exp(value - max);
+                }
+                const opmath_t shift = log ? max + std::log(sum) : max;
+                const opmath_t scale = opmath_t(1) / sum;
+                for (int64_t r = 0; r < size; ++r) {
+                    const opmath_t value = static_cast<opmath_t>(column[r * inner + j]) - shift;
+                    out_column[r * inner + j] = static_cast<out_t>(log ? value : std::exp(value) * scale);
+                }
+            }
+        }
+    });
+}
+
+template <typename scalar_t, typename out_t>
+void softmax(const at::Tensor& out, const at::Tensor& in, bool log)
+{
+    out_t* out_data = out.mutable_data_ptr<out_t>();
+    const scalar_t* in_data = in.const_data_ptr<scalar_t>();
+    if (in.size(2) == 1) {
+        softmax_rows<scalar_t, out_t>(out_data, in_data, in.size(0), in.size(1), log);
+    } else {
+        softmax_columns<scalar_t, out_t>(out_data, in_data, in.size(0), in.size(1), in.size(2), log);
+    }
+}
+
+void softmax_kernel(const at::Tensor& out, const at::Tensor& in, bool log)
+{
+    AT_DISPATCH_FLOATING_TYPES_AND2(at::kBFloat16, at::kHalf, in.scalar_type(), "foo_softmax", [&]() {
+        if (out.scalar_type() == in.scalar_type()) {
+            softmax<scalar_t, scalar_t>(out, in, log);
+        } else {
+            softmax<scalar_t, at::opmath_type<scalar_t>>(out, in, log);
+        }
+    });
+}
+
+// ===== Layer norm =====
+
+// One pass computes the mean and variance of a row with Welford's update in
+// every lane; the lanes, which all saw the same number of elements, are then
+// merged pairwise (Chan et al.) and the remaining elements added one by one.
+// A second pass writes the normalized row.
+template <typename scalar_t, typename param_t>
+void layer_norm(const at::Tensor& out, const at::Tensor& mean, const at::Tensor& rstd, const at::Tensor& in,
+    const at::Tensor& weight, const at::Tensor& bias, double eps)
+{
+    using V = OpmathVec<scalar_t>;
+    using opmath_t = typename V::opmath_t;
+    using Vec = typename V::Vec;
+    constexpr int64_t kStep = V::kStep;
+    constexpr int64_t kPieces = V::kPieces;
+    const int64_t rows = in.size(0);
+    const int64_t n = in.size(1);
+    const scalar_t* in_data = in.const_data_ptr<scalar_t>();
+    scalar_t* out_data = out.mutable_data_ptr<scalar_t>();
+    param_t* mean_data = mean.mutable_data_ptr<param_t>();
+    param_t* rstd_data = rstd.mutable_data_ptr<param_t>();
+    const param_t* w = weight.defined() ? weight.const_data_ptr<param_t>() : nullptr;
+    const param_t* b = bias.defined() ? bias.const_data_ptr<param_t>() : nullptr;
+    const int64_t grain = std::max<int64_t>(1, at::internal::GRAIN_SIZE / std::max<int64_t>(n, 1));
+    device_parallel_for(0, rows, grain, [&](int64_t begin, int64_t end) {
+        Vec x[kPieces];
+        Vec y[kPieces];
+        Vec wv[kPieces];
+        Vec bv[kPieces];
+        for (int64_t row = begin; row < end; ++row) {
+            const scalar_t* src = in_data + row * n;
+            scalar_t* dst = out_data + row * n;
+            Vec m[kPieces];
+            Vec m2[kPieces];
+            std::fill(m, m + kPieces, Vec(0));
+            std::fill(m2, m2 + kPieces, Vec(0));
+            int64_t count = 0;
+            int64_t i = 0;
+            for (; i + kStep <= n; i += kStep) {
+                ++count;
+                const Vec inv_count(opmath_t(1) / static_cast<opmath_t>(count));
+                V::load(src + i, x);
+                for (int64_t p = 0; p < kPieces; ++p) {
+                    const Vec delta = x[p] - m[p];
+                    m[p] = m[p] + delta * inv_count;
+                    m2[p] = m2[p] + delta * (x[p] - m[p]);
+                }
+            }
+            opmath_t means[kStep];
+            opmath_t m2s[kStep];
+            for (int64_t p = 0; p < kPieces; ++p) {
+                m[p].store(means + p * Vec::size());
+                m2[p].store(m2s + p * Vec::size());
+            }
+            auto lane_count = static_cast<opmath_t>(count);
+            for (int64_t width = 1; width < kStep; width *= 2) {
+                for (int64_t l = 0; l + width < kStep; l += 2 * width) {
+                    const opmath_t delta = means[l + width] - means[l];
+                    means[l] += delta / 2;
+                    m2s[l] += m2s[l + width] + delta * delta * lane_count / 2;
+                }
+                lane_count *= 2;
+            }
+            opmath_t row_mean = means[0];
+            opmath_t row_m2 = m2s[0];
+            int64_t total = count * kStep;
+            for (int64_t j = i; j < n; ++j) {
+                ++total;
+                const auto value = static_cast<opmath_t>(src[j]);
+                const opmath_t delta = value - row_mean;
+                row_mean += delta / static_cast<opmath_t>(total);
+                row_m2 += delta * (value - row_mean);
+            }
+            const opmath_t var = std::max(row_m2 / static_cast<opmath_t>(n), opmath_t(0));
+            const opmath_t row_rstd = opmath_t(1) / std::sqrt(var + static_cast<opmath_t>(eps));
+            mean_data[row] = static_cast<param_t>(row_mean);
+            rstd_data[row] = static_cast<param_t>(row_rstd);
+
+            const Vec vmean(row_mean);
+            const Vec vrstd(row_rstd);
+            for (i = 0; i + kStep <= n; i += kStep) {
+                V::load(src + i, x);
+                if (w) {
+                    V::load_param(w + i, wv);
+                }
+                if (b) {
+                    V::load_param(b + i, bv);
+                }
+                for (int64_t p = 0; p < kPieces; ++p) {
+                    y[p] = (x[p] - vmean) * vrstd;
+                    if (w) {
+                        y[p] = y[p] * wv[p];
+                    }
+                    if (b) {
+                        y[p] = y[p] + bv[p];
+                    }
+                }
+                V::store(dst + i, y);
+            }
+            for (; i < n; ++i) {
+                opmath_t value = (static_cast<opmath_t>(src[i]) - row_mean) * row_rstd;
+                if (w) {
+                    value *= static_cast<opmath_t>(w[i]);
+                }
+                if (b) {
+                    value += static_cast<opmath_t>(b[i]);
+                }
+                dst[i] = static_cast<scalar_t>(value);
+            }
+        }
+    });
+}
+
+void layer_norm_kernel(const at::Tensor& out, const at::Tensor& mean, const at::Tensor& rstd, const at::Tensor& in,
+    const at::Tensor& weight, const at::Tensor& bias, double eps)
+{
+    AT_DISPATCH_FLOATING_TYPES_AND2(at::kBFloat16, at::kHalf, in.scalar_type(), "foo_layer_norm", [&]() {
+        if (mean.scalar_type() == in.scalar_type()) {
+            layer_norm<scalar_t, scalar_t>(out, mean, rstd, in, weight, bias, eps);
+        } else {
+            layer_norm<scalar_t, at::opmath_type<scalar_t>>(out, mean, rstd, in, weight, bias, eps);
+        }
+    });
+}
+
+} // namespace
+
+FOO_REGISTER_DISPATCH(reduce_stub, &reduce_kernel);
+FOO_REGISTER_DISPATCH(softmax_stub, &softmax_kernel);
+FOO_REGISTER_DISPATCH(layer_norm_stub, &layer_norm_kernel);
+
+} // namespace foo_core
@@ -1,34 +1,376 @@
+#include <ATen/core/dispatch/Dispatcher.h>
 #include <ATen/native/CPUFallback.h>
-#include <iostream>
+#include <c10/core/TensorImpl.h>
+#include <c10/util/Exception.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <optional>
 #include <string>
 #include <torch/library.h>
-#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "foo_core/fallback.h"
+#include "FooAlias.h"
+#include "FooDeviceGuardImpl.h"
+#include "FooFallback.h"
+#include "FooFallbackStats.h"
+#include "FooLazy.h"
+#include "FooStorageImpl.h"
+#include "FooStream.h"
+#include "FooTrace.h"
 
 namespace foo_core {
 
-bool has_op_name_warned(const std::string& op_name)
+namespace {
+
+FallbackMode fallback_mode_from_env()
+{
+    const char* env = std::getenv("TORCH_FOO_FALLBACK_MODE");
+    if (env == nullptr) {
+        return FallbackMode::Copy;
+    }
+    const std::string mode(env);
+    if (mode == "alias") {
+        return FallbackMode::Alias;
+    }
+    TORCH_CHECK(mode == "copy", "TORCH_FOO_FALLBACK_MODE must be 'copy' or 'alias', got '", mode, "'");
+    return FallbackMode::Copy;
+}
+
+std::atomic<FallbackMode>& fallback_mode()
+{
+    static std::atomic<FallbackMode> mode(fallback_mode_from_env());
+    return mode;
+}
+
+bool fallback_raise_from_env()
+{
+    const char* env = std::getenv("TORCH_FOO_FALLBACK_RAISE");
+    return env != nullptr && std::string(env) != "0" && std::string(env) != "";
+}
+
+std::atomic<bool>& fallback_raise()
+{
+    static std::atomic<bool> raise(fallback_raise_from_env());
+    return raise;
+}
+
+// Calls `fn` on every foo tensor in `ivalues`.
+template <typename Fn>
+void for_each_foo_tensor(c10::ArrayRef<c10::IValue> ivalues, const Fn& fn)
+{
+    auto visit = [&](const at::Tensor& tensor) {
+        if (tensor.defined() && tensor.is_privateuseone()) {
+            fn(tensor);
+        }
+    };
+    for (const c10::IValue& ivalue : ivalues) {
+        if (ivalue.isTensor()) {
+            visit(ivalue.toTensor());
+        } else if (ivalue.isTensorList()) {
+            for (const at::Tensor& tensor : ivalue.toTensorVector()) {
+                visit(tensor);
+            }
+        } else if (ivalue.isOptionalTensorList()) {
+            for (const std::optional<at::Tensor>& tensor : ivalue.toOptionalTensorList().vec()) {
+                if (tensor.has_value()) {
+                    visit(*tensor);
+                }
+            }
+        }
+    }
+}
+
+// Sums the bytes of the foo tensors in `ivalues`, which is what the copy
+// fallback moves between the devices for them.
+uint64_t foo_nbytes(c10::ArrayRef<c10::IValue> ivalues)
+{
+    uint64_t nbytes = 0;
+    for_each_foo_tensor(ivalues, [&](const at::Tensor& tensor) { nbytes += tensor.nbytes(); });
+    return nbytes;
+}
+
+// Bytes the copy fallback writes back to mutable foo arguments.
+uint64_t mutated_foo_nbytes(const c10::FunctionSchema& schema, c10::ArrayRef<c10::IValue> arguments)
+{
+    uint64_t nbytes = 0;
+    for (size_t idx = 0; idx < arguments.size(); ++idx) {
+        const c10::AliasInfo* alias_info = schema.arguments()[idx].alias_info();
+        if (alias_info && alias_info->isWrite()) {
+            nbytes += foo_nbytes(arguments.slice(idx, 1));
+        }
+    }
+    return nbytes;
+}
+
+// =====================================
+// ========= Zero-copy fallback ========
+// =====================================
+
+// Our storages are host memory, so instead of copying every foo argument to a
+// fresh CPU tensor (and every result back) like at::native::cpu_fallback, the
+// alias fallback hands the CPU kernel CPU tensors that view the foo storages
+// and wraps its outputs as foo tensors over the same memory:
+//
+// - Foo tensors (also inside Tensor[] and Tensor?[] arguments) are replaced
+//   by CPU aliases. Tensors sharing a foo storage share one alias storage.
+// - Foo device arguments of factory ops are replaced by the CPU device.
+// - In-place and out= kernels write through the alias into foo memory. If the
+//   kernel changed the metadata of a mutable argument (e.g. resized or
+//   restrided it), the change is mirrored onto the foo tensor.
+// - Results that alias a mutable argument return that argument, results that
+//   view an input become views of the foo storage, and fresh results are
+//   wrapped as foo tensors that take ownership of the CPU memory.
+class AliasFallback {
+public:
+    AliasFallback(const c10::OperatorHandle& op, torch::jit::Stack* stack) : schema_(op.schema()), stack_(stack) {}
+
+    void run(const c10::OperatorHandle& op)
+    {
+        const size_t num_arguments = schema_.arguments().size();
+        const size_t arguments_begin = stack_->size() - num_arguments;
+        arguments_.assign(stack_->begin() + arguments_begin, stack_->end());
+        cpu_arguments_.resize(num_arguments);
+
+        for (size_t idx = 0; idx < num_arguments; ++idx) {
+            c10::IValue& ivalue = (*stack_)[arguments_begin + idx];
+            if (ivalue.isTensor()) {
+                cpu_arguments_[idx] = to_cpu(ivalue.toTensor());
+                ivalue = cpu_arguments_[idx];
+            } else if (ivalue.isTensorList()) {
+                const c10::List<at::Tensor> tensors = ivalue.toTensorList();
+                c10::List<at::Tensor> cpu_tensors;
+                cpu_tensors.reserve(tensors.size());
+                for (size_t i = 0; i < tensors.size(); ++i) {
+                    cpu_tensors.push_back(to_cpu(tensors.get(i)));
+                }
+                ivalue = c10::IValue(std::move(cpu_tensors));
+            } else if (ivalue.isOptionalTensorList()) {
+                const c10::List<std::optional<at::Tensor>> tensors = ivalue.toOptionalTensorList();
+                c10::List<std::optional<at::Tensor>> cpu_tensors;
+                cpu_tensors.reserve(tensors.size());
+                for (size_t i = 0; i < tensors.size(); ++i) {
+                    const std::optional<at::Tensor> tensor = tensors.get(i);
+                    cpu_tensors.push_back(tensor.has_value() ? std::optional<at::Tensor>(to_cpu(*tensor)) : std::nullopt);
+                }
+                ivalue = c10::IValue(std::move(cpu_tensors));
+            } else if (ivalue.isDevice() && ivalue.toDevice().is_privateuseone()) {
+                set_device(ivalue.toDevice());
+                ivalue = c10::IValue(c10::Device(c10::DeviceType::CPU));
+            }
+        }
+
+        op.redispatchBoxed(c10::DispatchKeySet(c10::DispatchKey::CPU), stack_);
+
+        for (size_t idx = 0; idx < num_arguments; ++idx) {
+            const c10::AliasInfo* alias_info = schema_.arguments()[idx].alias_info();
+            const c10::IValue& argument = arguments_[idx];
+            if (alias_info && alias_info->isWrite() && argument.isTensor() && argument.toTensor().is_privateuseone()) {
+                sync_mutated_argument(argument.toTensor(), cpu_arguments_[idx]);
+            }
+        }
+
+        const std::vector<c10::Argument>& returns = schema_.returns();
+        const size_t returns_begin = stack_->size() - returns.size();
+        for (size_t idx = 0; idx < returns.size(); ++idx) {
+            c10::IValue& ivalue = (*stack_)[returns_begin + idx];
+            if (const c10::IValue* argument = find_mutable_argument(returns[idx].alias_info())) {
+                ivalue = *argument;
+            } else if (ivalue.isTensor()) {
+                ivalue = to_foo(ivalue.toTensor());
+            } else if (ivalue.isTensorList()) {
+                const c10::List<at::Tensor> tensors = ivalue.toTensorList();
+                c10::List<at::Tensor> foo_tensors;
+                foo_tensors.reserve(tensors.size());
+                for (size_t i = 0; i < tensors.size(); ++i) {
+                    foo_tensors.push_back(to_foo(tensors.get(i)));
+                }
+                ivalue = c10::IValue(std::move(foo_tensors));
+            }
+        }
+    }
+
+private:
+    void set_device(c10::Device device)
+    {
+        if (!device_.has_value()) {
+            device_ = device;
+        }
+    }
+
+    c10::Device device()
+    {
+        if (device_.has_value() && device_->has_index()) {
+            return *device_;
+        }
+        const c10::DeviceIndex current = FooDeviceGuardImpl().getDevice().index();
+        return c10::Device(c10::DeviceType::PrivateUse1, current < 0 ? 0 : current);
+    }
+
+    at::Tensor to_cpu(const at::Tensor& tensor)
+    {
+        if (!tensor.defined() || !tensor.is_privateuseone()) {
+            return tensor;
+        }
+        set_device(tensor.device());
+        const c10::Storage& foo_storage = tensor.storage();
+        for (const auto& storages : storages_) {
+            if (storages.second.unsafeGetStorageImpl() == foo_storage.unsafeGetStorageImpl()) {
+                return cpu_alias(tensor, storages.first);
+            }
+        }
+        c10::Storage cpu_storage = cpu_alias_storage(foo_storage);
+        storages_.emplace_back(cpu_storage, foo_storage);
+        return cpu_alias(tensor, cpu_storage);
+    }
+
+    at::Tensor to_foo(const at::Tensor& tensor)
+    {
+        if (!tensor.defined() || !tensor.is_cpu()) {
+            return tensor;
+        }
+        const c10::StorageImpl* cpu_storage = tensor.storage().unsafeGetStorageImpl();
+        for (const auto& storages : storages_) {
+            if (storages.first.unsafeGetStorageImpl() == cpu_storage) {
+                return foo_view(tensor, storages.second);
+            }
+        }
+        return foo_wrap(tensor, device());
+    }
+
+    // In-place and out= ops return the argument sharing their alias set.
+    const c10::IValue* find_mutable_argument(const c10::AliasInfo* alias_info)
+    {
+        if (!alias_info || !alias_info->isWrite()) {
+            return nullptr;
+        }
+        for (size_t idx = 0; idx < arguments_.size(); ++idx) {
+            const c10::AliasInfo* argument_alias_info = schema_.arguments()[idx].alias_info();
+            if (argument_alias_info && *argument_alias_info == *alias_info) {
+                return &arguments_[idx];
+            }
+        }
+        return nullptr;
+    }
+
+    // Mirrors changes the CPU kernel made to the alias of a mutable argument.
+    void sync_mutated_argument(const at::Tensor& foo, const at::Tensor& cpu)
+    {
+        c10::TensorImpl* foo_impl = foo.unsafeGetTensorImpl();
+        c10::StorageImpl* foo_storage = foo.storage().unsafeGetStorageImpl();
+        const c10::Storage& cpu_storage = cpu.storage();
+        const bool is_own_alias = std::any_of(storages_.begin(), storages_.end(), [&](const auto& storages) {
+            return storages.first.unsafeGetStorageImpl() == cpu_storage.unsafeGetStorageImpl()
+                && storages.second.unsafeGetStorageImpl() == foo_storage;
+        });
+        if (is_own_alias) {
+            if (cpu_storage.unsafeGetStorageImpl()->data() != foo_storage->data()) {
+                // The kernel grew the storage, which moved the alias to fresh CPU
+                // memory. Point the foo storage, and so every view of it, there.
+                c10::Storage wrapped = foo_wrap_storage(cpu_storage, foo.device());
+                foo_storage->set_data_ptr_noswap(std::move(wrapped.unsafeGetStorageImpl()->mutable_data_ptr()));
+                foo_storage->set_nbytes(cpu_storage.nbytes());
+            }
+        } else {
+            // The kernel swapped the storage (e.g. set_).
+            foo_impl->set_storage_keep_dtype(to_foo(cpu).storage());
+        }
+        if (foo.sizes() != cpu.sizes() || foo.strides() != cpu.strides() || foo.storage_offset() != cpu.storage_offset()) {
+            foo_impl->set_sizes_and_strides(cpu.sizes(), cpu.strides(), cpu.storage_offset());
+        }
+    }
+
+    const c10::FunctionSchema& schema_;
+    torch::jit::Stack* stack_;
+    std::optional<c10::Device> device_;
+    std::vector<c10::IValue> arguments_;       // the original arguments
+    std::vector<at::Tensor> cpu_arguments_;    // CPU aliases of single tensor arguments
+    std::vector<std::pair<c10::Storage, c10::Storage>> storages_; // (CPU alias, foo storage)
+};
+
+} // namespace
+
+FallbackMode get_fallback_mode()
+{
+    return fallback_mode().load(std::memory_order_relaxed);
+}
+
+void set_fallback_mode(FallbackMode mode)
+{
+    fallback_mode().store(mode, std::memory_order_relaxed);
+}
+
+bool get_fallback_raise()
+{
+    return fallback_raise().load(std::memory_order_relaxed);
+}
+
+void set_fallback_raise(bool raise)
 {
-    static std::unordered_set<std::string> _op_lists = {};
-   if (_op_lists.find(op_name) != _op_lists.end()) {
-       return true;
-   }
-   _op_lists.insert(op_name);
-   return false;
+    fallback_raise().store(raise, std::memory_order_relaxed);
 }
 
 void cpu_fallback(const c10::OperatorHandle& op, torch::jit::Stack* stack)
 {
-    // Add custom fallback logic here, or warnings that we are falling back to CPU
-    if (!has_op_name_warned(c10::toString(op.schema().operator_name()))) {
-        std::cout << "Falling back to CPU for operator: " << op.operator_name().name << std::endl;
-        // TORCH_WARN("CAUTION: The operator '",
-        //             op.schema().operator_name(),
-        //             "' is not currently supported ",
-        //             "on the backend and will fall back to run on the CPU.",
-        //             " This may have performance implications.");
+    // In lazy mode, elementwise ops are recorded instead of run.
+    if (lazy_record(op, stack)) {
+        return;
+    }
+    flush_lazy();
+
+    const c10::FunctionSchema& schema = op.schema();
+    TORCH_CHECK_NOT_IMPLEMENTED(!get_fallback_raise(),
+        "The operator '", schema.operator_name(), "' is not implemented for the foo backend ",
+        "and the CPU fallback is disabled (torch.foo.set_fallback_raise(False) enables it).");
+
+    // Fallbacks are reported through torch.foo.fallback_stats() and the trace.
+    FallbackCounters& counters = fallback_counters(schema);
+
+    const auto start = std::chrono::steady_clock::now();
+#ifdef FOO_WITH_TRACING
+    // Describe the call by its first tensor argument.
+    at::Tensor traced;
+    for (auto it = stack->end() - schema.arguments().size(); it != stack->end() && tracing_enabled(); ++it) {
+        if (it->isTensor()) {
+            traced = it->toTensor();
+            break;
+        }
+    }
+    FOO_TRACE_SCOPE(counters.name.c_str(), traced);
+#endif
+    uint64_t bytes_to_cpu = 0;
+    uint64_t bytes_to_foo = 0;
+
+    // The fallback touches foo memory from the host, so write out pending
+    // fills and wait for the work this thread has already enqueued on the foo
+    // streams.
+    for_each_foo_tensor(torch::jit::last(*stack, schema.arguments().size()),
+        [](const at::Tensor& tensor) { materialize_fill(tensor); });
+    synchronize_current_streams();
+    if (get_fallback_mode() == FallbackMode::Alias) {
+        AliasFallback(op, stack).run(op);
+    } else {
+        // The copy fallback copies every foo argument to the CPU, then copies
+        // the mutated arguments and the results back.
+        const size_t num_arguments = schema.arguments().size();
+        const std::vector<c10::IValue> arguments(stack->end() - num_arguments, stack->end());
+        bytes_to_cpu = foo_nbytes(arguments);
+        bytes_to_foo = mutated_foo_nbytes(schema, arguments);
+        at::native::cpu_fallback(op, stack);
+        const size_t num_returns = schema.returns().size();
+        for (size_t idx = 0; idx < num_returns; ++idx) {
+            const c10::AliasInfo* alias_info = schema.returns()[idx].alias_info();
+            if (!alias_info || !alias_info->isWrite()) {
+                bytes_to_foo += foo_nbytes(c10::ArrayRef<c10::IValue>(&(*stack)[stack->size() - num_returns + idx], 1));
+            }
+        }
     }
 
-    at::native::cpu_fallback(op, stack);
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    counters.record(static_cast<uint64_t>(elapsed.count()), bytes_to_cpu, bytes_to_foo);
 }
 
 TORCH_LIBRARY_IMPL(_, PrivateUse1, m) {
@@ -1,74 +1,300 @@
 #include "foo_core/operations.h"
+#include <ATen/TensorIterator.h>
+#include <torch/autograd.h>
 #include <torch/library.h>
 
+#include <tuple>
+
+#include "FooDeviceGuard.h"
+#include "FooKernels.h"
+#include "FooLazy.h"
+#include "FooStorageImpl.h"
+#include "FooTrace.h"
+#include "foo_core/stream.h"
+
 namespace foo_core {
 
-// fuse (a * b) + c pointwise
+FOO_DEFINE_DISPATCH(mymuladd_stub);
+FOO_DEFINE_DISPATCH(mymul_stub);
+FOO_DEFINE_DISPATCH(myadd_stub);
+FOO_DEFINE_DISPATCH(mymul_backward_stub);
+
+namespace {
+
+void check_pointwise_inputs(const at::Tensor& a, const at::Tensor& b)
+{
+    TORCH_CHECK(a.sizes() == b.sizes(), "expected a and b to have the same shape, got ", a.sizes(), " and ", b.sizes());
+    TORCH_CHECK(a.scalar_type() == b.scalar_type(), "expected a and b to have the same dtype, got ", a.scalar_type(), " and ", b.scalar_type());
+}
+
+} // namespace
+
+// The kernels below are built on TensorIterator. It walks strided operands in
+// place instead of forcing .contiguous() copies, hands contiguous inner loops
+// to the vectorized lambda, uses 64-bit indexing, and splits large iteration
+// spaces across the intra-op thread pool via at::parallel_for.
+//
+// Each op is split into building the iterator, which also allocates the output,
+// and the loop itself. The CPU entry points run the loop right away, while the
+// foo entry points enqueue it on the current stream. The iterator owns its
+// operands so a copy of it can safely outlive the caller's tensors. The loops
+// live in cpu/PointwiseKernels.cpp, which is compiled once per CPU capability,
+// and are reached through dispatch stubs.
+namespace {
+
+at::TensorIterator make_pointwise_iter(const at::Tensor& out, const at::Tensor& a, const at::Tensor& b)
+{
+    return at::TensorIteratorConfig()
+        .add_owned_output(out)
+        .add_owned_const_input(a)
+        .add_owned_const_input(b)
+        .build();
+}
+
+at::TensorIterator make_backward_iter(const at::Tensor& grad, const at::Tensor& a, const at::Tensor& b)
+{
+    check_pointwise_inputs(a, b);
+    TORCH_CHECK(grad.sizes() == a.sizes(), "expected grad to have shape ", a.sizes(), ", got ", grad.sizes());
+    TORCH_CHECK(grad.scalar_type() == a.scalar_type(), "expected grad to have dtype ", a.scalar_type(), ", got ",
+        grad.scalar_type());
+    return at::TensorIteratorConfig()
+        .add_owned_output(at::Tensor())
+        .add_owned_output(at::Tensor())
+        .add_owned_const_input(grad)
+        .add_owned_const_input(a)
+        .add_owned_const_input(b)
+        .build();
+}
+
+void check_foo_inputs(std::initializer_list<at::Tensor> tensors)
+{
+    for (const at::Tensor& t : tensors) {
+        TORCH_CHECK(t.is_privateuseone(), "expected all tensors to be on a foo device, got ", t.device());
+    }
+}
+
+} // namespace
+
 at::Tensor mymuladd_cpu(const at::Tensor& a, const at::Tensor& b, double c)
 {
-    TORCH_CHECK(a.sizes() == b.sizes());
-    TORCH_CHECK(a.dtype() == at::kFloat);
-    TORCH_CHECK(b.dtype() == at::kFloat);
+    check_pointwise_inputs(a, b);
     TORCH_INTERNAL_ASSERT(a.device().type() == at::DeviceType::CPU);
     TORCH_INTERNAL_ASSERT(b.device().type() == at::DeviceType::CPU);
-    at::Tensor a_contig = a.contiguous();
-    at::Tensor b_contig = b.contiguous();
-    at::Tensor result = torch::empty(a_contig.sizes(), a_contig.options());
-    const float* a_ptr = a_contig.data_ptr<float>();
-    const float* b_ptr = b_contig.data_ptr<float>();
-    float* result_ptr = result.data_ptr<float>();
-    for (int i = 0; i < result.numel(); i++) {
-        result_ptr[i] = a_ptr[i] * b_ptr[i] + c;
-    }
-    return result;
-}
-
-// (a * b) pointwise
-at::Tensor mymul_cpu(const at::Tensor& a, const at::Tensor& b) {
-  TORCH_CHECK(a.sizes() == b.sizes());
-  TORCH_CHECK(a.dtype() == at::kFloat);
-  TORCH_CHECK(b.dtype() == at::kFloat);
-  TORCH_INTERNAL_ASSERT(a.device().type() == at::DeviceType::CPU);
-  TORCH_INTERNAL_ASSERT(b.device().type() == at::DeviceType::CPU);
-  at::Tensor a_contig = a.contiguous();
-  at::Tensor b_contig = b.contiguous();
-  at::Tensor result = torch::empty(a_contig.sizes(), a_contig.options());
-  const float* a_ptr = a_contig.data_ptr<float>();
-  const float* b_ptr = b_contig.data_ptr<float>();
-  float* result_ptr = result.data_ptr<float>();
-  for (int64_t i = 0; i < result.numel(); i++) {
-    result_ptr[i] = a_ptr[i] * b_ptr[i];
-  }
-  return result;
+    auto iter = make_pointwise_iter(at::Tensor(), a, b);
+    mymuladd_stub(iter, c);
+    return iter.output();
+}
+
+at::Tensor mymul_cpu(const at::Tensor& a, const at::Tensor& b)
+{
+    check_pointwise_inputs(a, b);
+    TORCH_INTERNAL_ASSERT(a.device().type() == at::DeviceType::CPU);
+    TORCH_INTERNAL_ASSERT(b.device().type() == at::DeviceType::CPU);
+    auto iter = make_pointwise_iter(at::Tensor(), a, b);
+    mymul_stub(iter);
+    return iter.output();
 }
 
 // An example of an operator that mutates one of its inputs.
-void myadd_out_cpu(const at::Tensor& a, const at::Tensor& b, at::Tensor& out) {
-  TORCH_CHECK(a.sizes() == b.sizes());
-  TORCH_CHECK(b.sizes() == out.sizes());
-  TORCH_CHECK(a.dtype() == at::kFloat);
-  TORCH_CHECK(b.dtype() == at::kFloat);
-  TORCH_CHECK(out.dtype() == at::kFloat);
-  TORCH_CHECK(out.is_contiguous());
-  TORCH_INTERNAL_ASSERT(a.device().type() == at::DeviceType::CPU);
-  TORCH_INTERNAL_ASSERT(b.device().type() == at::DeviceType::CPU);
-  TORCH_INTERNAL_ASSERT(out.device().type() == at::DeviceType::CPU);
-  at::Tensor a_contig = a.contiguous();
-  at::Tensor b_contig = b.contiguous();
-  const float* a_ptr = a_contig.data_ptr<float>();
-  const float* b_ptr = b_contig.data_ptr<float>();
-  float* result_ptr = out.data_ptr<float>();
-  for (int64_t i = 0; i < out.numel(); i++) {
-    result_ptr[i] = a_ptr[i] + b_ptr[i];
-  }
-}
-
-// Register the new operators
+void myadd_out_cpu(const at::Tensor& a, const at::Tensor& b, at::Tensor& out)
+{
+    check_pointwise_inputs(a, b);
+    TORCH_CHECK(b.sizes() == out.sizes(), "expected out to have shape ", b.sizes(), ", got ", out.sizes());
+    TORCH_INTERNAL_ASSERT(a.device().type() == at::DeviceType::CPU);
+    TORCH_INTERNAL_ASSERT(b.device().type() == at::DeviceType::CPU);
+    TORCH_INTERNAL_ASSERT(out.device().type() == at::DeviceType::CPU);
+    auto iter = make_pointwise_iter(out, a, b);
+    myadd_stub(iter);
+}
+
+std::tuple<at::Tensor, at::Tensor> mymul_backward_cpu(const at::Tensor& grad, const at::Tensor& a, const at::Tensor& b)
+{
+    TORCH_INTERNAL_ASSERT(grad.device().type() == at::DeviceType::CPU);
+    TORCH_INTERNAL_ASSERT(a.device().type() == at::DeviceType::CPU);
+    TORCH_INTERNAL_ASSERT(b.device().type() == at::DeviceType::CPU);
+    auto iter = make_backward_iter(grad, a, b);
+    mymul_backward_stub(iter);
+    return std::make_tuple(iter.output(0), iter.output(1));
+}
+
+at::Tensor mymuladd_foo(const at::Tensor& a, const at::Tensor& b, double c)
+{
+    check_pointwise_inputs(a, b);
+    check_foo_inputs({a, b});
+    if (at::Tensor lazy = lazy_record_muladd(a, b, &c); lazy.defined()) {
+        return lazy;
+    }
+    flush_lazy();
+    materialize_fills(a, b);
+    const FooDeviceGuard guard(a.device());
+    auto iter = make_pointwise_iter(at::Tensor(), a, b);
+    launch([iter, c]() mutable {
+        FOO_TRACE_SCOPE("foo::mymuladd", iter.output());
+        mymuladd_stub(iter, c);
+    });
+    return iter.output();
+}
+
+at::Tensor mymul_foo(const at::Tensor& a, const at::Tensor& b)
+{
+    check_pointwise_inputs(a, b);
+    check_foo_inputs({a, b});
+    if (at::Tensor lazy = lazy_record_muladd(a, b, nullptr); lazy.defined()) {
+        return lazy;
+    }
+    flush_lazy();
+    materialize_fills(a, b);
+    const FooDeviceGuard guard(a.device());
+    auto iter = make_pointwise_iter(at::Tensor(), a, b);
+    launch([iter]() mutable {
+        FOO_TRACE_SCOPE("foo::mymul", iter.output());
+        mymul_stub(iter);
+    });
+    return iter.output();
+}
+
+void myadd_out_foo(const at::Tensor& a, const at::Tensor& b, at::Tensor& out)
+{
+    check_pointwise_inputs(a, b);
+    TORCH_CHECK(b.sizes() == out.sizes(), "expected out to have shape ", b.sizes(), ", got ", out.sizes());
+    check_foo_inputs({a, b, out});
+    flush_lazy();
+    materialize_fills(a, b);
+    materialize_fill_for_write(out);
+    const FooDeviceGuard guard(out.device());
+    auto iter = make_pointwise_iter(out, a, b);
+    launch([iter]() mutable {
+        FOO_TRACE_SCOPE("foo::myadd_out", iter.output());
+        myadd_stub(iter);
+    });
+}
+
+std::tuple<at::Tensor, at::Tensor> mymul_backward_foo(const at::Tensor& grad, const at::Tensor& a, const at::Tensor& b)
+{
+    check_foo_inputs({grad, a, b});
+    flush_lazy();
+    materialize_fills(grad, a, b);
+    const FooDeviceGuard guard(a.device());
+    auto iter = make_backward_iter(grad, a, b);
+    launch([iter]() mutable {
+        FOO_TRACE_SCOPE("foo::mymul_backward", iter.output(0));
+        mymul_backward_stub(iter);
+    });
+    return std::make_tuple(iter.output(0), iter.output(1));
+}
+
+// ===== Meta kernels =====
+// Shape, dtype and stride propagation for FakeTensor and torch.compile. They
+// run the same input checks and build the same TensorIterator as the real
+// kernels on meta tensors, so the outputs get exactly the layout the real
+// kernels would allocate, without running the loop.
+namespace {
+
+at::Tensor mymuladd_meta(const at::Tensor& a, const at::Tensor& b, double /*c*/)
+{
+    check_pointwise_inputs(a, b);
+    return make_pointwise_iter(at::Tensor(), a, b).output();
+}
+
+at::Tensor mymul_meta(const at::Tensor& a, const at::Tensor& b)
+{
+    check_pointwise_inputs(a, b);
+    return make_pointwise_iter(at::Tensor(), a, b).output();
+}
+
+void myadd_out_meta(const at::Tensor& a, const at::Tensor& b, at::Tensor& out)
+{
+    check_pointwise_inputs(a, b);
+    TORCH_CHECK(b.sizes() == out.sizes(), "expected out to have shape ", b.sizes(), ", got ", out.sizes());
+}
+
+std::tuple<at::Tensor, at::Tensor> mymul_backward_meta(const at::Tensor& grad, const at::Tensor& a, const at::Tensor& b)
+{
+    auto iter = make_backward_iter(grad, a, b);
+    return std::make_tuple(iter.output(0), iter.output(1));
+}
+
+} // namespace
+
+// ===== Autograd =====
+// a * b (+ c) has gradients grad * b and grad * a, which mymul_backward
+// computes in one pass. The backward goes through the dispatcher, so it runs
+// on whatever device the inputs live on and is traceable by AOTAutograd.
+namespace {
+
+std::tuple<at::Tensor, at::Tensor> call_mymul_backward(const at::Tensor& grad, const at::Tensor& a, const at::Tensor& b)
+{
+    static const auto op = c10::Dispatcher::singleton()
+        .findSchemaOrThrow("foo::mymul_backward", "")
+        .typed<std::tuple<at::Tensor, at::Tensor>(const at::Tensor&, const at::Tensor&, const at::Tensor&)>();
+    return op.call(grad, a, b);
+}
+
+class MulAddFunction : public torch::autograd::Function<MulAddFunction> {
+public:
+    static at::Tensor forward(
+        torch::autograd::AutogradContext* ctx, const at::Tensor& a, const at::Tensor& b, double c)
+    {
+        ctx->save_for_backward({a, b});
+        at::AutoDispatchBelowADInplaceOrView guard;
+        static const auto op = c10::Dispatcher::singleton()
+            .findSchemaOrThrow("foo::mymuladd", "")
+            .typed<at::Tensor(const at::Tensor&, const at::Tensor&, double)>();
+        return op.call(a, b, c);
+    }
+
+    static torch::autograd::variable_list backward(
+        torch::autograd::AutogradContext* ctx, torch::autograd::variable_list grad_outputs)
+    {
+        const auto saved = ctx->get_saved_variables();
+        auto [grad_a, grad_b] = call_mymul_backward(grad_outputs[0], saved[0], saved[1]);
+        return {grad_a, grad_b, at::Tensor()};
+    }
+};
+
+class MulFunction : public torch::autograd::Function<MulFunction> {
+public:
+    static at::Tensor forward(torch::autograd::AutogradContext* ctx, const at::Tensor& a, const at::Tensor& b)
+    {
+        ctx->save_for_backward({a, b});
+        at::AutoDispatchBelowADInplaceOrView guard;
+        static const auto op = c10::Dispatcher::singleton()
+            .findSchemaOrThrow("foo::mymul", "")
+            .typed<at::Tensor(const at::Tensor&, const at::Tensor&)>();
+        return op.call(a, b);
+    }
+
+    static torch::autograd::variable_list backward(
+        torch::autograd::AutogradContext* ctx, torch::autograd::variable_list grad_outputs)
+    {
+        const auto saved = ctx->get_saved_variables();
+        auto [grad_a, grad_b] = call_mymul_backward(grad_outputs[0], saved[0], saved[1]);
+        return {grad_a, grad_b};
+    }
+};
+
+at::Tensor mymuladd_autograd(const at::Tensor& a, const at::Tensor& b, double c)
+{
+    return MulAddFunction::apply(a, b, c);
+}
+
+at::Tensor mymul_autograd(const at::Tensor& a, const at::Tensor& b)
+{
+    return MulFunction::apply(a, b);
+}
+
+} // namespace
+
+// Register the new operators. The pt2_compliant tag tells torch.compile that
+// the schemas, meta kernels and autograd registrations below are complete, so
+// the ops are traced into the graph (and become extern kernels under inductor)
+// instead of causing graph breaks.
 TORCH_LIBRARY(foo, m)
 {
-    m.def("mymuladd(Tensor a, Tensor b, float c) -> Tensor");
-    m.def("mymul(Tensor a, Tensor b) -> Tensor");
-    m.def("myadd_out(Tensor a, Tensor b, Tensor(a!) out) -> ()");
+    m.def("mymuladd(Tensor a, Tensor b, float c) -> Tensor", {at::Tag::pt2_compliant_tag});
+    m.def("mymul(Tensor a, Tensor b) -> Tensor", {at::Tag::pt2_compliant_tag});
+    m.def("myadd_out(Tensor a, Tensor b, Tensor(a!) out) -> ()", {at::Tag::pt2_compliant_tag});
+    m.def("mymul_backward(Tensor grad, Tensor a, Tensor b) -> (Tensor, Tensor)", {at::Tag::pt2_compliant_tag});
 }
 // Register the implementations for the operators.
 TORCH_LIBRARY_IMPL(foo, CPU, m)
@@ -76,15 +302,26 @@ TORCH_LIBRARY_IMPL(foo, CPU, m)
     m.impl("mymuladd", &foo_core::mymuladd_cpu);
     m.impl("mymul", &foo_core::mymul_cpu);
     m.impl("myadd_out", &foo_core::myadd_out_cpu);
+    m.impl("mymul_backward", &foo_core::mymul_backward_cpu);
 }
-
-// Using the torch::Tensor API which comes with autograd.
-torch::Tensor add(const torch::Tensor& a, const torch::Tensor& b) {
-    return a + b;
+TORCH_LIBRARY_IMPL(foo, PrivateUse1, m)
+{
+    m.impl("mymuladd", &foo_core::mymuladd_foo);
+    m.impl("mymul", &foo_core::mymul_foo);
+    m.impl("myadd_out", &foo_core::myadd_out_foo);
+    m.impl("mymul_backward", &foo_core::mymul_backward_foo);
 }
-
-torch::Tensor multiply(const torch::Tensor& a, const torch::Tensor& b) {
-    return a * b;
+TORCH_LIBRARY_IMPL(foo, Meta, m)
+{
+    m.impl("mymuladd", &mymuladd_meta);
+    m.impl("mymul", &mymul_meta);
+    m.impl("myadd_out", &myadd_out_meta);
+    m.impl("mymul_backward", &mymul_backward_meta);
+}
+TORCH_LIBRARY_IMPL(foo, Autograd, m)
+{
+    m.impl("mymuladd", &mymuladd_autograd);
+    m.impl("mymul", &mymul_autograd);
 }
 
 }  // namespace foo_core
@@ -0,0 +1,186 @@
+"""Generates the torch_foo._C._ops fast-path bindings.
+
+Calling an operator through ``torch.ops.foo.<name>`` boxes every argument into
+an IValue, looks the operator up and unboxes the arguments again before the
+kernel runs. For small tensors that per-call cost dominates. Like PyTorch's own
+generated bindings (see torch/csrc/utils/python_arg_parser.h), the functions
+generated here parse their arguments with a static PythonArgParser and call a
+typed operator handle, so the call still goes through the dispatcher (and
+autograd, tracing, ...) but stays unboxed the whole way.
+
+    python gen_fast_ops.py <schema file> <output .cpp>
+"""
+import re
+import sys
+from dataclasses import dataclass
+from typing import List, Optional
+
+# schema type -> (PythonArgParser type, C++ argument type, PythonArgs accessor)
+ARG_TYPES = {
+    "Tensor": ("Tensor", "const at::Tensor&", "tensor"),
+    "Tensor(a!)": ("Tensor", "at::Tensor&", "tensor"),
+    "float": ("double", "double", "toDouble"),
+    "int": ("int64_t", "int64_t", "toInt64"),
+    "bool": ("bool", "bool", "toBool"),
+    "Scalar": ("Scalar", "const at::Scalar&", "scalar"),
+}
+RETURN_TYPES = {"Tensor": "at::Tensor", "()": "void"}
+
+
+@dataclass
+class Argument:
+    type: str
+    name: str
+    default: Optional[str] = None
+    kwarg_only: bool = False
+
+    @property
+    def declaration(self) -> str:
+        default = f"={self.default}" if self.default is not None else ""
+        return f"{self.type} {self.name}{default}"
+
+
+@dataclass
+class Operator:
+    python_name: str
+    qualified_name: str
+    overload: str
+    args: List[Argument]
+    returns: str
+
+    @property
+    def schema(self) -> str:
+        args = declare_args(self.args, lambda a: a.declaration)
+        overload = f".{self.overload}" if self.overload else ""
+        return f"{self.qualified_name}{overload}({args}) -> {self.returns}"
+
+
+def declare_args(args: List[Argument], declare) -> str:
+    """Joins argument declarations, inserting the `*` before keyword-only ones."""
+    parts = []
+    for i, arg in enumerate(args):
+        if arg.kwarg_only and (i == 0 or not args[i - 1].kwarg_only):
+            parts.append("*")
+        parts.append(declare(arg))
+    return ", ".join(parts)
+
+
+def parse_schema(line: str) -> Operator:
+    match = re.fullmatch(
+        r"(?:(\w+)\s*=\s*)?(\w+::\w+)(?:\.(\w+))?\((.*)\)\s*->\s*(.+)", line)
+    if match is None:
+        raise ValueError(f"cannot parse schema '{line}'")
+    python_name, qualified_name, overload, args, returns = match.groups()
+    arguments = []
+    kwarg_only = False
+    for arg in filter(None, (a.strip() for a in args.split(","))):
+        if arg == "*":
+            kwarg_only = True
+            continue
+        declaration, _, default = arg.partition("=")
+        type_, name = declaration.rsplit(" ", 1)
+        if type_ not in ARG_TYPES:
+            raise ValueError(f"unsupported argument type '{type_}' in '{line}'")
+        arguments.append(Argument(type_, name, default or None, kwarg_only))
+    if returns not in RETURN_TYPES:
+        raise ValueError(f"unsupported return type '{returns}' in '{line}'")
+    python_name = python_name or qualified_name.split("::")[1]
+    return Operator(python_name, qualified_name, overload or "", arguments, returns)
+
+
+def gen_function(op: Operator) -> str:
+    def parser_arg(a: Argument) -> str:
+        default = f"={a.default}" if a.default is not None else ""
+        return f"{ARG_TYPES[a.type][0]} {a.name}{default}"
+
+    parser_args = declare_args(op.args, parser_arg)
+    cpp_args = [ARG_TYPES[a.type][1] for a in op.args]
+    return_type = RETURN_TYPES[op.returns]
+    params = ", ".join(f"{t} {a.name}" for t, a in zip(cpp_args, op.args))
+    call_args = ", ".join(a.name for a in op.args)
+    # Mutable tensors need an lvalue to bind to at::Tensor&.
+    unpack = "\n".join(
+        f"    {'at::Tensor' if a.type == 'Tensor(a!)' else 'auto'} {a.name} = r.{ARG_TYPES[a.type][2]}({i});"
+        for i, a in enumerate(op.args))
+    if op.returns == "()":
+        finish = f"    dispatch({call_args});\n    Py_RETURN_NONE;"
+    else:
+        finish = f"    return THPVariable_Wrap(dispatch({call_args}));"
+    return f"""\
+// {op.schema}
+PyObject* fast_{op.python_name}(PyObject* /*self*/, PyObject* args, PyObject* kwargs)
+{{
+    HANDLE_TH_ERRORS
+    static torch::PythonArgParser parser({{
+        "{op.python_name}({parser_args})",
+    }});
+    torch::ParsedArgs<{max(len(op.args), 1)}> parsed_args;
+    const torch::PythonArgs r = parser.parse(args, kwargs, parsed_args);
+{unpack}
+    static const auto op = c10::Dispatcher::singleton()
+        .findSchemaOrThrow("{op.qualified_name}", "{op.overload}")
+        .typed<{return_type}({", ".join(cpp_args)})>();
+    auto dispatch = []({params}) -> {return_type} {{
+        // Taken while the GIL is held, for the allocations of the op.
+        foo_core::AllocationContextGuard context;
+        pybind11::gil_scoped_release no_gil;
+        return op.call({call_args});
+    }};
+{finish}
+    END_HANDLE_TH_ERRORS
+}}
+"""
+
+
+def gen_file(ops: List[Operator], schema_path: str) -> str:
+    functions = "\n".join(gen_function(op) for op in ops)
+    methods = "\n".join(
+        f'    {{"{op.python_name}", castPyCFunctionWithKeywords(fast_{op.python_name}), METH_VARARGS | METH_KEYWORDS, "{op.schema}"}},'
+        for op in ops)
+    return f"""\
+// @generated by gen_fast_ops.py from {schema_path}. Do not edit.
+
+#include <ATen/core/dispatch/Dispatcher.h>
+#include <torch/csrc/Exceptions.h>
+#include <torch/csrc/autograd/python_variable.h>
+#include <torch/csrc/utils/pybind.h>
+#include <torch/csrc/utils/python_arg_parser.h>
+#include <torch/csrc/utils/pycfunction_helpers.h>
+
+#include "fast_ops.h"
+#include "foo_core/allocator.h"
+
+namespace torch_foo {{
+namespace {{
+
+{functions}
+PyMethodDef fast_ops_methods[] = {{
+{methods}
+    {{nullptr, nullptr, 0, nullptr}},
+}};
+
+}} // namespace
+
+void InitFastOps(PyObject* module)
+{{
+    if (PyModule_AddFunctions(module, fast_ops_methods) < 0) {{
+        throw python_error();
+    }}
+}}
+
+}} // namespace torch_foo
+"""
+
+
+def main():
+    schema_path, output_path = sys.argv[1:3]
+    with open(schema_path) as f:
+        lines = [line.strip() for line in f]
+    ops = [parse_schema(line) for line in lines if line and not line.startswith("#")]
+    source = gen_file(ops, schema_path.rsplit("/", 1)[-1])
+    with open(output_path, "w") as f:
+        f.write(source)
+
+
+if __name__ == "__main__":
+    main()
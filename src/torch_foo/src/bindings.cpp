@@ -28,8 +28,25 @@
 *
 */
 
+#include <torch/csrc/Dtype.h>
+#include <torch/csrc/Generator.h>
 #include <torch/csrc/utils/pybind.h>
+#include <pybind11/chrono.h>
+#include "foo_core/allocator.h"
+#include "foo_core/device.h"
+#ifdef FOO_WITH_C10D
+#include "foo_core/distributed.h"
+#endif
+#include "foo_core/fallback.h"
+#include "foo_core/file.h"
+#include "foo_core/interop.h"
+#include "foo_core/lazy.h"
+#include "foo_core/matmul.h"
 #include "foo_core/operations.h"
+#include "foo_core/random.h"
+#include "foo_core/stream.h"
+#include "foo_core/trace.h"
+#include "fast_ops.h"
 
 namespace torch_foo {
 namespace {
@@ -40,21 +57,236 @@ at::Tensor temp_func(const at::Tensor& a, const at::Tensor& b)
     return foo_core::mymuladd_cpu(a, b, 10.0);
 }
 
+py::dict stat_array_to_dict(const foo_core::StatArray& stats)
+{
+    static const char* const names[] = {"all", "small_pool", "large_pool"};
+    py::dict result;
+    for (size_t i = 0; i < stats.size(); ++i) {
+        py::dict stat;
+        stat["current"] = stats[i].current;
+        stat["peak"] = stats[i].peak;
+        stat["allocated"] = stats[i].allocated;
+        stat["freed"] = stats[i].freed;
+        result[names[i]] = stat;
+    }
+    return result;
+}
+
+// Mirrors the layout of torch.cuda.memory_stats_as_nested_dict().
+py::dict device_stats_to_dict(const foo_core::DeviceStats& stats)
+{
+    py::dict result;
+    result["allocation"] = stat_array_to_dict(stats.allocation);
+    result["segment"] = stat_array_to_dict(stats.segment);
+    result["inactive_split"] = stat_array_to_dict(stats.inactive_split);
+    result["allocated_bytes"] = stat_array_to_dict(stats.allocated_bytes);
+    result["requested_bytes"] = stat_array_to_dict(stats.requested_bytes);
+    result["reserved_bytes"] = stat_array_to_dict(stats.reserved_bytes);
+    result["inactive_split_bytes"] = stat_array_to_dict(stats.inactive_split_bytes);
+    result["num_alloc_retries"] = stats.num_alloc_retries;
+    result["num_ooms"] = stats.num_ooms;
+    return result;
+}
+
+// Records the Python stack of the allocating thread. Allocations made by
+// stream workers have no Python stack, and taking the GIL there could deadlock
+// against a caller that waits on the stream while holding it, so only threads
+// that already hold the GIL are recorded.
+foo_core::AllocationContext gather_python_frames()
+{
+    constexpr size_t kMaxFrames = 64;
+    if (!Py_IsInitialized() || !PyGILState_Check()) {
+        return nullptr;
+    }
+    auto frames = std::make_shared<std::vector<foo_core::Frame>>();
+    py::object frame = py::reinterpret_borrow<py::object>(reinterpret_cast<PyObject*>(PyEval_GetFrame()));
+    while (frame && !frame.is_none() && frames->size() < kMaxFrames) {
+        const py::object code = frame.attr("f_code");
+        frames->push_back({code.attr("co_filename").cast<std::string>(), code.attr("co_name").cast<std::string>(),
+            frame.attr("f_lineno").cast<int>()});
+        frame = frame.attr("f_back");
+    }
+    return frames;
+}
+
+py::list memory_snapshot_to_list(const std::vector<foo_core::SegmentInfo>& segments)
+{
+    py::list result;
+    for (const foo_core::SegmentInfo& segment : segments) {
+        py::list blocks;
+        for (const foo_core::BlockInfo& block : segment.blocks) {
+            py::list frames;
+            if (block.context) {
+                for (const foo_core::Frame& frame : *block.context) {
+                    py::dict entry;
+                    entry["filename"] = frame.filename;
+                    entry["name"] = frame.name;
+                    entry["line"] = frame.line;
+                    frames.append(entry);
+                }
+            }
+            py::dict entry;
+            entry["address"] = block.address;
+            entry["size"] = block.size;
+            entry["requested_size"] = block.requested_size;
+            entry["state"] = block.allocated ? "active_allocated" : "inactive";
+            entry["frames"] = frames;
+            blocks.append(entry);
+        }
+        py::dict entry;
+        entry["device"] = segment.device;
+        entry["address"] = segment.address;
+        entry["total_size"] = segment.total_size;
+        entry["allocated_size"] = segment.allocated_size;
+        entry["segment_type"] = segment.is_small ? "small" : "large";
+        entry["blocks"] = blocks;
+        result.append(entry);
+    }
+    return result;
+}
+
 void InitFooBindings(py::module m)
 {
     // Extra initialization code here
 
     // Functions to be exposed for the backend module
-    m.def("current_device", []() {
-        return 0; // Hardcoded 0 device.
-    }, "Returns the curent device index");
-    m.def("device_count", []() {
-        return 2; // Hardcode 2 total devices.
-    }, "Returns the total number of devices available");
-
-    // Functions over torch tensors
-    m.def("add", &foo_core::add, "add two tensors element-wise", py::arg("a"), py::arg("b"));
-    m.def("multiply", &foo_core::multiply, "Multiply two tensors element-wise", py::arg("a"), py::arg("b"));
+    m.def("current_device", &foo_core::current_device, "Returns the curent device index");
+    m.def("device_count", &foo_core::device_count, "Returns the total number of devices available");
+    m.def("_get_device_count", &foo_core::device_count, "Returns the total number of devices available");
+    m.def("_set_device", &foo_core::set_device, "Sets the current device of this thread", py::arg("device_index"));
+    m.def("_get_device_numa_node", &foo_core::device_numa_node, "Returns the NUMA node backing a device",
+        py::arg("device_index"));
+    m.def("_get_cpu_capability", &foo_core::cpu_capability,
+        "Returns the instruction set level the foo kernels were selected for");
+
+    // Random numbers
+    m.def("_get_default_generator", [](c10::DeviceIndex device_index) {
+        return py::reinterpret_steal<py::object>(THPGenerator_Wrap(foo_core::default_generator(device_index)));
+    }, "Returns the default torch.Generator of a device", py::arg("device_index"));
+
+    // Streams, passed to and from Python as (stream_id, device_index, device_type)
+    m.def("_get_current_stream", [](c10::DeviceIndex device_index) {
+        const c10::Stream stream = foo_core::get_current_stream(device_index);
+        return std::make_tuple(stream.id(), stream.device_index(), static_cast<int64_t>(stream.device_type()));
+    }, "Returns the current stream of a device", py::arg("device_index"));
+    m.def("_get_default_stream", [](c10::DeviceIndex device_index) {
+        const c10::Stream stream = foo_core::get_default_stream(device_index);
+        return std::make_tuple(stream.id(), stream.device_index(), static_cast<int64_t>(stream.device_type()));
+    }, "Returns the default stream of a device", py::arg("device_index"));
+    m.def("_set_stream", [](int64_t stream_id, c10::DeviceIndex device_index, int64_t device_type) {
+        foo_core::set_current_stream(c10::Stream::unpack3(
+            stream_id, device_index, static_cast<c10::DeviceType>(device_type)));
+    }, "Sets the current stream of its device", py::arg("stream_id"), py::arg("device_index"), py::arg("device_type"));
+    m.def("_synchronize", [](c10::DeviceIndex device_index) {
+        py::gil_scoped_release no_gil;
+        foo_core::synchronize(device_index);
+    }, "Waits for all work on every stream of a device", py::arg("device_index"));
+
+    // Memory-mapped files
+    m.def("_from_file", [](const std::string& path, int64_t offset, std::vector<int64_t> shape, py::object dtype,
+                            c10::DeviceIndex device_index) {
+        TORCH_CHECK(THPDtype_Check(dtype.ptr()), "dtype must be a torch.dtype");
+        return foo_core::from_file(path, offset, shape, reinterpret_cast<THPDtype*>(dtype.ptr())->scalar_type,
+            device_index);
+    }, "Returns a foo tensor mapping the bytes of a file", py::arg("path"), py::arg("offset"), py::arg("shape"),
+        py::arg("dtype"), py::arg("device_index"));
+
+    // Zero-copy interop
+    m.def("_host_view", [](const at::Tensor& tensor) {
+        py::gil_scoped_release no_gil;
+        return foo_core::host_view(tensor);
+    }, "Returns a CPU tensor viewing the memory of a foo tensor, once its pending work is done", py::arg("tensor"));
+    m.def("_wrap_host", &foo_core::wrap_host, "Returns a foo tensor viewing the memory of a CPU tensor",
+        py::arg("tensor"), py::arg("device_index"));
+
+    // Distributed
+#ifdef FOO_WITH_C10D
+    m.def("_create_process_group", &foo_core::create_process_group,
+        "Returns the c10d backend of foo tensors, for processes on one host", py::arg("store"), py::arg("rank"),
+        py::arg("size"), py::arg("timeout"));
+#endif
+
+    // CPU fallback
+    m.def("_set_fallback_mode", [](const std::string& mode) {
+        TORCH_CHECK(mode == "alias" || mode == "copy", "fallback mode must be 'alias' or 'copy', got '", mode, "'");
+        foo_core::set_fallback_mode(mode == "alias" ? foo_core::FallbackMode::Alias : foo_core::FallbackMode::Copy);
+    }, "Selects how ops without a foo kernel run on the CPU", py::arg("mode"));
+    m.def("_get_fallback_mode", []() {
+        return foo_core::get_fallback_mode() == foo_core::FallbackMode::Alias ? "alias" : "copy";
+    }, "Returns how ops without a foo kernel run on the CPU");
+    m.def("_set_fallback_raise", &foo_core::set_fallback_raise,
+        "Makes ops without a foo kernel raise instead of falling back", py::arg("raise"));
+    m.def("_get_fallback_raise", &foo_core::get_fallback_raise,
+        "Returns whether ops without a foo kernel raise instead of falling back");
+    m.def("_fallback_stats", []() {
+        py::dict stats;
+        for (const foo_core::FallbackOpStats& op : foo_core::get_fallback_stats()) {
+            py::dict entry;
+            entry["calls"] = op.calls;
+            entry["total_time_ns"] = op.total_ns;
+            entry["max_time_ns"] = op.max_ns;
+            entry["bytes_to_cpu"] = op.bytes_to_cpu;
+            entry["bytes_to_foo"] = op.bytes_to_foo;
+            stats[py::str(op.name)] = entry;
+        }
+        return stats;
+    }, "Returns the per-operator statistics of the CPU fallback");
+    m.def("_reset_fallback_stats", &foo_core::reset_fallback_stats, "Resets the statistics of the CPU fallback");
+
+    // Lazy mode
+    m.def("_is_lazy_mode", &foo_core::is_lazy_mode, "Returns whether elementwise ops are recorded instead of run");
+    m.def("_set_lazy_mode", &foo_core::set_lazy_mode, "Turns lazy mode on or off", py::arg("enabled"));
+    m.def("_lazy_sync", []() {
+        py::gil_scoped_release no_gil;
+        foo_core::lazy_sync();
+    }, "Enqueues every pending lazy op");
+    m.def("_lazy_stats", []() {
+        const foo_core::LazyStats stats = foo_core::get_lazy_stats();
+        py::dict result;
+        result["recorded_ops"] = stats.recorded_ops;
+        result["fused_kernels"] = stats.fused_kernels;
+        return result;
+    }, "Returns the number of ops lazy mode recorded and of fused kernels it ran them as");
+    m.def("_reset_lazy_stats", &foo_core::reset_lazy_stats, "Resets the statistics of lazy mode");
+
+    // Matmul
+    m.def("_is_weight_prepacking", &foo_core::is_weight_prepacking,
+        "Returns whether mm and addmm keep the packed copies of their weights");
+    m.def("_set_weight_prepacking", &foo_core::set_weight_prepacking, "Turns weight prepacking on or off",
+        py::arg("enabled"));
+    m.def("_prepack_weight", &foo_core::prepack_weight, "Prepacks the operands viewing the storage of a weight",
+        py::arg("weight"));
+    m.def("_clear_prepacked_weights", &foo_core::clear_prepacked_weights, "Drops every packed weight");
+
+    // Tracing
+    m.def("_is_tracing_available", &foo_core::is_tracing_available, "Returns whether tracing support was compiled in");
+    m.def("_is_tracing_enabled", &foo_core::is_tracing_enabled, "Returns whether kernels are being traced");
+    m.def("_set_tracing_enabled", &foo_core::set_tracing_enabled, "Starts or stops tracing kernels", py::arg("enabled"));
+    m.def("_clear_trace", &foo_core::clear_trace, "Drops every recorded trace event");
+    m.def("_export_chrome_trace", &foo_core::export_chrome_trace, "Returns the recorded events as Chrome trace JSON");
+
+    // Memory management
+    m.def("_empty_cache", &foo_core::empty_cache, "Releases all unused cached memory held by the foo allocator");
+    m.def("_host_empty_cache", &foo_core::host_empty_cache, "Releases all unused cached pinned host memory");
+    m.def("_memory_stats", [](c10::DeviceIndex device) {
+        return device_stats_to_dict(foo_core::get_device_stats(device));
+    }, "Returns the caching allocator statistics of a device as a nested dict", py::arg("device_index"));
+    m.def("_reset_peak_memory_stats", &foo_core::reset_peak_stats,
+        "Resets the peak values of the caching allocator statistics of a device", py::arg("device_index"));
+    m.def("_reset_accumulated_memory_stats", &foo_core::reset_accumulated_stats,
+        "Resets the accumulated values of the caching allocator statistics of a device", py::arg("device_index"));
+    m.def("_record_memory_history", [](bool enabled) {
+        foo_core::record_memory_history(enabled ? &gather_python_frames : foo_core::ContextRecorder());
+    }, "Starts or stops recording where foo memory is allocated", py::arg("enabled"));
+    m.def("_memory_snapshot", []() {
+        return memory_snapshot_to_list(foo_core::memory_snapshot());
+    }, "Returns the segments and blocks held by the caching allocator");
+
+    // Functions over torch tensors. These are generated from codegen/fast_ops.txt
+    // and skip both pybind's argument conversion and the boxed dispatch of
+    // torch.ops.
+    py::module ops = m.def_submodule("_ops", "Statically parsed fast paths for foo operators");
+    InitFastOps(ops.ptr());
 }
 
 } // namespace
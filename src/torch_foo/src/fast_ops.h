@@ -0,0 +1,11 @@
+#pragma once
+
+#include <Python.h>
+
+namespace torch_foo {
+
+// Adds the generated fast-path operator bindings (see codegen/fast_ops.txt) as
+// functions of `module`.
+void InitFastOps(PyObject* module);
+
+} // namespace torch_foo
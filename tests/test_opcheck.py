@@ -0,0 +1,83 @@
+import pytest
+import torch
+import torch_foo  # noqa: F401  registers the foo backend and ops
+
+DEVICES = ["cpu", "foo"]
+
+
+def sample_inputs(op, device, requires_grad=False):
+    def make(*shape, dtype=torch.float32):
+        return torch.randn(*shape, dtype=dtype, device=device, requires_grad=requires_grad)
+
+    if op == "mymuladd":
+        return [(make(3), make(3), 1.5), (make(4, 5).t(), make(5, 4), -2.0), (make(8, dtype=torch.bfloat16),
+                make(8, dtype=torch.bfloat16), 0.0)]
+    if op == "mymul":
+        return [(make(3), make(3)), (make(4, 5).t(), make(5, 4)), (make(2, 3, dtype=torch.float64),
+                make(2, 3, dtype=torch.float64))]
+    if op == "mymul_backward":
+        return [(make(3), make(3), make(3)), (make(4, 5), make(5, 4).t(), make(4, 5))]
+    raise ValueError(op)
+
+
+@pytest.mark.parametrize("device", DEVICES)
+@pytest.mark.parametrize("op", ["mymuladd", "mymul", "mymul_backward"])
+def test_opcheck(op, device):
+    for args in sample_inputs(op, device):
+        torch.library.opcheck(getattr(torch.ops.foo, op), args)
+    if op != "mymul_backward":
+        for args in sample_inputs(op, device, requires_grad=True):
+            torch.library.opcheck(getattr(torch.ops.foo, op), args)
+
+
+@pytest.mark.parametrize("device", DEVICES)
+def test_opcheck_myadd_out(device):
+    a, b = torch.randn(2, 6, device=device).unbind()
+    torch.library.opcheck(torch.ops.foo.myadd_out, (a, b, torch.empty(6, device=device)))
+
+
+def test_meta_kernels_propagate_layout():
+    a = torch.empty(4, 5, device="meta").t()
+    b = torch.empty(5, 4, device="meta").t()
+    out = torch.ops.foo.mymuladd(a, b, 1.0)
+    assert out.device.type == "meta"
+    assert out.shape == (5, 4)
+    # same layout as the transposed inputs, like the CPU kernel would allocate
+    assert out.stride() == a.stride()
+    with pytest.raises(RuntimeError, match="same shape"):
+        torch.ops.foo.mymul(torch.empty(3, device="meta"), torch.empty(4, device="meta"))
+
+
+@pytest.mark.parametrize("device", DEVICES)
+def test_gradients(device):
+    a = torch.randn(17, dtype=torch.float64, device=device, requires_grad=True)
+    b = torch.randn(17, dtype=torch.float64, device=device, requires_grad=True)
+    torch.autograd.gradcheck(lambda x, y: torch.ops.foo.mymuladd(x, y, 3.0), (a, b))
+    torch.autograd.gradcheck(torch.ops.foo.mymul, (a, b))
+
+
+@pytest.mark.parametrize("device", DEVICES)
+def test_compile_without_graph_breaks(device):
+    def fn(a, b):
+        return torch.ops.foo.mymuladd(torch.ops.foo.mymul(a, b), b, 1.0).sum()
+
+    a = torch.randn(32, device=device, requires_grad=True)
+    b = torch.randn(32, device=device, requires_grad=True)
+    compiled = torch.compile(fn, fullgraph=True, backend="aot_eager")
+    loss = compiled(a, b)
+    loss.backward()
+    a_ref, b_ref = a.detach().cpu().requires_grad_(), b.detach().cpu().requires_grad_()
+    loss_ref = fn(a_ref, b_ref)
+    loss_ref.backward()
+    assert torch.allclose(loss.cpu(), loss_ref)
+    assert torch.allclose(a.grad.cpu(), a_ref.grad)
+    assert torch.allclose(b.grad.cpu(), b_ref.grad)
+
+
+def test_inductor_extern_kernel():
+    def fn(a, b):
+        return torch.ops.foo.mymuladd(a.sin(), b, 2.0).cos()
+
+    a, b = torch.randn(2, 64).unbind()
+    compiled = torch.compile(fn, fullgraph=True, backend="inductor")
+    assert torch.allclose(compiled(a, b), fn(a, b))
@@ -1,6 +1,7 @@
 import torch
 from torch_foo import add, multiply
 import pytest
+import json
 
 def test_add():
     a = torch.tensor([1.0, 2.0, 3.0])
@@ -21,3 +22,674 @@ def test_multiply():
     result = multiply(a, b)
     expected = torch.tensor([4.0, 10.0, 18.0])
     assert torch.allclose(result, expected)
+
+def test_caching_allocator_reuses_blocks():
+    a = torch.empty(1024, device="foo")
+    ptr = a.data_ptr()
+    del a
+    b = torch.empty(1024, device="foo")
+    assert b.data_ptr() == ptr
+    del b
+    torch.foo.empty_cache()
+
+@pytest.mark.parametrize("dtype", [torch.float32, torch.float64, torch.bfloat16, torch.float16])
+def test_mymuladd_strided(dtype):
+    a = torch.randn(64, 33, dtype=dtype).t()
+    b = torch.randn(64, 33, dtype=dtype).t()
+    result = torch.ops.foo.mymuladd(a, b, 2.0)
+    expected = (a.float() * b.float() + 2.0).to(dtype)
+    assert torch.allclose(result.float(), expected.float(), rtol=1e-2, atol=1e-2)
+
+    out = torch.empty(64, 33, dtype=dtype).t()
+    torch.ops.foo.myadd_out(a, b, out)
+    assert torch.allclose(out.float(), (a.float() + b.float()), rtol=1e-2, atol=1e-2)
+
+def test_streams_and_events():
+    a = torch.randn(1024, 1024).to("foo")
+    b = torch.randn(1024, 1024).to("foo")
+    side_stream = torch.foo.Stream()
+    start = torch.foo.Event(enable_timing=True)
+    end = torch.foo.Event(enable_timing=True)
+    with torch.foo.stream(side_stream):
+        start.record()
+        result = torch.ops.foo.mymuladd(a, b, 1.0)
+        end.record()
+    torch.foo.current_stream().wait_event(end)
+    end.synchronize()
+    assert end.query()
+    assert start.elapsed_time(end) >= 0
+    torch.foo.synchronize()
+    assert torch.foo.current_stream() == torch.foo.default_stream()
+
+def test_alias_fallback():
+    assert torch.foo.get_fallback_mode() == "copy"
+    torch.foo.set_fallback_mode("alias")
+    try:
+        x_cpu = torch.randn(8, 8)
+        x = x_cpu.to("foo")
+        torch.foo.reset_fallback_stats()
+        # out-of-place result
+        assert torch.allclose(torch.cumsum(x, 0).cpu(), torch.cumsum(x_cpu, 0))
+        # in-place ops write through to foo memory and return self
+        y = x.clone()
+        ptr = y.data_ptr()
+        assert y.cumsum_(1) is y
+        assert y.data_ptr() == ptr
+        assert torch.allclose(y.cpu(), torch.cumsum(x_cpu, 1))
+        # out= ops write into the given foo memory
+        out = torch.empty(8, 8, device="foo")
+        ptr = out.data_ptr()
+        assert torch.cumsum(x, 0, out=out) is out
+        assert out.data_ptr() == ptr
+        assert torch.allclose(out.cpu(), torch.cumsum(x_cpu, 0))
+        # out= ops that resize their output
+        out = torch.empty(0, device="foo")
+        torch.cumsum(x, 0, out=out)
+        assert out.shape == x.shape
+        assert torch.allclose(out.cpu(), torch.cumsum(x_cpu, 0))
+        # all of them ran on CPU aliases of the foo memory, without copies
+        stats = torch.foo.fallback_stats()
+        for name in ("aten::cumsum", "aten::cumsum_", "aten::cumsum.out"):
+            assert stats[name]["calls"] >= 1
+            assert stats[name]["bytes_to_cpu"] == 0
+            assert stats[name]["bytes_to_foo"] == 0
+    finally:
+        torch.foo.set_fallback_mode("copy")
+
+def test_fallback_stats():
+    x = torch.randn(16, device="foo")
+    torch.foo.reset_fallback_stats()
+    torch.cumsum(x, 0)
+    torch.cumsum(x, 0)
+    stats = torch.foo.fallback_stats()
+    assert stats["aten::cumsum"]["calls"] == 2
+    assert stats["aten::cumsum"]["max_time_ns"] <= stats["aten::cumsum"]["total_time_ns"]
+
+    torch.foo.reset_fallback_stats()
+    torch.cumsum(x, 0)
+    stats = torch.foo.fallback_stats()["aten::cumsum"]
+    assert stats["bytes_to_cpu"] == x.nbytes
+    assert stats["bytes_to_foo"] == x.nbytes
+
+    torch.foo.set_fallback_raise(True)
+    try:
+        with pytest.raises(NotImplementedError):
+            torch.cumsum(x, 0)
+    finally:
+        torch.foo.set_fallback_raise(False)
+
+def test_tracing(tmp_path):
+    if not torch.foo.is_tracing_available():
+        pytest.skip("built without FOO_WITH_TRACING")
+    import json
+    a = torch.randn(4, 8, device="foo")
+    torch.foo.clear_trace()
+    torch.foo.set_tracing_enabled(True)
+    try:
+        torch.ops.foo.mymul(a, a)
+        torch.foo.synchronize()
+    finally:
+        torch.foo.set_tracing_enabled(False)
+    path = tmp_path / "trace.json"
+    torch.foo.export_chrome_trace(str(path))
+    events = json.loads(path.read_text())["traceEvents"]
+    mymul = [e for e in events if e["name"] == "foo::mymul"]
+    assert len(mymul) == 1
+    assert mymul[0]["ph"] == "X"
+    assert mymul[0]["args"]["shape"] == [4, 8]
+    assert mymul[0]["args"]["bytes"] == a.nbytes
+
+@pytest.mark.parametrize("dtype", [torch.float32, torch.float64, torch.bfloat16])
+def test_strided_host_copies(dtype):
+    x_cpu = torch.randn(64, 48)
+    # sliced and transposed sources, with dtype conversion, in both directions
+    src = x_cpu[8:40:2, 4:].t()
+    x = src.to("foo", dtype=dtype)
+    assert x.dtype == dtype
+    assert torch.equal(x.cpu(), src.to(dtype))
+    assert torch.equal(x[3:, ::3].cpu(), src.to(dtype)[3:, ::3])
+    assert torch.equal(x.t().to("cpu", dtype=torch.float32), src.to(dtype).t().float())
+
+    # copy_ into a strided foo destination and out of a foo view into a CPU one
+    # (src is 44 x 16)
+    dst = torch.zeros(44, 32, device="foo", dtype=dtype)
+    dst[:, ::2].copy_(src)
+    assert torch.equal(dst.cpu()[:, ::2], src.to(dtype))
+    out = torch.zeros(16, 44)
+    out.t().copy_(x)
+    assert torch.equal(out.t(), x.cpu().float())
+
+def test_non_blocking_copy():
+    x_cpu = torch.randn(1 << 20)
+    x = x_cpu.to("foo", non_blocking=True)
+    y = torch.empty_like(x_cpu)
+    y.copy_(x, non_blocking=True)
+    torch.foo.synchronize()
+    assert torch.equal(y, x_cpu)
+
+def test_pinned_memory():
+    x_cpu = torch.randn(1024, 256)
+    pinned = x_cpu.pin_memory("foo")
+    assert pinned.is_pinned("foo")
+    assert not x_cpu.is_pinned("foo")
+    assert torch.empty(16, pin_memory=True).is_pinned("foo")
+
+    # non_blocking copies from and to pinned memory complete asynchronously
+    x = pinned.to("foo", non_blocking=True)
+    back = torch.empty_like(pinned).pin_memory("foo")
+    back.copy_(x, non_blocking=True)
+    torch.foo.synchronize()
+    assert torch.equal(back, x_cpu)
+
+    # freed blocks are cached and reused
+    ptr = pinned.data_ptr()
+    del pinned
+    assert torch.empty_like(x_cpu).pin_memory("foo").data_ptr() == ptr
+    torch.foo.host_empty_cache()
+
+def test_device_topology():
+    import threading
+    count = torch.foo.device_count()
+    assert count >= 2
+    assert torch.foo.current_device() == 0
+    for index in range(count):
+        assert torch.foo.get_device_numa_node(index) >= 0
+        x = torch.ones(4, device=f"foo:{index}")
+        assert x.device.index == index
+
+    # the current device is per thread
+    torch.foo.set_device(count - 1)
+    try:
+        seen = []
+        thread = threading.Thread(target=lambda: seen.append(torch.foo.current_device()))
+        thread.start()
+        thread.join()
+        assert seen == [0]
+        assert torch.foo.current_device() == count - 1
+    finally:
+        torch.foo.set_device(0)
+
+def test_cpu_capability():
+    import os
+    import subprocess
+    import sys
+    assert torch.foo.get_cpu_capability() in ("default", "avx2", "avx512")
+    # a pinned level computes the same results as the selected one, up to the
+    # rounding of fused multiply-adds
+    script = (
+        "import torch, torch_foo\n"
+        "torch.manual_seed(0)\n"
+        "a, b = torch.randn(2, 1027).unbind()\n"
+        "grads = [torch.randn(100) for _ in range(3)]\n"
+        "print(torch.foo.get_cpu_capability())\n"
+        "print(torch.ops.foo.mymuladd(a.to('foo'), b.to('foo'), 0.5).cpu().tolist())\n"
+        "print(torch.cat(torch._foreach_sqrt([g.abs().to('foo') for g in grads])).cpu().tolist())\n"
+    )
+    outputs = []
+    for level in ("default", torch.foo.get_cpu_capability()):
+        env = dict(os.environ, TORCH_FOO_CPU_CAPABILITY=level)
+        result = subprocess.run([sys.executable, "-c", script], env=env, capture_output=True, text=True, check=True)
+        selected, *values = result.stdout.splitlines()
+        assert selected == level
+        outputs.append([torch.tensor(eval(v)) for v in values])
+    for expected, actual in zip(*outputs):
+        assert torch.allclose(actual, expected, rtol=1e-6, atol=1e-6)
+
+def test_lazy_fusion():
+    a_cpu, b_cpu, c_cpu = torch.randn(3, 4099).unbind()
+    a, b, c = a_cpu.to("foo"), b_cpu.to("foo"), c_cpu.to("foo")
+    torch.foo.sync()
+    torch.foo.reset_lazy_stats()
+    with torch.foo.lazy():
+        d = a * b + c
+        e = torch.sigmoid(d) * 2 - 1
+        f = torch.ops.foo.mymuladd(a, b, 1.5)
+        g = torch.relu(f).sqrt() / 3
+    # the nine ops were recorded, nothing ran yet
+    assert torch.foo.lazy_stats() == {"recorded_ops": 9, "fused_kernels": 0}
+    # reading the results runs them as one fused kernel
+    assert torch.allclose(d.cpu(), a_cpu * b_cpu + c_cpu)
+    assert torch.foo.lazy_stats() == {"recorded_ops": 9, "fused_kernels": 1}
+    assert torch.allclose(e.cpu(), torch.sigmoid(a_cpu * b_cpu + c_cpu) * 2 - 1, atol=1e-6)
+    assert torch.allclose(g.cpu(), torch.relu(a_cpu * b_cpu + 1.5).sqrt() / 3)
+    # views of part of a pending result run eagerly
+    with torch.foo.lazy():
+        y = a * 2
+        z = y[:3] + 1
+    assert torch.allclose(z.cpu(), a_cpu[:3] * 2 + 1)
+    # ops the lazy graph doesn't support flush it and run eagerly
+    with torch.foo.lazy():
+        h = (a + 1).sum()
+    torch.foo.sync()
+    assert torch.allclose(h.cpu(), (a_cpu + 1).sum())
+
+def test_fast_ops():
+    import torch_foo
+    a_cpu, b_cpu = torch.randn(2, 64).unbind()
+    a, b = a_cpu.to("foo"), b_cpu.to("foo")
+    expected = torch.ops.foo.mymuladd(a, b, 0.5).cpu()
+    assert torch.equal(torch_foo.ops.mymuladd(a, b, 0.5).cpu(), expected)
+    assert torch.equal(torch_foo.ops.mymuladd(a, b=b, c=0.5).cpu(), expected)
+    assert torch.equal(torch_foo.ops.mymul(a, b).cpu(), a_cpu * b_cpu)
+    out = torch.empty(64, device="foo")
+    assert torch_foo.ops.myadd_out(a, b, out) is None
+    assert torch.equal(out.cpu(), a_cpu + b_cpu)
+    assert torch.allclose(add(a_cpu, b_cpu, alpha=2), a_cpu + 2 * b_cpu)
+    # still dispatched, so autograd sees the call
+    x = torch.randn(4, requires_grad=True)
+    multiply(x, x).sum().backward()
+    assert torch.allclose(x.grad, 2 * x.detach())
+    with pytest.raises(TypeError):
+        torch_foo.ops.mymuladd(a, b)
+
+@pytest.mark.parametrize("impl", ["foreach", "fused"])
+def test_foreach_optimizer_step(impl):
+    torch.manual_seed(0)
+    shapes = [(3,), (64, 17), (70000,), (5, 5, 5)]
+    params_cpu = [torch.randn(s) for s in shapes]
+    grads_cpu = [torch.randn(s) for s in shapes]
+    params = [torch.nn.Parameter(p.to("foo")) for p in params_cpu]
+    params_cpu = [torch.nn.Parameter(p) for p in params_cpu]
+    kwargs = {"lr": 1e-2, "weight_decay": 0.1, "amsgrad": True}
+    opt = torch.optim.AdamW(params, **kwargs, **{impl: True})
+    opt_cpu = torch.optim.AdamW(params_cpu, **kwargs, foreach=False)
+    torch.foo.reset_fallback_stats()
+    for _ in range(3):
+        for p, p_cpu, g in zip(params, params_cpu, grads_cpu):
+            p.grad, p_cpu.grad = g.to("foo"), g.clone()
+        opt.step()
+        opt_cpu.step()
+    # the optimizer step ran on native foo kernels
+    assert not any("_foreach" in op or "_fused" in op for op in torch.foo.fallback_stats())
+    for p, p_cpu in zip(params, params_cpu):
+        assert torch.allclose(p.detach().cpu(), p_cpu.detach(), atol=1e-6)
+
+def test_foreach_ops():
+    xs_cpu = [torch.randn(n) for n in (1, 31, 100000)]
+    ys_cpu = [torch.rand(n) + 0.5 for n in (1, 31, 100000)]
+    xs, ys = [x.to("foo") for x in xs_cpu], [y.to("foo") for y in ys_cpu]
+    torch._foreach_addcdiv_(xs, ys, ys, [0.5, 1.0, 2.0])
+    torch._foreach_addcdiv_(xs_cpu, ys_cpu, ys_cpu, [0.5, 1.0, 2.0])
+    out = torch._foreach_sub(xs, ys, alpha=3)
+    out_cpu = torch._foreach_sub(xs_cpu, ys_cpu, alpha=3)
+    for a, b in zip(xs + out, xs_cpu + out_cpu):
+        assert torch.allclose(a.cpu(), b)
+    # tensors with gaps between their elements take the per-tensor path
+    zs = [torch.randn(8, 8, device="foo")[:, ::2] for _ in range(2)]
+    expected = [z.cpu() * 2 for z in zs]
+    torch._foreach_mul_(zs, 2)
+    for z, e in zip(zs, expected):
+        assert torch.equal(z.cpu(), e)
+
+def test_memory_stats_and_snapshot():
+    torch.foo.synchronize()
+    torch.foo.empty_cache()
+    torch.foo.reset_peak_memory_stats()
+    before = torch.foo.memory_allocated()
+    allocs = torch.foo.memory_stats()["allocation.all.allocated"]
+    torch.foo.record_memory_history(True)
+    try:
+        x = torch.empty(1000, device="foo")
+        y = torch.empty(3 << 20, dtype=torch.uint8, device="foo")
+    finally:
+        torch.foo.record_memory_history(False)
+    stats = torch.foo.memory_stats()
+    assert torch.foo.memory_allocated() == before + 4096 + (3 << 20)
+    assert stats["allocation.all.allocated"] == allocs + 2
+    assert stats["allocated_bytes.small_pool.current"] >= 4096
+    assert stats["requested_bytes.large_pool.current"] >= 3 << 20
+    assert torch.foo.memory_reserved() >= torch.foo.memory_allocated()
+    # the remainder of x's 2 MiB segment is free but stranded
+    assert stats["inactive_split_bytes.small_pool.current"] > 0
+
+    blocks = {b["address"]: b for seg in torch.foo.memory_snapshot() for b in seg["blocks"]}
+    block = blocks[x.data_ptr()]
+    assert block["state"] == "active_allocated" and block["requested_size"] == 4000
+    assert any(f["name"] == "test_memory_stats_and_snapshot" for f in block["frames"])
+
+    peak = torch.foo.max_memory_allocated()
+    del x, y
+    assert torch.foo.memory_allocated() == before
+    assert torch.foo.max_memory_allocated() == peak
+    torch.foo.reset_peak_memory_stats()
+    assert torch.foo.max_memory_allocated() == before
+
+    # the fast ops allocate without the GIL, under the stack of their caller
+    import torch_foo
+    a = torch.ones(7, device="foo")
+    torch.foo.record_memory_history(True)
+    try:
+        z = torch_foo.ops.mymul(a, a)
+    finally:
+        torch.foo.record_memory_history(False)
+    blocks = {b["address"]: b for seg in torch.foo.memory_snapshot() for b in seg["blocks"]}
+    assert any(f["name"] == "test_memory_stats_and_snapshot" for f in blocks[z.data_ptr()]["frames"])
+
+def test_deferred_fills():
+    z = torch.zeros(3, 5, device="foo")
+    o = torch.ones(7, dtype=torch.float64, device="foo")
+    f = torch.full((4,), 2.5, dtype=torch.bfloat16, device="foo")
+    assert torch.equal(z.cpu(), torch.zeros(3, 5))
+    assert torch.equal(o.cpu(), torch.ones(7, dtype=torch.float64))
+    assert torch.equal(f.cpu(), torch.full((4,), 2.5, dtype=torch.bfloat16))
+    # a fill of part of the storage writes out the pending one first
+    x = torch.zeros(10, device="foo")
+    x[::2].fill_(3)
+    x[1:3].zero_()
+    assert torch.equal(x.cpu(), torch.tensor([0.0, 0, 0, 0, 3, 0, 3, 0, 3, 0]))
+    # kernels and copies read the constant
+    a_cpu = torch.randn(10)
+    y = torch.ones(10, device="foo")
+    assert torch.allclose(torch.ops.foo.mymuladd(a_cpu.to("foo"), y, 1.0).cpu(), a_cpu + 1)
+    assert torch.equal(y.to(torch.float64).cpu(), torch.ones(10, dtype=torch.float64))
+    y.copy_(a_cpu)
+    assert torch.equal(y.cpu(), a_cpu)
+    v = torch.full((2, 3), 4.0, device="foo").view(3, 2)
+    assert torch.equal((v + 1).cpu(), torch.full((3, 2), 5.0))
+    # views of a storage filled as another dtype
+    w = torch.zeros(4, dtype=torch.int32, device="foo")
+    w.fill_(-1)
+    assert torch.equal(w.view(torch.uint8).cpu(), torch.full((16,), 255, dtype=torch.uint8))
+    gs = [torch.randn(n, device="foo") for n in (3, 1000)]
+    torch._foreach_zero_(gs)
+    assert all(torch.equal(g.cpu(), torch.zeros_like(g.cpu())) for g in gs)
+
+def test_random():
+    torch.manual_seed(123)
+    torch.foo.reset_fallback_stats()
+    a = torch.rand(10000, device="foo")
+    b = torch.randn(100, 50, dtype=torch.float64, device="foo")
+    perm = torch.randperm(1000, device="foo")
+    mask = torch.empty(5000, device="foo").bernoulli_(0.25)
+    assert torch.foo.fallback_stats() == {}
+    assert 0 <= a.min().item() and a.max().item() < 1
+    assert abs(b.mean().item()) < 0.1 and abs(b.std().item() - 1) < 0.1
+    assert torch.equal(perm.sort().values.cpu(), torch.arange(1000))
+    assert abs(mask.mean().item() - 0.25) < 0.03
+
+    # same seed, same numbers, whatever the number of threads
+    threads = torch.get_num_threads()
+    torch.set_num_threads(1)
+    try:
+        torch.manual_seed(123)
+        assert torch.equal(torch.rand(10000, device="foo").cpu(), a.cpu())
+    finally:
+        torch.set_num_threads(threads)
+
+    # saving and restoring the state replays the same numbers
+    state = torch.foo.get_rng_state()
+    x = torch.randn(7, 3, device="foo")
+    torch.foo.set_rng_state(state)
+    assert torch.equal(torch.randn(7, 3, device="foo").cpu(), x.cpu())
+    # non-contiguous outputs get the values of contiguous ones
+    torch.foo.set_rng_state(state)
+    y = torch.empty(3, 7, device="foo").t().normal_()
+    assert torch.equal(y.cpu(), x.cpu())
+
+    g = torch.Generator(device="foo").manual_seed(5)
+    x = torch.ones(1000, device="foo", requires_grad=True)
+    torch.foo.reset_fallback_stats()
+    out = torch.nn.functional.dropout(x, 0.5)
+    out.sum().backward()
+    assert torch.foo.fallback_stats() == {}
+    assert set(out.detach().cpu().tolist()) <= {0.0, 2.0}
+    assert torch.equal(x.grad.cpu(), out.detach().cpu())
+    u = torch.empty(100, device="foo").uniform_(-2, 3, generator=g)
+    assert torch.equal(u.cpu(), torch.empty(100, device="foo").uniform_(-2, 3, generator=g.manual_seed(5)).cpu())
+
+def test_peer_copy():
+    a_cpu = torch.randn(1000, 33)
+    a = a_cpu.to("foo:0")
+    with torch.foo.stream(torch.foo.Stream("foo:0")):
+        b = torch.ops.foo.mymul(a, a)
+        c = b.to("foo:1")
+        b.copy_(a)
+    assert c.device == torch.device("foo:1")
+    assert torch.equal(c.cpu(), a_cpu * a_cpu)
+    d = torch.empty(33, 1000, device="foo:0").t()
+    d.copy_(c)
+    assert torch.equal(d.cpu(), a_cpu * a_cpu)
+    assert torch.equal(b.to("foo:1", torch.float64).cpu(), a_cpu.double())
+
+def test_pointwise_ops():
+    x_cpu = torch.randn(4, 5)
+    y_cpu = torch.randn(5)
+    i_cpu = torch.randint(-5, 5, (4, 1), dtype=torch.int32)
+    x, y, i = x_cpu.to("foo"), y_cpu.to("foo"), i_cpu.to("foo")
+    torch.foo.reset_fallback_stats()
+    # broadcasting, alpha, type promotion and CPU scalars
+    assert torch.allclose(torch.add(x, y, alpha=2).cpu(), torch.add(x_cpu, y_cpu, alpha=2))
+    assert torch.allclose((x * i).cpu(), x_cpu * i_cpu)
+    assert (x * i).dtype == torch.float32
+    assert torch.allclose((x / torch.tensor(3.0)).cpu(), x_cpu / 3)
+    assert torch.equal(torch.div(i, 2, rounding_mode="floor").cpu(), torch.div(i_cpu, 2, rounding_mode="floor"))
+    assert torch.equal((x > y).cpu(), x_cpu > y_cpu)
+    assert torch.allclose(torch.where(x > 0, x, y).cpu(), torch.where(x_cpu > 0, x_cpu, y_cpu))
+    assert torch.allclose(x.clamp(-0.5, 0.5).cpu(), x_cpu.clamp(-0.5, 0.5))
+    assert torch.allclose(torch.addcdiv(x, y, x.abs() + 1, value=0.5).cpu(),
+                          torch.addcdiv(x_cpu, y_cpu, x_cpu.abs() + 1, value=0.5))
+    for fn in (torch.exp, torch.sin, torch.tanh, torch.relu, torch.nn.functional.gelu, torch.nn.functional.silu):
+        assert torch.allclose(fn(x.t()).cpu(), fn(x_cpu.t()), atol=1e-6)
+    # in-place and out= variants
+    z = x.clone()
+    assert z.mul_(y).sub_(1) is z
+    assert torch.allclose(z.cpu(), x_cpu * y_cpu - 1)
+    out = torch.empty(0, device="foo")
+    torch.mul(x, y, out=out)
+    assert out.shape == (4, 5)
+    assert torch.allclose(out.cpu(), x_cpu * y_cpu)
+    # backward of the activations runs natively too
+    w = x.clone().requires_grad_()
+    torch.sigmoid(torch.relu(w) * 3).backward(torch.ones_like(w))
+    w_cpu = x_cpu.clone().requires_grad_()
+    torch.sigmoid(torch.relu(w_cpu) * 3).backward(torch.ones_like(w_cpu))
+    assert torch.allclose(w.grad.cpu(), w_cpu.grad)
+    assert torch.foo.fallback_stats() == {}
+    # shape and dtype errors are raised by the call
+    with pytest.raises(RuntimeError):
+        x + torch.randn(3, device="foo")
+    with pytest.raises(RuntimeError):
+        i.add_(x)
+
+def test_reductions():
+    x_cpu = torch.randn(6, 300, 7)
+    x = x_cpu.to("foo")
+    torch.foo.reset_fallback_stats()
+    assert torch.allclose(x.sum().cpu(), x_cpu.sum(), rtol=1e-4)
+    for dim in (0, 1, 2, (0, 2), (1, 2)):
+        assert torch.allclose(x.sum(dim).cpu(), x_cpu.sum(dim), rtol=1e-4, atol=1e-4)
+        assert torch.allclose(x.mean(dim, keepdim=True).cpu(), x_cpu.mean(dim, keepdim=True), atol=1e-5)
+        assert torch.equal(x.amax(dim).cpu(), x_cpu.amax(dim))
+        assert torch.allclose(x.var(dim).cpu(), x_cpu.var(dim), rtol=1e-4)
+        assert torch.allclose(torch.linalg.vector_norm(x, dim=dim).cpu(), torch.linalg.vector_norm(x_cpu, dim=dim),
+                              rtol=1e-4)
+    assert torch.allclose(x.transpose(0, 2).std().cpu(), x_cpu.std(), rtol=1e-4)
+    h = x.to(torch.bfloat16)
+    assert h.sum(1).dtype == torch.bfloat16
+    assert torch.allclose(h.sum(1, dtype=torch.float32).cpu(), x_cpu.to(torch.bfloat16).float().sum(1), rtol=1e-3)
+    for dim in (0, 1, 2):
+        assert torch.allclose(torch.softmax(x, dim).cpu(), torch.softmax(x_cpu, dim), atol=1e-6)
+        assert torch.allclose(torch.log_softmax(x, dim).cpu(), torch.log_softmax(x_cpu, dim), atol=1e-5)
+    # masked rows, as in attention
+    scores = torch.tensor([[float("-inf"), 1.0, 2.0], [float("-inf")] * 3], device="foo")
+    probs = torch.softmax(scores, -1).cpu()
+    assert torch.allclose(probs[0], torch.softmax(torch.tensor([float("-inf"), 1.0, 2.0]), -1))
+    assert probs[1].isnan().all()
+    ln = torch.nn.LayerNorm(7).to("foo")
+    ln_cpu = torch.nn.LayerNorm(7)
+    with torch.no_grad():
+        assert torch.allclose(ln(x).cpu(), ln_cpu(x_cpu), atol=1e-5)
+    assert torch.foo.fallback_stats() == {}
+
+    # bit-identical results whatever the number of threads
+    y = torch.randn(1000, 513, device="foo")
+    results = []
+    threads = torch.get_num_threads()
+    for n in (1, threads):
+        torch.set_num_threads(n)
+        try:
+            results.append([y.sum().cpu(), y.sum(0).cpu(), y.var(1).cpu(), torch.softmax(y, 0).cpu()])
+        finally:
+            torch.set_num_threads(threads)
+    assert all(torch.equal(a, b) for a, b in zip(*results))
+
+def test_matmul():
+    a_cpu, b_cpu = torch.randn(37, 300), torch.randn(300, 45)
+    a, b = a_cpu.to("foo"), b_cpu.to("foo")
+    bias_cpu = torch.randn(45)
+    torch.foo.reset_fallback_stats()
+    assert torch.allclose((a @ b).cpu(), a_cpu @ b_cpu, atol=1e-4)
+    assert torch.allclose(a.t().mm(a).cpu(), a_cpu.t().mm(a_cpu), atol=1e-3)
+    assert torch.allclose(torch.addmm(bias_cpu.to("foo"), a, b, beta=0.5, alpha=2).cpu(),
+                          torch.addmm(bias_cpu, a_cpu, b_cpu, beta=0.5, alpha=2), atol=1e-4)
+    x_cpu, y_cpu = torch.randn(5, 7, 33), torch.randn(5, 33, 9)
+    assert torch.allclose(torch.bmm(x_cpu.to("foo"), y_cpu.to("foo")).cpu(), torch.bmm(x_cpu, y_cpu), atol=1e-5)
+    assert torch.equal((a.double() @ b.double()).cpu(), a_cpu.double() @ b_cpu.double())
+    linear_cpu = torch.nn.Linear(300, 45)
+    linear = torch.nn.Linear(300, 45).to("foo")
+    linear.load_state_dict(linear_cpu.state_dict())
+    with torch.no_grad():
+        assert torch.allclose(linear(a).cpu(), linear_cpu(a_cpu), atol=1e-4)
+    assert torch.foo.fallback_stats() == {}
+    with pytest.raises(RuntimeError, match="cannot be multiplied"):
+        a @ a
+
+    # packed weights are reused until the weight changes
+    torch.foo.set_weight_prepacking(True)
+    try:
+        with torch.no_grad():
+            for _ in range(2):
+                assert torch.allclose(linear(a).cpu(), linear_cpu(a_cpu), atol=1e-4)
+            linear.weight.mul_(2)
+            linear_cpu.weight.mul_(2)
+            assert torch.allclose(linear(a).cpu(), linear_cpu(a_cpu), atol=1e-4)
+        # other operands are not, as writes through .data don't bump the version
+        m = torch.randn(300, 8, device="foo")
+        r = a @ m
+        m.data.mul_(2)
+        assert torch.allclose((a @ m).cpu(), r.cpu() * 2, atol=1e-4)
+    finally:
+        torch.foo.set_weight_prepacking(False)
+        torch.foo.clear_prepacked_weights()
+    # prepack() opts a weight in
+    w_cpu = torch.randn(300, 8)
+    w = w_cpu.to("foo")
+    torch.foo.prepack(w)
+    try:
+        assert torch.allclose((a @ w).cpu(), a_cpu @ w_cpu, atol=1e-4)
+        w.mul_(2)
+        assert torch.allclose((a @ w).cpu(), a_cpu @ w_cpu * 2, atol=1e-4)
+    finally:
+        torch.foo.clear_prepacked_weights()
+
+def test_from_file(tmp_path):
+    x = torch.randn(3, 5)
+    path = tmp_path / "x.bin"
+    path.write_bytes(b"\0" * 8 + x.numpy().tobytes())
+    y = torch.foo.from_file(path, 8, (3, 5), torch.float32)
+    assert y.device.type == "foo"
+    assert torch.equal(y.cpu(), x)
+    # copy-on-write: the file keeps its bytes
+    y.mul_(2)
+    assert torch.equal(y.cpu(), x * 2)
+    assert torch.equal(torch.foo.from_file(path, 8, (3, 5), torch.float32).cpu(), x)
+    # unaligned offsets are read instead of mapped
+    assert torch.equal(torch.foo.from_file(path, 7, (2,), torch.float32).cpu(),
+                       torch.frombuffer(bytearray(path.read_bytes()[7:15]), dtype=torch.float32))
+    with pytest.raises(RuntimeError, match="bytes from offset"):
+        torch.foo.from_file(path, 8, (4, 5), torch.float32)
+
+    tensors = {"w": torch.randn(4, 6), "b": torch.arange(5, dtype=torch.int64), "h": torch.randn(3).half()}
+    header, data = {"__metadata__": {"format": "pt"}}, b""
+    dtypes = {torch.float32: "F32", torch.int64: "I64", torch.float16: "F16"}
+    for name, t in tensors.items():
+        raw = t.numpy().tobytes()
+        header[name] = {"dtype": dtypes[t.dtype], "shape": list(t.shape),
+                        "data_offsets": [len(data), len(data) + len(raw)]}
+        data += raw
+    encoded = json.dumps(header).encode()
+    encoded += b" " * (-len(encoded) % 8)
+    path = tmp_path / "model.safetensors"
+    path.write_bytes(len(encoded).to_bytes(8, "little") + encoded + data)
+    loaded = torch.foo.load_safetensors(path)
+    assert loaded.keys() == tensors.keys()
+    for name, t in tensors.items():
+        assert loaded[name].device.type == "foo"
+        assert torch.equal(loaded[name].cpu(), t)
+
+def test_dlpack_interop():
+    import numpy as np
+    x = torch.arange(12, dtype=torch.float32, device="foo").view(3, 4)
+    y = x.t() * 1  # pending work when exported
+    array = np.from_dlpack(torch.foo.HostBuffer(y))
+    assert np.array_equal(array, np.arange(12, dtype=np.float32).reshape(3, 4).T)
+    array[0, 0] = 42  # zero-copy both ways
+    assert y[0, 0].item() == 42
+    view = np.asarray(torch.foo.HostBuffer(x[:, 1::2]))
+    assert np.array_equal(view, x.cpu().numpy()[:, 1::2])
+    assert not view.flags.owndata
+    del x
+    assert view[2, 1] == 11  # the buffer keeps the storage alive
+    z = torch.zeros(5, device="foo")  # a deferred fill is written first
+    assert np.array_equal(np.from_dlpack(torch.foo.HostBuffer(z)), np.zeros(5, dtype=np.float32))
+    assert torch.equal(torch.from_dlpack(torch.foo.to_dlpack(z)), torch.zeros(5))
+
+    source = np.linspace(0, 1, 6).reshape(2, 3)
+    w = torch.foo.from_dlpack(source)
+    assert w.device.type == "foo"
+    assert torch.equal(w.cpu(), torch.from_numpy(source))
+    source[1, 2] = -1
+    assert w[1, 2].item() == -1
+
+def _run_collectives(rank, world_size, init_file):
+    import datetime
+    import os
+    import torch.distributed as dist
+    import torch_foo  # noqa: F401, registers the backend in the spawned process
+    # the slot size of rank 0 is used by every rank
+    os.environ["TORCH_FOO_SHM_SLOT_BYTES"] = "4096" if rank == 0 else str(1 << 20)
+    dist.init_process_group("foo", init_method=f"file://{init_file}", rank=rank, world_size=world_size)
+    try:
+        # larger than the 4 KiB slots, so the collectives take several chunks
+        n = 3000
+        base = torch.arange(n, dtype=torch.float32)
+        x = (base + rank).to("foo")
+        work = dist.all_reduce(x, async_op=True)
+        assert work.wait(timeout=datetime.timedelta(seconds=60))
+        assert torch.equal(x.cpu(), base * world_size + sum(range(world_size)))
+        y = torch.full((5,), float(rank + 1), device="foo")
+        dist.all_reduce(y, op=dist.ReduceOp.MAX)
+        assert torch.equal(y.cpu(), torch.full((5,), float(world_size)))
+        z = torch.full((4,), float(rank), device="foo")
+        dist.all_reduce(z, op=dist.ReduceOp.AVG)
+        assert torch.allclose(z.cpu(), torch.full((4,), (world_size - 1) / 2))
+
+        b = (base * (rank + 1)).to("foo")
+        dist.broadcast(b, src=1)
+        assert torch.equal(b.cpu(), base * 2)
+
+        gathered = [torch.empty(n, device="foo") for _ in range(world_size)]
+        dist.all_gather(gathered, (base + rank).to("foo"))
+        for r, t in enumerate(gathered):
+            assert torch.equal(t.cpu(), base + r)
+        flat = torch.empty(world_size * n, dtype=torch.int64, device="foo")
+        dist.all_gather_into_tensor(flat, torch.full((n,), rank, dtype=torch.int64, device="foo"))
+        assert torch.equal(flat.cpu(), torch.arange(world_size).repeat_interleave(n))
+
+        out = torch.empty(n, device="foo")
+        dist.reduce_scatter(out, [(base * (r + 1) + rank).to("foo") for r in range(world_size)])
+        expected = base * (rank + 1) * world_size + sum(range(world_size))
+        assert torch.equal(out.cpu(), expected)
+        out = torch.empty(n, device="foo")
+        dist.reduce_scatter_tensor(out, torch.cat([base * (r + 1) + rank for r in range(world_size)]).to("foo"))
+        assert torch.equal(out.cpu(), expected)
+    finally:
+        dist.destroy_process_group()
+
+def test_process_group(tmp_path):
+    import torch.distributed as dist
+    import torch.multiprocessing as mp
+    if not dist.is_available() or not torch.foo._has_process_group():
+        pytest.skip("torch_foo is built without its c10d backend")
+    world_size = 2
+    mp.spawn(_run_collectives, args=(world_size, str(tmp_path / "store")), nprocs=world_size)